@@ -48,6 +48,8 @@
 #include "htslib/hts_endian.h"
 #include "cram/pooled_alloc.h"
 #include "hts_internal.h"
+#include "hfile_internal.h"
+#include "pinflate_internal.h"
 
 #define BGZF_CACHE
 #define BGZF_MT
@@ -73,19 +75,62 @@
 static const uint8_t g_magic[19] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\0\0";
 
 #ifdef BGZF_CACHE
-typedef struct {
-    int size;
-    uint8_t *block;
-    int64_t end_offset;
-} cache_t;
+/*
+ * Decompressed blocks are held in a single process-wide cache shared by
+ * all BGZF read handles that have a non-zero cache size.  Blocks are keyed
+ * on the identity of the underlying file (so independently opened handles
+ * on the same file share entries) and the compressed block address.
+ *
+ * Entries are kept on a doubly linked list in least recently used order
+ * and evicted from the tail once the global byte budget is exceeded.
+ * A cache hit does not copy the data; instead the handle takes a reference
+ * to the entry and points fp->uncompressed_block at it until the next
+ * block is read.  Referenced entries are never evicted.
+ */
+typedef struct bgzf_cache_entry {
+    struct bgzf_cache_entry *prev, *next; // LRU list, most recent first
+    struct bgzf_cache_file *file;
+    int64_t block_address, end_offset;
+    int size, nref;
+    uint8_t data[];
+} bgzf_cache_entry;
 
 #include "htslib/khash.h"
-KHASH_MAP_INIT_INT64(cache, cache_t)
+KHASH_MAP_INIT_INT64(cache, bgzf_cache_entry *)
+
+typedef struct bgzf_cache_file {
+    struct bgzf_cache_file *next;
+    hfile_identity id;
+    int anonymous;   // id is not a real file identity; never shared
+    int nref;        // number of handles attached
+    khash_t(cache) *h;
+} bgzf_cache_file;
+
+static struct {
+    pthread_mutex_t lock;
+    bgzf_cache_file *files;
+    bgzf_cache_entry lru;  // list sentinel
+    bgzf_cache_t *handles; // attached handles; budget is their largest size
+    size_t budget, used;
+    int nhandles, nblocks;
+    uint64_t hits, misses, evictions, next_anon;
+} bgzf_gcache = { PTHREAD_MUTEX_INITIALIZER, NULL,
+                  { &bgzf_gcache.lru, &bgzf_gcache.lru } };
+
+#define CACHE_ENTRY_BYTES(sz) (sizeof(bgzf_cache_entry) + (sz))
 #endif
 
+// Per-handle view of the shared cache
 struct bgzf_cache_t {
-    khash_t(cache) *h;
-    khint_t last_pos;
+#ifdef BGZF_CACHE
+    bgzf_cache_file *file;   // NULL when caching is disabled
+    bgzf_cache_entry *held;  // entry lent out as fp->uncompressed_block
+    void *own_block;         // our own block buffer while one is held
+    struct bgzf_cache_t *next; // bgzf_gcache.handles list
+    size_t size;             // cache size asked for by this handle
+#else
+    int unused;
+#endif
 };
 
 #ifdef BGZF_MT
@@ -99,6 +144,14 @@ typedef struct bgzf_job {
     int errcode;
     int64_t block_address;
     int hit_eof;
+    int level;  // Compression level used when writing
+
+    // Plain gzip input; see bgzf_mt_gzip_reader()
+    struct gz_chunk *gz_chunk;  // Chunk holding the data to resolve
+    size_t gz_offset;           // Start of the data in gz_chunk
+    uint32_t gz_crc;            // CRC of uncomp_data
+    int gz_member_end;          // Ends a gzip member with this CRC and size
+    uint32_t gz_member_crc, gz_member_isize;
 } bgzf_job;
 
 enum mtaux_cmd {
@@ -123,6 +176,12 @@ typedef struct {
     hts_idx_cache_entry *e; // hts_idx elements
 } hts_idx_cache_t;
 
+// Tuning for BGZF_LEVEL_AUTO; see bgzf_auto_level()
+#define BGZF_AUTO_WINDOW 16  // blocks between adjustments
+#define BGZF_AUTO_START 6
+#define BGZF_AUTO_MIN 1
+#define BGZF_AUTO_MAX 9
+
 typedef struct bgzf_mtaux_t {
     // Memory pool for bgzf_job structs, to avoid many malloc/free
     pool_alloc_t *job_pool;
@@ -157,6 +216,15 @@ typedef struct bgzf_mtaux_t {
     hts_idx_t *hts_idx;
     uint64_t block_number, block_written;
     hts_idx_cache_t idx_cache;
+
+    // Plain gzip input: CRC and size of the current member so far
+    uint32_t gz_crc, gz_isize;
+
+    // BGZF_LEVEL_AUTO state; see bgzf_auto_level()
+    int auto_level;         // Level for the next block
+    int auto_blocks;        // Blocks queued since the level last changed
+    int auto_backlog;       // Sum of the backlogs seen for those blocks
+    uint64_t level_blocks[BGZF_AUTO_MAX+1]; // Blocks queued at each level
 } mtaux_t;
 #endif
 
@@ -295,6 +363,7 @@ static int bgzf_idx_flush(BGZF *fp) {
 void bgzf_index_destroy(BGZF *fp);
 int bgzf_index_add_block(BGZF *fp);
 static int mt_destroy(mtaux_t *mt);
+static void job_cleanup(void *arg);
 
 static inline void packInt16(uint8_t *buffer, uint16_t value)
 {
@@ -369,16 +438,11 @@ static BGZF *bgzf_read_init(hFILE *hfpr)
     fp->is_compressed = (n==18 && magic[0]==0x1f && magic[1]==0x8b);
     fp->is_gzip = ( !fp->is_compressed || ((magic[3]&4) && memcmp(&magic[12], "BC\2\0",4)==0) ) ? 0 : 1;
 #ifdef BGZF_CACHE
-    if (!(fp->cache = malloc(sizeof(*fp->cache)))) {
-        free(fp);
-        return NULL;
-    }
-    if (!(fp->cache->h = kh_init(cache))) {
-        free(fp->cache);
+    if (!(fp->cache = calloc(1, sizeof(*fp->cache)))) {
+        free(fp->uncompressed_block);
         free(fp);
         return NULL;
     }
-    fp->cache->last_pos = 0;
 #endif
     return fp;
 }
@@ -641,10 +705,12 @@ static int deflate_block(BGZF *fp, int block_length)
 {
     size_t comp_size = BGZF_MAX_BLOCK_SIZE;
     int ret;
+    int level = fp->compress_level == BGZF_LEVEL_AUTO
+        ? Z_DEFAULT_COMPRESSION : fp->compress_level;
     if ( !fp->is_gzip )
-        ret = bgzf_compress(fp->compressed_block, &comp_size, fp->uncompressed_block, block_length, fp->compress_level);
+        ret = bgzf_compress(fp->compressed_block, &comp_size, fp->uncompressed_block, block_length, level);
     else
-        ret = bgzf_gzip_compress(fp, fp->compressed_block, &comp_size, fp->uncompressed_block, block_length, fp->compress_level);
+        ret = bgzf_gzip_compress(fp, fp->compressed_block, &comp_size, fp->uncompressed_block, block_length, level);
 
     if ( ret != 0 )
     {
@@ -826,89 +892,280 @@ static int check_header(const uint8_t *header)
 }
 
 #ifdef BGZF_CACHE
-static void free_cache(BGZF *fp)
+// Unlinks an entry from the LRU list.  Call with bgzf_gcache.lock held.
+static inline void cache_lru_unlink(bgzf_cache_entry *e)
 {
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+// Adds an entry at the most recently used end.  Call with lock held.
+static inline void cache_lru_push(bgzf_cache_entry *e)
+{
+    e->next = bgzf_gcache.lru.next;
+    e->prev = &bgzf_gcache.lru;
+    e->next->prev = e;
+    bgzf_gcache.lru.next = e;
+}
+
+// Removes and frees an unreferenced entry.  Call with lock held.
+static void cache_drop_entry(bgzf_cache_entry *e)
+{
+    khint_t k = kh_get(cache, e->file->h, e->block_address);
+    if (k != kh_end(e->file->h)) kh_del(cache, e->file->h, k);
+    cache_lru_unlink(e);
+    bgzf_gcache.used -= CACHE_ENTRY_BYTES(e->size);
+    bgzf_gcache.nblocks--;
+    free(e);
+}
+
+// Evicts least recently used entries until extra bytes fit within
+// the budget.  Returns 0 if there is room, -1 otherwise.
+// Call with lock held.
+static int cache_make_room(size_t extra)
+{
+    bgzf_cache_entry *e = bgzf_gcache.lru.prev, *prev;
+    while (bgzf_gcache.used + extra > bgzf_gcache.budget
+           && e != &bgzf_gcache.lru) {
+        prev = e->prev;
+        if (e->nref == 0) {
+            cache_drop_entry(e);
+            bgzf_gcache.evictions++;
+        }
+        e = prev;
+    }
+    return bgzf_gcache.used + extra <= bgzf_gcache.budget ? 0 : -1;
+}
+
+// Drops a file record and all of its entries.  Call with lock held.
+static void cache_drop_file(bgzf_cache_file *f)
+{
+    bgzf_cache_file **pp;
     khint_t k;
+    for (k = kh_begin(f->h); k < kh_end(f->h); ++k) {
+        if (!kh_exist(f->h, k)) continue;
+        bgzf_cache_entry *e = kh_val(f->h, k);
+        cache_lru_unlink(e);
+        bgzf_gcache.used -= CACHE_ENTRY_BYTES(e->size);
+        bgzf_gcache.nblocks--;
+        free(e);
+    }
+    kh_destroy(cache, f->h);
+    for (pp = &bgzf_gcache.files; *pp; pp = &(*pp)->next) {
+        if (*pp == f) {
+            *pp = f->next;
+            break;
+        }
+    }
+    free(f);
+}
+
+// Gives back a block lent out by load_block_from_cache(), switching fp
+// back to its own buffer.  If keep is set, the current block contents
+// are copied across so the read position remains valid.
+static void cache_release_held(BGZF *fp, int keep)
+{
+    bgzf_cache_t *c = fp->cache;
+    if (!c || !c->held) return;
+
+    if (keep)
+        memcpy(c->own_block, c->held->data, c->held->size);
+    fp->uncompressed_block = c->own_block;
+    fp->compressed_block = (char *)c->own_block + BGZF_MAX_BLOCK_SIZE;
+    c->own_block = NULL;
+
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    c->held->nref--;
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    c->held = NULL;
+}
+
+// Sets the global budget to the largest size asked for by the attached
+// handles, evicting unreferenced entries if it has shrunk.  Call with
+// lock held.
+static void cache_update_budget(void)
+{
+    bgzf_cache_t *h;
+    size_t budget = 0;
+    for (h = bgzf_gcache.handles; h; h = h->next) {
+        if (budget < h->size)
+            budget = h->size;
+    }
+    bgzf_gcache.budget = budget;
+    cache_make_room(0);
+}
+
+// Detaches fp from the shared cache, dropping its file record when it
+// is no longer in use.
+static void cache_detach(BGZF *fp)
+{
+    bgzf_cache_t *c = fp->cache;
+    if (!c || !c->file) return;
+
+    cache_release_held(fp, 1);
+
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    bgzf_cache_file *f = c->file;
+    bgzf_cache_t **hp;
+    for (hp = &bgzf_gcache.handles; *hp; hp = &(*hp)->next) {
+        if (*hp == c) {
+            *hp = c->next;
+            break;
+        }
+    }
+    c->next = NULL;
+    c->size = 0;
+    if (--f->nref == 0 && f->anonymous)
+        cache_drop_file(f);
+    if (--bgzf_gcache.nhandles == 0) {
+        // Nobody is using the cache any more, so release everything.
+        while (bgzf_gcache.files)
+            cache_drop_file(bgzf_gcache.files);
+    }
+    cache_update_budget();
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    c->file = NULL;
+}
+
+// Attaches fp to the shared cache, or changes the size it asks for if
+// already attached.  The global budget is the largest size asked for by
+// any attached handle.  Returns 0 on success, -1 on failure.
+static int cache_attach(BGZF *fp, int cache_size)
+{
+    bgzf_cache_t *c = fp->cache;
+    hfile_identity id;
+    int anonymous = hfile_file_identity(fp->fp, &id) < 0;
+    bgzf_cache_file *f = NULL;
+
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    if (!c->file) {
+        if (!anonymous) {
+            for (f = bgzf_gcache.files; f; f = f->next) {
+                if (!f->anonymous && memcmp(&f->id, &id, sizeof(id)) == 0)
+                    break;
+            }
+        }
+        if (!f) {
+            if (!(f = calloc(1, sizeof(*f))) || !(f->h = kh_init(cache))) {
+                free(f);
+                pthread_mutex_unlock(&bgzf_gcache.lock);
+                return -1;
+            }
+            if (anonymous) {
+                f->id.ino = ++bgzf_gcache.next_anon;
+            } else {
+                f->id = id;
+            }
+            f->anonymous = anonymous;
+            f->next = bgzf_gcache.files;
+            bgzf_gcache.files = f;
+        }
+        f->nref++;
+        bgzf_gcache.nhandles++;
+        c->file = f;
+        c->next = bgzf_gcache.handles;
+        bgzf_gcache.handles = c;
+    }
+    c->size = cache_size;
+    cache_update_budget();
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    return 0;
+}
+
+static void free_cache(BGZF *fp)
+{
     if (fp->is_write) return;
-    khash_t(cache) *h = fp->cache->h;
-    for (k = kh_begin(h); k < kh_end(h); ++k)
-        if (kh_exist(h, k)) free(kh_val(h, k).block);
-    kh_destroy(cache, h);
+    cache_detach(fp);
     free(fp->cache);
 }
 
 static int load_block_from_cache(BGZF *fp, int64_t block_address)
 {
+    bgzf_cache_t *c = fp->cache;
+    bgzf_cache_entry *e = NULL;
     khint_t k;
-    cache_t *p;
 
-    khash_t(cache) *h = fp->cache->h;
-    k = kh_get(cache, h, block_address);
-    if (k == kh_end(h)) return 0;
-    p = &kh_val(h, k);
-    if (fp->block_length != 0) fp->block_offset = 0;
-    fp->block_address = block_address;
-    fp->block_length = p->size;
-    memcpy(fp->uncompressed_block, p->block, p->size);
-    if ( hseek(fp->fp, p->end_offset, SEEK_SET) < 0 )
+    if (!c->file) return 0;
+
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    k = kh_get(cache, c->file->h, block_address);
+    if (k != kh_end(c->file->h)) {
+        e = kh_val(c->file->h, k);
+        e->nref++;
+        cache_lru_unlink(e);
+        cache_lru_push(e);
+        bgzf_gcache.hits++;
+    } else {
+        bgzf_gcache.misses++;
+    }
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    if (!e) return 0;
+
+    if ( hseek(fp->fp, e->end_offset, SEEK_SET) < 0 )
     {
-        // todo: move the error up
-        hts_log_error("Could not hseek to %" PRId64, p->end_offset);
-        exit(1);
+        hts_log_error("Could not hseek to %" PRId64, e->end_offset);
+        pthread_mutex_lock(&bgzf_gcache.lock);
+        e->nref--;
+        pthread_mutex_unlock(&bgzf_gcache.lock);
+        return 0;
     }
-    return p->size;
+
+    cache_release_held(fp, 0);
+    c->own_block = fp->uncompressed_block;
+    c->held = e;
+    fp->uncompressed_block = e->data;
+
+    if (fp->block_length != 0) fp->block_offset = 0;
+    fp->block_address = block_address;
+    fp->block_length = e->size;
+    return e->size;
 }
 
 static void cache_block(BGZF *fp, int size)
 {
+    bgzf_cache_t *c = fp->cache;
+    bgzf_cache_entry *e;
+    khint_t k;
     int ret;
-    khint_t k, k_orig;
-    uint8_t *block = NULL;
-    cache_t *p;
-    //fprintf(stderr, "Cache block at %llx\n", (int)fp->block_address);
-    khash_t(cache) *h = fp->cache->h;
+
+    if (!c->file) return;
     if (BGZF_MAX_BLOCK_SIZE >= fp->cache_size) return;
     if (fp->block_length < 0 || fp->block_length > BGZF_MAX_BLOCK_SIZE) return;
-    if ((kh_size(h) + 1) * BGZF_MAX_BLOCK_SIZE > (uint32_t)fp->cache_size) {
-        /* Remove uniformly from any position in the hash by a simple
-         * round-robin approach.  An alternative strategy would be to
-         * remove the least recently accessed block, but the round-robin
-         * removal is simpler and is not expected to have a big impact
-         * on performance */
-        if (fp->cache->last_pos >= kh_end(h)) fp->cache->last_pos = kh_begin(h);
-        k_orig = k = fp->cache->last_pos;
-        if (++k >= kh_end(h)) k = kh_begin(h);
-        while (k != k_orig) {
-            if (kh_exist(h, k))
-                break;
-            if (++k == kh_end(h))
-                k = kh_begin(h);
-        }
-        fp->cache->last_pos = k;
 
-        if (k != k_orig) {
-            block = kh_val(h, k).block;
-            kh_del(cache, h, k);
-        }
-    } else {
-        block = (uint8_t*)malloc(BGZF_MAX_BLOCK_SIZE);
-    }
-    if (!block) return;
-    k = kh_put(cache, h, fp->block_address, &ret);
-    if (ret <= 0) { // kh_put failed, or in there already (shouldn't happen)
-        free(block);
-        return;
-    }
-    p = &kh_val(h, k);
-    p->size = fp->block_length;
-    p->end_offset = fp->block_address + size;
-    p->block = block;
-    memcpy(p->block, fp->uncompressed_block, p->size);
+    // Copy outside of the lock; most of the cost is here.
+    e = malloc(CACHE_ENTRY_BYTES(fp->block_length));
+    if (!e) return;
+    e->file = c->file;
+    e->block_address = fp->block_address;
+    e->end_offset = fp->block_address + size;
+    e->size = fp->block_length;
+    e->nref = 0;
+    memcpy(e->data, fp->uncompressed_block, e->size);
+
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    if (cache_make_room(CACHE_ENTRY_BYTES(e->size)) < 0)
+        goto fail;
+    k = kh_put(cache, c->file->h, e->block_address, &ret);
+    if (ret <= 0) // kh_put failed, or another handle got there first
+        goto fail;
+    kh_val(c->file->h, k) = e;
+    cache_lru_push(e);
+    bgzf_gcache.used += CACHE_ENTRY_BYTES(e->size);
+    bgzf_gcache.nblocks++;
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    return;
+
+ fail:
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+    free(e);
 }
 #else
 static void free_cache(BGZF *fp) {}
 static int load_block_from_cache(BGZF *fp, int64_t block_address) {return 0;}
 static void cache_block(BGZF *fp, int size) {}
+static void cache_release_held(BGZF *fp, int keep) {}
+static void cache_detach(BGZF *fp) {}
+static int cache_attach(BGZF *fp, int cache_size) {return -1;}
 #endif
 
 /*
@@ -939,6 +1196,9 @@ int bgzf_read_block(BGZF *fp)
             fp->block_length = 0;
             return 0;
         }
+        // The gzip reader stops at the first error, so nothing more is coming
+        if (fp->is_gzip && fp->errcode)
+            return -1;
         r = hts_tpool_next_result_wait(fp->mt->out_queue);
         bgzf_job *j = r ? (bgzf_job *)hts_tpool_result_data(r) : NULL;
 
@@ -961,11 +1221,34 @@ int bgzf_read_block(BGZF *fp)
             hts_log_error("BGZF decode jobs returned error %d "
                           "for block offset %"PRId64,
                           j->errcode, j->block_address);
+            job_cleanup(j);
+            hts_tpool_delete_result(r, 0);
             return -1;
         }
 
+        if (fp->is_gzip) {
+            // Check each member against its trailer as it ends
+            fp->mt->gz_crc = crc32_combine(fp->mt->gz_crc, j->gz_crc,
+                                           j->uncomp_len);
+            fp->mt->gz_isize += j->uncomp_len;
+            if (j->gz_member_end) {
+                if (fp->mt->gz_crc != j->gz_member_crc
+                    || fp->mt->gz_isize != j->gz_member_isize) {
+                    fp->errcode |= BGZF_ERR_CRC;
+                    hts_log_error("GZIP %s check failed for member ending "
+                                  "near offset %"PRId64,
+                                  fp->mt->gz_crc != j->gz_member_crc
+                                  ? "CRC" : "length", j->block_address);
+                    hts_tpool_delete_result(r, 0);
+                    return -1;
+                }
+                fp->mt->gz_crc = 0;
+                fp->mt->gz_isize = 0;
+            }
+        }
+
         if (j->hit_eof) {
-            if (!fp->last_block_eof && !fp->no_eof_block) {
+            if (!fp->last_block_eof && !fp->no_eof_block && !fp->is_gzip) {
                 fp->no_eof_block = 1;
                 hts_log_warning("EOF marker is absent. The input is probably truncated");
             }
@@ -991,6 +1274,10 @@ int bgzf_read_block(BGZF *fp)
 
         if ( j->uncomp_len && j->fp->idx_build_otf )
         {
+            if (fp->is_gzip) {
+                hts_tpool_delete_result(r, 0);
+                return -1; // cannot build index for gzip
+            }
             bgzf_index_add_block(j->fp);
             j->fp->idx->ublock_addr += j->uncomp_len;
         }
@@ -1018,6 +1305,7 @@ int bgzf_read_block(BGZF *fp)
 
  single_threaded:
     size = 0;
+    cache_release_held(fp, 0);
 
     int64_t block_address;
     block_address = bgzf_htell(fp);
@@ -1240,9 +1528,13 @@ ssize_t bgzf_raw_read(BGZF *fp, void *data, size_t length)
 /* Function to clean up when jobs are discarded (e.g. during seek)
  * This works for results too, as results are the same struct with
  * decompressed data stored in it. */
+static void gz_chunk_release(struct gz_chunk *ch);
+
 static void job_cleanup(void *arg) {
     bgzf_job *j = (bgzf_job *)arg;
     mtaux_t *mt = j->fp->mt;
+    if (j->fp->is_gzip && j->gz_chunk)
+        gz_chunk_release(j->gz_chunk);
     pthread_mutex_lock(&mt->job_pool_m);
     pool_free(mt->job_pool, j);
     pthread_mutex_unlock(&mt->job_pool_m);
@@ -1254,7 +1546,7 @@ static void *bgzf_encode_func(void *arg) {
     j->comp_len = BGZF_MAX_BLOCK_SIZE;
     int ret = bgzf_compress(j->comp_data, &j->comp_len,
                             j->uncomp_data, j->uncomp_len,
-                            j->fp->compress_level);
+                            j->level);
     if (ret != 0)
         j->errcode |= BGZF_ERR_ZLIB;
 
@@ -1422,7 +1714,6 @@ int bgzf_mt_read_block(BGZF *fp, bgzf_job *j)
     int64_t block_address;
     block_address = htell(fp->fp);
 
-    if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
     count = hpeek(fp->fp, header, sizeof(header));
     if (count == 0) // no data read
         return -1;
@@ -1522,6 +1813,547 @@ static void bgzf_mt_seek(BGZF *fp) {
     pthread_cond_signal(&mt->command_c);
 }
 
+/*
+ * Multi-threaded reading of plain gzip.
+ *
+ * Unlike BGZF there is no way to find where deflate blocks start without
+ * decoding everything before them.  Instead, following pugz, the input is
+ * split into chunks of GZ_CHUNK_SIZE bytes.  A job per chunk looks for a
+ * block boundary in it and decodes from there up to the boundary picked
+ * for the next chunk, leaving references to the data before its start as
+ * placeholders (see pinflate.c).
+ *
+ * The reader thread takes the chunks in order.  A chunk is used if it
+ * starts where the previous one finished; otherwise (a missed or wrong
+ * boundary, or data with no dynamic Huffman blocks) the reader decodes
+ * the gap itself.  Output is passed on to bgzf_gz_resolve_func() in
+ * blocks of up to BGZF_MAX_BLOCK_SIZE, which fills in the placeholders
+ * from the preceding 32KiB and computes the CRC that bgzf_read_block()
+ * checks against each member's trailer.
+ */
+
+#define GZ_CHUNK_SIZE (1 << 20)
+
+enum { GZ_SYNC_NONE, GZ_SYNC_SEARCHING, GZ_SYNC_DONE };
+
+typedef struct {
+    int64_t k;                 // Chunk number
+    int64_t pos;               // Boundary found, or -1
+    int state;
+} gz_sync_slot;
+
+typedef struct gz_reader {
+    BGZF *fp;
+    hts_tpool_process *q;      // Chunk decode jobs
+    int max_jobs;
+
+    // Block boundaries found, by chunk number modulo nsync
+    pthread_mutex_t sync_m;
+    pthread_cond_t sync_c;
+    gz_sync_slot *sync;
+    int nsync;
+
+    // Compressed input from stream offset in_base
+    uint8_t *in;
+    size_t in_len, in_size;
+    int64_t in_base;
+    int in_eof;
+    off_t offset;              // File offset of the start of the stream
+
+    int64_t pos;               // Bit position decoded up to
+    int done;                  // Set at the end of the stream
+    int errcode;
+    uint8_t window[PINF_WINDOW];
+    size_t wlen;               // Bytes of window that are valid
+} gz_reader;
+
+typedef struct gz_chunk {
+    gz_reader *gz;
+    int64_t k;                 // Chunk number, or -1 if decoded by the reader
+    uint8_t *in;               // Input from k * GZ_CHUNK_SIZE
+    size_t in_len;
+    int in_eof;
+    int64_t start, end;        // Bit positions in the stream
+    int status;
+    pinf_chunk c;
+
+    // The 32KiB before start, filled in when the chunk is used
+    uint8_t window[PINF_WINDOW];
+    size_t wlen;
+    pthread_mutex_t lock;
+    int refs;
+} gz_chunk;
+
+static gz_chunk *gz_chunk_init(gz_reader *gz, int64_t k) {
+    gz_chunk *ch = calloc(1, sizeof(*ch));
+    if (!ch)
+        return NULL;
+    ch->gz = gz;
+    ch->k = k;
+    ch->start = -1;
+    ch->refs = 1;
+    pthread_mutex_init(&ch->lock, NULL);
+    return ch;
+}
+
+static void gz_chunk_free(void *arg) {
+    gz_chunk *ch = (gz_chunk *)arg;
+    pinf_chunk_free(&ch->c);
+    pthread_mutex_destroy(&ch->lock);
+    free(ch->in);
+    free(ch);
+}
+
+static void gz_chunk_release(gz_chunk *ch) {
+    pthread_mutex_lock(&ch->lock);
+    int refs = --ch->refs;
+    pthread_mutex_unlock(&ch->lock);
+    if (refs == 0)
+        gz_chunk_free(ch);
+}
+
+/*
+ * Returns the stream bit position of the block boundary chosen for chunk
+ * k, or -1 if none was found.  This is wanted by the jobs for chunks k and
+ * k-1, so the first to ask does the search and the other waits for it.
+ * Only data up to the end of chunk k+1 is used so both would give the
+ * same answer.
+ */
+static int64_t gz_chunk_boundary(gz_chunk *ch, int64_t k) {
+    gz_reader *gz = ch->gz;
+    int64_t pos = -1;
+
+    pthread_mutex_lock(&gz->sync_m);
+    gz_sync_slot *s = &gz->sync[k % gz->nsync];
+    while (s->k == k && s->state == GZ_SYNC_SEARCHING)
+        pthread_cond_wait(&gz->sync_c, &gz->sync_m);
+    if (s->k == k && s->state == GZ_SYNC_DONE) {
+        pos = s->pos;
+        pthread_mutex_unlock(&gz->sync_m);
+        return pos;
+    }
+    s->k = k;
+    s->state = GZ_SYNC_SEARCHING;
+    pthread_mutex_unlock(&gz->sync_m);
+
+    size_t off = (size_t) (k - ch->k) * GZ_CHUNK_SIZE;
+    if (off < ch->in_len) {
+        size_t len = ch->in_len - off;
+        pinf_chunk scratch = { NULL };
+        if (len > 2 * GZ_CHUNK_SIZE)
+            len = 2 * GZ_CHUNK_SIZE;
+        int64_t p = pinf_find_block(ch->in + off, len, 0,
+                                    (uint64_t) GZ_CHUNK_SIZE * 8, &scratch);
+        if (p >= 0)
+            pos = k * GZ_CHUNK_SIZE * 8 + p;
+        pinf_chunk_free(&scratch);
+    }
+
+    pthread_mutex_lock(&gz->sync_m);
+    if (s->k == k) {
+        s->pos = pos;
+        s->state = GZ_SYNC_DONE;
+    }
+    pthread_cond_broadcast(&gz->sync_c);
+    pthread_mutex_unlock(&gz->sync_m);
+
+    return pos;
+}
+
+// Decodes a chunk from its first block boundary to the next chunk's
+static void *gz_chunk_decode_func(void *arg) {
+    gz_chunk *ch = (gz_chunk *)arg;
+    int64_t base = ch->k * GZ_CHUNK_SIZE * 8;
+
+    if (ch->start < 0)
+        ch->start = gz_chunk_boundary(ch, ch->k);
+    if (ch->start < 0) {
+        ch->status = PINF_ERROR;
+        return ch;
+    }
+
+    // The next boundary is not needed until we get near it
+    ch->status = pinf_decode(ch->in, ch->in_len, ch->in_eof,
+                             ch->start - base, GZ_CHUNK_SIZE * 8, &ch->c);
+    if (ch->status == PINF_STOP) {
+        int64_t stop = gz_chunk_boundary(ch, ch->k + 1);
+        ch->status = pinf_decode(ch->in, ch->in_len, ch->in_eof, ch->c.end,
+                                 stop < 0 ? UINT64_MAX : stop - base, &ch->c);
+    }
+    ch->end = base + ch->c.end;
+
+    return ch;
+}
+
+// Fills in placeholders and computes the CRC of one block of output
+static void *bgzf_gz_resolve_func(void *arg) {
+    bgzf_job *j = (bgzf_job *)arg;
+    gz_chunk *ch = j->gz_chunk;
+
+    if (pinf_resolve(j->uncomp_data, ch->c.out + j->gz_offset, j->uncomp_len,
+                     ch->window, ch->wlen) < 0) {
+        hts_log_error("Invalid distance in GZIP stream");
+        j->errcode |= BGZF_ERR_ZLIB;
+    }
+#ifdef HAVE_LIBDEFLATE
+    j->gz_crc = libdeflate_crc32(0, j->uncomp_data, j->uncomp_len);
+#else
+    j->gz_crc = crc32(0L, (Bytef *)j->uncomp_data, j->uncomp_len);
+#endif
+
+    j->gz_chunk = NULL;
+    gz_chunk_release(ch);
+
+    return arg;
+}
+
+// Reads until stream offset upto is buffered, or the end of the file
+static int gz_fill(gz_reader *gz, int64_t upto) {
+    while (!gz->in_eof && gz->in_base + (int64_t) gz->in_len < upto) {
+        size_t want = upto - gz->in_base - gz->in_len;
+        if (gz->in_len + want > gz->in_size) {
+            size_t new_size = gz->in_len + want;
+            uint8_t *in = realloc(gz->in, new_size);
+            if (!in)
+                return -1;
+            gz->in = in;
+            gz->in_size = new_size;
+        }
+        ssize_t n = hread(gz->fp->fp, gz->in + gz->in_len, want);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            gz->in_eof = 1;
+        gz->in_len += n;
+    }
+    return 0;
+}
+
+// Discards buffered input before stream offset from
+static void gz_discard(gz_reader *gz, int64_t from) {
+    size_t n = from - gz->in_base;
+    if (from <= gz->in_base || n > gz->in_len)
+        return;
+    memmove(gz->in, gz->in + n, gz->in_len - n);
+    gz->in_len -= n;
+    gz->in_base = from;
+}
+
+/*
+ * Checks for commands from the main thread.  Returns 1 if told to close,
+ * otherwise 0.  Seeks are not possible on gzip streams.
+ */
+static int gz_check_command(BGZF *fp) {
+    mtaux_t *mt = fp->mt;
+    int ret = 0;
+
+    pthread_mutex_lock(&mt->command_m);
+    switch (mt->command) {
+    case HAS_EOF:
+        bgzf_mt_eof(fp);   // Sets mt->command to HAS_EOF_DONE
+        break;
+
+    case SEEK_DONE:
+    case HAS_EOF_DONE:
+        pthread_cond_signal(&mt->command_c);
+        break;
+
+    case CLOSE:
+        pthread_cond_signal(&mt->command_c);
+        ret = 1;
+        break;
+
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&mt->command_m);
+
+    return ret;
+}
+
+/*
+ * Passes on the output of a chunk starting at gz->pos, and takes
+ * ownership of it.  Returns 0 on success, 1 if told to close, or -1 on
+ * error.  A chunk that failed after the end of a gzip member (see
+ * pinf_decode()) is passed on up to that point before the error is
+ * reported.
+ */
+static int gz_emit(gz_reader *gz, gz_chunk *ch) {
+    BGZF *fp = gz->fp;
+    mtaux_t *mt = fp->mt;
+    pinf_chunk *c = &ch->c;
+    size_t off = 0, m = 0;
+    int ret = 0;
+    int bad_tail = ch->status == PINF_ERROR && c->nmembers > 0
+        && c->members[c->nmembers - 1].bit_pos == c->end;
+
+    memcpy(ch->window, gz->window, PINF_WINDOW);
+    ch->wlen = gz->wlen;
+    gz->pos = ch->end;
+    gz->done = (ch->status == PINF_END);
+
+    // Keep the last 32KiB of output for the following chunk
+    if (c->out_len >= PINF_WINDOW) {
+        ret = pinf_resolve(gz->window, c->out + c->out_len - PINF_WINDOW,
+                           PINF_WINDOW, ch->window, ch->wlen);
+        gz->wlen = PINF_WINDOW;
+    } else {
+        memmove(gz->window, gz->window + c->out_len,
+                PINF_WINDOW - c->out_len);
+        ret = pinf_resolve(gz->window + PINF_WINDOW - c->out_len, c->out,
+                           c->out_len, ch->window, ch->wlen);
+        gz->wlen += c->out_len;
+        if (gz->wlen > PINF_WINDOW)
+            gz->wlen = PINF_WINDOW;
+    }
+    if (ret < 0) {
+        hts_log_error("Invalid distance in GZIP stream");
+        gz->errcode |= BGZF_ERR_ZLIB;
+        gz_chunk_release(ch);
+        return -1;
+    }
+
+    while (off < c->out_len || m < c->nmembers) {
+        size_t end = off + BGZF_MAX_BLOCK_SIZE;
+        if (end > c->out_len)
+            end = c->out_len;
+
+        pthread_mutex_lock(&mt->job_pool_m);
+        bgzf_job *j = pool_alloc(mt->job_pool);
+        pthread_mutex_unlock(&mt->job_pool_m);
+        if (!j) {
+            gz->errcode |= BGZF_ERR_IO;
+            ret = -1;
+            break;
+        }
+        j->fp = fp;
+        j->errcode = 0;
+        j->comp_len = 0;
+        j->hit_eof = 0;
+        j->block_address = gz->offset + ch->start / 8;
+        j->gz_chunk = ch;
+        j->gz_offset = off;
+        j->gz_member_end = 0;
+        if (m < c->nmembers && c->members[m].out_pos <= end) {
+            end = c->members[m].out_pos;
+            j->gz_member_end = 1;
+            j->gz_member_crc = c->members[m].crc;
+            j->gz_member_isize = c->members[m].isize;
+            m++;
+        }
+        j->uncomp_len = end - off;
+        off = end;
+
+        pthread_mutex_lock(&ch->lock);
+        ch->refs++;
+        pthread_mutex_unlock(&ch->lock);
+        if (hts_tpool_dispatch3(mt->pool, mt->out_queue, bgzf_gz_resolve_func,
+                                j, job_cleanup, job_cleanup, 0) < 0) {
+            job_cleanup(j);
+            gz->errcode |= BGZF_ERR_IO;
+            ret = -1;
+            break;
+        }
+
+        if ((ret = gz_check_command(fp)) != 0)
+            break;
+    }
+
+    gz_chunk_release(ch);
+    if (ret == 0 && bad_tail) {
+        hts_log_error("Reading GZIP stream failed at offset %"PRId64,
+                      (int64_t) (gz->offset + gz->pos / 8));
+        gz->errcode |= BGZF_ERR_ZLIB;
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Decodes from gz->pos in this thread, up to the first block boundary at
+ * or after stop but not much more than a chunk's worth.  Returns as for
+ * gz_emit().
+ */
+static int gz_decode_gap(gz_reader *gz, int64_t stop) {
+    int64_t from = gz->pos / 8, limit = gz->pos + GZ_CHUNK_SIZE * 8;
+    size_t want = 3 * GZ_CHUNK_SIZE;
+    gz_chunk *ch;
+
+    if (stop > limit)
+        stop = limit;
+    for (;;) {
+        if (gz_fill(gz, from + want) < 0) {
+            hts_log_error("Failed to read GZIP data at offset %"PRId64,
+                          (int64_t) (gz->offset + gz->in_base + gz->in_len));
+            gz->errcode |= BGZF_ERR_IO;
+            return -1;
+        }
+        if (!(ch = gz_chunk_init(gz, -1))) {
+            gz->errcode |= BGZF_ERR_IO;
+            return -1;
+        }
+
+        uint8_t *in = gz->in + (from - gz->in_base);
+        size_t len = gz->in_base + gz->in_len - from;
+        ch->start = gz->pos;
+        ch->status = pinf_decode(in, len, gz->in_eof, gz->pos - from * 8,
+                                 stop - from * 8, &ch->c);
+        ch->end = from * 8 + ch->c.end;
+        if (ch->end > ch->start)
+            break;
+
+        int status = ch->status;
+        gz_chunk_free(ch);
+        if (gz->in_eof || status != PINF_NEED_INPUT) {
+            hts_log_error("Reading GZIP stream failed at offset %"PRId64,
+                          (int64_t) (gz->offset + from));
+            gz->errcode |= BGZF_ERR_ZLIB;
+            return -1;
+        }
+        want *= 2;
+    }
+
+    return gz_emit(gz, ch);
+}
+
+/*
+ * Reader thread loop for plain gzip.  Returns 0 at the end of the stream,
+ * 1 if told to close, or -1 on error.  The final job j is given the
+ * file offset reached, and on error its errcode.
+ */
+static int bgzf_mt_gzip_reader(BGZF *fp, bgzf_job *j) {
+    mtaux_t *mt = fp->mt;
+    int64_t next_k = 0, ndone = 0;
+    int i, ret = -1;
+
+    j->block_address = htell(fp->fp);
+    gz_reader *gz = calloc(1, sizeof(*gz));
+    if (!gz) {
+        j->errcode = BGZF_ERR_IO;
+        return -1;
+    }
+    gz->fp = fp;
+    gz->offset = htell(fp->fp);
+    gz->max_jobs = mt->n_threads > 2 ? mt->n_threads : 2;
+    gz->nsync = gz->max_jobs + 2;
+    pthread_mutex_init(&gz->sync_m, NULL);
+    pthread_cond_init(&gz->sync_c, NULL);
+    if (!(gz->sync = malloc(gz->nsync * sizeof(*gz->sync))))
+        goto nomem;
+    for (i = 0; i < gz->nsync; i++) {
+        gz->sync[i].k = -1;
+        gz->sync[i].state = GZ_SYNC_NONE;
+    }
+    if (!(gz->q = hts_tpool_process_init(mt->pool, 2 * gz->max_jobs, 0)))
+        goto nomem;
+
+    if (gz_fill(gz, 3 * GZ_CHUNK_SIZE) < 0) {
+        gz->errcode |= BGZF_ERR_IO;
+        goto err;
+    }
+    int64_t hlen = pinf_gzip_header(gz->in, gz->in_len);
+    if (hlen <= 0) {
+        hts_log_error("Invalid GZIP header at offset %"PRId64,
+                      (int64_t) gz->offset);
+        gz->errcode |= BGZF_ERR_HEADER;
+        goto err;
+    }
+    gz->pos = hlen * 8;
+
+    while (!gz->done) {
+        // Keep the pool supplied with chunks to decode
+        while (next_k - ndone < gz->max_jobs) {
+            int64_t from = next_k * GZ_CHUNK_SIZE;
+            if (gz_fill(gz, from + 3 * GZ_CHUNK_SIZE) < 0) {
+                gz->errcode |= BGZF_ERR_IO;
+                goto err;
+            }
+            int64_t avail = gz->in_base + gz->in_len;
+            if (from >= avail)
+                break;
+
+            gz_chunk *ch = gz_chunk_init(gz, next_k);
+            if (!ch)
+                goto nomem;
+            ch->in_len = avail - from < 3 * GZ_CHUNK_SIZE
+                ? avail - from : 3 * GZ_CHUNK_SIZE;
+            ch->in_eof = gz->in_eof && from + ch->in_len == avail;
+            if (!(ch->in = malloc(ch->in_len))) {
+                gz_chunk_free(ch);
+                goto nomem;
+            }
+            memcpy(ch->in, gz->in + (from - gz->in_base), ch->in_len);
+            if (next_k == 0)
+                ch->start = gz->pos;
+
+            if (hts_tpool_dispatch3(mt->pool, gz->q, gz_chunk_decode_func, ch,
+                                    gz_chunk_free, gz_chunk_free, 0) < 0) {
+                gz_chunk_free(ch);
+                goto nomem;
+            }
+            next_k++;
+        }
+        if (ndone == next_k)
+            break;
+
+        hts_tpool_result *r = hts_tpool_next_result_wait(gz->q);
+        if (!r)
+            goto nomem;
+        gz_chunk *ch = (gz_chunk *)hts_tpool_result_data(r);
+        hts_tpool_delete_result(r, 0);
+        ndone++;
+
+        // Use the chunk if it starts where we are, after filling any gap
+        int usable = ch->status != PINF_ERROR && ch->end > ch->start;
+        while (usable && !gz->done && gz->pos < ch->start) {
+            if ((ret = gz_decode_gap(gz, ch->start)) != 0) {
+                gz_chunk_free(ch);
+                goto out;
+            }
+        }
+        if (usable && !gz->done && gz->pos == ch->start) {
+            free(ch->in);
+            ch->in = NULL;
+            if ((ret = gz_emit(gz, ch)) != 0)
+                goto out;
+        } else {
+            gz_chunk_free(ch);
+        }
+
+        int64_t keep = gz->pos / 8;
+        if (keep > next_k * GZ_CHUNK_SIZE)
+            keep = next_k * GZ_CHUNK_SIZE;
+        gz_discard(gz, keep);
+
+        if ((ret = gz_check_command(fp)) != 0)
+            goto out;
+    }
+
+    // Anything left after the last usable chunk
+    while (!gz->done) {
+        if ((ret = gz_decode_gap(gz, INT64_MAX)) != 0)
+            goto out;
+    }
+    ret = 0;
+    goto out;
+
+ nomem:
+    gz->errcode |= BGZF_ERR_IO;
+ err:
+    ret = -1;
+ out:
+    if (ret < 0)
+        j->errcode = gz->errcode ? gz->errcode : BGZF_ERR_IO;
+    j->block_address = gz->offset + gz->pos / 8;
+    hts_tpool_process_destroy(gz->q);
+    pthread_mutex_destroy(&gz->sync_m);
+    pthread_cond_destroy(&gz->sync_c);
+    free(gz->sync);
+    free(gz->in);
+    free(gz);
+    return ret;
+}
+
 static void *bgzf_mt_reader(void *vp) {
     BGZF *fp = (BGZF *)vp;
     mtaux_t *mt = fp->mt;
@@ -1537,6 +2369,17 @@ restart:
     j->hit_eof = 0;
     j->fp = fp;
 
+    if (fp->is_gzip) {
+        j->gz_chunk = NULL;
+        j->gz_member_end = 0;
+        if (bgzf_mt_gzip_reader(fp, j) > 0) {
+            job_cleanup(j);
+            hts_tpool_process_destroy(mt->out_queue);
+            return NULL;
+        }
+        goto eof;
+    }
+
     while (bgzf_mt_read_block(fp, j) == 0) {
         // Dispatch
         if (hts_tpool_dispatch3(mt->pool, mt->out_queue, bgzf_decode_func, j,
@@ -1604,7 +2447,7 @@ restart:
     // Dispatch an empty block so EOF is spotted.
     // We also use this mechanism for returning errors, in which case
     // j->errcode is set already.
-
+ eof:
     j->hit_eof = 1;
     if (hts_tpool_dispatch3(mt->pool, mt->out_queue, bgzf_nul_func, j,
                             job_cleanup, job_cleanup, 0) < 0) {
@@ -1612,7 +2455,9 @@ restart:
         hts_tpool_process_destroy(mt->out_queue);
         return NULL;
     }
-    if (j->errcode != 0) {
+    // Gzip errors are found after earlier chunks have been queued, so
+    // leave the queue intact and wait for the close.
+    if (j->errcode != 0 && !fp->is_gzip) {
         hts_tpool_process_destroy(mt->out_queue);
         return &j->errcode;
     }
@@ -1669,6 +2514,16 @@ int bgzf_thread_pool(BGZF *fp, hts_tpool *pool, int qsize) {
     if (!fp->is_compressed)
         return 0;
 
+    // Plain gzip can only be read with threads from the start
+    if (fp->is_gzip && !fp->is_write && fp->gz_stream)
+        return 0;
+
+    // The shared block cache is not used when multi-threading
+    if (!fp->is_write) {
+        cache_detach(fp);
+        fp->cache_size = 0;
+    }
+
     mtaux_t *mt;
     mt = (mtaux_t*)calloc(1, sizeof(mtaux_t));
     if (!mt) return -1;
@@ -1694,6 +2549,7 @@ int bgzf_thread_pool(BGZF *fp, hts_tpool *pool, int qsize) {
     mt->jobs_pending = 0;
     mt->free_block = fp->uncompressed_block; // currently in-use block
     mt->block_address = fp->block_address;
+    mt->auto_level = BGZF_AUTO_START;
     pthread_create(&mt->io_task, NULL,
                    fp->is_write ? bgzf_mt_writer : bgzf_mt_reader, fp);
 
@@ -1707,8 +2563,9 @@ int bgzf_thread_pool(BGZF *fp, hts_tpool *pool, int qsize) {
 
 int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
 {
-    // No gain from multi-threading when not compressed
-    if (!fp->is_compressed || fp->is_gzip)
+    // No gain from multi-threading when not compressed.  Plain gzip
+    // output is single-threaded, as is input that has already been started.
+    if (!fp->is_compressed || (fp->is_gzip && (fp->is_write || fp->gz_stream)))
         return 0;
 
     if (n_threads < 1) return -1;
@@ -1726,6 +2583,19 @@ int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
     return 0;
 }
 
+int bgzf_thread_pool_adopt(BGZF *fp)
+{
+    if (!fp->mt)
+        return -1;
+    fp->mt->own_pool = 1;
+    return 0;
+}
+
+hts_tpool *bgzf_thread_pool_get(BGZF *fp)
+{
+    return fp->mt ? fp->mt->pool : NULL;
+}
+
 static int mt_destroy(mtaux_t *mt)
 {
     int ret = 0;
@@ -1773,6 +2643,64 @@ static int mt_destroy(mtaux_t *mt)
     return ret;
 }
 
+/*
+ * Picks the level for the next block when compress_level is BGZF_LEVEL_AUTO.
+ *
+ * As each block is queued we note how many blocks are waiting to be
+ * compressed or being compressed.  If on average that is under half the
+ * number of threads, the workers are idling and the producer is the limit,
+ * so we can afford a higher level.  If the queue is mostly full the
+ * producer is about to block in hts_tpool_dispatch, so the level is
+ * lowered instead.  Finished blocks waiting for the writer thread are not
+ * counted, as a slow output is not helped by writing more data.
+ */
+static int bgzf_auto_level(mtaux_t *mt)
+{
+    hts_tpool_process *q = mt->out_queue;
+    int backlog = hts_tpool_process_sz(q) - hts_tpool_process_len(q);
+    mt->auto_backlog += backlog > 0 ? backlog : 0;
+
+    if (++mt->auto_blocks == BGZF_AUTO_WINDOW) {
+        int qsize = hts_tpool_process_qsize(q);
+        if (mt->auto_backlog * 2 < mt->n_threads * BGZF_AUTO_WINDOW) {
+            if (mt->auto_level < BGZF_AUTO_MAX)
+                mt->auto_level++;
+        } else if (mt->auto_backlog * 4 > qsize * 3 * BGZF_AUTO_WINDOW) {
+            if (mt->auto_level > BGZF_AUTO_MIN)
+                mt->auto_level--;
+        }
+        mt->auto_blocks = mt->auto_backlog = 0;
+    }
+
+    mt->level_blocks[mt->auto_level]++;
+    return mt->auto_level;
+}
+
+int bgzf_auto_level_counts(BGZF *fp, uint64_t *counts, int n)
+{
+    int i;
+    if (!fp->is_write || !fp->mt)
+        return -1;
+    if (n > BGZF_AUTO_MAX + 1)
+        n = BGZF_AUTO_MAX + 1;
+    for (i = 0; i < n; i++)
+        counts[i] = fp->mt->level_blocks[i];
+    return n;
+}
+
+static void bgzf_auto_level_report(mtaux_t *mt)
+{
+    kstring_t ks = KS_INITIALIZE;
+    int i;
+    for (i = BGZF_AUTO_MIN; i <= BGZF_AUTO_MAX; i++)
+        if (mt->level_blocks[i])
+            ksprintf(&ks, " %d:%"PRIu64, i, mt->level_blocks[i]);
+    if (ks.l)
+        hts_log_info("Blocks written at each automatic compression level:%s",
+                     ks.s);
+    ks_free(&ks);
+}
+
 static int mt_queue(BGZF *fp)
 {
     mtaux_t *mt = fp->mt;
@@ -1789,7 +2717,10 @@ static int mt_queue(BGZF *fp)
     j->fp = fp;
     j->errcode = 0;
     j->uncomp_len  = fp->block_offset;
-    if (fp->compress_level == 0) {
+    j->level = fp->compress_level;
+    if (j->level == BGZF_LEVEL_AUTO)
+        j->level = bgzf_auto_level(mt);
+    if (j->level == 0) {
         memcpy(j->comp_data + BLOCK_HEADER_LENGTH + 5, fp->uncompressed_block,
                j->uncomp_len);
         if (hts_tpool_dispatch3(mt->pool, mt->out_queue,
@@ -1991,6 +2922,8 @@ static void bgzf_close_mt(BGZF *fp) {
     if (fp->mt) {
         if (!fp->mt->free_block)
             fp->uncompressed_block = NULL;
+        if (fp->is_write)
+            bgzf_auto_level_report(fp->mt);
         if (mt_destroy(fp->mt) < 0)
             fp->errcode = BGZF_ERR_IO;
     }
@@ -2035,8 +2968,8 @@ int bgzf_close(BGZF* fp)
     ret = hclose(fp->fp);
     if (ret != 0) return -1;
     bgzf_index_destroy(fp);
-    free(fp->uncompressed_block);
     free_cache(fp);
+    free(fp->uncompressed_block);
     ret = fp->errcode ? -1 : 0;
     free(fp);
     return ret;
@@ -2045,7 +2978,28 @@ int bgzf_close(BGZF* fp)
 void bgzf_set_cache_size(BGZF *fp, int cache_size)
 {
     if (fp && fp->mt) return; // Not appropriate when multi-threading
-    if (fp && fp->cache) fp->cache_size = cache_size;
+    if (!fp || !fp->cache) return;
+    if (cache_size > 0) {
+        if (cache_attach(fp, cache_size) < 0) return;
+    } else {
+        cache_detach(fp);
+    }
+    fp->cache_size = cache_size;
+}
+
+void bgzf_cache_stats(bgzf_cache_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#ifdef BGZF_CACHE
+    pthread_mutex_lock(&bgzf_gcache.lock);
+    stats->hits = bgzf_gcache.hits;
+    stats->misses = bgzf_gcache.misses;
+    stats->evictions = bgzf_gcache.evictions;
+    stats->bytes_used = bgzf_gcache.used;
+    stats->bytes_budget = bgzf_gcache.budget;
+    stats->nblocks = bgzf_gcache.nblocks;
+    pthread_mutex_unlock(&bgzf_gcache.lock);
+#endif
 }
 
 int bgzf_check_EOF(BGZF *fp) {
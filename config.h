@@ -0,0 +1,16 @@
+/* Default config.h generated by Makefile */
+#define HAVE_LIBBZ2 1
+#define HAVE_LIBLZMA 1
+#ifndef __APPLE__
+#define HAVE_LZMA_H 1
+#endif
+#define HAVE_DRAND48 1
+#define HAVE_LIBCURL 1
+#ifndef _WIN32
+#define HAVE_MMAP 1
+#endif
+#ifdef __APPLE__
+#define HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC 1
+#elif defined(__linux__) || defined(__CYGWIN__)
+#define HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC 1
+#endif
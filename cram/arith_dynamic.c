@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The adaptive arithmetic codec from CRAM 3.1.
+ *
+ * Unlike rANS, which stores a frequency table up front, the models here
+ * start flat and learn as they go.  That costs some speed but nothing in
+ * table overhead, so it wins on small blocks and on heavily skewed data
+ * where the static tables are a large part of the output.
+ *
+ * The stream starts with a flags byte (see arith_dynamic.h) followed by
+ * the uncompressed size as a uint7 unless ARITH_NOSZ is set.  Striped data
+ * then has the number of streams, their uint7 compressed sizes and the
+ * sub-streams themselves, each without a size.  Otherwise there is the
+ * PACK meta data if ARITH_PACK is set, and then either the raw data, the
+ * bzip2 data, or the number of symbols in use (0 meaning 256) followed by
+ * the range coded data.
+ *
+ * With ARITH_RLE each symbol is followed by the number of extra copies of
+ * it, coded as a series of values 0 to 3 that continues while the value
+ * is 3.  The first value of a run is modelled on the symbol and the rest
+ * share two further models.
+ */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef HAVE_LIBBZ2
+#include <bzlib.h>
+#endif
+
+#include "arith_dynamic.h"
+#include "c_range_coder.h"
+#include "c_simple_model.h"
+#include "pack.h"
+#include "varint.h"
+
+// Contexts for the run length models: one per symbol then two more
+#define RUN_CTX 258
+
+/*-----------------------------------------------------------------------------
+ * Range coding
+ */
+
+static uint8_t *arith_enc(const uint8_t *in, uint32_t in_size,
+                          uint8_t *out, uint8_t *out_end, int flags)
+{
+    int order1 = flags & ARITH_ORDER, rle = flags & ARITH_RLE;
+    model_set lit, run = {0};
+    range_coder rc;
+    uint32_t i, m = 0;
+    uint8_t last = 0;
+
+    if (out_end - out < 2)
+        return NULL;
+
+    for (i = 0; i < in_size; i++)
+        if (m < in[i])
+            m = in[i];
+    m++;
+    *out++ = m & 0xff;
+
+    if (model_set_init(&lit, order1 ? m : 1, m) < 0)
+        return NULL;
+    if (rle && model_set_init(&run, RUN_CTX, 4) < 0) {
+        model_set_free(&lit);
+        return NULL;
+    }
+
+    rc_start_encode(&rc, out, out_end - out);
+    for (i = 0; i < in_size && !rc.err; i++) {
+        uint8_t s = in[i];
+        model_encode(model_get(&lit, order1 ? last : 0), &rc, s);
+        last = s;
+
+        if (rle) {
+            uint32_t len = 0, part, rctx = s;
+            while (i+1 < in_size && in[i+1] == s)
+                i++, len++;
+            do {
+                part = len > 3 ? 3 : len;
+                model_encode(model_get(&run, rctx), &rc, part);
+                len -= part;
+                rctx = rctx < 256 ? 256 : 257;
+            } while (part == 3);
+        }
+    }
+    out += rc_finish_encode(&rc, out);
+
+    model_set_free(&lit);
+    model_set_free(&run);
+    return rc.err ? NULL : out;
+}
+
+static int arith_dec(const uint8_t *in, uint32_t in_size,
+                     uint8_t *out, uint32_t out_size, int flags)
+{
+    int order1 = flags & ARITH_ORDER, rle = flags & ARITH_RLE;
+    model_set lit, run = {0};
+    range_coder rc;
+    uint32_t i, m;
+    uint8_t last = 0;
+
+    if (in_size < 1)
+        return -1;
+    m = in[0] ? in[0] : 256;
+
+    if (model_set_init(&lit, order1 ? m : 1, m) < 0)
+        return -1;
+    if (rle && model_set_init(&run, RUN_CTX, 4) < 0) {
+        model_set_free(&lit);
+        return -1;
+    }
+
+    rc_start_decode(&rc, (unsigned char *)in + 1, in_size - 1);
+    for (i = 0; i < out_size && !rc.err; ) {
+        uint8_t s = model_decode(model_get(&lit, order1 ? last : 0), &rc);
+        out[i++] = last = s;
+
+        if (rle) {
+            uint32_t len = 0, part, rctx = s;
+            do {
+                part = model_decode(model_get(&run, rctx), &rc);
+                len += part;
+                rctx = rctx < 256 ? 256 : 257;
+            } while (part == 3 && len <= out_size - i);
+            if (len > out_size - i) {
+                rc.err = 1;
+                break;
+            }
+            memset(&out[i], s, len);
+            i += len;
+        }
+    }
+
+    model_set_free(&lit);
+    model_set_free(&run);
+    return rc.err ? -1 : 0;
+}
+
+#ifdef HAVE_LIBBZ2
+static uint8_t *bzip2_enc(const uint8_t *in, uint32_t in_size,
+                          uint8_t *out, uint8_t *out_end)
+{
+    unsigned int len = out_end - out;
+    if (BZ_OK != BZ2_bzBuffToBuffCompress((char *)out, &len,
+                                          (char *)in, in_size, 9, 0, 30))
+        return NULL;
+    return out + len;
+}
+
+static int bzip2_dec(const uint8_t *in, uint32_t in_size,
+                     uint8_t *out, uint32_t out_size)
+{
+    unsigned int len = out_size;
+    if (BZ_OK != BZ2_bzBuffToBuffDecompress((char *)out, &len,
+                                            (char *)in, in_size, 0, 0)
+        || len != out_size)
+        return -1;
+    return 0;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Top level
+ */
+
+unsigned int arith_compress_bound(unsigned int size, int order)
+{
+    int N = (order & ARITH_STRIPE) ? ((order >> 8) & 0xff) : 1;
+    if (!N)
+        N = 4;
+
+    // Output larger than the input falls back to ARITH_CAT, so this is the
+    // input plus headers and room for the coder to work in.
+    return size + size/16 + 1024 + N*64;
+}
+
+// Compresses a single non-striped stream.
+static uint8_t *compress_block(const uint8_t *in, uint32_t in_size,
+                               uint8_t *out, uint8_t *out_end, int order)
+{
+    int flags = order & (ARITH_ORDER | ARITH_EXT | ARITH_NOSZ | ARITH_CAT
+                         | ARITH_RLE | ARITH_PACK);
+    uint8_t *cp = out, *packed = NULL, *ret = NULL, *e = NULL;
+    const uint8_t *data = in;
+    uint32_t data_len = in_size;
+
+    if (out_end - cp < 6)
+        return NULL;
+    cp++;
+    if (!(flags & ARITH_NOSZ))
+        cp += var_put_u32(cp, NULL, in_size);
+
+    if (!in_size)
+        flags = (flags & ARITH_NOSZ) | ARITH_CAT;
+
+    if (flags & ARITH_PACK) {
+        uint8_t pmeta[32];
+        int pmeta_len;
+        if ((packed = hts_pack(data, data_len, pmeta, &pmeta_len,
+                               &data_len))) {
+            if (out_end - cp < pmeta_len)
+                goto err;
+            memcpy(cp, pmeta, pmeta_len);
+            cp += pmeta_len;
+            data = packed;
+        } else {
+            flags &= ~ARITH_PACK;
+        }
+    }
+
+    if (!(flags & ARITH_CAT) && data_len) {
+        if (flags & ARITH_EXT) {
+#ifdef HAVE_LIBBZ2
+            e = bzip2_enc(data, data_len, cp, out_end);
+#endif
+        } else {
+            e = arith_enc(data, data_len, cp, out_end, flags);
+        }
+        if (e && e - cp < data_len) {
+            ret = e;
+            goto done;
+        }
+    }
+
+    // Not worth entropy coding
+    flags = (flags & (ARITH_NOSZ | ARITH_PACK)) | ARITH_CAT;
+    if (out_end - cp < data_len)
+        goto err;
+    memcpy(cp, data, data_len);
+    ret = cp + data_len;
+
+ done:
+    out[0] = flags;
+ err:
+    free(packed);
+    return ret;
+}
+
+/*
+ * Splits the input into N streams of every Nth byte, each compressed
+ * independently.
+ */
+static uint8_t *compress_stripe(const uint8_t *in, uint32_t in_size,
+                                uint8_t *out, uint8_t *out_end, int order)
+{
+    int N = (order >> 8) & 0xff, j;
+    int sub_order = (order & 0xff & ~ARITH_STRIPE) | ARITH_NOSZ;
+    uint8_t *cp = out, *tmp = NULL, *ret = NULL, **sub;
+    uint32_t *clen, i, k;
+
+    if (!N)
+        N = 4;
+    sub = calloc(N, sizeof(*sub));
+    clen = malloc(N * sizeof(*clen));
+    tmp = malloc(in_size / N + 1);
+    if (!sub || !clen || !tmp)
+        goto err;
+
+    for (j = 0; j < N; j++) {
+        uint32_t ulen = in_size / N + (j < in_size % N);
+        for (i = j, k = 0; i < in_size; i += N)
+            tmp[k++] = in[i];
+        clen[j] = arith_compress_bound(ulen, sub_order);
+        if (!(sub[j] = malloc(clen[j])))
+            goto err;
+        if (!arith_compress_to(tmp, ulen, sub[j], &clen[j], sub_order))
+            goto err;
+    }
+
+    if (out_end - cp < 7 + 5*N)
+        goto err;
+    *cp++ = ARITH_STRIPE | (order & ARITH_NOSZ);
+    if (!(order & ARITH_NOSZ))
+        cp += var_put_u32(cp, NULL, in_size);
+    *cp++ = N;
+    for (j = 0; j < N; j++)
+        cp += var_put_u32(cp, NULL, clen[j]);
+    for (j = 0; j < N; j++) {
+        if (out_end - cp < clen[j])
+            goto err;
+        memcpy(cp, sub[j], clen[j]);
+        cp += clen[j];
+    }
+    ret = cp;
+
+ err:
+    if (sub)
+        for (j = 0; j < N; j++)
+            free(sub[j]);
+    free(sub);
+    free(clen);
+    free(tmp);
+    return ret;
+}
+
+unsigned char *arith_compress_to(unsigned char *in, unsigned int in_size,
+                                 unsigned char *out, unsigned int *out_size,
+                                 int order)
+{
+    unsigned char *end;
+    int alloced = 0;
+
+    if (!out) {
+        *out_size = arith_compress_bound(in_size, order);
+        if (!(out = malloc(*out_size)))
+            return NULL;
+        alloced = 1;
+    }
+
+    end = (order & ARITH_STRIPE)
+        ? compress_stripe(in, in_size, out, out + *out_size, order)
+        : compress_block(in, in_size, out, out + *out_size, order);
+    if (!end) {
+        if (alloced)
+            free(out);
+        return NULL;
+    }
+
+    *out_size = end - out;
+    return out;
+}
+
+unsigned char *arith_compress(unsigned char *in, unsigned int in_size,
+                              unsigned int *out_size, int order)
+{
+    return arith_compress_to(in, in_size, NULL, out_size, order);
+}
+
+// Uncompresses the data after the flags and size of a non-striped stream.
+static int uncompress_block(const uint8_t *cp, const uint8_t *end, int flags,
+                            uint8_t *out, uint32_t osz)
+{
+    uint8_t P[16] = {0}, *body = out;
+    uint32_t plen = osz;
+    int nsym = 0, n, ret = -1;
+
+    if (!osz)
+        return 0;
+
+    if (flags & ARITH_PACK) {
+        if (!(n = hts_unpack_meta(cp, end, osz, P, &nsym, &plen)))
+            return -1;
+        cp += n;
+        if (!(body = malloc(plen + 1)))
+            return -1;
+    }
+
+    if (flags & ARITH_CAT) {
+        if (plen > end - cp)
+            goto err;
+        memcpy(body, cp, plen);
+    } else if (flags & ARITH_EXT) {
+#ifdef HAVE_LIBBZ2
+        if (bzip2_dec(cp, end - cp, body, plen) < 0)
+            goto err;
+#else
+        goto err;
+#endif
+    } else if (plen) {
+        if (arith_dec(cp, end - cp, body, plen, flags) < 0)
+            goto err;
+    }
+
+    if (flags & ARITH_PACK)
+        hts_unpack(body, P, nsym, out, osz);
+
+    ret = 0;
+
+ err:
+    if (body != out)
+        free(body);
+    return ret;
+}
+
+static int uncompress_stream(const uint8_t *in, uint32_t in_size,
+                             uint8_t *out, uint32_t *out_size,
+                             int allow_stripe);
+
+static int uncompress_stripe(const uint8_t *cp, const uint8_t *end,
+                             uint8_t *out, uint32_t osz)
+{
+    uint32_t clen[256], i, k;
+    uint8_t *tmp;
+    int N, j, n;
+
+    if (cp >= end || !(N = *cp++))
+        return -1;
+    for (j = 0; j < N; j++) {
+        if (!(n = var_get_u32(cp, end, &clen[j])))
+            return -1;
+        cp += n;
+    }
+
+    if (!(tmp = malloc(osz / N + 1)))
+        return -1;
+    for (j = 0; j < N; j++) {
+        uint32_t ulen = osz / N + (j < osz % N);
+        if (clen[j] > end - cp
+            || uncompress_stream(cp, clen[j], tmp, &ulen, 0) < 0
+            || ulen != osz / N + (j < osz % N)) {
+            free(tmp);
+            return -1;
+        }
+        for (i = j, k = 0; i < osz; i += N)
+            out[i] = tmp[k++];
+        cp += clen[j];
+    }
+
+    free(tmp);
+    return 0;
+}
+
+static int uncompress_stream(const uint8_t *in, uint32_t in_size,
+                             uint8_t *out, uint32_t *out_size,
+                             int allow_stripe)
+{
+    const uint8_t *cp = in, *end = in + in_size;
+    uint32_t osz;
+    int flags, n;
+
+    if (!in_size)
+        return -1;
+    flags = *cp++;
+
+    if (flags & ARITH_NOSZ) {
+        osz = *out_size;
+    } else {
+        if (!(n = var_get_u32(cp, end, &osz)) || osz > *out_size)
+            return -1;
+        cp += n;
+    }
+
+    if (flags & ARITH_STRIPE) {
+        if (!allow_stripe || uncompress_stripe(cp, end, out, osz) < 0)
+            return -1;
+    } else if (uncompress_block(cp, end, flags, out, osz) < 0) {
+        return -1;
+    }
+
+    *out_size = osz;
+    return 0;
+}
+
+unsigned char *arith_uncompress_to(unsigned char *in, unsigned int in_size,
+                                   unsigned char *out,
+                                   unsigned int *out_size)
+{
+    uint32_t osz;
+    int alloced = 0;
+
+    if (!in_size)
+        return NULL;
+
+    if (!out) {
+        if (in[0] & ARITH_NOSZ) {
+            osz = *out_size;
+        } else if (!var_get_u32(in + 1, in + in_size, &osz)) {
+            return NULL;
+        }
+        if (osz > INT_MAX || !(out = malloc(osz ? osz : 1)))
+            return NULL;
+        *out_size = osz;
+        alloced = 1;
+    }
+
+    if (uncompress_stream(in, in_size, out, out_size, 1) < 0) {
+        if (alloced)
+            free(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+unsigned char *arith_uncompress(unsigned char *in, unsigned int in_size,
+                                unsigned int *out_size)
+{
+    return arith_uncompress_to(in, in_size, NULL, out_size);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A byte-wise range coder with carry propagation, after the coder by
+ * Eugene Shelwien and Dmitry Subbotin.  It is driven by adaptive models
+ * (see c_simple_model.h) in the CRAM 3.1 fqzcomp and arithmetic codecs.
+ *
+ * The encoder holds back the most recent byte, and any 0xff bytes after
+ * it, until it knows whether a carry will ripple into them.  Both sides
+ * read and write bounded buffers; running past the end sets rc->err
+ * rather than touching memory outside them.
+ */
+
+#ifndef C_RANGE_CODER_H
+#define C_RANGE_CODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RC_TOP (1u<<24)
+
+typedef struct {
+    uint64_t low;
+    uint32_t range, code;
+    uint32_t ff_num;        // 0xff bytes held back after cache
+    uint8_t  cache;         // last byte held back awaiting a carry
+    unsigned char *cp, *end;
+    int err;
+} range_coder;
+
+static inline void rc_start_encode(range_coder *rc, unsigned char *out,
+                                   size_t out_size) {
+    rc->low = 0;
+    rc->range = 0xffffffff;
+    rc->code = 0;
+    rc->ff_num = 0;
+    rc->cache = 0;
+    rc->cp = out;
+    rc->end = out + out_size;
+    rc->err = 0;
+}
+
+static inline void rc_put_byte(range_coder *rc, uint8_t c) {
+    if (rc->cp < rc->end)
+        *rc->cp++ = c;
+    else
+        rc->err = 1;
+}
+
+static inline void rc_shift_low(range_coder *rc) {
+    if ((uint32_t)rc->low < 0xff000000u || (rc->low >> 32)) {
+        uint8_t carry = rc->low >> 32;
+        rc_put_byte(rc, rc->cache + carry);
+        for (; rc->ff_num; rc->ff_num--)
+            rc_put_byte(rc, 0xff + carry);
+        rc->cache = (uint32_t)rc->low >> 24;
+    } else {
+        rc->ff_num++;
+    }
+    rc->low = (uint32_t)rc->low << 8;
+}
+
+// Encodes the range [cum, cum+freq) out of tot_freq
+static inline void rc_encode(range_coder *rc, uint32_t cum, uint32_t freq,
+                             uint32_t tot_freq) {
+    rc->range /= tot_freq;
+    rc->low += (uint64_t)cum * rc->range;
+    rc->range *= freq;
+    while (rc->range < RC_TOP) {
+        rc->range <<= 8;
+        rc_shift_low(rc);
+    }
+}
+
+// Flushes the encoder.  Returns the number of bytes written.
+static inline size_t rc_finish_encode(range_coder *rc, unsigned char *out) {
+    int i;
+    for (i = 0; i < 5; i++)
+        rc_shift_low(rc);
+    return rc->cp - out;
+}
+
+static inline uint8_t rc_get_byte(range_coder *rc) {
+    if (rc->cp < rc->end)
+        return *rc->cp++;
+    rc->err = 1;
+    return 0;
+}
+
+static inline void rc_start_decode(range_coder *rc, unsigned char *in,
+                                   size_t in_size) {
+    int i;
+    rc->low = 0;
+    rc->range = 0xffffffff;
+    rc->code = 0;
+    rc->cp = in;
+    rc->end = in + in_size;
+    rc->err = 0;
+    for (i = 0; i < 5; i++)
+        rc->code = (rc->code << 8) | rc_get_byte(rc);
+}
+
+// Returns the cumulative frequency of the next symbol, out of tot_freq
+static inline uint32_t rc_get_freq(range_coder *rc, uint32_t tot_freq) {
+    uint32_t f = rc->code / (rc->range /= tot_freq);
+    if (f < tot_freq)
+        return f;
+    rc->err = 1; // Corrupt data
+    return tot_freq - 1;
+}
+
+// Consumes the symbol found with rc_get_freq()
+static inline void rc_decode(range_coder *rc, uint32_t cum, uint32_t freq) {
+    rc->code -= cum * rc->range;
+    rc->range *= freq;
+    while (rc->range < RC_TOP) {
+        rc->code = (rc->code << 8) | rc_get_byte(rc);
+        rc->range <<= 8;
+    }
+}
+
+#endif /* C_RANGE_CODER_H */
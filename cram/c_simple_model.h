@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Adaptive frequency models for the range coder in c_range_coder.h.
+ *
+ * Each model starts with every symbol at frequency 1 and adds MODEL_STEP
+ * to a symbol each time it is coded, halving all frequencies when the
+ * total gets too large.  Symbols are kept roughly in order of decreasing
+ * frequency, by swapping with the previous entry, so the linear searches
+ * are usually short.
+ *
+ * Models are grouped into sets indexed by context.  A set is allocated
+ * zeroed and each model is initialised the first time its context is
+ * used, so large but sparsely used context spaces are cheap.
+ */
+
+#ifndef C_SIMPLE_MODEL_H
+#define C_SIMPLE_MODEL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "c_range_coder.h"
+
+#define MODEL_MAX_FREQ ((1<<16) - 17)
+#define MODEL_STEP 16
+
+typedef struct {
+    uint16_t freq;
+    uint16_t sym;
+} model_sym;
+
+typedef struct {
+    uint32_t tot_freq;  // zero until initialised
+    uint32_t nsym;
+    model_sym F[];      // nsym entries then a zero frequency terminator
+} adaptive_model;
+
+typedef struct {
+    unsigned char *mem;
+    size_t stride;
+    uint32_t nsym;
+} model_set;
+
+static inline void model_init(adaptive_model *m, uint32_t nsym) {
+    uint32_t i;
+    for (i = 0; i < nsym; i++) {
+        m->F[i].freq = 1;
+        m->F[i].sym = i;
+    }
+    m->F[nsym].freq = 0;
+    m->F[nsym].sym = 0;
+    m->tot_freq = nsym;
+    m->nsym = nsym;
+}
+
+static inline void model_normalise(adaptive_model *m) {
+    uint32_t i;
+    m->tot_freq = 0;
+    for (i = 0; i < m->nsym; i++)
+        m->tot_freq += m->F[i].freq -= m->F[i].freq >> 1;
+}
+
+// Counts a use of F[i], keeping the symbols roughly sorted
+static inline void model_update(adaptive_model *m, model_sym *s) {
+    s->freq += MODEL_STEP;
+    m->tot_freq += MODEL_STEP;
+    if (m->tot_freq > MODEL_MAX_FREQ)
+        model_normalise(m);
+
+    if (s != m->F && s[0].freq > s[-1].freq) {
+        model_sym t = s[0];
+        s[0] = s[-1];
+        s[-1] = t;
+    }
+}
+
+// Encodes sym, which must be less than the model's nsym
+static inline void model_encode(adaptive_model *m, range_coder *rc,
+                                uint32_t sym) {
+    model_sym *s = m->F;
+    uint32_t cum = 0;
+
+    while (s->sym != sym)
+        cum += s++->freq;
+
+    rc_encode(rc, cum, s->freq, m->tot_freq);
+    model_update(m, s);
+}
+
+static inline uint32_t model_decode(adaptive_model *m, range_coder *rc) {
+    uint32_t f = rc_get_freq(rc, m->tot_freq), cum = 0, sym;
+    model_sym *s = m->F;
+
+    while ((cum += s->freq) <= f)
+        s++;
+    cum -= s->freq;
+
+    rc_decode(rc, cum, s->freq);
+    sym = s->sym;
+    model_update(m, s);
+
+    return sym;
+}
+
+/*
+ * Allocates nctx models of nsym symbols.
+ * Returns 0 on success, -1 on failure.
+ */
+static inline int model_set_init(model_set *ms, size_t nctx, uint32_t nsym) {
+    ms->nsym = nsym;
+    ms->stride = sizeof(adaptive_model) + (nsym + 1) * sizeof(model_sym);
+    ms->mem = calloc(nctx, ms->stride);
+    return ms->mem ? 0 : -1;
+}
+
+static inline adaptive_model *model_get(model_set *ms, uint32_t ctx) {
+    adaptive_model *m = (adaptive_model *)(ms->mem + ctx * ms->stride);
+    if (!m->tot_freq)
+        model_init(m, ms->nsym);
+    return m;
+}
+
+static inline void model_set_free(model_set *ms) {
+    free(ms->mem);
+    ms->mem = NULL;
+}
+
+#endif /* C_SIMPLE_MODEL_H */
@@ -2141,6 +2141,90 @@ int cram_codec_to_id(cram_codec *c, int *id2) {
     return bnum1;
 }
 
+/*
+ * Checks whether an integer codec produces the same value every time
+ * without consuming any input, as with single-symbol huffman and zero-bit
+ * beta codes.
+ *
+ * Returns 1 and fills out *val if so,
+ *         0 if not.
+ */
+int cram_codec_const_int(cram_codec *c, int32_t *val) {
+    if (c->decode == cram_huffman_decode_int0) {
+        *val = c->u.huffman.codes[0].symbol;
+        return 1;
+    }
+
+    if (c->decode == cram_beta_decode_int && c->u.beta.nbits == 0) {
+        *val = -c->u.beta.offset;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Decodes all remaining ITF8 values in the external block of an integer
+ * codec in one pass.  The caller must ensure no other codec reads from
+ * the same block, as the block is consumed entirely.
+ *
+ * Most values are below 128, so while a whole 8-byte word has no
+ * continuation bits set it is copied out directly.  Decoding stops at the
+ * first truncated value, leaving later reads to report the error.
+ *
+ * Returns an allocated array of *n values on success;
+ *         NULL if this isn't an external integer codec or on failure.
+ */
+int32_t *cram_external_decode_int_all(cram_slice *slice, cram_codec *c,
+                                      int *n) {
+    const unsigned char *cp, *end;
+    int32_t *val;
+    cram_block *b;
+    int i = 0;
+
+    if (c->decode != cram_external_decode_int)
+        return NULL;
+
+    b = cram_get_block_by_id(slice, c->u.external.content_id);
+    if (!b || b->method != RAW || b->idx > b->uncomp_size)
+        return NULL;
+
+    cp  = b->data + b->idx;
+    end = b->data + b->uncomp_size;
+
+    // Every value occupies at least one byte
+    if (!(val = malloc((end - cp + 1) * sizeof(*val))))
+        return NULL;
+
+    while (cp < end) {
+        uint64_t w;
+        int l;
+
+        if (end - cp >= 8) {
+            memcpy(&w, cp, 8);
+            if (!(w & 0x8080808080808080ULL)) {
+                val[i+0] = cp[0]; val[i+1] = cp[1];
+                val[i+2] = cp[2]; val[i+3] = cp[3];
+                val[i+4] = cp[4]; val[i+5] = cp[5];
+                val[i+6] = cp[6]; val[i+7] = cp[7];
+                i  += 8;
+                cp += 8;
+                continue;
+            }
+        }
+
+        l = safe_itf8_get((const char *)cp, (const char *)end, &val[i]);
+        if (l <= 0)
+            break;
+        i++;
+        cp += l;
+    }
+
+    b->idx = cp - b->data;
+    *n = i;
+    return val;
+}
+
 
 /*
  * cram_codec structures are specialised for decoding or encoding.
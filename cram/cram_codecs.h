@@ -176,6 +176,10 @@ static inline int cram_not_enough_bits(cram_block *blk, int nbits) {
  */
 int cram_codec_to_id(cram_codec *c, int *id2);
 
+int cram_codec_const_int(cram_codec *c, int32_t *val);
+int32_t *cram_external_decode_int_all(cram_slice *slice, cram_codec *c,
+                                      int *n);
+
 /*
  * cram_codec structures are specialised for decoding or encoding.
  * Unfortunately this makes turning a decoder into an encoder (such as
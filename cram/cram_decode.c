@@ -941,6 +941,125 @@ void cram_decode_estimate_sizes(cram_block_compression_hdr *hdr, cram_slice *s,
     }
 }
 
+/*
+ * Counts the codecs, both data series and tags, reading from external
+ * block id.
+ */
+static int cram_block_nreaders(cram_block_compression_hdr *hdr, int id) {
+    int i, n = 0;
+
+    for (i = 0; i < DS_END; i++) {
+        int bnum1, bnum2;
+        if (!hdr->codecs[i])
+            continue;
+        bnum1 = cram_codec_to_id(hdr->codecs[i], &bnum2);
+        n += (bnum1 == id || bnum2 == id);
+    }
+
+    for (i = 0; i < CRAM_MAP_HASH; i++) {
+        cram_map *m;
+        for (m = hdr->tag_encoding_map[i]; m; m = m->next) {
+            int bnum1, bnum2;
+            if (!m->codec)
+                continue;
+            bnum1 = cram_codec_to_id(m->codec, &bnum2);
+            n += (bnum1 == id || bnum2 == id);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Decodes the integer data series needed by this slice into columns up
+ * front, where this can be done independently of the other series: those
+ * with an external block to themselves, or a constant code.  Everything
+ * else, including series interleaved in the CORE block, is still decoded
+ * value by value.
+ *
+ * Returns 0 on success
+ *        -1 on failure
+ */
+static int cram_decode_columns(cram_fd *fd, cram_block_compression_hdr *hdr,
+                               cram_slice *s) {
+    static const struct {
+        enum cram_DS_ID id;
+        enum cram_fields bit;
+    } int_ds[] = {
+        {DS_BF, CRAM_BF}, {DS_CF, CRAM_CF}, {DS_RI, CRAM_RI},
+        {DS_RL, CRAM_RL}, {DS_AP, CRAM_AP}, {DS_RG, CRAM_RG},
+        {DS_MF, CRAM_MF}, {DS_NS, CRAM_NS}, {DS_NP, CRAM_NP},
+        {DS_TS, CRAM_TS}, {DS_NF, CRAM_NF}, {DS_TL, CRAM_TL},
+        {DS_FN, CRAM_FN}, {DS_FP, CRAM_FP}, {DS_DL, CRAM_DL},
+        {DS_RS, CRAM_RS}, {DS_PD, CRAM_PD}, {DS_HC, CRAM_HC},
+        {DS_MQ, CRAM_MQ},
+    };
+    int i;
+
+    // CF and MF are bytes in CRAM 1.0
+    if (CRAM_MAJOR_VERS(fd->version) == 1)
+        return 0;
+
+    if (!s->ds_col && !(s->ds_col = calloc(DS_END, sizeof(*s->ds_col))))
+        return -1;
+
+    for (i = 0; i < sizeof(int_ds)/sizeof(*int_ds); i++) {
+        cram_ds_column *col = &s->ds_col[int_ds[i].id];
+        cram_codec *c = hdr->codecs[int_ds[i].id];
+        int id;
+
+        free(col->val);
+        memset(col, 0, sizeof(*col));
+
+        if (!c || !(s->data_series & int_ds[i].bit))
+            continue;
+
+        if (cram_codec_const_int(c, &col->const_val)) {
+            col->is_const = 1;
+            continue;
+        }
+
+        id = cram_codec_to_id(c, NULL);
+        if (id < 0 || id == s->hdr->ref_base_id ||
+            cram_block_nreaders(hdr, id) != 1)
+            continue;
+
+        // NULL leaves this series to the codec
+        col->val = cram_external_decode_int_all(s, c, &col->n);
+    }
+
+    return 0;
+}
+
+/*
+ * Fetches the next value of an integer data series, from its column if
+ * cram_decode_columns() made one or from the codec otherwise.
+ *
+ * Returns 0 on success
+ *        -1 on failure
+ */
+static inline int cram_decode_ds_int(cram_slice *s, cram_codec *c,
+                                     enum cram_DS_ID id, cram_block *in,
+                                     int32_t *out) {
+    int one = 1;
+
+    if (s->ds_col) {
+        cram_ds_column *col = &s->ds_col[id];
+        if (col->val) {
+            if (col->idx >= col->n)
+                return -1;
+            *out = col->val[col->idx++];
+            return 0;
+        }
+        if (col->is_const) {
+            *out = col->const_val;
+            return 0;
+        }
+    }
+
+    return c->decode(s, c, in, (char *)out, &one);
+}
+
 
 /* ----------------------------------------------------------------------
  * CRAM slices
@@ -1132,8 +1251,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
 
     if (ds & CRAM_FN) {
         if (!c->comp_hdr->codecs[DS_FN]) return -1;
-        r |= c->comp_hdr->codecs[DS_FN]->decode(s,c->comp_hdr->codecs[DS_FN],
-                                                blk, (char *)&fn, &out_sz);
+        r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_FN], DS_FN,
+                                blk, &fn);
         if (r) return r;
     } else {
         fn = 0;
@@ -1169,10 +1288,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
             continue;
 
         if (!c->comp_hdr->codecs[DS_FP]) return -1;
-        r |= c->comp_hdr->codecs[DS_FP]->decode(s,
-                                                c->comp_hdr->codecs[DS_FP],
-                                                blk,
-                                                (char *)&pos, &out_sz);
+        r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_FP], DS_FP,
+                                blk, &pos);
         if (r) return r;
         pos += prev_pos;
 
@@ -1376,9 +1493,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
             }
             if (ds & CRAM_DL) {
                 if (!c->comp_hdr->codecs[DS_DL]) return -1;
-                r |= c->comp_hdr->codecs[DS_DL]
-                                ->decode(s, c->comp_hdr->codecs[DS_DL], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_DL], DS_DL,
+                                        blk, &i32);
                 if (r) return r;
                 if (decode_md || decode_nm) {
                     if (ref_pos + i32 > s->ref_end)
@@ -1619,9 +1735,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
             }
             if (ds & CRAM_HC) {
                 if (!c->comp_hdr->codecs[DS_HC]) return -1;
-                r |= c->comp_hdr->codecs[DS_HC]
-                                ->decode(s, c->comp_hdr->codecs[DS_HC], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_HC], DS_HC,
+                                        blk, &i32);
                 if (r) return r;
                 cig_op = BAM_CHARD_CLIP;
                 cig_len += i32;
@@ -1636,9 +1751,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
             }
             if (ds & CRAM_PD) {
                 if (!c->comp_hdr->codecs[DS_PD]) return -1;
-                r |= c->comp_hdr->codecs[DS_PD]
-                                ->decode(s, c->comp_hdr->codecs[DS_PD], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_PD], DS_PD,
+                                        blk, &i32);
                 if (r) return r;
                 cig_op = BAM_CPAD;
                 cig_len += i32;
@@ -1653,9 +1767,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
             }
             if (ds & CRAM_RS) {
                 if (!c->comp_hdr->codecs[DS_RS]) return -1;
-                r |= c->comp_hdr->codecs[DS_RS]
-                                ->decode(s, c->comp_hdr->codecs[DS_RS], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_RS], DS_RS,
+                                        blk, &i32);
                 if (r) return r;
                 cig_op = BAM_CREF_SKIP;
                 cig_len += i32;
@@ -1782,9 +1895,8 @@ static int cram_decode_seq(cram_fd *fd, cram_container *c, cram_slice *s,
 
     if (ds & CRAM_MQ) {
         if (!c->comp_hdr->codecs[DS_MQ]) return -1;
-        r |= c->comp_hdr->codecs[DS_MQ]
-                        ->decode(s, c->comp_hdr->codecs[DS_MQ], blk,
-                                 (char *)&cr->mqual, &out_sz);
+        r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_MQ], DS_MQ,
+                                blk, &cr->mqual);
     } else {
         cr->mqual = 40;
     }
@@ -1917,7 +2029,7 @@ static int cram_decode_aux_1_0(cram_container *c, cram_slice *s,
 static int cram_decode_aux(cram_container *c, cram_slice *s,
                            cram_block *blk, cram_record *cr,
                            int *has_MD, int *has_NM) {
-    int i, r = 0, out_sz = 1;
+    int i, r = 0;
     int32_t TL = 0;
     unsigned char *TN;
     uint32_t ds = s->data_series;
@@ -1929,8 +2041,7 @@ static int cram_decode_aux(cram_container *c, cram_slice *s,
     }
 
     if (!c->comp_hdr->codecs[DS_TL]) return -1;
-    r |= c->comp_hdr->codecs[DS_TL]->decode(s, c->comp_hdr->codecs[DS_TL], blk,
-                                            (char *)&TL, &out_sz);
+    r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_TL], DS_TL, blk, &TL);
     if (r || TL < 0 || TL >= c->comp_hdr->nTL)
         return -1;
 
@@ -2159,6 +2270,9 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
     if (cram_dependent_data_series(fd, c->comp_hdr, s) != 0)
         return -1;
 
+    if (cram_decode_columns(fd, c->comp_hdr, s) != 0)
+        return -1;
+
     ds = s->data_series;
 
     blk->bit = 7; // MSB first
@@ -2213,15 +2327,19 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
             b = cram_get_block_by_id(s, s->hdr->ref_base_id);
             if (!b)
                 return -1;
-            if (cram_uncompress_block(b) != 0)
-                return -1;
-            s->ref = (char *)BLOCK_DATA(b);
             s->ref_start = s->hdr->ref_seq_start;
             s->ref_end   = s->hdr->ref_seq_start + s->hdr->ref_seq_span-1;
-            if (s->hdr->ref_seq_span > b->uncomp_size) {
-                hts_log_error("Embedded reference is too small at #%d:%d-%d",
-                              ref_id, s->ref_start, s->ref_end);
-                return -1;
+            // Only needed for SAM_SEQ or to generate MD/NM.
+            // Otherwise leave the block compressed.
+            if ((fd->required_fields & SAM_SEQ) || s->decode_md) {
+                if (cram_uncompress_block(b) != 0)
+                    return -1;
+                if (s->hdr->ref_seq_span > b->uncomp_size) {
+                    hts_log_error("Embedded reference is too small at #%d:%d-%d",
+                                  ref_id, s->ref_start, s->ref_end);
+                    return -1;
+                }
+                s->ref = (char *)BLOCK_DATA(b);
             }
         } else if (!c->comp_hdr->no_ref) {
             //// Avoid Java cramtools bug by loading entire reference seq
@@ -2343,9 +2461,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
         out_sz = 1; /* decode 1 item */
         if (ds & CRAM_BF) {
             if (!c->comp_hdr->codecs[DS_BF]) goto block_err;
-            r |= c->comp_hdr->codecs[DS_BF]
-                            ->decode(s, c->comp_hdr->codecs[DS_BF], blk,
-                                     (char *)&bf, &out_sz);
+            r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_BF], DS_BF,
+                                    blk, &bf);
             if (r || bf < 0 ||
                 bf >= sizeof(fd->bam_flag_swap)/sizeof(*fd->bam_flag_swap))
                 goto block_err;
@@ -2366,9 +2483,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
                 cr->cram_flags = cf;
             } else {
                 if (!c->comp_hdr->codecs[DS_CF]) goto block_err;
-                r |= c->comp_hdr->codecs[DS_CF]
-                                ->decode(s, c->comp_hdr->codecs[DS_CF], blk,
-                                         (char *)&cr->cram_flags, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_CF], DS_CF,
+                                        blk, &cr->cram_flags);
                 if (r) goto block_err;
                 cf = cr->cram_flags;
             }
@@ -2379,9 +2495,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
         if (CRAM_MAJOR_VERS(fd->version) != 1 && ref_id == -2) {
             if (ds & CRAM_RI) {
                 if (!c->comp_hdr->codecs[DS_RI]) goto block_err;
-                r |= c->comp_hdr->codecs[DS_RI]
-                                ->decode(s, c->comp_hdr->codecs[DS_RI], blk,
-                                         (char *)&cr->ref_id, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_RI], DS_RI,
+                                        blk, &cr->ref_id);
                 if (r) goto block_err;
                 if ((fd->required_fields & (SAM_SEQ|SAM_TLEN))
                     && cr->ref_id >= 0
@@ -2442,9 +2557,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
 
         if (ds & CRAM_RL) {
             if (!c->comp_hdr->codecs[DS_RL]) goto block_err;
-            r |= c->comp_hdr->codecs[DS_RL]
-                            ->decode(s, c->comp_hdr->codecs[DS_RL], blk,
-                                     (char *)&cr->len, &out_sz);
+            r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_RL], DS_RL,
+                                    blk, &cr->len);
             if (r) goto block_err;
             if (cr->len < 0) {
                 hts_log_error("Read has negative length");
@@ -2460,9 +2574,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
                                      (char *)&cr->apos, &out_sz);
 #else
             int32_t i32;
-            r |= c->comp_hdr->codecs[DS_AP]
-                            ->decode(s, c->comp_hdr->codecs[DS_AP], blk,
-                                     (char *)&i32, &out_sz);
+            r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_AP], DS_AP,
+                                    blk, &i32);
             cr->apos = i32;
 #endif
             if (r) goto block_err;
@@ -2475,9 +2588,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
 
         if (ds & CRAM_RG) {
             if (!c->comp_hdr->codecs[DS_RG]) goto block_err;
-            r |= c->comp_hdr->codecs[DS_RG]
-                           ->decode(s, c->comp_hdr->codecs[DS_RG], blk,
-                                    (char *)&cr->rg, &out_sz);
+            r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_RG], DS_RG,
+                                    blk, &cr->rg);
             if (r) goto block_err;
             if (cr->rg == unknown_rg)
                 cr->rg = -1;
@@ -2518,11 +2630,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
                     cr->mate_flags = mf;
                 } else {
                     if (!c->comp_hdr->codecs[DS_MF]) goto block_err;
-                    r |= c->comp_hdr->codecs[DS_MF]
-                                    ->decode(s, c->comp_hdr->codecs[DS_MF],
-                                             blk,
-                                             (char *)&cr->mate_flags,
-                                             &out_sz);
+                    r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_MF],
+                                            DS_MF, blk, &cr->mate_flags);
                     if (r) goto block_err;
                 }
             } else {
@@ -2547,9 +2656,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
 
             if (ds & CRAM_NS) {
                 if (!c->comp_hdr->codecs[DS_NS]) goto block_err;
-                r |= c->comp_hdr->codecs[DS_NS]
-                                ->decode(s, c->comp_hdr->codecs[DS_NS], blk,
-                                         (char *)&cr->mate_ref_id, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_NS], DS_NS,
+                                        blk, &cr->mate_ref_id);
                 if (r) goto block_err;
             }
 
@@ -2567,9 +2675,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
                                          (char *)&cr->mate_pos, &out_sz);
 #else
                 int32_t i32;
-                r |= c->comp_hdr->codecs[DS_NP]
-                                ->decode(s, c->comp_hdr->codecs[DS_NP], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_NP], DS_NP,
+                                        blk, &i32);
                 cr->mate_pos = i32;
 #endif
                 if (r) goto block_err;
@@ -2583,9 +2690,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
                                          (char *)&cr->tlen, &out_sz);
 #else
                 int32_t i32;
-                r |= c->comp_hdr->codecs[DS_TS]
-                                ->decode(s, c->comp_hdr->codecs[DS_TS], blk,
-                                         (char *)&i32, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_TS], DS_TS,
+                                        blk, &i32);
                 cr->tlen = i32;
 #endif
                 if (r) goto block_err;
@@ -2595,9 +2701,8 @@ int cram_decode_slice(cram_fd *fd, cram_container *c, cram_slice *s,
         } else if ((ds & CRAM_CF) && (cf & CRAM_FLAG_MATE_DOWNSTREAM)) {
             if (ds & CRAM_NF) {
                 if (!c->comp_hdr->codecs[DS_NF]) goto block_err;
-                r |= c->comp_hdr->codecs[DS_NF]
-                                ->decode(s, c->comp_hdr->codecs[DS_NF], blk,
-                                         (char *)&cr->mate_line, &out_sz);
+                r |= cram_decode_ds_int(s, c->comp_hdr->codecs[DS_NF], DS_NF,
+                                        blk, &cr->mate_line);
                 if (r) goto block_err;
                 cr->mate_line += rec + 1;
 
@@ -3174,6 +3279,12 @@ static cram_slice *cram_next_slice(cram_fd *fd, cram_container **cp) {
                     continue;
                 }
             }
+
+            // Start loading the reference before a worker needs it
+            if (s_next->hdr->ref_seq_id >= 0 && s_next->hdr->ref_base_id < 0
+                && !c_next->comp_hdr->no_ref
+                && (fd->required_fields & SAM_SEQ))
+                cram_prefetch_ref(fd, s_next->hdr->ref_seq_id);
         } // end: if (!fd->ooc)
 
         if (!c_next || !s_next)
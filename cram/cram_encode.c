@@ -812,6 +812,84 @@ static int cram_encode_slice_read(cram_fd *fd,
 }
 
 
+/*
+ * The block compressions of a slice.  Each block uses its own metrics, so
+ * they are independent and can run concurrently.
+ */
+typedef struct {
+    cram_block *b;
+    cram_metrics *m;
+    int64_t ticket; // turn to use m, or -1
+    int method, level;
+    int with_slice; // pass the slice, for fqzcomp
+} cram_block_task;
+
+typedef struct {
+    cram_fd *fd;
+    cram_slice *s;
+    cram_block_task *t;
+    int n;
+} cram_slice_tasks;
+
+/*
+ * Queues a block for compression.  Blocks may be shared between data
+ * series, in which case the first request for a block is the one used.
+ */
+static void cram_add_block_task(cram_slice_tasks *st, cram_block *b,
+                                cram_metrics *m, int method, int level,
+                                int with_slice) {
+    int i;
+
+    if (!b || b->method != RAW)
+        return;
+    for (i = 0; i < st->n; i++)
+        if (st->t[i].b == b)
+            return;
+
+    st->t[st->n].b = b;
+    st->t[st->n].m = m;
+    st->t[st->n].ticket = -1;
+    st->t[st->n].method = method;
+    st->t[st->n].level = level;
+    st->t[st->n].with_slice = with_slice;
+    st->n++;
+}
+
+static int cram_block_task_run(void *arg, int i) {
+    cram_slice_tasks *st = arg;
+    cram_block_task *t = &st->t[i];
+
+    return cram_compress_block2(st->fd, t->with_slice ? st->s : NULL,
+                                t->b, t->m, t->ticket, t->method, t->level);
+}
+
+/*
+ * The metrics carry over from one container to the next, so with threads
+ * the slices must use them in the order they were written for the output
+ * to match the unthreaded case.  Each slice takes a ticket per metrics in
+ * turn here, and cram_compress_block2() waits for the ticket to come up.
+ * The last slice of a container lets the next container take its tickets.
+ */
+static void cram_claim_metrics(cram_fd *fd, cram_container *c,
+                               cram_slice_tasks *st, int last) {
+    int i;
+
+    if (!fd->pool)
+        return;
+
+    pthread_mutex_lock(&fd->metrics_lock);
+    while (fd->claim_seq != c->seq)
+        pthread_cond_wait(&fd->metrics_cond, &fd->metrics_lock);
+    for (i = 0; i < st->n; i++)
+        if (st->t[i].m)
+            st->t[i].ticket = st->t[i].m->claimed++;
+    if (last) {
+        fd->claim_seq++;
+        pthread_cond_broadcast(&fd->metrics_cond);
+    }
+    pthread_mutex_unlock(&fd->metrics_lock);
+}
+
 /*
  * Applies various compression methods to specific blocks, depending on
  * known observations of how data series compress.
@@ -820,22 +898,46 @@ static int cram_encode_slice_read(cram_fd *fd,
  *        -1 on failure
  */
 static int cram_compress_slice(cram_fd *fd, cram_container *c, cram_slice *s) {
-    int level = fd->level, i;
-    int method = 1<<GZIP | 1<<GZIP_RLE, methodF = method;
+    int level = fd->level, i, r;
+    int method = 1<<GZIP | 1<<GZIP_RLE, methodF = method, methodN;
+    int methodQ = fd->version >= (3<<8) + 1 ? 1<<FQZ : 0;
+    cram_slice_tasks st;
+
+    st.fd = fd;
+    st.s = s;
+    st.n = 0;
+    st.t = malloc((DS_END + s->naux_block + 1) * sizeof(*st.t));
+    if (!st.t)
+        return -1;
 
     /* Compress the CORE Block too, with minimal zlib level */
     if (level > 5 && s->block[0]->uncomp_size > 500)
-        cram_compress_block(fd, s->block[0], NULL, 1<<GZIP, 1);
+        cram_add_block_task(&st, s->block[0], NULL, 1<<GZIP, 1, 0);
 
     if (fd->use_bz2)
         method |= 1<<BZIP2;
 
-    if (fd->use_rans)
-        method |= (1<<RANS0) | (1<<RANS1);
+    // CRAM 3.1 supersedes rANS 4x8 with rANS Nx16
+    if (fd->use_rans) {
+        if (fd->version >= (3<<8) + 1)
+            method |= (1<<RANS_PR0)   | (1<<RANS_PR1)
+                    | (1<<RANS_PR64)  | (1<<RANS_PR65)
+                    | (1<<RANS_PR128) | (1<<RANS_PR129)
+                    | (1<<RANS_PR192) | (1<<RANS_PR193);
+        else
+            method |= (1<<RANS0) | (1<<RANS1);
+    }
 
     if (fd->use_lzma)
         method |= (1<<LZMA);
 
+    // Adaptive arithmetic coding mainly wins on small or skewed blocks
+    if (fd->use_arith && fd->version >= (3<<8) + 1)
+        method |= (1<<ARITH_PR0)   | (1<<ARITH_PR1)
+                | (1<<ARITH_PR64)  | (1<<ARITH_PR65)
+                | (1<<ARITH_PR128) | (1<<ARITH_PR129)
+                | (1<<ARITH_PR192) | (1<<ARITH_PR193);
+
     /* Faster method for data series we only need entropy encoding on */
     methodF = method & ~(1<<GZIP | 1<<BZIP2 | 1<<LZMA);
     if (level >= 6)
@@ -843,108 +945,84 @@ static int cram_compress_slice(cram_fd *fd, cram_container *c, cram_slice *s) {
 
 
     /* Specific compression methods for certain block types */
-    if (cram_compress_block(fd, s->block[DS_IN], fd->m[DS_IN], //IN (seq)
-                            method, level))
-        return -1;
+    cram_add_block_task(&st, s->block[DS_IN], fd->m[DS_IN], //IN (seq)
+                        method, level, 0);
 
     if (fd->level == 0) {
         /* Do nothing */
     } else if (fd->level == 1) {
-        if (cram_compress_block(fd, s->block[DS_QS], fd->m[DS_QS],
-                                methodF, 1))
-            return -1;
-        for (i = DS_aux; i <= DS_aux_oz; i++) {
-            if (s->block[i])
-                if (cram_compress_block(fd, s->block[i], fd->m[i],
-                                        method, 1))
-                    return -1;
-        }
+        cram_add_block_task(&st, s->block[DS_QS], fd->m[DS_QS],
+                            methodF, 1, 0);
+        for (i = DS_aux; i <= DS_aux_oz; i++)
+            cram_add_block_task(&st, s->block[i], fd->m[i], method, 1, 0);
     } else if (fd->level < 3) {
-        if (cram_compress_block(fd, s->block[DS_QS], fd->m[DS_QS],
-                                method, 1))
-            return -1;
-        if (cram_compress_block(fd, s->block[DS_BA], fd->m[DS_BA],
-                                method, 1))
-            return -1;
-        if (s->block[DS_BB])
-            if (cram_compress_block(fd, s->block[DS_BB], fd->m[DS_BB],
-                                    method, 1))
-                return -1;
-        for (i = DS_aux; i <= DS_aux_oz; i++) {
-            if (s->block[i])
-                if (cram_compress_block(fd, s->block[i], fd->m[i],
-                                        method, level))
-                    return -1;
-        }
+        cram_add_block_task(&st, s->block[DS_QS], fd->m[DS_QS],
+                            method | methodQ, 1, 1);
+        cram_add_block_task(&st, s->block[DS_BA], fd->m[DS_BA],
+                            method, 1, 0);
+        cram_add_block_task(&st, s->block[DS_BB], fd->m[DS_BB],
+                            method, 1, 0);
+        for (i = DS_aux; i <= DS_aux_oz; i++)
+            cram_add_block_task(&st, s->block[i], fd->m[i],
+                                method, level, 0);
     } else {
-        if (cram_compress_block(fd, s->block[DS_QS], fd->m[DS_QS],
-                                method, level))
-            return -1;
-        if (cram_compress_block(fd, s->block[DS_BA], fd->m[DS_BA],
-                                method, level))
-            return -1;
-        if (s->block[DS_BB])
-            if (cram_compress_block(fd, s->block[DS_BB], fd->m[DS_BB],
-                                    method, level))
-                return -1;
-        for (i = DS_aux; i <= DS_aux_oz; i++) {
-            if (s->block[i])
-                if (cram_compress_block(fd, s->block[i], fd->m[i],
-                                        method, level))
-                    return -1;
-        }
-    }
-
-    // NAME: best is generally xz, bzip2, zlib then rans1
-    if (cram_compress_block(fd, s->block[DS_RN], fd->m[DS_RN],
-                            method & ~(1<<RANS0 | 1<<GZIP_RLE),
-                            level))
-        return -1;
+        cram_add_block_task(&st, s->block[DS_QS], fd->m[DS_QS],
+                            method | methodQ, level, 1);
+        cram_add_block_task(&st, s->block[DS_BA], fd->m[DS_BA],
+                            method, level, 0);
+        cram_add_block_task(&st, s->block[DS_BB], fd->m[DS_BB],
+                            method, level, 0);
+        for (i = DS_aux; i <= DS_aux_oz; i++)
+            cram_add_block_task(&st, s->block[i], fd->m[i],
+                                method, level, 0);
+    }
+
+    // NAME: best is generally tok3, xz, bzip2, zlib then rans1
+    methodN = method & ~(1<<RANS0 | 1<<GZIP_RLE |
+                         1<<RANS_PR0 | 1<<RANS_PR64 |
+                         1<<RANS_PR128 | 1<<RANS_PR192 |
+                         1<<ARITH_PR0 | 1<<ARITH_PR64 |
+                         1<<ARITH_PR128 | 1<<ARITH_PR192);
+    if (fd->version >= (3<<8) + 1) {
+        methodN |= 1<<TOK3;
+        if (fd->use_arith)
+            methodN |= 1<<TOKA;
+    }
+    cram_add_block_task(&st, s->block[DS_RN], fd->m[DS_RN],
+                        methodN, level, 0);
 
     // NS shows strong local correlation as rearrangements are localised
     if (s->block[DS_NS] != s->block[0])
-        if (cram_compress_block(fd, s->block[DS_NS], fd->m[DS_NS],
-                                method, level))
-            return -1;
+        cram_add_block_task(&st, s->block[DS_NS], fd->m[DS_NS],
+                            method, level, 0);
 
 
     /*
      * Compress any auxiliary tags with their own per-tag metrics
      */
-    {
-        int i;
-        for (i = 0; i < s->naux_block; i++) {
-            if (!s->aux_block[i] || s->aux_block[i] == s->block[0])
-                continue;
-
-            if (s->aux_block[i]->method != RAW)
-                continue;
+    for (i = 0; i < s->naux_block; i++) {
+        if (!s->aux_block[i] || s->aux_block[i] == s->block[0])
+            continue;
 
-            if (cram_compress_block(fd, s->aux_block[i], s->aux_block[i]->m,
-                                    method, level))
-                return -1;
-        }
+        cram_add_block_task(&st, s->aux_block[i], s->aux_block[i]->m,
+                            method, level, 0);
     }
 
     /*
      * Minimal compression of any block still uncompressed, bar CORE
      */
-    {
-        int i;
-        for (i = 1; i < s->hdr->num_blocks && i < DS_END; i++) {
-            if (!s->block[i] || s->block[i] == s->block[0])
-                continue;
-
-            if (s->block[i]->method != RAW)
-                continue;
+    for (i = 1; i < s->hdr->num_blocks && i < DS_END; i++) {
+        if (!s->block[i] || s->block[i] == s->block[0])
+            continue;
 
-            if (cram_compress_block(fd, s->block[i], fd->m[i],
-                                    methodF, level))
-                return -1;
-        }
+        cram_add_block_task(&st, s->block[i], fd->m[i], methodF, level, 0);
     }
 
-    return 0;
+    cram_claim_metrics(fd, c, &st, s == c->slices[c->curr_slice-1]);
+    r = cram_run_parallel(fd, st.n, cram_block_task_run, &st);
+    free(st.t);
+
+    return r;
 }
 
 /*
@@ -1477,9 +1555,6 @@ int cram_encode_container(cram_fd *fd, cram_container *c) {
     /* Detect if a multi-seq container */
     cram_stats_encoding(fd, c->stats[DS_RI]);
     multi_ref = c->stats[DS_RI]->nvals > 1;
-    pthread_mutex_lock(&fd->metrics_lock);
-    fd->last_RI_count = c->stats[DS_RI]->nvals;
-    pthread_mutex_unlock(&fd->metrics_lock);
 
 
     if (multi_ref) {
@@ -2290,8 +2365,10 @@ static char *cram_encode_aux(cram_fd *fd, bam_seq_t *b, cram_container *c,
 
         if (r == 1) {
             khint_t k_global;
+            cram_metrics *tag_metrics;
 
-            // Global tags_used for cram_metrics support
+            // Global tags_used for cram_metrics support.  Other threads
+            // may resize the hash, so keep the pointer rather than k_global.
             pthread_mutex_lock(&fd->metrics_lock);
             k_global = kh_put(m_metrics, fd->tags_used, key, &r);
             if (-1 == r) {
@@ -2306,6 +2383,7 @@ static char *cram_encode_aux(cram_fd *fd, bam_seq_t *b, cram_container *c,
                     goto err;
                 }
             }
+            tag_metrics = kh_val(fd->tags_used, k_global);
 
             pthread_mutex_unlock(&fd->metrics_lock);
 
@@ -2418,9 +2496,7 @@ static char *cram_encode_aux(cram_fd *fd, bam_seq_t *b, cram_container *c,
             m->codec = c;
 
             // Link to fd-global tag metrics
-            pthread_mutex_lock(&fd->metrics_lock);
-            m->m = k_global ? (cram_metrics *)kh_val(fd->tags_used, k_global) : NULL;
-            pthread_mutex_unlock(&fd->metrics_lock);
+            m->m = tag_metrics;
         }
 
         cram_tag_map *tm = (cram_tag_map *)kh_val(c->tags_used, k);
@@ -3270,6 +3346,10 @@ int cram_put_bam_seq(cram_fd *fd, bam_seq_t *b) {
         int slice_rec, curr_rec, multi_seq = fd->multi_seq == 1;
         int curr_ref = c->slice ? c->curr_ref : bam_ref(b);
 
+        // A new reference can be loading while this container fills
+        if (!fd->no_ref && (!c->slice || bam_ref(b) != c->curr_ref))
+            cram_prefetch_ref(fd, bam_ref(b));
+
         /*
          * Start packing slices when we routinely have under 1/4tr full.
          *
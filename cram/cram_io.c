@@ -74,6 +74,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "../htslib/hts.h"
 #include "open_trace_file.h"
 #include "rANS_static.h"
+#include "rANS_static4x16.h"
+#include "arith_dynamic.h"
+#include "tokenise_name3.h"
+#include "fqzcomp_qual.h"
 
 //#define REF_DEBUG
 
@@ -1177,6 +1181,72 @@ int cram_uncompress_block(cram_block *b) {
         break;
     }
 
+    case RANSPR: {
+        unsigned int usize = b->uncomp_size, usize2 = usize;
+        if (!(uncomp = malloc(usize ? usize : 1)))
+            return -1;
+        if (!rans_uncompress_to_4x16(b->data, b->comp_size,
+                                     (unsigned char *)uncomp, &usize2)
+            || usize != usize2) {
+            free(uncomp);
+            return -1;
+        }
+        free(b->data);
+        b->data = (unsigned char *)uncomp;
+        b->alloc = usize;
+        b->method = RAW;
+        break;
+    }
+
+    case ARITH: {
+        unsigned int usize = b->uncomp_size, usize2 = usize;
+        if (!(uncomp = malloc(usize ? usize : 1)))
+            return -1;
+        if (!arith_uncompress_to(b->data, b->comp_size,
+                                 (unsigned char *)uncomp, &usize2)
+            || usize != usize2) {
+            free(uncomp);
+            return -1;
+        }
+        free(b->data);
+        b->data = (unsigned char *)uncomp;
+        b->alloc = usize;
+        b->method = RAW;
+        break;
+    }
+
+    case FQZ: {
+        size_t usize2;
+        uncomp = (char *)fqz_decompress(b->data, b->comp_size, &usize2);
+        if (!uncomp)
+            return -1;
+        if (usize2 != b->uncomp_size) {
+            free(uncomp);
+            return -1;
+        }
+        free(b->data);
+        b->data = (unsigned char *)uncomp;
+        b->alloc = usize2;
+        b->method = RAW;
+        break;
+    }
+
+    case TOK3: {
+        unsigned int usize2;
+        uncomp = (char *)tok3_decode_names(b->data, b->comp_size, &usize2);
+        if (!uncomp)
+            return -1;
+        if (usize2 != b->uncomp_size) {
+            free(uncomp);
+            return -1;
+        }
+        free(b->data);
+        b->data = (unsigned char *)uncomp;
+        b->alloc = usize2;
+        b->method = RAW;
+        break;
+    }
+
     default:
         return -1;
     }
@@ -1184,7 +1254,76 @@ int cram_uncompress_block(cram_block *b) {
     return 0;
 }
 
-static char *cram_compress_by_method(char *in, size_t in_size,
+// Blocks of at least this size are rANS Nx16 encoded with 32 states
+#define RANS_PR_X32_SIZE 65536
+
+// Returns the rANS Nx16 order/flags byte for a RANS_PR* method
+static int rans_pr_order(enum cram_block_method method) {
+    switch (method) {
+    case RANS_PR1:   return 1;
+    case RANS_PR64:  return RANS_ORDER_RLE;
+    case RANS_PR65:  return RANS_ORDER_RLE | 1;
+    case RANS_PR128: return RANS_ORDER_PACK;
+    case RANS_PR129: return RANS_ORDER_PACK | 1;
+    case RANS_PR192: return RANS_ORDER_PACK | RANS_ORDER_RLE;
+    case RANS_PR193: return RANS_ORDER_PACK | RANS_ORDER_RLE | 1;
+    default:         return 0;
+    }
+}
+
+// Returns the arithmetic coder order/flags byte for an ARITH_PR* method
+static int arith_pr_order(enum cram_block_method method) {
+    switch (method) {
+    case ARITH_PR1:   return ARITH_ORDER;
+    case ARITH_PR64:  return ARITH_RLE;
+    case ARITH_PR65:  return ARITH_RLE | ARITH_ORDER;
+    case ARITH_PR128: return ARITH_PACK;
+    case ARITH_PR129: return ARITH_PACK | ARITH_ORDER;
+    case ARITH_PR192: return ARITH_PACK | ARITH_RLE;
+    case ARITH_PR193: return ARITH_PACK | ARITH_RLE | ARITH_ORDER;
+    default:          return 0;
+    }
+}
+
+/*
+ * Describes the records of a slice for the fqzcomp quality codec.  Each
+ * record owns the quality block bytes from its own offset up to the next
+ * record's, which includes any qualities stored with read features.
+ */
+static char *fqz_compress_slice(cram_slice *s, char *in, size_t in_size,
+                                size_t *out_size, int level) {
+    fqz_slice f;
+    char *comp = NULL;
+    int i, n;
+
+    if (!s || !s->hdr || !s->crecs || !(n = s->hdr->num_records))
+        return NULL;
+
+    f.num_records = n;
+    f.len = malloc(n * sizeof(*f.len));
+    f.flags = malloc(n * sizeof(*f.flags));
+    if (!f.len || !f.flags)
+        goto err;
+
+    for (i = 0; i < n; i++) {
+        size_t start = s->crecs[i].qual;
+        size_t end = i+1 < n ? s->crecs[i+1].qual : in_size;
+        if (end < start || end > in_size || (i == 0 && start != 0))
+            goto err;
+        f.len[i] = end - start;
+        f.flags[i] = s->crecs[i].flags;
+    }
+
+    comp = (char *)fqz_compress(&f, (unsigned char *)in, in_size, out_size,
+                                level);
+
+ err:
+    free(f.len);
+    free(f.flags);
+    return comp;
+}
+
+static char *cram_compress_by_method(cram_slice *s, char *in, size_t in_size,
                                      int content_id, size_t *out_size,
                                      enum cram_block_method method,
                                      int level, int strat) {
@@ -1249,6 +1388,58 @@ static char *cram_compress_by_method(char *in, size_t in_size,
         return (char *)cp;
     }
 
+    case RANS_PR0:
+    case RANS_PR1:
+    case RANS_PR64:
+    case RANS_PR65:
+    case RANS_PR128:
+    case RANS_PR129:
+    case RANS_PR192:
+    case RANS_PR193: {
+        unsigned int out_size_i;
+        unsigned char *cp;
+
+        // Large blocks use 32 states so the decoder can vectorise
+        int order = rans_pr_order(method);
+        if (in_size >= RANS_PR_X32_SIZE)
+            order |= RANS_ORDER_X32;
+        cp = rans_compress_4x16((unsigned char *)in, in_size, &out_size_i,
+                                order);
+        *out_size = out_size_i;
+        return (char *)cp;
+    }
+
+    case ARITH_PR0:
+    case ARITH_PR1:
+    case ARITH_PR64:
+    case ARITH_PR65:
+    case ARITH_PR128:
+    case ARITH_PR129:
+    case ARITH_PR192:
+    case ARITH_PR193: {
+        unsigned int out_size_i;
+        unsigned char *cp;
+
+        cp = arith_compress((unsigned char *)in, in_size, &out_size_i,
+                            arith_pr_order(method));
+        *out_size = out_size_i;
+        return (char *)cp;
+    }
+
+    case FQZ:
+        return fqz_compress_slice(s, in, in_size, out_size, level);
+
+    case TOK3:
+    case TOKA: {
+        int out_size_i;
+        unsigned char *cp;
+
+        cp = tok3_encode_names(in, in_size, level, method == TOKA,
+                               &out_size_i);
+        *out_size = out_size_i;
+        return (char *)cp;
+    }
+
     case RAW:
         break;
 
@@ -1259,6 +1450,194 @@ static char *cram_compress_by_method(char *in, size_t in_size,
     return NULL;
 }
 
+/*
+ * A batch of tasks for cram_run_parallel().  Pool jobs and the calling
+ * thread all claim tasks from it until none are left, so the caller never
+ * waits for a job the pool has not started, which could otherwise
+ * deadlock when called from a pool job.  Jobs may still be queued after
+ * the caller returns, so the batch is freed by whoever drops the last
+ * reference, and a late job finds nothing to do.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t all_done;
+    int (*func)(void *arg, int i);
+    void *arg;
+    int ntasks, next, ndone, nrefs, err;
+} cram_par_batch;
+
+static void cram_par_unref(cram_par_batch *pb) {
+    int last;
+
+    pthread_mutex_lock(&pb->lock);
+    last = --pb->nrefs == 0;
+    pthread_mutex_unlock(&pb->lock);
+
+    if (last) {
+        pthread_mutex_destroy(&pb->lock);
+        pthread_cond_destroy(&pb->all_done);
+        free(pb);
+    }
+}
+
+static void cram_par_work(cram_par_batch *pb) {
+    pthread_mutex_lock(&pb->lock);
+    while (pb->next < pb->ntasks) {
+        int i = pb->next++, r;
+        pthread_mutex_unlock(&pb->lock);
+        r = pb->func(pb->arg, i);
+        pthread_mutex_lock(&pb->lock);
+        if (r < 0)
+            pb->err = 1;
+        if (++pb->ndone == pb->ntasks)
+            pthread_cond_broadcast(&pb->all_done);
+    }
+    pthread_mutex_unlock(&pb->lock);
+}
+
+static void *cram_par_job(void *arg) {
+    cram_par_work(arg);
+    cram_par_unref(arg);
+    return NULL;
+}
+
+static void cram_par_job_cleanup(void *arg) {
+    cram_par_unref(arg);
+}
+
+int cram_run_parallel(cram_fd *fd, int ntasks,
+                      int (*func)(void *arg, int i), void *arg) {
+    cram_par_batch *pb;
+    int i, njobs, err = 0;
+
+    njobs = fd->pool && fd->tqueue ? hts_tpool_size(fd->pool) : 0;
+    if (njobs > ntasks - 1)
+        njobs = ntasks - 1;
+
+    if (njobs <= 0 || !(pb = calloc(1, sizeof(*pb)))) {
+        for (i = 0; i < ntasks; i++)
+            if (func(arg, i) < 0)
+                err = 1;
+        return err ? -1 : 0;
+    }
+
+    pthread_mutex_init(&pb->lock, NULL);
+    pthread_cond_init(&pb->all_done, NULL);
+    pb->func = func;
+    pb->arg = arg;
+    pb->ntasks = ntasks;
+    pb->nrefs = 1 + njobs;
+
+    // A full queue just means more of the work is done here
+    for (i = 0; i < njobs; i++)
+        if (hts_tpool_dispatch3(fd->pool, fd->tqueue, cram_par_job, pb,
+                                cram_par_job_cleanup, NULL, 1) < 0)
+            cram_par_unref(pb);
+
+    cram_par_work(pb);
+
+    pthread_mutex_lock(&pb->lock);
+    while (pb->ndone < pb->ntasks)
+        pthread_cond_wait(&pb->all_done, &pb->lock);
+    err = pb->err;
+    pthread_mutex_unlock(&pb->lock);
+
+    cram_par_unref(pb);
+    return err ? -1 : 0;
+}
+
+
+/*
+ * The order in which cram_compress_block() tries methods.  When two give
+ * the same size, the earlier one wins.
+ */
+static const int cram_trial_order[] = {
+    GZIP_RLE, GZIP, RANS0, RANS1,
+    RANS_PR0, RANS_PR1, RANS_PR64, RANS_PR65,
+    RANS_PR128, RANS_PR129, RANS_PR192, RANS_PR193,
+    ARITH_PR0, ARITH_PR1, ARITH_PR64, ARITH_PR65,
+    ARITH_PR128, ARITH_PR129, ARITH_PR192, ARITH_PR193,
+    FQZ, TOK3, TOKA, BZIP2, LZMA,
+};
+#define NTRIAL_METHODS (sizeof(cram_trial_order)/sizeof(*cram_trial_order))
+
+/*
+ * The relative CPU cost of a method at compression levels up to 6, used to
+ * scale trial sizes so slower methods need to do better to be chosen.
+ */
+static double cram_method_cost(int method, int level) {
+    switch (method) {
+    case RANS1:
+    case RANS_PR1:
+    case RANS_PR65:
+    case RANS_PR129:
+    case RANS_PR193: return level <= 3 ? 1.02 : 1.01;
+    case GZIP:       return level <= 3 ? 1.04 : 1.02;
+    case BZIP2:
+    case FQZ:
+    case TOKA:
+    case ARITH_PR0:
+    case ARITH_PR1:
+    case ARITH_PR64:
+    case ARITH_PR65:
+    case ARITH_PR128:
+    case ARITH_PR129:
+    case ARITH_PR192:
+    case ARITH_PR193: return level <= 3 ? 1.08 : 1.03;
+    case LZMA:       return level <= 3 ? 1.10 : 1.05;
+    default:         return 1.0;
+    }
+}
+
+/*
+ * The trial compressions of one block, run by cram_run_parallel().  The
+ * smallest result is kept as each finishes, with ties going to the earlier
+ * method in cram_trial_order, so the choice does not depend on timing.
+ */
+typedef struct {
+    cram_slice *s;
+    cram_block *b;
+    int level;
+    int m[NTRIAL_METHODS];
+    size_t *sz;
+    pthread_mutex_t lock;
+    char *c_best;
+    int i_best;
+} cram_trial_job;
+
+static int cram_trial_run(void *arg, int i) {
+    cram_trial_job *tj = arg;
+    cram_block *b = tj->b;
+    int m = tj->m[i];
+    size_t sz = 0;
+    char *c;
+
+    if (m == GZIP_RLE)
+        c = cram_compress_by_method(tj->s, (char *)b->data, b->uncomp_size,
+                                    b->content_id, &sz, GZIP, 1, Z_RLE);
+    else
+        c = cram_compress_by_method(tj->s, (char *)b->data, b->uncomp_size,
+                                    b->content_id, &sz, m, tj->level,
+                                    m == GZIP ? Z_FILTERED : 0);
+    if (!c)
+        sz = b->uncomp_size*2+1000;
+
+    //fprintf(stderr, "Block %d; %d->%d\n", b->content_id, b->uncomp_size, sz);
+
+    pthread_mutex_lock(&tj->lock);
+    tj->sz[m] = sz;
+    if (c && (tj->i_best < 0 || sz < tj->sz[tj->m[tj->i_best]]
+              || (sz == tj->sz[tj->m[tj->i_best]] && i < tj->i_best))) {
+        free(tj->c_best);
+        tj->c_best = c;
+        tj->i_best = i;
+        c = NULL;
+    }
+    pthread_mutex_unlock(&tj->lock);
+
+    free(c);
+    return 0;
+}
 
 /*
  * Compresses a block using one of two different zlib strategies. If we only
@@ -1272,6 +1651,39 @@ static char *cram_compress_by_method(char *in, size_t in_size,
  */
 int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
                         int method, int level) {
+    return cram_compress_block2(fd, NULL, b, metrics, -1, method, level);
+}
+
+/*
+ * Takes and gives up the turn to use a set of metrics, for a ticket handed
+ * out in container order (see cram_claim_metrics()).  A ticket of -1 means
+ * no ordering is needed.  Must be called with metrics_lock held.
+ */
+static void cram_metrics_wait(cram_fd *fd, cram_metrics *m, int64_t ticket) {
+    while (ticket >= 0 && m->served != ticket)
+        pthread_cond_wait(&fd->metrics_cond, &fd->metrics_lock);
+}
+
+static void cram_metrics_done(cram_fd *fd, cram_metrics *m, int64_t ticket) {
+    if (ticket < 0)
+        return;
+    m->served++;
+    pthread_cond_broadcast(&fd->metrics_cond);
+}
+
+// Passes on the turn without using the metrics
+static void cram_metrics_skip(cram_fd *fd, cram_metrics *m, int64_t ticket) {
+    if (!m || ticket < 0)
+        return;
+    pthread_mutex_lock(&fd->metrics_lock);
+    cram_metrics_wait(fd, m, ticket);
+    cram_metrics_done(fd, m, ticket);
+    pthread_mutex_unlock(&fd->metrics_lock);
+}
+
+int cram_compress_block2(cram_fd *fd, cram_slice *s, cram_block *b,
+                         cram_metrics *metrics, int64_t ticket,
+                         int method, int level) {
 
     char *comp = NULL;
     size_t comp_size = 0;
@@ -1283,6 +1695,7 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
         // one base type present and hence using E_HUFFMAN on block 0.
         // A second explicit attempt to compress the same block then
         // occurs.
+        cram_metrics_skip(fd, metrics, ticket);
         return 0;
     }
 
@@ -1300,6 +1713,7 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
     //fprintf(stderr, "IN: block %d, sz %d\n", b->content_id, b->uncomp_size);
 
     if (method == RAW || level == 0 || b->uncomp_size == 0) {
+        cram_metrics_skip(fd, metrics, ticket);
         b->method = RAW;
         b->comp_size = b->uncomp_size;
         //fprintf(stderr, "Skip block id %d\n", b->content_id);
@@ -1308,16 +1722,12 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
 
     if (metrics) {
         pthread_mutex_lock(&fd->metrics_lock);
+        cram_metrics_wait(fd, metrics, ticket);
         if (metrics->trial > 0 || --metrics->next_trial <= 0) {
             size_t sz_best = INT_MAX;
-            size_t sz_gz_rle = 0;
-            size_t sz_gz_def = 0;
-            size_t sz_rans0 = 0;
-            size_t sz_rans1 = 0;
-            size_t sz_bzip2 = 0;
-            size_t sz_lzma = 0;
-            int method_best = 0;
-            char *c_best = NULL, *c = NULL;
+            size_t sz[CRAM_MAX_METHOD] = {0};
+            int method_best = 0, i, ntrial = 0;
+            cram_trial_job tj;
 
             if (metrics->revised_method)
                 method = metrics->revised_method;
@@ -1327,167 +1737,56 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
             if (metrics->next_trial <= 0) {
                 metrics->next_trial = TRIAL_SPAN;
                 metrics->trial = NTRIALS;
-                metrics->sz_gz_rle /= 2;
-                metrics->sz_gz_def /= 2;
-                metrics->sz_rans0  /= 2;
-                metrics->sz_rans1  /= 2;
-                metrics->sz_bzip2  /= 2;
-                metrics->sz_lzma   /= 2;
+                for (i = 0; i < CRAM_MAX_METHOD; i++)
+                    metrics->sz[i] /= 2;
             }
 
             pthread_mutex_unlock(&fd->metrics_lock);
 
-            if (method & (1<<GZIP_RLE)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_gz_rle, GZIP, 1, Z_RLE);
-                if (c && sz_best > sz_gz_rle) {
-                    sz_best = sz_gz_rle;
-                    method_best = GZIP_RLE;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_gz_rle = b->uncomp_size*2+1000;
-                }
-
-                //fprintf(stderr, "Block %d; %d->%d\n", b->content_id, b->uncomp_size, sz_gz_rle);
-            }
-
-            if (method & (1<<GZIP)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_gz_def, GZIP, level,
-                                            Z_FILTERED);
-                if (c && sz_best > sz_gz_def) {
-                    sz_best = sz_gz_def;
-                    method_best = GZIP;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_gz_def = b->uncomp_size*2+1000;
-                }
-
-                //fprintf(stderr, "Block %d; %d->%d\n", b->content_id, b->uncomp_size, sz_gz_def);
-            }
-
-            if (method & (1<<RANS0)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_rans0, RANS0, 0, 0);
-                if (c && sz_best > sz_rans0) {
-                    sz_best = sz_rans0;
-                    method_best = RANS0;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_rans0 = b->uncomp_size*2+1000;
-                }
-            }
-
-            if (method & (1<<RANS1)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_rans1, RANS1, 0, 0);
-                if (c && sz_best > sz_rans1) {
-                    sz_best = sz_rans1;
-                    method_best = RANS1;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_rans1 = b->uncomp_size*2+1000;
-                }
-            }
-
-            if (method & (1<<BZIP2)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_bzip2, BZIP2, level, 0);
-                if (c && sz_best > sz_bzip2) {
-                    sz_best = sz_bzip2;
-                    method_best = BZIP2;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_bzip2 = b->uncomp_size*2+1000;
-                }
-            }
-
-            if (method & (1<<LZMA)) {
-                c = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                            b->content_id, &sz_lzma, LZMA, level, 0);
-                if (c && sz_best > sz_lzma) {
-                    sz_best = sz_lzma;
-                    method_best = LZMA;
-                    if (c_best)
-                        free(c_best);
-                    c_best = c;
-                } else if (c) {
-                    free(c);
-                } else {
-                    sz_lzma = b->uncomp_size*2+1000;
-                }
+            // Independent trials, so they can run concurrently
+            tj.s = s;
+            tj.b = b;
+            tj.level = level;
+            tj.sz = sz;
+            tj.c_best = NULL;
+            tj.i_best = -1;
+            for (i = 0; i < NTRIAL_METHODS; i++)
+                if (method & (1<<cram_trial_order[i]))
+                    tj.m[ntrial++] = cram_trial_order[i];
+            pthread_mutex_init(&tj.lock, NULL);
+            cram_run_parallel(fd, ntrial, cram_trial_run, &tj);
+            pthread_mutex_destroy(&tj.lock);
+            if (tj.i_best >= 0) {
+                method_best = tj.m[tj.i_best];
+                sz_best = sz[method_best];
             }
 
             //fprintf(stderr, "sz_best = %d\n", sz_best);
 
             free(b->data);
-            b->data = (unsigned char *)c_best;
+            b->data = (unsigned char *)tj.c_best;
             //printf("method_best = %s\n", cram_block_method2str(method_best));
             b->method = method_best == GZIP_RLE ? GZIP : method_best;
             b->comp_size = sz_best;
 
             pthread_mutex_lock(&fd->metrics_lock);
-            metrics->sz_gz_rle += sz_gz_rle;
-            metrics->sz_gz_def += sz_gz_def;
-            metrics->sz_rans0  += sz_rans0;
-            metrics->sz_rans1  += sz_rans1;
-            metrics->sz_bzip2  += sz_bzip2;
-            metrics->sz_lzma   += sz_lzma;
+            for (i = 0; i < CRAM_MAX_METHOD; i++)
+                metrics->sz[i] += sz[i];
             if (--metrics->trial == 0) {
                 int best_method = RAW;
                 int best_sz = INT_MAX;
 
                 // Scale methods by cost
-                if (fd->level <= 3) {
-                    metrics->sz_rans1  *= 1.02;
-                    metrics->sz_gz_def *= 1.04;
-                    metrics->sz_bzip2  *= 1.08;
-                    metrics->sz_lzma   *= 1.10;
-                } else if (fd->level <= 6) {
-                    metrics->sz_rans1  *= 1.01;
-                    metrics->sz_gz_def *= 1.02;
-                    metrics->sz_bzip2  *= 1.03;
-                    metrics->sz_lzma   *= 1.05;
+                if (fd->level <= 6)
+                    for (i = 0; i < CRAM_MAX_METHOD; i++)
+                        metrics->sz[i] *= cram_method_cost(i, fd->level);
+
+                for (i = 0; i < NTRIAL_METHODS; i++) {
+                    int m = cram_trial_order[i];
+                    if (method & (1<<m) && best_sz > metrics->sz[m])
+                        best_sz = metrics->sz[m], best_method = m;
                 }
 
-                if (method & (1<<GZIP_RLE) && best_sz > metrics->sz_gz_rle)
-                    best_sz = metrics->sz_gz_rle, best_method = GZIP_RLE;
-
-                if (method & (1<<GZIP) && best_sz > metrics->sz_gz_def)
-                    best_sz = metrics->sz_gz_def, best_method = GZIP;
-
-                if (method & (1<<RANS0) && best_sz > metrics->sz_rans0)
-                    best_sz = metrics->sz_rans0, best_method = RANS0;
-
-                if (method & (1<<RANS1) && best_sz > metrics->sz_rans1)
-                    best_sz = metrics->sz_rans1, best_method = RANS1;
-
-                if (method & (1<<BZIP2) && best_sz > metrics->sz_bzip2)
-                    best_sz = metrics->sz_bzip2, best_method = BZIP2;
-
-                if (method & (1<<LZMA) && best_sz > metrics->sz_lzma)
-                    best_sz = metrics->sz_lzma, best_method = LZMA;
-
                 if (best_method == GZIP_RLE) {
                     metrics->method = GZIP;
                     metrics->strat  = Z_RLE;
@@ -1502,64 +1801,17 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
                 // for this block type.
 #define MAXDELTA 0.20
 #define MAXFAILS 4
-                if (best_method == GZIP_RLE) {
-                    metrics->gz_rle_cnt = 0;
-                    metrics->gz_rle_extra = 0;
-                } else if (best_sz < metrics->sz_gz_rle) {
-                    double r = (double)metrics->sz_gz_rle / best_sz - 1;
-                    if (++metrics->gz_rle_cnt >= MAXFAILS &&
-                        (metrics->gz_rle_extra += r) >= MAXDELTA)
-                        method &= ~(1<<GZIP_RLE);
-                }
-
-                if (best_method == GZIP) {
-                    metrics->gz_def_cnt = 0;
-                    metrics->gz_def_extra = 0;
-                } else if (best_sz < metrics->sz_gz_def) {
-                    double r = (double)metrics->sz_gz_def / best_sz - 1;
-                    if (++metrics->gz_def_cnt >= MAXFAILS &&
-                        (metrics->gz_def_extra += r) >= MAXDELTA)
-                        method &= ~(1<<GZIP);
-                }
-
-                if (best_method == RANS0) {
-                    metrics->rans0_cnt = 0;
-                    metrics->rans0_extra = 0;
-                } else if (best_sz < metrics->sz_rans0) {
-                    double r = (double)metrics->sz_rans0 / best_sz - 1;
-                    if (++metrics->rans0_cnt >= MAXFAILS &&
-                        (metrics->rans0_extra += r) >= MAXDELTA)
-                        method &= ~(1<<RANS0);
-                }
-
-                if (best_method == RANS1) {
-                    metrics->rans1_cnt = 0;
-                    metrics->rans1_extra = 0;
-                } else if (best_sz < metrics->sz_rans1) {
-                    double r = (double)metrics->sz_rans1 / best_sz - 1;
-                    if (++metrics->rans1_cnt >= MAXFAILS &&
-                        (metrics->rans1_extra += r) >= MAXDELTA)
-                        method &= ~(1<<RANS1);
-                }
-
-                if (best_method == BZIP2) {
-                    metrics->bzip2_cnt = 0;
-                    metrics->bzip2_extra = 0;
-                } else if (best_sz < metrics->sz_bzip2) {
-                    double r = (double)metrics->sz_bzip2 / best_sz - 1;
-                    if (++metrics->bzip2_cnt >= MAXFAILS &&
-                        (metrics->bzip2_extra += r) >= MAXDELTA)
-                        method &= ~(1<<BZIP2);
-                }
-
-                if (best_method == LZMA) {
-                    metrics->lzma_cnt = 0;
-                    metrics->lzma_extra = 0;
-                } else if (best_sz < metrics->sz_lzma) {
-                    double r = (double)metrics->sz_lzma / best_sz - 1;
-                    if (++metrics->lzma_cnt >= MAXFAILS &&
-                        (metrics->lzma_extra += r) >= MAXDELTA)
-                        method &= ~(1<<LZMA);
+                for (i = 0; i < NTRIAL_METHODS; i++) {
+                    int m = cram_trial_order[i];
+                    if (best_method == m) {
+                        metrics->cnt[m] = 0;
+                        metrics->extra[m] = 0;
+                    } else if (best_sz < metrics->sz[m]) {
+                        double r = (double)metrics->sz[m] / best_sz - 1;
+                        if (++metrics->cnt[m] >= MAXFAILS &&
+                            (metrics->extra[m] += r) >= MAXDELTA)
+                            method &= ~(1<<m);
+                    }
                 }
 
                 //if (method != metrics->revised_method)
@@ -1567,15 +1819,25 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
                 //          b->content_id, metrics->revised_method, method);
                 metrics->revised_method = method;
             }
+            cram_metrics_done(fd, metrics, ticket);
             pthread_mutex_unlock(&fd->metrics_lock);
         } else {
             strat = metrics->strat;
             method = metrics->method;
 
+            cram_metrics_done(fd, metrics, ticket);
             pthread_mutex_unlock(&fd->metrics_lock);
-            comp = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                           b->content_id, &comp_size, method,
-                                           level, strat);
+            comp = cram_compress_by_method(s, (char *)b->data,
+                                           b->uncomp_size, b->content_id,
+                                           &comp_size, method, level, strat);
+            if (!comp && method == FQZ) {
+                // Depends on the slice layout, so may not always apply
+                method = GZIP;
+                comp = cram_compress_by_method(s, (char *)b->data,
+                                               b->uncomp_size, b->content_id,
+                                               &comp_size, method, level,
+                                               Z_FILTERED);
+            }
             if (!comp)
                 return -1;
             free(b->data);
@@ -1586,8 +1848,9 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
 
     } else {
         // no cached metrics, so just do zlib?
-        comp = cram_compress_by_method((char *)b->data, b->uncomp_size,
-                                       b->content_id, &comp_size, GZIP, level, Z_FILTERED);
+        comp = cram_compress_by_method(s, (char *)b->data, b->uncomp_size,
+                                       b->content_id, &comp_size, GZIP, level,
+                                       Z_FILTERED);
         if (!comp) {
             hts_log_error("Compression failed");
             return -1;
@@ -1604,6 +1867,12 @@ int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
 
     if (b->method == RANS1)
         b->method = RANS0; // Spec just has RANS (not 0/1) with auto-sensing
+    else if (b->method >= RANS_PR1 && b->method <= RANS_PR193)
+        b->method = RANSPR; // Likewise, the order is in the data
+    else if (b->method >= ARITH_PR1 && b->method <= ARITH_PR193)
+        b->method = ARITH;
+    else if (b->method == TOKA)
+        b->method = TOK3;
 
     return 0;
 }
@@ -1630,6 +1899,25 @@ char *cram_block_method2str(enum cram_block_method m) {
     case RANS0:    return "RANS0";
     case RANS1:    return "RANS1";
     case GZIP_RLE: return "GZIP_RLE";
+    case RANS_PR0:   return "RANS_PR0";
+    case RANS_PR1:   return "RANS_PR1";
+    case RANS_PR64:  return "RANS_PR64";
+    case RANS_PR65:  return "RANS_PR65";
+    case RANS_PR128: return "RANS_PR128";
+    case RANS_PR129: return "RANS_PR129";
+    case RANS_PR192: return "RANS_PR192";
+    case RANS_PR193: return "RANS_PR193";
+    case ARITH_PR0:   return "ARITH_PR0";
+    case ARITH_PR1:   return "ARITH_PR1";
+    case ARITH_PR64:  return "ARITH_PR64";
+    case ARITH_PR65:  return "ARITH_PR65";
+    case ARITH_PR128: return "ARITH_PR128";
+    case ARITH_PR129: return "ARITH_PR129";
+    case ARITH_PR192: return "ARITH_PR192";
+    case ARITH_PR193: return "ARITH_PR193";
+    case FQZ:        return "FQZ";
+    case TOK3:       return "TOK3";
+    case TOKA:       return "TOKA";
     case BM_ERROR: break;
     }
     return "?";
@@ -1677,11 +1965,128 @@ char *cram_content_type2str(enum cram_content_type t) {
 static void ref_entry_free_seq(ref_entry *e) {
     if (e->mf)
         mfclose(e->mf);
-    if (e->seq && !e->mf)
+    if (e->seq && !e->mf && !e->is_mapped)
         free(e->seq);
 
     e->seq = NULL;
     e->mf = NULL;
+    e->is_mapped = 0;
+}
+
+/*
+ * Returns true if the sequence for e can be taken from the shared
+ * memory mapping held in r->fai rather than loaded into memory.
+ */
+static inline int ref_entry_mappable(refs_t *r, ref_entry *e) {
+    return r->fai && !e->is_md5 && e->fn == r->fai_fn;
+}
+
+/*
+ * Reference cache.
+ *
+ * Sequences whose reference count drops to zero are not freed straight
+ * away, but put on an LRU list in case they are needed again.  Idle
+ * sequences are then freed, least recently used first, while the total
+ * size loaded exceeds r->cache_size.  With the default cache_size of 0
+ * only the most recently released sequence is kept, and freed when the
+ * next one is released, so incr/decr cycles on a single sequence don't
+ * reload it.  Sequences held by r->last (see cram_ref_load) or
+ * e->prefetched (see cram_prefetch_ref) are not idle, so these avoid
+ * load/free loops and keep prefetched data until it is first used.
+ *
+ * All of these need r->lock to be held.
+ */
+
+// Accounts for sequence newly loaded into e.
+static void ref_cache_loaded(refs_t *r, ref_entry *e) {
+    if (e->is_mapped)
+        return;
+
+    r->stats.bytes_loaded += e->length;
+    r->stats.bytes_cached += e->length;
+    if (r->stats.max_cached < r->stats.bytes_cached)
+        r->stats.max_cached = r->stats.bytes_cached;
+}
+
+static void ref_lru_remove(refs_t *r, ref_entry *e) {
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        r->lru_head = e->lru_next;
+
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        r->lru_tail = e->lru_prev;
+
+    e->lru_prev = e->lru_next = NULL;
+    r->nlru--;
+}
+
+static inline int ref_in_lru(refs_t *r, ref_entry *e) {
+    return e->lru_prev || r->lru_head == e;
+}
+
+// Frees idle sequences until another "need" bytes fit in the cache budget.
+static void ref_cache_make_room(refs_t *r, int64_t need) {
+    int keep = r->cache_size ? 0 : 1;
+
+    while (r->nlru > keep && r->stats.bytes_cached + need > r->cache_size) {
+        ref_entry *e = r->lru_tail;
+
+        RP("%d FREE REF %p\n", gettid(), e->seq);
+        ref_lru_remove(r, e);
+        if (!e->is_mapped)
+            r->stats.bytes_cached -= e->length;
+        ref_entry_free_seq(e);
+        if (e->is_md5) e->length = 0;
+        r->stats.evictions++;
+    }
+}
+
+// Frees idle sequences until we are within the cache budget.
+static void ref_cache_evict(refs_t *r) {
+    ref_cache_make_room(r, 0);
+}
+
+// Called when the reference count of e has dropped to zero.
+static void ref_cache_release(refs_t *r, ref_entry *e) {
+    if (!e->seq || ref_in_lru(r, e))
+        return;
+
+    e->lru_prev = NULL;
+    e->lru_next = r->lru_head;
+    if (r->lru_head)
+        r->lru_head->lru_prev = e;
+    else
+        r->lru_tail = e;
+    r->lru_head = e;
+    r->nlru++;
+
+    ref_cache_evict(r);
+}
+
+// Drops the count held on a sequence loaded by cram_prefetch_ref().
+static void ref_prefetch_release(refs_t *r, ref_entry *e) {
+    if (!e || !e->prefetched)
+        return;
+
+    e->prefetched = 0;
+    r->nprefetched--;
+    if (--e->count <= 0)
+        ref_cache_release(r, e);
+}
+
+// On first use of a prefetched sequence, its count moves to r->last as if
+// cram_ref_load() had loaded it.
+static void ref_prefetch_to_last(refs_t *r, ref_entry *e) {
+    ref_entry *last = r->last;
+
+    e->prefetched = 0;
+    r->nprefetched--;
+    r->last = e;
+    if (last && --last->count <= 0)
+        ref_cache_release(r, last);
 }
 
 void refs_free(refs_t *r) {
@@ -1719,7 +2124,11 @@ void refs_free(refs_t *r) {
     if (r->fp)
         bgzf_close(r->fp);
 
+    if (r->fai)
+        fai_destroy(r->fai);
+
     pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->prefetch_done);
 
     free(r);
 }
@@ -1738,12 +2147,13 @@ static refs_t *refs_create(void) {
     r->ref_id = NULL; // see refs2id() to populate.
     r->count = 1;
     r->last = NULL;
-    r->last_id = -1;
+    r->prefetch_id = -1;
 
     if (!(r->h_meta = kh_init(refs)))
         goto err;
 
     pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->prefetch_done, NULL);
 
     return r;
 
@@ -1786,6 +2196,44 @@ static BGZF *bgzf_open_ref(char *fn, char *mode, int is_md5) {
     return fp;
 }
 
+/*
+ * Detaches all sequences from the memory mapping in r->fai so that it can
+ * be destroyed.  Idle sequences are simply dropped, while those still in
+ * use are copied.
+ *
+ * Returns 0 on success;
+ *        -1 on failure
+ */
+static int refs_unmap(refs_t *r) {
+    khint_t k;
+
+    for (k = kh_begin(r->h_meta); k != kh_end(r->h_meta); k++) {
+        ref_entry *e;
+        char *seq;
+
+        if (!kh_exist(r->h_meta, k) || !(e = kh_val(r->h_meta, k)))
+            continue;
+        if (!e->is_mapped)
+            continue;
+
+        if (e->count == 0) {
+            if (ref_in_lru(r, e))
+                ref_lru_remove(r, e);
+            ref_entry_free_seq(e);
+            continue;
+        }
+
+        if (!(seq = malloc(e->length)))
+            return -1;
+        memcpy(seq, e->seq, e->length);
+        e->seq = seq;
+        e->is_mapped = 0;
+        ref_cache_loaded(r, e);
+    }
+
+    return 0;
+}
+
 /*
  * Loads a FAI file for a reference.fasta.
  * "is_err" indicates whether failure to load is worthy of emitting an
@@ -1842,6 +2290,31 @@ static refs_t *refs_load_fai(refs_t *r_orig, const char *fn, int is_err) {
         goto err;
     }
 
+    /*
+     * If a line-free ".bin" copy of the reference exists (see FAI_MMAP),
+     * map it so that sequences are shared via the page cache with other
+     * processes instead of each loading a private copy.  We can only use
+     * it directly if it is already upper case.
+     */
+    if (r->fai) {
+        if (refs_unmap(r) < 0)
+            goto err;
+        fai_destroy(r->fai);
+        r->fai = NULL;
+    }
+    if (!hisremote(r->fn)) {
+        char bin_fn[PATH_MAX];
+        snprintf(bin_fn, PATH_MAX, "%s.bin", r->fn);
+        if (access(bin_fn, R_OK) == 0) {
+            r->fai = fai_load3(r->fn, fai_fn, NULL, FAI_MMAP);
+            if (r->fai && !fai_mapped_upper(r->fai)) {
+                fai_destroy(r->fai);
+                r->fai = NULL;
+            }
+            r->fai_fn = r->fn;
+        }
+    }
+
     if (!(fp = hopen(fai_fn, "r"))) {
         hts_log_error("Failed to open index file '%s'", fai_fn);
         if (is_err)
@@ -1890,6 +2363,9 @@ static refs_t *refs_load_fai(refs_t *r_orig, const char *fn, int is_err) {
         e->seq = NULL;
         e->mf = NULL;
         e->is_md5 = 0;
+        e->is_mapped = 0;
+        e->lru_prev = e->lru_next = NULL;
+        e->prefetched = 0;
 
         k = kh_put(refs, r->h_meta, e->name, &n);
         if (-1 == n)  {
@@ -2347,6 +2823,8 @@ static int cram_populate_ref(cram_fd *fd, int id, ref_entry *r) {
         }
         r->length = sz;
         r->is_md5 = 1;
+        ref_cache_loaded(fd->refs, r);
+        ref_cache_evict(fd->refs);
     } else {
         refs_t *refs;
         const char *fn;
@@ -2459,8 +2937,8 @@ static void cram_ref_incr_locked(refs_t *r, int id) {
     if (id < 0 || !r->ref_id[id] || !r->ref_id[id]->seq)
         return;
 
-    if (r->last_id == id)
-        r->last_id = -1;
+    if (ref_in_lru(r, r->ref_id[id]))
+        ref_lru_remove(r, r->ref_id[id]);
 
     ++r->ref_id[id]->count;
 }
@@ -2482,16 +2960,7 @@ static void cram_ref_decr_locked(refs_t *r, int id) {
 
     if (--r->ref_id[id]->count <= 0) {
         assert(r->ref_id[id]->count == 0);
-        if (r->last_id >= 0) {
-            if (r->ref_id[r->last_id]->count <= 0 &&
-                r->ref_id[r->last_id]->seq) {
-                RP("%d FREE REF %d (%p)\n", gettid(),
-                   r->last_id, r->ref_id[r->last_id]->seq);
-                ref_entry_free_seq(r->ref_id[r->last_id]);
-                if (r->ref_id[r->last_id]->is_md5) r->ref_id[r->last_id]->length = 0;
-            }
-        }
-        r->last_id = id;
+        ref_cache_release(r, r->ref_id[id]);
     }
 }
 
@@ -2600,16 +3069,31 @@ ref_entry *cram_ref_load(refs_t *r, int id, int is_md5) {
         RP("%d cram_ref_load DECR %d\n", gettid(), idx);
 #endif
         assert(r->last->count > 0);
-        if (--r->last->count <= 0) {
-            RP("%d FREE REF %d (%p)\n", gettid(), id, r->ref_id[id]->seq);
-            if (r->last->seq)
-                ref_entry_free_seq(r->last);
-        }
+        if (--r->last->count <= 0)
+            ref_cache_release(r, r->last);
     }
 
     if (!r->fn)
         return NULL;
 
+    if (ref_entry_mappable(r, e)) {
+        hts_pos_t len;
+        const char *view = faidx_seq_view(r->fai, e->name, 0, e->length-1,
+                                          &len);
+        if (view && len == e->length) {
+            RP("%d Mapped ref %d (%d..%d) = %p\n", gettid(), id, start, end,
+               view);
+            e->seq = (char *)view;
+            e->mf = NULL;
+            e->is_mapped = 1;
+            ref_cache_loaded(r, e);
+            e->count++;
+            r->last = e;
+            e->count++;
+            return e;
+        }
+    }
+
     /* Open file if it's not already the current open reference */
     if (strcmp(r->fn, e->fn) || r->fp == NULL) {
         if (r->fp)
@@ -2622,6 +3106,7 @@ ref_entry *cram_ref_load(refs_t *r, int id, int is_md5) {
 
     RP("%d Loading ref %d (%d..%d)\n", gettid(), id, start, end);
 
+    ref_cache_make_room(r, e->length);
     if (!(seq = load_ref_portion(r->fp, e, start, end))) {
         return NULL;
     }
@@ -2631,6 +3116,9 @@ ref_entry *cram_ref_load(refs_t *r, int id, int is_md5) {
     RP("%d INC REF %d, %"PRId64"\n", gettid(), id, (e->count+1));
     e->seq = seq;
     e->mf = NULL;
+    e->is_mapped = 0;
+    ref_cache_loaded(r, e);
+    ref_cache_evict(r);
     e->count++;
 
     /*
@@ -2644,6 +3132,33 @@ ref_entry *cram_ref_load(refs_t *r, int id, int is_md5) {
     return e;
 }
 
+/*
+ * Guesses the reference following 'id' in sorted data: the next in header
+ * order, skipping any the index shows to have no data.  Only references
+ * whose location is already known are returned, so a wrong guess never
+ * triggers an M5 lookup or download.
+ *
+ * Called with fd->refs->lock held.
+ * Returns the reference id on success;
+ *         -1 if there is no suitable candidate.
+ */
+static int cram_next_ref_id(cram_fd *fd, int id) {
+    refs_t *r = fd->refs;
+    int n;
+
+    for (n = id+1; n < r->nref; n++) {
+        if (fd->index) {
+            if (n+1 >= fd->index_sz)
+                return -1;
+            if (fd->index[n+1].nslice == 0)
+                continue;
+        }
+        return r->ref_id[n] && r->ref_id[n]->length ? n : -1;
+    }
+
+    return -1;
+}
+
 /*
  * Returns a portion of a reference sequence from start to end inclusive.
  * The returned pointer is owned by either the cram_file fd or by the
@@ -2669,7 +3184,7 @@ ref_entry *cram_ref_load(refs_t *r, int id, int is_md5) {
 char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
     ref_entry *r;
     char *seq;
-    int ostart = start;
+    int ostart = start, first_use = 0, next_id = -1;
 
     if (id == -1)
         return NULL;
@@ -2725,6 +3240,12 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
      * rewrite my code to have one curl handle per thread.
      */
     pthread_mutex_lock(&fd->refs->lock);
+
+    // Let a background load of this reference finish rather than repeat it
+    while (fd->refs->prefetch_loading && fd->refs->prefetch_id == id)
+        pthread_cond_wait(&fd->refs->prefetch_done, &fd->refs->lock);
+
+    int cached = r->seq != NULL;
     if (r->length == 0) {
         if (cram_populate_ref(fd, id, r) == -1) {
             hts_log_error("Failed to populate reference for id %d", id);
@@ -2733,7 +3254,7 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
             return NULL;
         }
         r = fd->refs->ref_id[id];
-        if (fd->unsorted)
+        if (fd->unsorted && !fd->refs->cache_size)
             cram_ref_incr_locked(fd->refs, id);
     }
 
@@ -2750,7 +3271,15 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
     if (start < 1)
         return NULL;
 
-    if (end - start >= 0.5*r->length || fd->shared_ref) {
+    /*
+     * Mapped references cost nothing to "load" in full, so always take
+     * the shared whole-reference route for them.  Otherwise with a
+     * cache budget, don't load all of a sequence larger than it when
+     * we can make do with a portion.
+     */
+    if ((end - start >= 0.5*r->length &&
+         (!fd->refs->cache_size || r->length <= fd->refs->cache_size))
+        || fd->shared_ref || ref_entry_mappable(fd->refs, r)) {
         start = 1;
         end = r->length;
     }
@@ -2768,9 +3297,19 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
 
         if (id >= 0) {
             if (r->seq) {
+                if (cached)
+                    fd->refs->stats.hits++;
+                else
+                    fd->refs->stats.misses++;
                 cram_ref_incr_locked(fd->refs, id);
+                if (r->prefetched) {
+                    ref_prefetch_to_last(fd->refs, r);
+                    first_use = 1;
+                }
             } else {
                 ref_entry *e;
+                fd->refs->stats.misses++;
+                first_use = 1;
                 if (!(e = cram_ref_load(fd->refs, id, r->is_md5))) {
                     pthread_mutex_unlock(&fd->refs->lock);
                     pthread_mutex_unlock(&fd->ref_lock);
@@ -2778,9 +3317,10 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
                 }
 
                 /* unsorted data implies cache ref indefinitely, to avoid
-                 * continually loading and unloading.
+                 * continually loading and unloading.  With a cache budget
+                 * we leave this to the LRU list instead.
                  */
-                if (fd->unsorted)
+                if (fd->unsorted && !fd->refs->cache_size)
                     cram_ref_incr_locked(fd->refs, id);
             }
 
@@ -2790,6 +3330,18 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
             fd->ref_id    = id;
 
             cp = fd->refs->ref_id[id]->seq + ostart-1;
+
+            /* On moving to a new reference in sorted data, start on the
+             * one we expect next.  Anything prefetched for earlier ones
+             * has been skipped over so won't be wanted now.
+             */
+            if (first_use && fd->pqueue && !fd->unsorted &&
+                fd->range.refid == -2) {
+                int i;
+                for (i = 0; i < id && fd->refs->nprefetched; i++)
+                    ref_prefetch_release(fd->refs, fd->refs->ref_id[i]);
+                next_id = cram_next_ref_id(fd, id);
+            }
         } else {
             fd->ref = NULL;
             cp = NULL;
@@ -2799,6 +3351,10 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
 
         pthread_mutex_unlock(&fd->refs->lock);
         pthread_mutex_unlock(&fd->ref_lock);
+
+        if (next_id >= 0)
+            cram_prefetch_ref(fd, next_id);
+
         return cp;
     }
 
@@ -2836,11 +3392,13 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
         }
     }
 
+    fd->refs->stats.misses++;
     if (!(fd->ref = load_ref_portion(fd->refs->fp, r, start, end))) {
         pthread_mutex_unlock(&fd->refs->lock);
         pthread_mutex_unlock(&fd->ref_lock);
         return NULL;
     }
+    fd->refs->stats.bytes_loaded += end - start + 1;
 
     if (fd->ref_free)
         free(fd->ref_free);
@@ -2857,6 +3415,113 @@ char *cram_get_ref(cram_fd *fd, int id, int start, int end) {
     return seq ? seq + ostart - start : NULL;
 }
 
+typedef struct {
+    cram_fd *fd;
+    int id;
+} cram_prefetch_job;
+
+/*
+ * Thread pool job for cram_prefetch_ref().  The sequence itself is read
+ * using its own file handle with the refs lock released, so other threads
+ * can carry on using the references already loaded.  Once loaded it holds
+ * one count until cram_get_ref() first asks for it.
+ */
+static void *cram_prefetch_ref_thread(void *arg) {
+    cram_prefetch_job *j = (cram_prefetch_job *)arg;
+    cram_fd *fd = j->fd;
+    refs_t *r = fd->refs;
+    ref_entry *e;
+    char *seq = NULL;
+    BGZF *fp;
+
+    // Finding an M5 or UR reference works on fd, so lock as cram_get_ref().
+    pthread_mutex_lock(&fd->ref_lock);
+    pthread_mutex_lock(&r->lock);
+    e = r->ref_id[j->id];
+    if (e && !e->seq && e->length == 0)
+        e = cram_populate_ref(fd, j->id, e) == 0 ? r->ref_id[j->id] : NULL;
+    pthread_mutex_unlock(&fd->ref_lock);
+
+    if (e && !e->seq && e->length && e->fn && !ref_entry_mappable(r, e)) {
+        RP("%d Prefetching ref %d\n", gettid(), j->id);
+        r->prefetch_loading = 1;
+        pthread_mutex_unlock(&r->lock);
+
+        if ((fp = bgzf_open_ref(e->fn, "r", e->is_md5))) {
+            seq = load_ref_portion(fp, e, 1, e->length);
+            if (bgzf_close(fp) != 0) {
+                free(seq);
+                seq = NULL;
+            }
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->prefetch_loading = 0;
+        if (seq && !e->seq) {
+            e->seq = seq;
+            e->mf = NULL;
+            e->is_mapped = 0;
+            ref_cache_loaded(r, e);
+        } else {
+            free(seq);
+        }
+    }
+
+    // Only hold a sequence nobody else has picked up yet
+    if (e && e->seq && e->count == 0 && !ref_in_lru(r, e)) {
+        e->count++;
+        e->prefetched = 1;
+        r->nprefetched++;
+        ref_cache_evict(r);
+    }
+
+    r->prefetch_id = -1;
+    pthread_cond_broadcast(&r->prefetch_done);
+    pthread_mutex_unlock(&r->lock);
+
+    free(j);
+    return NULL;
+}
+
+// Called on jobs still queued when the prefetch queue is destroyed
+static void cram_prefetch_job_cleanup(void *arg) {
+    cram_prefetch_job *j = (cram_prefetch_job *)arg;
+    refs_t *r = j->fd->refs;
+
+    pthread_mutex_lock(&r->lock);
+    r->prefetch_id = -1;
+    pthread_mutex_unlock(&r->lock);
+    free(j);
+}
+
+void cram_prefetch_ref(cram_fd *fd, int id) {
+    refs_t *r = fd->refs;
+    ref_entry *e;
+    cram_prefetch_job *j;
+
+    if (!fd->pool || !fd->pqueue || !r || id < 0)
+        return;
+
+    // One at a time, and only if it fits any cache budget
+    pthread_mutex_lock(&r->lock);
+    if (id >= r->nref || !(e = r->ref_id[id]) || e->seq ||
+        r->prefetch_id >= 0 ||
+        (r->cache_size &&
+         r->stats.bytes_cached + e->length > r->cache_size) ||
+        !(j = malloc(sizeof(*j)))) {
+        pthread_mutex_unlock(&r->lock);
+        return;
+    }
+    j->fd = fd;
+    j->id = id;
+    r->prefetch_id = id;
+    pthread_mutex_unlock(&r->lock);
+
+    if (hts_tpool_dispatch3(fd->pool, fd->pqueue, cram_prefetch_ref_thread, j,
+                            cram_prefetch_job_cleanup, NULL, 1) < 0)
+        cram_prefetch_job_cleanup(j);
+}
+
 /*
  * If fd has been opened for reading, it may be permitted to specify 'fn'
  * as NULL and let the code auto-detect the reference by parsing the
@@ -2876,10 +3541,12 @@ int cram_load_reference(cram_fd *fd, char *fn) {
     fd->ref_fn = fn;
 
     if ((!fd->refs || (fd->refs->nref == 0 && !fn)) && fd->header) {
+        int64_t cache_size = fd->refs ? fd->refs->cache_size : 0;
         if (fd->refs)
             refs_free(fd->refs);
         if (!(fd->refs = refs_create()))
             return -1;
+        fd->refs->cache_size = cache_size;
         if (-1 == refs_from_header(fd))
             return -1;
     }
@@ -3364,9 +4031,29 @@ static int cram_flush_container2(cram_fd *fd, cram_container *c) {
  * Returns 0 on success
  *        -1 on failure
  */
+/*
+ * Lets the next container claim metrics, if the last slice of this one
+ * did not already do so (eg on error).  See cram_claim_metrics().
+ */
+static void cram_claims_done(cram_fd *fd, cram_container *c) {
+    if (!fd->pool)
+        return;
+
+    pthread_mutex_lock(&fd->metrics_lock);
+    while (fd->claim_seq < c->seq)
+        pthread_cond_wait(&fd->metrics_cond, &fd->metrics_lock);
+    if (fd->claim_seq == c->seq) {
+        fd->claim_seq++;
+        pthread_cond_broadcast(&fd->metrics_cond);
+    }
+    pthread_mutex_unlock(&fd->metrics_lock);
+}
+
 int cram_flush_container(cram_fd *fd, cram_container *c) {
     /* Encode the container blocks and generate compression header */
-    if (0 != cram_encode_container(fd, c))
+    int r = cram_encode_container(fd, c);
+    cram_claims_done(fd, c);
+    if (0 != r)
         return -1;
 
     return cram_flush_container2(fd, c);
@@ -3381,7 +4068,9 @@ void *cram_flush_thread(void *arg) {
     cram_job *j = (cram_job *)arg;
 
     /* Encode the container blocks and generate compression header */
-    if (0 != cram_encode_container(j->fd, j->c)) {
+    int r = cram_encode_container(j->fd, j->c);
+    cram_claims_done(j->fd, j->c);
+    if (0 != r) {
         hts_log_error("Call to cram_encode_container failed");
         return NULL;
     }
@@ -3468,15 +4157,8 @@ void reset_metrics(cram_fd *fd) {
         // (fd->rqueue->pending).  It's tricky to reset the
         // metrics exactly the correct point, so instead we
         // just flush the pool, reset, and then continue again.
-
-        // Don't bother starting a new trial before then though.
-        for (i = 0; i < DS_END; i++) {
-            cram_metrics *m = fd->m[i];
-            if (!m)
-                continue;
-            m->next_trial = 999;
-        }
-
+        // The containers already queued use the metrics just as they
+        // would without threads, so the output does not change.
         pthread_mutex_unlock(&fd->metrics_lock);
         hts_tpool_process_flush(fd->rqueue);
         pthread_mutex_lock(&fd->metrics_lock);
@@ -3491,17 +4173,39 @@ void reset_metrics(cram_fd *fd) {
         m->next_trial = TRIAL_SPAN;
         m->revised_method = 0;
 
-        m->sz_gz_rle = 0;
-        m->sz_gz_def = 0;
-        m->sz_rans0  = 0;
-        m->sz_rans1  = 0;
-        m->sz_bzip2  = 0;
-        m->sz_lzma   = 0;
+        memset(m->sz, 0, sizeof(m->sz));
+    }
+}
+
+/*
+ * Counts the distinct reference ids in a container, as its RI statistics
+ * will.  This is done before the container is queued, rather than by the
+ * encoder, so the choice of multi-ref containers does not depend on which
+ * thread finishes first.
+ */
+static int cram_count_refs(cram_container *c) {
+    khash_t(s_i2i) *h;
+    int i, r, n, last = -2;
+
+    if (!c->bams || !(h = kh_init(s_i2i)))
+        return 0;
+
+    for (i = 0; i < c->curr_c_rec; i++) {
+        int ref = bam_ref(c->bams[i]);
+        if (ref == last)
+            continue;
+        kh_put(s_i2i, h, ref, &r);
+        last = ref;
     }
+
+    n = kh_size(h);
+    kh_destroy(s_i2i, h);
+    return n;
 }
 
 int cram_flush_container_mt(cram_fd *fd, cram_container *c) {
     cram_job *j;
+    int nrefs = cram_count_refs(c);
 
     // At the junction of mapped to unmapped data the compression
     // methods may need to change due to very different statistical
@@ -3519,6 +4223,8 @@ int cram_flush_container_mt(cram_fd *fd, cram_container *c) {
         reset_metrics(fd);
     }
     fd->last_mapped = c->n_mapped * (c->max_rec+1)/(c->curr_rec+1) ;
+    fd->last_RI_count = nrefs;
+    c->seq = fd->next_seq++;
     pthread_mutex_unlock(&fd->metrics_lock);
 
     if (!fd->pool)
@@ -3699,6 +4405,13 @@ void cram_free_slice(cram_slice *s) {
     if (s->features)
         free(s->features);
 
+    if (s->ds_col) {
+        int i;
+        for (i = 0; i < DS_END; i++)
+            free(s->ds_col[i].val);
+        free(s->ds_col);
+    }
+
     if (s->TN)
         free(s->TN);
 
@@ -4506,6 +5219,7 @@ cram_fd *cram_dopen(hFILE *fp, const char *filename, const char *mode) {
     fd->use_bz2 = 0;
     fd->use_rans = (CRAM_MAJOR_VERS(fd->version) >= 3);
     fd->use_lzma = 0;
+    fd->use_arith = 1; // CRAM 3.1 onwards
     fd->multi_seq = -1;
     fd->multi_seq_user = -1;
     fd->unsorted   = 0;
@@ -4518,6 +5232,8 @@ cram_fd *cram_dopen(hFILE *fp, const char *filename, const char *mode) {
     fd->own_pool    = 0;
     fd->pool        = NULL;
     fd->rqueue      = NULL;
+    fd->tqueue      = NULL;
+    fd->pqueue      = NULL;
     fd->job_pending = NULL;
     fd->ooc         = 0;
     fd->required_fields = INT_MAX;
@@ -4636,6 +5352,7 @@ int cram_close(cram_fd *fd) {
             fd->ctr = NULL; // prevent double freeing
 
         pthread_mutex_destroy(&fd->metrics_lock);
+        pthread_cond_destroy(&fd->metrics_cond);
         pthread_mutex_destroy(&fd->ref_lock);
         pthread_mutex_destroy(&fd->bam_list_lock);
 
@@ -4644,6 +5361,21 @@ int cram_close(cram_fd *fd) {
         hts_tpool_process_destroy(fd->rqueue);
     }
 
+    // Only holds helpers left over from cram_run_parallel()
+    if (fd->tqueue)
+        hts_tpool_process_destroy(fd->tqueue);
+
+    if (fd->pqueue) {
+        hts_tpool_process_destroy(fd->pqueue);
+        fd->pqueue = NULL;
+
+        // Anything prefetched but never used
+        pthread_mutex_lock(&fd->refs->lock);
+        for (i = 0; i < fd->refs->nref && fd->refs->nprefetched; i++)
+            ref_prefetch_release(fd->refs, fd->refs->ref_id[i]);
+        pthread_mutex_unlock(&fd->refs->lock);
+    }
+
     if (fd->mode == 'w') {
         /* Write EOF block */
         if (CRAM_MAJOR_VERS(fd->version) == 3) {
@@ -4832,6 +5564,35 @@ int cram_set_voption(cram_fd *fd, enum hts_fmt_option opt, va_list args) {
         fd->use_lzma = va_arg(args, int);
         break;
 
+    case CRAM_OPT_USE_ARITH:
+        fd->use_arith = va_arg(args, int);
+        break;
+
+    case CRAM_OPT_REF_CACHE_SIZE: {
+        int mb = va_arg(args, int);
+        if (mb < 0 || !fd->refs) {
+            errno = EINVAL;
+            return -1;
+        }
+        pthread_mutex_lock(&fd->refs->lock);
+        fd->refs->cache_size = (int64_t)mb << 20;
+        ref_cache_evict(fd->refs);
+        pthread_mutex_unlock(&fd->refs->lock);
+        break;
+    }
+
+    case CRAM_OPT_REF_CACHE_STATS: {
+        cram_ref_cache_stats *st = va_arg(args, cram_ref_cache_stats *);
+        if (!st || !fd->refs) {
+            errno = EINVAL;
+            return -1;
+        }
+        pthread_mutex_lock(&fd->refs->lock);
+        *st = fd->refs->stats;
+        pthread_mutex_unlock(&fd->refs->lock);
+        break;
+    }
+
     case CRAM_OPT_SHARED_REF:
         fd->shared_ref = 1;
         refs = va_arg(args, refs_t *);
@@ -4883,8 +5644,9 @@ int cram_set_voption(cram_fd *fd, enum hts_fmt_option opt, va_list args) {
         }
         if (!((major == 1 &&  minor == 0) ||
               (major == 2 && (minor == 0 || minor == 1)) ||
-              (major == 3 &&  minor == 0))) {
-            hts_log_error("Unknown version string; use 1.0, 2.0, 2.1 or 3.0");
+              (major == 3 && (minor == 0 || minor == 1)))) {
+            hts_log_error("Unknown version string; "
+                          "use 1.0, 2.0, 2.1, 3.0 or 3.1");
             errno = EINVAL;
             return -1;
         }
@@ -4906,7 +5668,11 @@ int cram_set_voption(cram_fd *fd, enum hts_fmt_option opt, va_list args) {
                 return -1;
 
             fd->rqueue = hts_tpool_process_init(fd->pool, nthreads*2, 0);
+            if (fd->mode == 'w')
+                fd->tqueue = hts_tpool_process_init(fd->pool, nthreads*2, 1);
+            fd->pqueue = hts_tpool_process_init(fd->pool, nthreads*2, 1);
             pthread_mutex_init(&fd->metrics_lock, NULL);
+            pthread_cond_init(&fd->metrics_cond, NULL);
             pthread_mutex_init(&fd->ref_lock, NULL);
             pthread_mutex_init(&fd->range_lock, NULL);
             pthread_mutex_init(&fd->bam_list_lock, NULL);
@@ -4923,7 +5689,15 @@ int cram_set_voption(cram_fd *fd, enum hts_fmt_option opt, va_list args) {
             fd->rqueue = hts_tpool_process_init(fd->pool,
                                                 p->qsize ? p->qsize : hts_tpool_size(fd->pool)*2,
                                                 0);
+            if (fd->mode == 'w')
+                fd->tqueue = hts_tpool_process_init(fd->pool,
+                                                    hts_tpool_size(fd->pool)*2,
+                                                    1);
+            fd->pqueue = hts_tpool_process_init(fd->pool,
+                                                hts_tpool_size(fd->pool)*2,
+                                                1);
             pthread_mutex_init(&fd->metrics_lock, NULL);
+            pthread_cond_init(&fd->metrics_cond, NULL);
             pthread_mutex_init(&fd->ref_lock, NULL);
             pthread_mutex_init(&fd->range_lock, NULL);
             pthread_mutex_init(&fd->bam_list_lock, NULL);
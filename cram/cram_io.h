@@ -468,6 +468,34 @@ int cram_uncompress_block(cram_block *b);
 int cram_compress_block(cram_fd *fd, cram_block *b, cram_metrics *metrics,
                         int method, int level);
 
+/*! Compresses a block, with access to the slice it belongs to.
+ *
+ * As cram_compress_block(), but s (which may be NULL) describes the
+ * records in the slice, which is needed by the fqzcomp quality codec.
+ * If ticket is not -1, the metrics are only used once all earlier
+ * tickets for them have been, so threads do not change the output.
+ *
+ * @return
+ * Returns 0 on success;
+ *        -1 on failure
+ */
+int cram_compress_block2(cram_fd *fd, cram_slice *s, cram_block *b,
+                         cram_metrics *metrics, int64_t ticket,
+                         int method, int level);
+
+/*! Runs func(arg, i) for i from 0 to ntasks-1, using the thread pool.
+ *
+ * The tasks must be independent.  The calling thread takes part, so this
+ * may be used from within a thread pool job.  Without a pool the tasks are
+ * run in order.
+ *
+ * @return
+ * Returns 0 on success;
+ *        -1 if any task returned -1
+ */
+int cram_run_parallel(cram_fd *fd, int ntasks,
+                      int (*func)(void *arg, int i), void *arg);
+
 cram_metrics *cram_new_metrics(void);
 char *cram_block_method2str(enum cram_block_method m);
 char *cram_content_type2str(enum cram_content_type t);
@@ -690,6 +718,15 @@ void refs_free(refs_t *r);
 char *cram_get_ref(cram_fd *fd, int id, int start, int end);
 void cram_ref_incr(refs_t *r, int id);
 void cram_ref_decr(refs_t *r, int id);
+
+/*! Starts loading reference 'id' in the background.
+ *
+ * With a thread pool this queues a job to load the whole of reference
+ * 'id', so a later cram_get_ref() for it need not wait for the I/O.
+ * It is only a hint; without a pool, or if the reference is already
+ * loaded or cannot be, it does nothing.
+ */
+void cram_prefetch_ref(cram_fd *fd, int id);
 /**@}*/
 /**@{ ----------------------------------------------------------------------
  * Containers
@@ -52,6 +52,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "../htslib/thread_pool.h"
 #include "../htslib/cram.h"
+#include "../htslib/faidx.h"
 #include "string_alloc.h"
 #include "mFILE.h"
 #include "../htslib/khash.h"
@@ -201,8 +202,36 @@ enum cram_block_method {
     LZMA     = 3,
     RANS     = 4,  // Generic; either order
     RANS0    = 4,
+    RANSPR   = 5,  // rANS Nx16 (CRAM 3.1); generic for all RANS_PR*
+    ARITH    = 6,  // Adaptive arithmetic coder (CRAM 3.1); all ARITH_PR*
+    FQZ      = 7,  // fqzcomp quality codec (CRAM 3.1)
+    TOK3     = 8,  // Read name tokeniser (CRAM 3.1)
     RANS1    = 10, // Not externalised; stored as RANS (generic)
     GZIP_RLE = 11, // NB: not externalised in CRAM
+
+    // rANS Nx16 variants, named after the order/flags byte they use.
+    // Not externalised; all stored as RANSPR.
+    RANS_PR0   = 5,
+    RANS_PR1   = 12,
+    RANS_PR64  = 13,
+    RANS_PR65  = 14,
+    RANS_PR128 = 15,
+    RANS_PR129 = 16,
+    RANS_PR192 = 17,
+    RANS_PR193 = 18,
+
+    // Adaptive arithmetic coder variants, using the same flags.
+    // Not externalised; all stored as ARITH.
+    ARITH_PR0   = 6,
+    ARITH_PR1   = 19,
+    ARITH_PR64  = 20,
+    ARITH_PR65  = 21,
+    ARITH_PR128 = 22,
+    ARITH_PR129 = 23,
+    ARITH_PR192 = 24,
+    ARITH_PR193 = 25,
+
+    TOKA = 26, // Name tokeniser with arithmetic coding; stored as TOK3
 };
 */
 
@@ -219,38 +248,31 @@ enum cram_content_type {
 */
 
 /* Compression metrics */
+
+// Size of the per-method arrays; methods are also used as bits in an int.
+#define CRAM_MAX_METHOD 32
+
 struct cram_metrics {
     // number of trials and time to next trial
     int trial;
     int next_trial;
 
-    // aggregate sizes during trials
-    int sz_gz_rle;
-    int sz_gz_def;
-    int sz_rans0;
-    int sz_rans1;
-    int sz_bzip2;
-    int sz_lzma;
+    // aggregate sizes during trials, indexed by method
+    int sz[CRAM_MAX_METHOD];
 
     // resultant method from trials
     int method;
     int strat;
 
     // Revisions of method, to allow culling of continually failing ones.
-    int gz_rle_cnt;
-    int gz_def_cnt;
-    int rans0_cnt;
-    int rans1_cnt;
-    int bzip2_cnt;
-    int lzma_cnt;
+    int cnt[CRAM_MAX_METHOD];
     int revised_method;
 
-    double gz_rle_extra;
-    double gz_def_extra;
-    double rans0_extra;
-    double rans1_extra;
-    double bzip2_extra;
-    double lzma_extra;
+    double extra[CRAM_MAX_METHOD];
+
+    // With threads, slices use the metrics in the order they were
+    // written; claimed hands out tickets and served is the one up next.
+    int64_t claimed, served;
 };
 
 // Hash aux key (XX:i) to cram_metrics
@@ -396,6 +418,7 @@ struct cram_container {
     int last_slice;              // number of reads in last slice (0 for 1st)
     int multi_seq;               // true if packing multi seqs per cont/slice
     int unsorted;                // true is AP_delta is 0.
+    int64_t seq;                 // order in which the container was flushed
 
     /* Copied from fd before encoding, to allow multi-threading */
     int ref_start, first_base, last_base, ref_id, ref_end;
@@ -537,6 +560,17 @@ typedef union cram_feature {
     } H;
 } cram_feature;
 
+/*
+ * An integer data series decoded for a whole slice at once, so records
+ * can be reconstructed without calling the codec for every value.
+ */
+typedef struct {
+    int32_t *val;      // decoded values, if not constant
+    int n, idx;        // number of values and next one to return
+    int is_const;      // every value is const_val
+    int32_t const_val;
+} cram_ds_column;
+
 /*
  * A slice is really just a set of blocks, but it
  * is the logical unit for decoding a number of
@@ -597,6 +631,8 @@ struct cram_slice {
     unsigned int data_series; // See cram_fields enum
     int decode_md;
 
+    cram_ds_column *ds_col;    // [DS_END] columns decoded up front, or NULL
+
     int max_rec, curr_rec;       // current and max recs per slice
     int slice_num;               // To be copied into c->curr_slice in decode
 };
@@ -616,6 +652,10 @@ typedef struct ref_entry {
     char *seq;
     mFILE *mf;
     int is_md5;            // Reference comes from a raw seq found by MD5
+    int is_mapped;         // seq is a view into refs_t->fai's mapping
+    struct ref_entry *lru_prev, *lru_next; // refs_t LRU list, while idle
+    int prefetched;        // holds a count until first used; see
+                           // cram_prefetch_ref()
 } ref_entry;
 
 KHASH_MAP_INIT_STR(refs, ref_entry*)
@@ -631,11 +671,27 @@ struct refs_t {
     char *fn;              // current file opened
     BGZF *fp;              // and the hFILE* to go with it.
 
+    faidx_t *fai;          // Memory mapped ".bin" copy of fai_fn, if any
+    char *fai_fn;
+
     int count;             // how many cram_fd sharing this refs struct
 
     pthread_mutex_t lock;  // Mutex for multi-threaded updating
     ref_entry *last;       // Last queried sequence
-    int last_id;           // Used in cram_ref_decr_locked to delay free
+
+    // Loaded sequences no longer in use, most recently released first.
+    // See ref_cache_release().
+    ref_entry *lru_head, *lru_tail;
+    int nlru;
+    int64_t cache_size;    // byte budget for loaded sequences
+    cram_ref_cache_stats stats;
+
+    // Reference being loaded ahead of use by cram_prefetch_ref(), or -1.
+    // While prefetch_loading is set it is being read without the lock and
+    // prefetch_done is signalled once it completes.
+    int prefetch_id, prefetch_loading;
+    pthread_cond_t prefetch_done;
+    int nprefetched;       // number of ref_entry with prefetched set
 };
 
 /*-----------------------------------------------------------------------------
@@ -729,6 +785,7 @@ struct cram_fd {
     int use_bz2;
     int use_rans;
     int use_lzma;
+    int use_arith;
     int shared_ref;
     unsigned int required_fields;
     int store_md;
@@ -759,7 +816,12 @@ struct cram_fd {
     int own_pool;
     hts_tpool *pool;
     hts_tpool_process *rqueue;
+    hts_tpool_process *tqueue; // cram_run_parallel() helpers, no results
+    hts_tpool_process *pqueue; // cram_prefetch_ref() jobs, no results
     pthread_mutex_t metrics_lock;
+    pthread_cond_t metrics_cond;        // signals claim_seq or served changes
+    int64_t next_seq;                   // seq for the next flushed container
+    int64_t claim_seq;                  // container next to claim metrics
     pthread_mutex_t ref_lock;
     pthread_mutex_t range_lock;
     spare_bams *bl;
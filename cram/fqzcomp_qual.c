@@ -0,0 +1,754 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The CRAM 3.1 fqzcomp quality codec.
+ *
+ * Quality values are arithmetic coded with adaptive models selected by a
+ * 16-bit context built from:
+ *
+ *   - the previous quality values, each mapped through qtab and shifted
+ *     in qshift bits at a time, keeping the last qbits bits;
+ *   - the number of values left in the record, mapped through ptab;
+ *   - the sum of the drops in quality so far, mapped through dtab;
+ *   - a selector, here whether the record is READ2.
+ *
+ * Each part is shifted to its own bit position (qloc, ploc, dloc, sloc)
+ * and all of this is configurable per data set, with the parameters
+ * stored before the coded data.  Record lengths are stored too (just once
+ * if they are all the same), as is a flag for reverse strand records,
+ * whose qualities are coded in sequencing order.
+ *
+ * Layout:
+ *   uint7  total size of the quality values
+ *   uint8  version (FQZ_VERS)
+ *   uint8  global flags (GFLAG_*)
+ *   [uint8 number of parameter sets]         if GFLAG_MULTI_PARAM
+ *   [uint8 max selector, array stab]         if GFLAG_HAVE_STAB
+ *   per parameter set:
+ *     uint16 context offset, little endian
+ *     uint8  parameter flags (PFLAG_*)
+ *     uint8  max symbol
+ *     uint8  qbits<<4 | qshift
+ *     uint8  qloc<<4  | sloc
+ *     uint8  ploc<<4  | dloc
+ *     [max symbol + 1 bytes qmap]            if PFLAG_HAVE_QMAP
+ *     [array qtab, ptab, dtab]               if PFLAG_HAVE_*TAB
+ *   range coded data
+ *
+ * Arrays hold non-decreasing values starting at zero, and are stored as
+ * the number of entries with each successive value.  Counts of 255 or
+ * more continue into the next byte.  These bytes are then run length
+ * encoded: a byte equal to the one before it is followed by the number
+ * of further copies.
+ */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fqzcomp_qual.h"
+#include "c_range_coder.h"
+#include "c_simple_model.h"
+#include "varint.h"
+
+#define FQZ_VERS 5
+
+#define GFLAG_MULTI_PARAM 1
+#define GFLAG_HAVE_STAB   2
+#define GFLAG_DO_REV      4
+
+#define PFLAG_DO_DEDUP    2
+#define PFLAG_DO_LEN      4
+#define PFLAG_DO_SEL      8
+#define PFLAG_HAVE_QMAP  16
+#define PFLAG_HAVE_PTAB  32
+#define PFLAG_HAVE_DTAB  64
+#define PFLAG_HAVE_QTAB 128
+
+#define QTAB_SIZE 256
+#define PTAB_SIZE 1024
+#define DTAB_SIZE 256
+
+// Upper bound on contexts * symbols chosen by the encoder
+#define MAX_MODEL_SYMS (1<<22)
+
+typedef struct {
+    uint16_t context;
+    int pflags;
+    int max_sym;
+    int qbits, qshift, qloc, sloc, ploc, dloc;
+    uint8_t  qmap[256];
+    uint32_t qtab[QTAB_SIZE], ptab[PTAB_SIZE], dtab[DTAB_SIZE];
+} fqz_param;
+
+typedef struct {
+    int gflags, nparam, max_sel;
+    uint8_t stab[256];
+    fqz_param *p;
+} fqz_gparams;
+
+typedef struct {
+    model_set qual;
+    model_set len[4];
+    model_set rev, dup, sel;
+} fqz_models;
+
+static inline uint32_t fqz_context(const fqz_param *pm, uint32_t qctx,
+                                   uint32_t p, uint32_t delta, uint32_t sel) {
+    uint32_t ctx = pm->context
+        + ((qctx & ((1u << pm->qbits) - 1)) << pm->qloc)
+        + (pm->ptab[p < PTAB_SIZE ? p : PTAB_SIZE-1] << pm->ploc)
+        + (pm->dtab[delta < DTAB_SIZE ? delta : DTAB_SIZE-1] << pm->dloc);
+    if (pm->pflags & PFLAG_DO_SEL)
+        ctx += sel << pm->sloc;
+    return ctx & 0xffff;
+}
+
+// Returns the number of contexts the parameters can produce
+static uint32_t fqz_num_contexts(const fqz_gparams *gp) {
+    uint32_t max = 0;
+    int i;
+
+    for (i = 0; i < gp->nparam; i++) {
+        const fqz_param *pm = &gp->p[i];
+        uint64_t c = pm->context
+            + ((uint64_t)((1u << pm->qbits) - 1) << pm->qloc)
+            + ((uint64_t)pm->ptab[PTAB_SIZE-1] << pm->ploc)
+            + ((uint64_t)pm->dtab[DTAB_SIZE-1] << pm->dloc);
+        if (pm->pflags & PFLAG_DO_SEL)
+            c += (uint64_t)gp->max_sel << pm->sloc;
+        if (c > 0xffff)
+            c = 0xffff;
+        if (max < c)
+            max = c;
+    }
+
+    return max + 1;
+}
+
+static int fqz_models_init(fqz_models *m, const fqz_gparams *gp) {
+    int i, nsym = 0, err = 0;
+
+    for (i = 0; i < gp->nparam; i++)
+        if (nsym < gp->p[i].max_sym + 1)
+            nsym = gp->p[i].max_sym + 1;
+
+    memset(m, 0, sizeof(*m));
+    err |= model_set_init(&m->qual, fqz_num_contexts(gp), nsym);
+    for (i = 0; i < 4; i++)
+        err |= model_set_init(&m->len[i], 1, 256);
+    err |= model_set_init(&m->rev, 1, 2);
+    err |= model_set_init(&m->dup, 1, 2);
+    err |= model_set_init(&m->sel, 1, gp->max_sel + 1);
+
+    return err;
+}
+
+static void fqz_models_free(fqz_models *m) {
+    int i;
+    model_set_free(&m->qual);
+    for (i = 0; i < 4; i++)
+        model_set_free(&m->len[i]);
+    model_set_free(&m->rev);
+    model_set_free(&m->dup);
+    model_set_free(&m->sel);
+}
+
+/* ------------------------------------------------------------------------
+ * Parameter storage
+ */
+
+// Writes a non-decreasing array starting at 0.  Returns the bytes used.
+static int store_array(unsigned char *out, const uint32_t *a, int n) {
+    unsigned char runs[2048], *cp = out;
+    uint32_t v = 0;
+    int i = 0, k = 0, j;
+
+    // Run lengths of each value
+    while (i < n) {
+        int run = 0;
+        while (i < n && a[i] == v)
+            i++, run++;
+        for (; run >= 255; run -= 255)
+            runs[k++] = 255;
+        runs[k++] = run;
+        v++;
+    }
+
+    // Repeated run lengths, as the byte then a count of further copies
+    for (j = 0; j < k; ) {
+        int c = runs[j++], copies = 0;
+        *cp++ = c;
+        if (j < k && runs[j] == c) {
+            *cp++ = c;
+            j++;
+            while (j < k && runs[j] == c && copies < 255)
+                j++, copies++;
+            *cp++ = copies;
+        }
+    }
+
+    return cp - out;
+}
+
+// Reads an array written by store_array().  Returns the bytes used or -1.
+static int read_array(const unsigned char *in, const unsigned char *end,
+                      uint32_t *a, int n) {
+    const unsigned char *cp = in;
+    int i = 0, last = -1, copies = 0, c = 0;
+    uint32_t v = 0;
+
+    while (i < n) {
+        int run = 0;
+        do {
+            if (copies) {
+                copies--;
+            } else {
+                if (cp >= end)
+                    return -1;
+                c = *cp++;
+                if (c == last) {
+                    if (cp >= end)
+                        return -1;
+                    copies = *cp++;
+                    last = -1;
+                } else {
+                    last = c;
+                }
+            }
+            run += c;
+        } while (c == 255);
+        if (run > n - i)
+            return -1;
+        while (run--)
+            a[i++] = v;
+        v++;
+    }
+
+    return cp - in;
+}
+
+static int is_identity(const uint32_t *a, uint32_t n) {
+    uint32_t i;
+    for (i = 0; i < n; i++)
+        if (a[i] != i)
+            return 0;
+    return 1;
+}
+
+// Writes the parameters to out.  Returns the bytes used.
+static int store_params(unsigned char *out, const fqz_gparams *gp) {
+    unsigned char *cp = out;
+    int i;
+
+    *cp++ = FQZ_VERS;
+    *cp++ = gp->gflags;
+    if (gp->gflags & GFLAG_MULTI_PARAM)
+        *cp++ = gp->nparam;
+    if (gp->gflags & GFLAG_HAVE_STAB) {
+        uint32_t stab[256];
+        *cp++ = gp->max_sel;
+        for (i = 0; i < 256; i++)
+            stab[i] = gp->stab[i];
+        cp += store_array(cp, stab, 256);
+    }
+
+    for (i = 0; i < gp->nparam; i++) {
+        const fqz_param *pm = &gp->p[i];
+        *cp++ = pm->context & 0xff;
+        *cp++ = pm->context >> 8;
+        *cp++ = pm->pflags;
+        *cp++ = pm->max_sym;
+        *cp++ = (pm->qbits << 4) | pm->qshift;
+        *cp++ = (pm->qloc << 4) | pm->sloc;
+        *cp++ = (pm->ploc << 4) | pm->dloc;
+        if (pm->pflags & PFLAG_HAVE_QMAP) {
+            memcpy(cp, pm->qmap, pm->max_sym + 1);
+            cp += pm->max_sym + 1;
+        }
+        if (pm->pflags & PFLAG_HAVE_QTAB)
+            cp += store_array(cp, pm->qtab, QTAB_SIZE);
+        if (pm->pflags & PFLAG_HAVE_PTAB)
+            cp += store_array(cp, pm->ptab, PTAB_SIZE);
+        if (pm->pflags & PFLAG_HAVE_DTAB)
+            cp += store_array(cp, pm->dtab, DTAB_SIZE);
+    }
+
+    return cp - out;
+}
+
+// Reads the parameters into gp.  Returns the bytes used or -1.
+static int read_params(const unsigned char *in, const unsigned char *end,
+                       fqz_gparams *gp) {
+    const unsigned char *cp = in;
+    int i, n;
+
+    memset(gp, 0, sizeof(*gp));
+    if (end - cp < 2 || *cp++ != FQZ_VERS)
+        return -1;
+    gp->gflags = *cp++;
+
+    gp->nparam = 1;
+    if (gp->gflags & GFLAG_MULTI_PARAM) {
+        if (cp >= end || !(gp->nparam = *cp++))
+            return -1;
+    }
+
+    if (gp->gflags & GFLAG_HAVE_STAB) {
+        uint32_t stab[256];
+        if (cp >= end)
+            return -1;
+        gp->max_sel = *cp++;
+        if ((n = read_array(cp, end, stab, 256)) < 0)
+            return -1;
+        cp += n;
+        for (i = 0; i < 256; i++) {
+            if (stab[i] >= (uint32_t)gp->nparam)
+                return -1;
+            gp->stab[i] = stab[i];
+        }
+    } else {
+        gp->max_sel = gp->nparam > 1 ? gp->nparam - 1 : 0;
+        for (i = 0; i < 256; i++)
+            gp->stab[i] = i < gp->nparam ? i : gp->nparam - 1;
+    }
+
+    if (!(gp->p = calloc((unsigned)gp->nparam, sizeof(*gp->p))))
+        return -1;
+
+    for (i = 0; i < gp->nparam; i++) {
+        fqz_param *pm = &gp->p[i];
+        int j;
+
+        if (end - cp < 7)
+            return -1;
+        pm->context = cp[0] | (cp[1] << 8);
+        pm->pflags  = cp[2];
+        pm->max_sym = cp[3];
+        pm->qbits   = cp[4] >> 4;
+        pm->qshift  = cp[4] & 15;
+        pm->qloc    = cp[5] >> 4;
+        pm->sloc    = cp[5] & 15;
+        pm->ploc    = cp[6] >> 4;
+        pm->dloc    = cp[6] & 15;
+        cp += 7;
+
+        if (pm->pflags & PFLAG_HAVE_QMAP) {
+            if (end - cp < pm->max_sym + 1)
+                return -1;
+            memcpy(pm->qmap, cp, pm->max_sym + 1);
+            cp += pm->max_sym + 1;
+        } else {
+            for (j = 0; j < 256; j++)
+                pm->qmap[j] = j;
+        }
+
+        if (pm->pflags & PFLAG_HAVE_QTAB) {
+            if ((n = read_array(cp, end, pm->qtab, QTAB_SIZE)) < 0)
+                return -1;
+            cp += n;
+        } else {
+            for (j = 0; j < QTAB_SIZE; j++)
+                pm->qtab[j] = j;
+        }
+
+        if (pm->pflags & PFLAG_HAVE_PTAB) {
+            if ((n = read_array(cp, end, pm->ptab, PTAB_SIZE)) < 0)
+                return -1;
+            cp += n;
+        }
+
+        if (pm->pflags & PFLAG_HAVE_DTAB) {
+            if ((n = read_array(cp, end, pm->dtab, DTAB_SIZE)) < 0)
+                return -1;
+            cp += n;
+        }
+    }
+
+    return cp - in;
+}
+
+/* ------------------------------------------------------------------------
+ * Encoder
+ */
+
+/*
+ * Chooses parameters for the data.  Strategy 1 spends more of the
+ * context on quality history and none on the quality drops.
+ */
+static int pick_params(fqz_gparams *gp, fqz_param *pm, const fqz_slice *s,
+                       const unsigned char *in, size_t in_size,
+                       int strategy, uint8_t *code) {
+    uint32_t hist[256] = {0}, maxlen = 0, nsym = 0;
+    int i, nbits, pbits = 4, dbits = strategy ? 0 : 2, sbits = 0;
+    int fixed_len = 1, read1 = 0, read2 = 0, rev = 0, dups = 0;
+    size_t j, k;
+
+    for (j = 0; j < in_size; j++)
+        hist[in[j]]++;
+
+    memset(pm, 0, sizeof(*pm));
+    for (i = 0; i < 256; i++) {
+        if (hist[i]) {
+            code[i] = nsym;
+            pm->qmap[nsym++] = i;
+        }
+    }
+    if (!nsym)
+        return -1;
+
+    // Only map qualities when some values are unused
+    if (pm->qmap[nsym-1] + 1u > nsym) {
+        pm->pflags |= PFLAG_HAVE_QMAP;
+        pm->max_sym = nsym - 1;
+    } else {
+        for (i = 0; i < 256; i++)
+            code[i] = i;
+        pm->max_sym = pm->qmap[nsym-1];
+    }
+
+    for (i = 0, j = 0; i < s->num_records; i++) {
+        uint32_t len = s->len[i];
+        if (!len)
+            continue;
+        if (maxlen && len != maxlen)
+            fixed_len = 0;
+        if (maxlen < len)
+            maxlen = len;
+        if (s->flags[i] & FQZ_FREAD2)
+            read2 = 1;
+        else
+            read1 = 1;
+        if (s->flags[i] & FQZ_FREVERSE)
+            rev = 1;
+        if (j >= len && memcmp(in + j - len, in + j, len) == 0)
+            dups++;
+        j += len;
+    }
+
+    gp->gflags = rev ? GFLAG_DO_REV : 0;
+    gp->nparam = 1;
+    gp->max_sel = 0;
+    gp->p = pm;
+    memset(gp->stab, 0, sizeof(gp->stab));
+    if (read1 && read2) {
+        gp->gflags |= GFLAG_HAVE_STAB;
+        gp->max_sel = 1;
+        pm->pflags |= PFLAG_DO_SEL;
+        sbits = 1;
+    }
+    if (fixed_len)
+        pm->pflags |= PFLAG_DO_LEN;
+    if (dups > s->num_records / 100)
+        pm->pflags |= PFLAG_DO_DEDUP;
+
+    // Quality history, at most 5 bits per value
+    for (nbits = 1; (1 << nbits) <= pm->max_sym; nbits++)
+        ;
+    pm->qshift = nbits < 5 ? nbits : 5;
+    for (i = 0; i < QTAB_SIZE; i++)
+        pm->qtab[i] = i >> (nbits - pm->qshift);
+    if (!is_identity(pm->qtab, QTAB_SIZE))
+        pm->pflags |= PFLAG_HAVE_QTAB;
+    pm->qbits = pm->qshift * (pm->qshift <= 2 ? 3 + strategy : 2 + strategy);
+    if (pm->qbits > 16 - pbits - dbits - sbits)
+        pm->qbits = 16 - pbits - dbits - sbits;
+
+    // Limit the model memory for large alphabets
+    while (pm->qbits > pm->qshift
+           && ((size_t)1 << (pm->qbits + pbits + dbits + sbits))
+              * (pm->max_sym + 2) > MAX_MODEL_SYMS)
+        pm->qbits--;
+
+    // Position, as a fraction of the longest record
+    if (maxlen > PTAB_SIZE)
+        maxlen = PTAB_SIZE;
+    for (nbits = 0; (maxlen >> nbits) >= (1u << pbits); nbits++)
+        ;
+    for (k = 0; k < PTAB_SIZE; k++) {
+        uint32_t v = k >> nbits;
+        pm->ptab[k] = v < (1u << pbits) ? v : (1u << pbits) - 1;
+    }
+    pm->pflags |= PFLAG_HAVE_PTAB;
+
+    // Total drop in quality so far
+    if (dbits) {
+        for (k = 0; k < DTAB_SIZE; k++)
+            pm->dtab[k] = k == 0 ? 0 : k < 8 ? 1 : k < 32 ? 2 : 3;
+        pm->pflags |= PFLAG_HAVE_DTAB;
+    }
+
+    pm->qloc = 0;
+    pm->ploc = pm->qbits;
+    pm->dloc = dbits ? pm->ploc + pbits : 0;
+    pm->sloc = sbits ? pm->ploc + pbits + dbits : 0;
+
+    return 0;
+}
+
+static unsigned char *fqz_compress_strat(fqz_slice *s, unsigned char *in,
+                                         size_t in_size, size_t *out_size,
+                                         int strategy) {
+    fqz_gparams gp;
+    fqz_param pm;
+    fqz_models m;
+    range_coder rc;
+    uint8_t code[256];
+    unsigned char *out = NULL, *cp, *tmp = NULL, *prev = NULL;
+    size_t out_alloc, i = 0;
+    uint32_t prev_len = 0, maxlen = 0;
+    int r, first_len = 1;
+
+    if (pick_params(&gp, &pm, s, in, in_size, strategy, code) < 0)
+        return NULL;
+
+    for (r = 0; r < s->num_records; r++)
+        if (maxlen < s->len[r])
+            maxlen = s->len[r];
+
+    // Generous room for the parameters and per record overheads
+    out_alloc = in_size + in_size / 4 + (size_t)s->num_records * 8 + 4096;
+    if (!(out = malloc(out_alloc))
+        || !(tmp = malloc(maxlen + 1)) || !(prev = malloc(maxlen + 1))
+        || fqz_models_init(&m, &gp) < 0) {
+        free(out); free(tmp); free(prev);
+        return NULL;
+    }
+
+    cp = out + var_put_u32(out, NULL, in_size);
+    cp += store_params(cp, &gp);
+    rc_start_encode(&rc, cp, out + out_alloc - cp);
+
+    for (r = 0; r < s->num_records; r++) {
+        uint32_t len = s->len[r], sel = 0, rev = 0, j, p;
+        uint32_t qctx = 0, delta = 0, last = 0;
+        unsigned char *q = in + i;
+
+        if (!len)
+            continue;
+
+        if (gp.max_sel) {
+            sel = (s->flags[r] & FQZ_FREAD2) ? 1 : 0;
+            model_encode(model_get(&m.sel, 0), &rc, sel);
+        }
+
+        // Fixed length data only has the first length stored
+        if (!(pm.pflags & PFLAG_DO_LEN) || first_len) {
+            for (j = 0; j < 4; j++)
+                model_encode(model_get(&m.len[j], 0), &rc,
+                             (len >> (8*j)) & 0xff);
+            first_len = 0;
+        }
+
+        if (gp.gflags & GFLAG_DO_REV) {
+            rev = (s->flags[r] & FQZ_FREVERSE) ? 1 : 0;
+            model_encode(model_get(&m.rev, 0), &rc, rev);
+            if (rev) {
+                for (j = 0; j < len; j++)
+                    tmp[j] = q[len-1-j];
+                q = tmp;
+            }
+        }
+
+        if (pm.pflags & PFLAG_DO_DEDUP) {
+            int dup = len == prev_len && memcmp(q, prev, len) == 0;
+            model_encode(model_get(&m.dup, 0), &rc, dup);
+            memcpy(prev, q, len);
+            prev_len = len;
+            if (dup) {
+                i += len;
+                continue;
+            }
+        }
+
+        for (j = 0, p = len; j < len; j++, p--) {
+            uint32_t sym = code[q[j]];
+            model_encode(model_get(&m.qual,
+                                   fqz_context(&pm, qctx, p, delta, sel)),
+                         &rc, sym);
+            qctx = (qctx << pm.qshift) + pm.qtab[sym];
+            delta += (last > sym) * (last - sym);
+            last = sym;
+        }
+        i += len;
+    }
+
+    cp += rc_finish_encode(&rc, cp);
+    fqz_models_free(&m);
+    free(tmp);
+    free(prev);
+
+    if (rc.err || i != in_size) {
+        free(out);
+        return NULL;
+    }
+
+    *out_size = cp - out;
+    return out;
+}
+
+unsigned char *fqz_compress(fqz_slice *s, unsigned char *in, size_t in_size,
+                            size_t *out_size, int level)
+{
+    unsigned char *best, *alt;
+    size_t total = 0, alt_size;
+    int r;
+
+    for (r = 0; r < s->num_records; r++)
+        total += s->len[r];
+    if (total != in_size || in_size == 0 || in_size > UINT32_MAX)
+        return NULL;
+
+    best = fqz_compress_strat(s, in, in_size, out_size, 0);
+    if (level >= 7) {
+        alt = fqz_compress_strat(s, in, in_size, &alt_size, 1);
+        if (alt && (!best || alt_size < *out_size)) {
+            free(best);
+            best = alt;
+            *out_size = alt_size;
+        } else {
+            free(alt);
+        }
+    }
+
+    return best;
+}
+
+/* ------------------------------------------------------------------------
+ * Decoder
+ */
+
+static void reverse(unsigned char *q, uint32_t len) {
+    uint32_t j;
+    for (j = 0; j < len / 2; j++) {
+        unsigned char t = q[j];
+        q[j] = q[len-1-j];
+        q[len-1-j] = t;
+    }
+}
+
+unsigned char *fqz_decompress(unsigned char *in, size_t in_size,
+                              size_t *out_size)
+{
+    fqz_gparams gp;
+    fqz_models m;
+    range_coder rc;
+    unsigned char *out = NULL, *end = in + in_size;
+    uint32_t len, i = 0, prev_start = 0, prev_len = 0, last_len = 0;
+    int n, prev_rev = 0, models = 0, first_len = 1;
+
+    memset(&gp, 0, sizeof(gp));
+    if (!(n = var_get_u32(in, end, &len)) || !len)
+        return NULL;
+    in += n;
+    if ((n = read_params(in, end, &gp)) < 0)
+        goto err;
+    in += n;
+
+    if (fqz_models_init(&m, &gp) < 0)
+        goto err;
+    models = 1;
+    if (!(out = malloc(len)))
+        goto err;
+
+    rc_start_decode(&rc, in, end - in);
+
+    while (i < len) {
+        uint32_t rlen, sel = 0, rev = 0, j, p;
+        uint32_t qctx = 0, delta = 0, last = 0;
+        fqz_param *pm;
+
+        if (gp.max_sel)
+            sel = model_decode(model_get(&m.sel, 0), &rc);
+        pm = &gp.p[gp.stab[sel]];
+
+        if (!(pm->pflags & PFLAG_DO_LEN) || first_len) {
+            for (rlen = 0, j = 0; j < 4; j++)
+                rlen |= model_decode(model_get(&m.len[j], 0), &rc) << (8*j);
+            first_len = 0;
+            last_len = rlen;
+        } else {
+            rlen = last_len;
+        }
+        if (rlen == 0 || rlen > len - i || rc.err)
+            goto err;
+
+        if (gp.gflags & GFLAG_DO_REV)
+            rev = model_decode(model_get(&m.rev, 0), &rc);
+
+        if ((pm->pflags & PFLAG_DO_DEDUP)
+            && model_decode(model_get(&m.dup, 0), &rc)) {
+            if (rlen != prev_len)
+                goto err;
+            memcpy(out + i, out + prev_start, rlen);
+            if (prev_rev)
+                reverse(out + i, rlen);
+        } else {
+            unsigned char *q = out + i;
+            for (j = 0, p = rlen; j < rlen; j++, p--) {
+                uint32_t sym = model_decode(
+                    model_get(&m.qual, fqz_context(pm, qctx, p, delta, sel)),
+                    &rc);
+                q[j] = pm->qmap[sym];
+                qctx = (qctx << pm->qshift) + pm->qtab[sym];
+                delta += (last > sym) * (last - sym);
+                last = sym;
+            }
+        }
+
+        if (rev)
+            reverse(out + i, rlen);
+        prev_start = i;
+        prev_len = rlen;
+        prev_rev = rev;
+        i += rlen;
+    }
+
+    if (rc.err)
+        goto err;
+
+    fqz_models_free(&m);
+    free(gp.p);
+    *out_size = len;
+    return out;
+
+ err:
+    if (models)
+        fqz_models_free(&m);
+    free(gp.p);
+    free(out);
+    return NULL;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef FQZCOMP_QUAL_H
+#define FQZCOMP_QUAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record flags used to pick the quality context model */
+#define FQZ_FREVERSE 16
+#define FQZ_FREAD2   128
+
+/*
+ * The records whose quality strings make up a block.  The lengths must
+ * add up to the block size.  Flags are BAM flags; only FQZ_FREVERSE and
+ * FQZ_FREAD2 are used.
+ */
+typedef struct {
+    int num_records;
+    uint32_t *len;
+    uint32_t *flags;
+} fqz_slice;
+
+/*
+ * Compresses in_size bytes of quality values, split into records as
+ * described by s, with the CRAM 3.1 fqzcomp codec.  Higher levels try
+ * more context models.
+ *
+ * Returns the compressed data, with its size in *out_size, or NULL on
+ * failure.  The caller should free the result.
+ */
+unsigned char *fqz_compress(fqz_slice *s, unsigned char *in, size_t in_size,
+                            size_t *out_size, int level);
+
+/*
+ * Uncompresses in_size bytes of fqzcomp data.  No record information is
+ * needed, as the codec stores the lengths itself.
+ *
+ * Returns the quality values, with their size in *out_size, or NULL on
+ * failure.  The caller should free the result.
+ */
+unsigned char *fqz_decompress(unsigned char *in, size_t in_size,
+                              size_t *out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FQZCOMP_QUAL_H */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "varint.h"
+
+static uint32_t pack_len(uint32_t len, int nsym)
+{
+    return nsym <= 1 ? 0
+        :  nsym <= 2 ? len/8 + ((len&7) != 0)
+        :  nsym <= 4 ? len/4 + ((len&3) != 0)
+        :              len/2 + (len&1);
+}
+
+uint8_t *hts_pack(const uint8_t *in, uint32_t in_len,
+                  uint8_t *meta, int *meta_len, uint32_t *out_len)
+{
+    uint8_t seen[256] = {0}, map[256], *out;
+    uint32_t i, len;
+    int j, nsym = 0;
+
+    for (i = 0; i < in_len; i++)
+        seen[in[i]] = 1;
+    for (j = 0; j < 256; j++) {
+        if (!seen[j])
+            continue;
+        if (nsym == 16)
+            return NULL;
+        map[j] = nsym;
+        meta[1 + nsym++] = j;
+    }
+    meta[0] = nsym;
+
+    len = pack_len(in_len, nsym);
+    if (!(out = calloc(len + 1, 1)))
+        return NULL;
+
+    if (nsym <= 1) {
+        ;
+    } else if (nsym <= 2) {
+        for (i = 0; i < in_len; i++)
+            out[i>>3] |= map[in[i]] << (i&7);
+    } else if (nsym <= 4) {
+        for (i = 0; i < in_len; i++)
+            out[i>>2] |= map[in[i]] << ((i&3)*2);
+    } else {
+        for (i = 0; i < in_len; i++)
+            out[i>>1] |= map[in[i]] << ((i&1)*4);
+    }
+
+    *meta_len = 1 + nsym + var_put_u32(meta + 1 + nsym, NULL, len);
+    *out_len = len;
+    return out;
+}
+
+int hts_unpack_meta(const uint8_t *cp, const uint8_t *end, uint32_t out_len,
+                    uint8_t *P, int *nsym, uint32_t *plen)
+{
+    const uint8_t *op = cp;
+    int j, n;
+
+    if (cp >= end)
+        return 0;
+    *nsym = *cp++;
+    if (*nsym < 1 || *nsym > 16 || end - cp < *nsym)
+        return 0;
+    for (j = 0; j < *nsym; j++)
+        P[j] = *cp++;
+    if (!(n = var_get_u32(cp, end, plen)) || *plen != pack_len(out_len, *nsym))
+        return 0;
+    cp += n;
+
+    return cp - op;
+}
+
+void hts_unpack(const uint8_t *in, const uint8_t *P, int nsym,
+                uint8_t *out, uint32_t out_len)
+{
+    uint32_t i;
+
+    if (nsym <= 1) {
+        memset(out, P[0], out_len);
+    } else if (nsym <= 2) {
+        for (i = 0; i < out_len; i++)
+            out[i] = P[(in[i>>3] >> (i&7)) & 1];
+    } else if (nsym <= 4) {
+        for (i = 0; i < out_len; i++)
+            out[i] = P[(in[i>>2] >> ((i&3)*2)) & 3];
+    } else {
+        for (i = 0; i < out_len; i++)
+            out[i] = P[(in[i>>1] >> ((i&1)*4)) & 15];
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CRAM_PACK_H
+#define CRAM_PACK_H
+
+#include <stdint.h>
+
+/*
+ * The PACK transform shared by the CRAM 3.1 rANS Nx16 and adaptive
+ * arithmetic codecs.  Data using at most 16 distinct symbols is mapped to
+ * symbol numbers and stored 8, 4 or 2 to a byte (or not at all for a
+ * single symbol).  The meta data is the number of symbols, the symbols
+ * themselves and a uint7 packed length.
+ */
+
+/*
+ * Packs in_len bytes of "in", writing up to 22 bytes of meta data to meta
+ * and its length to *meta_len.
+ * Returns a newly allocated buffer of *out_len bytes, or NULL if there
+ * are too many symbols or on allocation failure.
+ */
+uint8_t *hts_pack(const uint8_t *in, uint32_t in_len,
+                  uint8_t *meta, int *meta_len, uint32_t *out_len);
+
+/*
+ * Reads the meta data written by hts_pack() for out_len bytes of unpacked
+ * data from cp, which must not go beyond end.  The symbols go to P (16
+ * bytes), their count to *nsym and the packed length to *plen.
+ * Returns the number of bytes read, or 0 on error.
+ */
+int hts_unpack_meta(const uint8_t *cp, const uint8_t *end, uint32_t out_len,
+                    uint8_t *P, int *nsym, uint32_t *plen);
+
+// Unpacks the data to out_len bytes of out
+void hts_unpack(const uint8_t *in, const uint8_t *P, int nsym,
+                uint8_t *out, uint32_t out_len);
+
+#endif /* CRAM_PACK_H */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RANS_STATIC4X16_H
+#define RANS_STATIC4X16_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The "order" parameter of rans_compress_4x16() is a bit field of these,
+ * as stored in the first byte of the compressed data.  For
+ * RANS_ORDER_STRIPE, the number of streams goes in bits 8 to 15 (default
+ * 4).
+ */
+#define RANS_ORDER_X32    0x04 // 32-way interleaving instead of 4-way
+#define RANS_ORDER_STRIPE 0x08 // Split into N interleaved streams
+#define RANS_ORDER_NOSZ   0x10 // Don't store the uncompressed size
+#define RANS_ORDER_CAT    0x20 // No entropy coding; data stored raw
+#define RANS_ORDER_RLE    0x40 // Run length encode before entropy coding
+#define RANS_ORDER_PACK   0x80 // Pack 2, 4, 8 or infinite symbols per byte
+
+/*
+ * Returns the largest size rans_compress_to_4x16() may need for an input
+ * of the given size.
+ */
+unsigned int rans_compress_bound_4x16(unsigned int size, int order);
+
+/*
+ * Compresses in_size bytes of "in" using the CRAM 3.1 rANS Nx16 codec.
+ *
+ * rans_compress_to_4x16() writes to "out", which has room for *out_size
+ * bytes, or allocates the buffer itself if out is NULL.  *out_size is set
+ * to the compressed size.
+ *
+ * Returns the compressed data on success, or NULL on failure.
+ */
+unsigned char *rans_compress_to_4x16(unsigned char *in, unsigned int in_size,
+                                     unsigned char *out,
+                                     unsigned int *out_size, int order);
+unsigned char *rans_compress_4x16(unsigned char *in, unsigned int in_size,
+                                  unsigned int *out_size, int order);
+
+/*
+ * Uncompresses in_size bytes of rANS Nx16 data.
+ *
+ * rans_uncompress_to_4x16() writes to "out", which has room for *out_size
+ * bytes, or allocates the buffer itself if out is NULL.  *out_size must be
+ * the uncompressed size for data compressed with RANS_ORDER_NOSZ.  It is
+ * set to the uncompressed size.
+ *
+ * Returns the uncompressed data on success, or NULL on failure.
+ */
+unsigned char *rans_uncompress_to_4x16(unsigned char *in, unsigned int in_size,
+                                       unsigned char *out,
+                                       unsigned int *out_size);
+unsigned char *rans_uncompress_4x16(unsigned char *in, unsigned int in_size,
+                                    unsigned int *out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RANS_STATIC4X16_H */
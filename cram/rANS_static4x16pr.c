@@ -0,0 +1,1392 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The rANS Nx16 codec from CRAM 3.1.
+ *
+ * This differs from the rANS 4x8 codec in rANS_static.c by renormalising
+ * 16 bits at a time, interleaving either 4 or 32 rANS states, and by
+ * optionally applying PACK, RLE and STRIPE transforms before entropy
+ * coding.  With 32 states the decoder has enough independent work to run
+ * 8 or 16 states per vector instruction, using gathers for the symbol
+ * lookups.
+ *
+ * The stream starts with a flags byte (see rANS_static4x16.h) followed by
+ * the uncompressed size as a uint7 unless RANS_ORDER_NOSZ is set.
+ */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "rANS_static4x16.h"
+#include "rANS_word.h"
+#include "pack.h"
+#include "varint.h"
+
+/*
+ * The vector decoders need per-function target attributes and
+ * __builtin_cpu_supports(), so they are only built for x86-64 with a
+ * compiler known to provide them.  Everything else uses the scalar code.
+ */
+#if defined(__x86_64__) && \
+    ((defined(__clang__) && __clang_major__ >= 4) || \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 5))
+#define BUILDING_RANS_X86 1
+#include <immintrin.h>
+#endif
+
+#define TF_SHIFT 12
+#define TOTFREQ (1<<TF_SHIFT)
+
+// Order-1 tables are normalised to 1<<TF_SHIFT_O1, or to the smaller
+// 1<<TF_SHIFT_O1_FAST for inputs below O1_FAST_SIZE where the cost of
+// storing and building the larger tables would not be recouped.
+#define TF_SHIFT_O1      12
+#define TF_SHIFT_O1_FAST 10
+#define O1_FAST_SIZE     (64*1024)
+
+// Decoder table entries hold the symbol (bits 0-7), the offset of the slot
+// within the symbol's range (bits 8-19) and the frequency - 1 (bits 20-31).
+#define DEC_ENTRY(s,b,f) ((uint32_t) (s) | ((uint32_t) (b) << 8) \
+                          | ((uint32_t) ((f)-1) << 20))
+
+/*-----------------------------------------------------------------------------
+ * Frequency tables
+ */
+
+/*
+ * Scales the frequencies in F, which sum to tot, so that they sum to tf
+ * while keeping every used symbol at a frequency of at least 1.
+ */
+static void normalise_freq(uint32_t *F, uint32_t tot, uint32_t tf)
+{
+    uint32_t i, fsum = 0, M = 0, Mf = 0;
+
+    if (!tot)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        if (!F[i])
+            continue;
+        uint32_t f = ((uint64_t) F[i] * tf + tot/2) / tot;
+        F[i] = f ? f : 1;
+        fsum += F[i];
+        if (Mf < F[i])
+            Mf = F[i], M = i;
+    }
+
+    if (fsum <= tf) {
+        F[M] += tf - fsum;
+    } else if (fsum - tf < F[M]) {
+        F[M] -= fsum - tf;
+    } else {
+        // Many rare symbols were rounded up; take from all that can spare it
+        while (fsum > tf) {
+            for (i = 0; i < 256 && fsum > tf; i++)
+                if (F[i] > 1)
+                    F[i]--, fsum--;
+        }
+    }
+}
+
+/*
+ * Writes the set of symbols with non-zero F, as a list of symbols where
+ * runs of consecutive symbols are stored as the first two followed by a
+ * count of the remainder.  Needs up to 513 bytes.
+ */
+static uint8_t *encode_alphabet(uint8_t *cp, const uint32_t *F)
+{
+    int j, rle = 0;
+
+    for (j = 0; j < 256; j++) {
+        if (!F[j])
+            continue;
+        if (rle) {
+            rle--;
+            continue;
+        }
+        *cp++ = j;
+        if (j && F[j-1]) {
+            for (rle = j+1; rle < 256 && F[rle]; rle++)
+                ;
+            rle -= j+1;
+            *cp++ = rle;
+        }
+    }
+    *cp++ = 0;
+
+    return cp;
+}
+
+// Returns the number of bytes read, or 0 on error.
+static int decode_alphabet(const uint8_t *cp, const uint8_t *end, uint8_t *A)
+{
+    const uint8_t *op = cp;
+    int j, rle = 0;
+
+    memset(A, 0, 256);
+    if (cp >= end)
+        return 0;
+
+    j = *cp++;
+    do {
+        A[j] = 1;
+        if (rle) {
+            rle--;
+            if (++j > 255)
+                return 0;
+        } else {
+            if (cp >= end)
+                return 0;
+            if (j+1 == *cp) {
+                j = *cp++;
+                if (cp >= end)
+                    return 0;
+                rle = *cp++;
+            } else {
+                j = *cp++;
+            }
+        }
+    } while (j);
+
+    return cp - op;
+}
+
+/*
+ * Fills the decoder table D for frequencies F, which must sum to a power
+ * of two no larger than 1<<shift.  Rows that sum to zero are left alone.
+ * Returns 0 on success, -1 on error.
+ */
+static int build_dec_table(uint32_t *F, uint32_t *D, int shift)
+{
+    uint32_t tf = 1u << shift, tot = 0, mult, x = 0;
+    int j;
+
+    for (j = 0; j < 256; j++) {
+        if (F[j] > tf)
+            return -1;
+        tot += F[j];
+    }
+    if (!tot)
+        return 0;
+    if (tot > tf || (tot & (tot-1)))
+        return -1;
+
+    // Frequencies may be stored at a lower precision than the table
+    mult = tf / tot;
+    for (j = 0; j < 256; j++) {
+        uint32_t f = F[j] * mult, k;
+        for (k = 0; k < f; k++)
+            D[x+k] = DEC_ENTRY(j, k, f);
+        x += f;
+    }
+
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Order-0 codec
+ */
+
+/*
+ * Encodes in_size > 0 bytes of "in" with N interleaved states into
+ * [out, out_end).  Returns a pointer to the end of the written data, or
+ * NULL if it did not fit.
+ */
+static uint8_t *rans_enc_O0(const uint8_t *in, uint32_t in_size,
+                            uint8_t *out, uint8_t *out_end, int N)
+{
+    uint32_t F[256] = {0}, C[256], i, x;
+    RansWordState R[32];
+    uint8_t *cp, *ptr;
+    int j;
+
+    if (out_end - out < 1300 + 4*N)
+        return NULL;
+
+    for (i = 0; i < in_size; i++)
+        F[in[i]]++;
+    normalise_freq(F, in_size, TOTFREQ);
+
+    cp = encode_alphabet(out, F);
+    for (j = x = 0; j < 256; j++) {
+        C[j] = x;
+        x += F[j];
+        if (F[j])
+            cp += var_put_u32(cp, NULL, F[j]);
+    }
+
+    for (j = 0; j < N; j++)
+        RansWordEncInit(&R[j]);
+
+    ptr = out_end;
+    for (i = in_size; i-- > 0; ) {
+        uint8_t s = in[i];
+        if (ptr - cp < 2 + 4*N)
+            return NULL;
+        RansWordEncPut(&R[i & (N-1)], &ptr, C[s], F[s], TF_SHIFT);
+    }
+    for (j = N-1; j >= 0; j--)
+        RansWordEncFlush(&R[j], &ptr);
+
+    memmove(cp, ptr, out_end - ptr);
+    return cp + (out_end - ptr);
+}
+
+#ifdef BUILDING_RANS_X86
+static uint32_t (*rans_dec_O0_32_fn)(const uint32_t *, uint32_t *,
+                                     const uint8_t **, const uint8_t *,
+                                     uint8_t *, uint32_t);
+static uint32_t (*rans_dec_O1_32_fn)(const uint32_t *, int, uint32_t *,
+                                     uint8_t *, const uint8_t **,
+                                     const uint8_t *, uint8_t *, uint32_t);
+#endif
+
+// Reads the N initial states, which the encoder leaves below 2^31.
+static const uint8_t *rans_dec_init(const uint8_t *cp, const uint8_t *end,
+                                    uint32_t *R, int N)
+{
+    int j;
+
+    if (end - cp < 4*N)
+        return NULL;
+    for (j = 0; j < N; j++, cp += 4)
+        if ((R[j] = RansWordDecInit(cp)) >= RANS_WORD_L << 16)
+            return NULL;
+
+    return cp;
+}
+
+/*
+ * Decodes out_sz bytes to "out" from the order-0 data in [cp, end).
+ * Returns a pointer to the end of the data read, or NULL on error.
+ */
+static const uint8_t *rans_dec_O0(const uint8_t *cp, const uint8_t *end,
+                                  uint8_t *out, uint32_t out_sz, int N)
+{
+    uint32_t D[TOTFREQ], F[256] = {0}, R[32], i = 0;
+    uint8_t A[256];
+    int j, n;
+
+    if (!out_sz)
+        return cp;
+
+    if (!(n = decode_alphabet(cp, end, A)))
+        return NULL;
+    cp += n;
+    for (j = 0; j < 256; j++) {
+        if (!A[j])
+            continue;
+        if (!(n = var_get_u32(cp, end, &F[j])))
+            return NULL;
+        cp += n;
+    }
+    if (build_dec_table(F, D, TF_SHIFT) < 0)
+        return NULL;
+    for (j = 0, n = 0; j < 256; j++)
+        n |= F[j] != 0;
+    if (!n)
+        return NULL;
+
+    if (!(cp = rans_dec_init(cp, end, R, N)))
+        return NULL;
+
+#ifdef BUILDING_RANS_X86
+    if (N == 32 && rans_dec_O0_32_fn)
+        i = rans_dec_O0_32_fn(D, R, &cp, end, out, out_sz);
+#endif
+
+    for (; i < out_sz; i++) {
+        uint32_t *r = &R[i & (N-1)], e = D[*r & (TOTFREQ-1)];
+        out[i] = e;
+        *r = ((e >> 20) + 1) * (*r >> TF_SHIFT) + ((e >> 8) & 0xfff);
+        if (*r < RANS_WORD_L) {
+            if (end - cp < 2)
+                return NULL;
+            *r = (*r << 16) | cp[0] | (cp[1] << 8);
+            cp += 2;
+        }
+    }
+
+    return cp;
+}
+
+/*-----------------------------------------------------------------------------
+ * Order-1 codec
+ *
+ * The input is split into N contiguous chunks, one per state, with the
+ * last state also taking the remainder.  Each chunk starts with context 0.
+ */
+
+static uint8_t *rans_enc_O1(const uint8_t *in, uint32_t in_size,
+                            uint8_t *out, uint8_t *out_end, int N)
+{
+    uint32_t (*F)[256] = NULL, (*C)[256] = NULL, T[256] = {0};
+    uint32_t isz = in_size / N, i, p, tlen, clen;
+    uint8_t *tbuf = NULL, *ctab = NULL, *tp, *cp = out, *ptr, *ret = NULL;
+    uint8_t alpha[256];
+    int shift = in_size < O1_FAST_SIZE ? TF_SHIFT_O1_FAST : TF_SHIFT_O1;
+    RansWordState R[32];
+    int j, k, a, na;
+
+    if (out_end - out < 16 + 4*N)
+        return NULL;
+
+    F = calloc(256, sizeof(*F));
+    C = malloc(256 * sizeof(*C));
+    tbuf = malloc(256*256*3 + 1024);
+    if (!F || !C || !tbuf)
+        goto err;
+
+    for (j = 0; j < N; j++) {
+        uint32_t s = j*isz, e = j == N-1 ? in_size : s + isz;
+        uint8_t last = 0;
+        for (p = s; p < e; p++) {
+            F[last][in[p]]++;
+            last = in[p];
+        }
+    }
+
+    // The alphabet covers every context and symbol, plus the initial
+    // context 0.
+    T[0] = 1;
+    for (j = 0; j < 256; j++)
+        for (k = 0; k < 256; k++)
+            if (F[j][k])
+                T[j] = T[k] = 1;
+
+    for (j = na = 0; j < 256; j++)
+        if (T[j])
+            alpha[na++] = j;
+
+    tp = encode_alphabet(tbuf, T);
+    for (j = 0; j < 256; j++) {
+        uint32_t tot = 0, x = 0;
+        if (!T[j])
+            continue;
+
+        for (k = 0; k < 256; k++)
+            tot += F[j][k];
+        normalise_freq(F[j], tot, 1u << shift);
+        for (k = 0; k < 256; k++) {
+            C[j][k] = x;
+            x += F[j][k];
+        }
+
+        for (a = 0; a < na; a++) {
+            uint32_t f = F[j][alpha[a]];
+            tp += var_put_u32(tp, NULL, f);
+            if (!f) {
+                // Zero frequencies are followed by a count of the zeros
+                // after them
+                int run = 0;
+                while (a+1 < na && run < 255 && !F[j][alpha[a+1]])
+                    run++, a++;
+                *tp++ = run;
+            }
+        }
+    }
+    tlen = tp - tbuf;
+
+    // Large tables are themselves order-0 compressed
+    if (tlen > 256 && (ctab = malloc(tlen + 1300 + 16))
+        && (tp = rans_enc_O0(tbuf, tlen, ctab, ctab + tlen + 1300 + 16, 4))
+        && (clen = tp - ctab) < tlen) {
+        if (out_end - cp < 11 + clen)
+            goto err;
+        *cp++ = (shift << 4) | 1;
+        cp += var_put_u32(cp, NULL, tlen);
+        cp += var_put_u32(cp, NULL, clen);
+        memcpy(cp, ctab, clen);
+        cp += clen;
+    } else {
+        if (out_end - cp < 1 + tlen)
+            goto err;
+        *cp++ = shift << 4;
+        memcpy(cp, tbuf, tlen);
+        cp += tlen;
+    }
+
+    for (j = 0; j < N; j++)
+        RansWordEncInit(&R[j]);
+
+    ptr = out_end;
+    for (p = in_size; p-- > N*isz; ) {
+        uint8_t c = p == (N-1)*isz ? 0 : in[p-1], s = in[p];
+        if (ptr - cp < 2 + 4*N)
+            goto err;
+        RansWordEncPut(&R[N-1], &ptr, C[c][s], F[c][s], shift);
+    }
+    for (i = isz; i-- > 0; ) {
+        if (ptr - cp < 2*N + 4*N)
+            goto err;
+        for (j = N-1; j >= 0; j--) {
+            p = j*isz + i;
+            uint8_t c = i ? in[p-1] : 0, s = in[p];
+            RansWordEncPut(&R[j], &ptr, C[c][s], F[c][s], shift);
+        }
+    }
+    for (j = N-1; j >= 0; j--)
+        RansWordEncFlush(&R[j], &ptr);
+
+    memmove(cp, ptr, out_end - ptr);
+    ret = cp + (out_end - ptr);
+
+ err:
+    free(F);
+    free(C);
+    free(tbuf);
+    free(ctab);
+    return ret;
+}
+
+/*
+ * Reads the order-1 frequencies from [cp, end) into the decoder table D,
+ * which has 1<<shift entries per context.
+ * Returns the number of bytes read, or -1 on error.
+ */
+static int decode_freq_O1(const uint8_t *cp, const uint8_t *end,
+                          uint32_t *D, int shift)
+{
+    const uint8_t *op = cp;
+    uint8_t A[256];
+    int i, j, n;
+
+    if (!(n = decode_alphabet(cp, end, A)))
+        return -1;
+    cp += n;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t F[256] = {0};
+        int run = 0;
+
+        if (!A[i])
+            continue;
+
+        for (j = 0; j < 256; j++) {
+            if (!A[j])
+                continue;
+            if (run > 0) {
+                run--;
+                continue;
+            }
+            if (!(n = var_get_u32(cp, end, &F[j])))
+                return -1;
+            cp += n;
+            if (!F[j]) {
+                if (cp >= end)
+                    return -1;
+                run = *cp++;
+            }
+        }
+
+        if (build_dec_table(F, D + ((uint32_t) i << shift), shift) < 0)
+            return -1;
+    }
+
+    return cp - op;
+}
+
+/*
+ * The N order-1 output chunks are isz bytes apart, so for power-of-two
+ * sizes storing a byte to each per round makes them all compete for the
+ * same cache sets.  Rounds are instead staged in a small block and written
+ * out O1_BLK bytes per state at a time.  With only 4 chunks there is no
+ * contention, so they are written directly.
+ */
+#define O1_BLK 32
+
+#ifdef __GNUC__
+#define RANS_NOINLINE __attribute__((noinline))
+#else
+#define RANS_NOINLINE
+#endif
+
+RANS_NOINLINE
+static void rans_O1_flush(uint8_t *out, uint32_t isz, uint32_t i0,
+                          uint8_t (*blk)[32], int n, int N)
+{
+    int j, k;
+    for (j = 0; j < N; j++) {
+        uint8_t *o = &out[j*isz + i0];
+        for (k = 0; k < n; k++)
+            o[k] = blk[k][j];
+    }
+}
+
+static const uint8_t *rans_dec_O1(const uint8_t *cp, const uint8_t *end,
+                                  uint8_t *out, uint32_t out_sz, int N)
+{
+    uint32_t *D = NULL, R[32], isz = out_sz / N, i = 0, i0, u_len, c_len;
+    uint8_t L[32] = {0}, *tbuf = NULL, blk[O1_BLK][32];
+    const uint8_t *tp, *tend, *ret = NULL;
+    int shift, comp, j, n;
+
+    if (!out_sz)
+        return cp;
+
+    if (cp >= end)
+        return NULL;
+    comp = *cp++;
+    shift = comp >> 4;
+    if (shift < 1 || shift > TF_SHIFT_O1)
+        return NULL;
+
+    tp = cp;
+    tend = end;
+    if (comp & 1) {
+        if (!(n = var_get_u32(cp, end, &u_len)))
+            return NULL;
+        cp += n;
+        if (!(n = var_get_u32(cp, end, &c_len)))
+            return NULL;
+        cp += n;
+        // A table can not exceed 256 rows of 256 entries of 3 bytes
+        if (c_len > end - cp || u_len > 256*256*3 + 1024)
+            return NULL;
+        if (!(tbuf = malloc(u_len)))
+            return NULL;
+        if (!rans_dec_O0(cp, cp + c_len, tbuf, u_len, 4))
+            goto err;
+        cp += c_len;
+        tp = tbuf;
+        tend = tbuf + u_len;
+    }
+
+    // Unused rows stay zero, so corrupt data can not reach uninitialised
+    // entries.
+    if (!(D = calloc((size_t) 256 << shift, sizeof(*D))))
+        goto err;
+    if ((n = decode_freq_O1(tp, tend, D, shift)) < 0)
+        goto err;
+    if (!(comp & 1))
+        cp += n;
+
+    if (!(cp = rans_dec_init(cp, end, R, N)))
+        goto err;
+
+#ifdef BUILDING_RANS_X86
+    if (N == 32 && rans_dec_O1_32_fn)
+        i = rans_dec_O1_32_fn(D, shift, R, L, &cp, end, out, isz);
+#endif
+
+    for (i0 = i; i < isz; i++) {
+        for (j = 0; j < N; j++) {
+            uint32_t e = D[((uint32_t) L[j] << shift)
+                           | (R[j] & ((1u << shift) - 1))];
+            L[j] = e;
+            if (N == 4)
+                out[j*isz + i] = e;
+            else
+                blk[i - i0][j] = e;
+            R[j] = ((e >> 20) + 1) * (R[j] >> shift) + ((e >> 8) & 0xfff);
+            if (R[j] < RANS_WORD_L) {
+                if (end - cp < 2)
+                    goto err;
+                R[j] = (R[j] << 16) | cp[0] | (cp[1] << 8);
+                cp += 2;
+            }
+        }
+        if (N == 32 && i - i0 == O1_BLK-1) {
+            rans_O1_flush(out, isz, i0, blk, O1_BLK, N);
+            i0 = i+1;
+        }
+    }
+    if (N == 32)
+        rans_O1_flush(out, isz, i0, blk, i - i0, N);
+
+    for (i = N*isz; i < out_sz; i++) {
+        uint32_t e = D[((uint32_t) L[N-1] << shift)
+                       | (R[N-1] & ((1u << shift) - 1))];
+        out[i] = L[N-1] = e;
+        R[N-1] = ((e >> 20) + 1) * (R[N-1] >> shift) + ((e >> 8) & 0xfff);
+        if (R[N-1] < RANS_WORD_L) {
+            if (end - cp < 2)
+                goto err;
+            R[N-1] = (R[N-1] << 16) | cp[0] | (cp[1] << 8);
+            cp += 2;
+        }
+    }
+
+    ret = cp;
+
+ err:
+    free(tbuf);
+    free(D);
+    return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Vectorised 32-way decoders
+ *
+ * These decode whole rounds of 32 symbols while at least 64 bytes of
+ * input remain, so the unaligned word loads can not overrun, and return
+ * the number of rounds done.  The scalar code above finishes the data.
+ * All states are below 2^31, so signed comparisons are safe.
+ */
+
+#ifdef BUILDING_RANS_X86
+
+// For each mask of states needing renormalisation, the permutation moving
+// the next words into those lanes, and the number of bytes consumed.
+static uint32_t rans_renorm_perm[256][8];
+static uint8_t rans_renorm_len[256];
+
+__attribute__((target("avx2")))
+static inline __m256i rans_dec_step_avx2(__m256i R, __m256i e,
+                                         __m256i shift, const uint8_t **pptr)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i m12 = _mm256_set1_epi32(0xfff);
+    const __m256i lo = _mm256_set1_epi32(RANS_WORD_L);
+    __m256i f = _mm256_add_epi32(_mm256_srli_epi32(e, 20), one);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(e, 8), m12);
+    __m256i x = _mm256_add_epi32(b, _mm256_mullo_epi32(f,
+                      _mm256_srl_epi32(R, _mm256_castsi256_si128(shift))));
+    __m256i c = _mm256_cmpgt_epi32(lo, x);
+    int k = _mm256_movemask_ps(_mm256_castsi256_ps(c));
+    __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) *pptr));
+
+    w = _mm256_permutevar8x32_epi32(w,
+            _mm256_loadu_si256((const __m256i *) rans_renorm_perm[k]));
+    *pptr += rans_renorm_len[k];
+    return _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, 16), w),
+                              c);
+}
+
+__attribute__((target("avx2")))
+static uint32_t rans_dec_O0_32_avx2(const uint32_t *D, uint32_t *R,
+                                    const uint8_t **pptr, const uint8_t *end,
+                                    uint8_t *out, uint32_t out_sz)
+{
+    const uint8_t *ptr = *pptr;
+    const __m256i mask = _mm256_set1_epi32(TOTFREQ-1);
+    const __m256i bytes = _mm256_set1_epi32(0xff);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i shift = _mm256_set1_epi64x(TF_SHIFT);
+    __m256i Rv[4], e[4];
+    uint32_t i;
+    int g;
+
+    for (g = 0; g < 4; g++)
+        Rv[g] = _mm256_loadu_si256((const __m256i *) &R[g*8]);
+
+    for (i = 0; i + 32 <= out_sz && end - ptr >= 64; i += 32) {
+        for (g = 0; g < 4; g++) {
+            e[g] = _mm256_i32gather_epi32((const int *) D,
+                                          _mm256_and_si256(Rv[g], mask), 4);
+            Rv[g] = rans_dec_step_avx2(Rv[g], e[g], shift, &ptr);
+        }
+
+        // Pack the low byte of each entry, restoring the state order
+        __m256i s01 = _mm256_packus_epi32(_mm256_and_si256(e[0], bytes),
+                                          _mm256_and_si256(e[1], bytes));
+        __m256i s23 = _mm256_packus_epi32(_mm256_and_si256(e[2], bytes),
+                                          _mm256_and_si256(e[3], bytes));
+        __m256i s = _mm256_packus_epi16(s01, s23);
+        _mm256_storeu_si256((__m256i *) &out[i],
+                            _mm256_permutevar8x32_epi32(s, order));
+    }
+
+    for (g = 0; g < 4; g++)
+        _mm256_storeu_si256((__m256i *) &R[g*8], Rv[g]);
+    *pptr = ptr;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t rans_dec_O1_32_avx2(const uint32_t *D, int shift, uint32_t *R,
+                                    uint8_t *L, const uint8_t **pptr,
+                                    const uint8_t *end, uint8_t *out,
+                                    uint32_t isz)
+{
+    const uint8_t *ptr = *pptr;
+    const __m256i mask = _mm256_set1_epi32((1 << shift) - 1);
+    const __m256i bytes = _mm256_set1_epi32(0xff);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i sh = _mm256_set1_epi64x(shift);
+    __m256i Rv[4], Lv[4];
+    uint8_t blk[O1_BLK][32];
+    uint32_t i;
+    int g;
+
+    for (g = 0; g < 4; g++) {
+        Rv[g] = _mm256_loadu_si256((const __m256i *) &R[g*8]);
+        Lv[g] = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)
+                                                     &L[g*8]));
+    }
+
+    for (i = 0; i < isz && end - ptr >= 64; i++) {
+        for (g = 0; g < 4; g++) {
+            __m256i idx = _mm256_or_si256(
+                _mm256_sll_epi32(Lv[g], _mm256_castsi256_si128(sh)),
+                _mm256_and_si256(Rv[g], mask));
+            __m256i e = _mm256_i32gather_epi32((const int *) D, idx, 4);
+            Lv[g] = _mm256_and_si256(e, bytes);
+            Rv[g] = rans_dec_step_avx2(Rv[g], e, sh, &ptr);
+        }
+
+        __m256i s = _mm256_packus_epi16(_mm256_packus_epi32(Lv[0], Lv[1]),
+                                        _mm256_packus_epi32(Lv[2], Lv[3]));
+        s = _mm256_permutevar8x32_epi32(s, order);
+        _mm256_storeu_si256((__m256i *) blk[i % O1_BLK], s);
+        if (i % O1_BLK == O1_BLK-1)
+            rans_O1_flush(out, isz, i - (O1_BLK-1), blk, O1_BLK, 32);
+    }
+    rans_O1_flush(out, isz, i - i % O1_BLK, blk, i % O1_BLK, 32);
+
+    for (g = 0; g < 4; g++)
+        _mm256_storeu_si256((__m256i *) &R[g*8], Rv[g]);
+    // The last staged round holds the current contexts
+    if (i)
+        memcpy(L, blk[(i-1) % O1_BLK], 32);
+    *pptr = ptr;
+    return i;
+}
+
+/*
+ * AVX-512 has unsigned compares into mask registers and vpexpandd, which
+ * places consecutive words into just the lanes that need them, so no
+ * permutation table is needed.
+ */
+__attribute__((target("avx512f")))
+static inline __m512i rans_dec_step_avx512(__m512i R, __m512i e, int shift,
+                                           const uint8_t **pptr)
+{
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i m12 = _mm512_set1_epi32(0xfff);
+    const __m512i lo = _mm512_set1_epi32(RANS_WORD_L);
+    __m512i f = _mm512_add_epi32(_mm512_srli_epi32(e, 20), one);
+    __m512i b = _mm512_and_si512(_mm512_srli_epi32(e, 8), m12);
+    __m512i x = _mm512_add_epi32(b, _mm512_mullo_epi32(f,
+                      _mm512_srl_epi32(R, _mm_cvtsi32_si128(shift))));
+    __mmask16 k = _mm512_cmplt_epu32_mask(x, lo);
+    __m512i w = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)
+                                                         *pptr));
+
+    *pptr += rans_renorm_len[k & 0xff] + rans_renorm_len[k >> 8];
+    return _mm512_mask_or_epi32(x, k, _mm512_slli_epi32(x, 16),
+                                _mm512_maskz_expand_epi32(k, w));
+}
+
+__attribute__((target("avx512f")))
+static uint32_t rans_dec_O0_32_avx512(const uint32_t *D, uint32_t *R,
+                                      const uint8_t **pptr,
+                                      const uint8_t *end,
+                                      uint8_t *out, uint32_t out_sz)
+{
+    const uint8_t *ptr = *pptr;
+    const __m512i mask = _mm512_set1_epi32(TOTFREQ-1);
+    __m512i R0 = _mm512_loadu_si512(&R[0]), R1 = _mm512_loadu_si512(&R[16]);
+    uint32_t i;
+
+    for (i = 0; i + 32 <= out_sz && end - ptr >= 64; i += 32) {
+        __m512i e0 = _mm512_i32gather_epi32(_mm512_and_si512(R0, mask),
+                                            (const void *) D, 4);
+        __m512i e1 = _mm512_i32gather_epi32(_mm512_and_si512(R1, mask),
+                                            (const void *) D, 4);
+        R0 = rans_dec_step_avx512(R0, e0, TF_SHIFT, &ptr);
+        R1 = rans_dec_step_avx512(R1, e1, TF_SHIFT, &ptr);
+        _mm_storeu_si128((__m128i *) &out[i],    _mm512_cvtepi32_epi8(e0));
+        _mm_storeu_si128((__m128i *) &out[i+16], _mm512_cvtepi32_epi8(e1));
+    }
+
+    _mm512_storeu_si512(&R[0], R0);
+    _mm512_storeu_si512(&R[16], R1);
+    *pptr = ptr;
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static uint32_t rans_dec_O1_32_avx512(const uint32_t *D, int shift,
+                                      uint32_t *R, uint8_t *L,
+                                      const uint8_t **pptr,
+                                      const uint8_t *end, uint8_t *out,
+                                      uint32_t isz)
+{
+    const uint8_t *ptr = *pptr;
+    const __m512i mask = _mm512_set1_epi32((1 << shift) - 1);
+    const __m512i bytes = _mm512_set1_epi32(0xff);
+    const __m128i sh = _mm_cvtsi32_si128(shift);
+    __m512i Rv[2], Lv[2];
+    uint8_t blk[O1_BLK][32];
+    uint32_t i;
+    int g;
+
+    for (g = 0; g < 2; g++) {
+        Rv[g] = _mm512_loadu_si512(&R[g*16]);
+        Lv[g] = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)
+                                                     &L[g*16]));
+    }
+
+    for (i = 0; i < isz && end - ptr >= 64; i++) {
+        for (g = 0; g < 2; g++) {
+            __m512i idx = _mm512_or_si512(_mm512_sll_epi32(Lv[g], sh),
+                                          _mm512_and_si512(Rv[g], mask));
+            __m512i e = _mm512_i32gather_epi32(idx, (const void *) D, 4);
+            Lv[g] = _mm512_and_si512(e, bytes);
+            Rv[g] = rans_dec_step_avx512(Rv[g], e, shift, &ptr);
+            _mm_storeu_si128((__m128i *) &blk[i % O1_BLK][g*16],
+                             _mm512_cvtepi32_epi8(e));
+        }
+        if (i % O1_BLK == O1_BLK-1)
+            rans_O1_flush(out, isz, i - (O1_BLK-1), blk, O1_BLK, 32);
+    }
+    rans_O1_flush(out, isz, i - i % O1_BLK, blk, i % O1_BLK, 32);
+
+    for (g = 0; g < 2; g++)
+        _mm512_storeu_si512(&R[g*16], Rv[g]);
+    if (i)
+        memcpy(L, blk[(i-1) % O1_BLK], 32);
+    *pptr = ptr;
+    return i;
+}
+
+__attribute__((constructor))
+static void rans_simd_init(void)
+{
+    int k, l, n;
+
+    for (k = 0; k < 256; k++) {
+        for (l = n = 0; l < 8; l++)
+            rans_renorm_perm[k][l] = (k >> l) & 1 ? n++ : 0;
+        rans_renorm_len[k] = 2*n;
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        rans_dec_O0_32_fn = rans_dec_O0_32_avx512;
+        rans_dec_O1_32_fn = rans_dec_O1_32_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        rans_dec_O0_32_fn = rans_dec_O0_32_avx2;
+        rans_dec_O1_32_fn = rans_dec_O1_32_avx2;
+    }
+}
+
+#endif /* BUILDING_RANS_X86 */
+
+/*-----------------------------------------------------------------------------
+ * RLE transform; PACK is in pack.c
+ */
+
+/*
+ * Run length encodes the symbols where it pays off.  Literals go to lit
+ * and the meta data to meta, which needs in_len + 263 bytes: the number of
+ * run symbols (0 for 256), the run symbols, and then a uint7 count of
+ * extra copies after each literal that is a run symbol.
+ * Returns 0 on success, or -1 if no symbol is worth encoding this way.
+ */
+static int rle_encode(const uint8_t *in, uint32_t in_len,
+                      uint8_t *lit, uint32_t *lit_len,
+                      uint8_t *meta, uint32_t *meta_len)
+{
+    int64_t saved[256] = {0};
+    uint8_t is_rle[256] = {0}, *mp = meta + 1;
+    uint32_t i, o = 0;
+    int j, nrle = 0;
+
+    if (!in_len)
+        return -1;
+
+    // Each repeat saves a literal; each run start costs a run length
+    for (i = 0; i < in_len; i++)
+        saved[in[i]] += i && in[i] == in[i-1] ? 1 : -1;
+    for (j = 0; j < 256; j++) {
+        if (saved[j] > 0) {
+            is_rle[j] = 1;
+            *mp++ = j;
+            nrle++;
+        }
+    }
+    if (!nrle)
+        return -1;
+    meta[0] = nrle & 0xff;
+
+    for (i = 0; i < in_len; i++) {
+        uint8_t s = in[i];
+        lit[o++] = s;
+        if (is_rle[s]) {
+            uint32_t run = 0;
+            while (i+1 < in_len && in[i+1] == s)
+                i++, run++;
+            mp += var_put_u32(mp, NULL, run);
+        }
+    }
+
+    *lit_len = o;
+    *meta_len = mp - meta;
+    return 0;
+}
+
+static int rle_decode(const uint8_t *lit, uint32_t lit_len,
+                      const uint8_t *meta, uint32_t meta_len,
+                      uint8_t *out, uint32_t out_len)
+{
+    const uint8_t *mp = meta, *mend = meta + meta_len;
+    uint8_t is_rle[256] = {0};
+    uint32_t i, o = 0, run;
+    int j, nrle, n;
+
+    if (mp >= mend)
+        return -1;
+    nrle = *mp++;
+    if (!nrle)
+        nrle = 256;
+    if (mend - mp < nrle)
+        return -1;
+    for (j = 0; j < nrle; j++)
+        is_rle[*mp++] = 1;
+
+    for (i = 0; i < lit_len; i++) {
+        uint8_t s = lit[i];
+        if (o >= out_len)
+            return -1;
+        if (is_rle[s]) {
+            if (!(n = var_get_u32(mp, mend, &run)))
+                return -1;
+            mp += n;
+            if (run > out_len - o - 1)
+                return -1;
+            memset(&out[o], s, run + 1);
+            o += run + 1;
+        } else {
+            out[o++] = s;
+        }
+    }
+
+    return o == out_len ? 0 : -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Top level
+ */
+
+unsigned int rans_compress_bound_4x16(unsigned int size, int order)
+{
+    int N = (order & RANS_ORDER_STRIPE) ? ((order >> 8) & 0xff) : 1;
+    if (!N)
+        N = 4;
+
+    // Output larger than the input falls back to RANS_ORDER_CAT, so this
+    // is the input plus headers and room for the encoders to work in.
+    return size + size/16 + 2048 + N*96;
+}
+
+// Compresses a single non-striped stream.
+static uint8_t *compress_block(const uint8_t *in, uint32_t in_size,
+                               uint8_t *out, uint8_t *out_end, int order)
+{
+    int flags = order & (1 | RANS_ORDER_X32 | RANS_ORDER_NOSZ
+                         | RANS_ORDER_CAT | RANS_ORDER_RLE | RANS_ORDER_PACK);
+    int N = (flags & RANS_ORDER_X32) ? 32 : 4;
+    uint8_t *cp = out, *packed = NULL, *lit = NULL, *meta = NULL;
+    uint8_t *cmeta = NULL, *ret = NULL;
+    const uint8_t *data = in;
+    uint32_t data_len = in_size;
+
+    if (out_end - cp < 6)
+        return NULL;
+    cp++;
+    if (!(flags & RANS_ORDER_NOSZ))
+        cp += var_put_u32(cp, NULL, in_size);
+
+    if (!in_size)
+        flags = (flags & RANS_ORDER_NOSZ) | RANS_ORDER_CAT;
+
+    if (flags & RANS_ORDER_PACK) {
+        uint8_t pmeta[32];
+        int pmeta_len;
+        if ((packed = hts_pack(data, data_len, pmeta, &pmeta_len,
+                                  &data_len))) {
+            if (out_end - cp < pmeta_len)
+                goto err;
+            memcpy(cp, pmeta, pmeta_len);
+            cp += pmeta_len;
+            data = packed;
+        } else {
+            flags &= ~RANS_ORDER_PACK;
+        }
+    }
+
+    if (flags & RANS_ORDER_RLE) {
+        uint32_t lit_len, meta_len, cmeta_len;
+        uint8_t *e;
+
+        lit = malloc(data_len + 1);
+        meta = malloc(data_len + 263);
+        if (!lit || !meta)
+            goto err;
+
+        if (rle_encode(data, data_len, lit, &lit_len, meta, &meta_len) < 0
+            || (uint64_t) lit_len + meta_len >= data_len) {
+            flags &= ~RANS_ORDER_RLE;
+        } else {
+            if (out_end - cp < 15 + meta_len)
+                goto err;
+            if ((cmeta = malloc(meta_len + 1316))
+                && (e = rans_enc_O0(meta, meta_len, cmeta,
+                                    cmeta + meta_len + 1316, 4))
+                && (cmeta_len = e - cmeta) < meta_len) {
+                cp += var_put_u32(cp, NULL, meta_len*2);
+                cp += var_put_u32(cp, NULL, lit_len);
+                cp += var_put_u32(cp, NULL, cmeta_len);
+                memcpy(cp, cmeta, cmeta_len);
+                cp += cmeta_len;
+            } else {
+                cp += var_put_u32(cp, NULL, meta_len*2 + 1);
+                cp += var_put_u32(cp, NULL, lit_len);
+                memcpy(cp, meta, meta_len);
+                cp += meta_len;
+            }
+            data = lit;
+            data_len = lit_len;
+        }
+    }
+
+    if (!(flags & RANS_ORDER_CAT) && data_len) {
+        uint8_t *e = (flags & 1)
+            ? rans_enc_O1(data, data_len, cp, out_end, N)
+            : rans_enc_O0(data, data_len, cp, out_end, N);
+        if (e && e - cp < data_len) {
+            ret = e;
+            goto done;
+        }
+    }
+
+    // Not worth entropy coding
+    flags |= RANS_ORDER_CAT;
+    if (out_end - cp < data_len)
+        goto err;
+    memcpy(cp, data, data_len);
+    ret = cp + data_len;
+
+ done:
+    out[0] = flags;
+ err:
+    free(packed);
+    free(lit);
+    free(meta);
+    free(cmeta);
+    return ret;
+}
+
+/*
+ * Splits the input into N streams of every Nth byte, each compressed
+ * independently.
+ */
+static uint8_t *compress_stripe(const uint8_t *in, uint32_t in_size,
+                                uint8_t *out, uint8_t *out_end, int order)
+{
+    int N = (order >> 8) & 0xff, j;
+    int sub_order = (order & 0xff & ~RANS_ORDER_STRIPE) | RANS_ORDER_NOSZ;
+    uint8_t *cp = out, *tmp = NULL, *ret = NULL, **sub;
+    uint32_t *clen, i, k;
+
+    if (!N)
+        N = 4;
+    sub = calloc(N, sizeof(*sub));
+    clen = malloc(N * sizeof(*clen));
+    tmp = malloc(in_size / N + 1);
+    if (!sub || !clen || !tmp)
+        goto err;
+
+    for (j = 0; j < N; j++) {
+        uint32_t ulen = in_size / N + (j < in_size % N);
+        for (i = j, k = 0; i < in_size; i += N)
+            tmp[k++] = in[i];
+        clen[j] = rans_compress_bound_4x16(ulen, sub_order);
+        if (!(sub[j] = malloc(clen[j])))
+            goto err;
+        if (!rans_compress_to_4x16(tmp, ulen, sub[j], &clen[j], sub_order))
+            goto err;
+    }
+
+    if (out_end - cp < 7 + 5*N)
+        goto err;
+    *cp++ = RANS_ORDER_STRIPE | (order & RANS_ORDER_NOSZ);
+    if (!(order & RANS_ORDER_NOSZ))
+        cp += var_put_u32(cp, NULL, in_size);
+    *cp++ = N;
+    for (j = 0; j < N; j++)
+        cp += var_put_u32(cp, NULL, clen[j]);
+    for (j = 0; j < N; j++) {
+        if (out_end - cp < clen[j])
+            goto err;
+        memcpy(cp, sub[j], clen[j]);
+        cp += clen[j];
+    }
+    ret = cp;
+
+ err:
+    if (sub)
+        for (j = 0; j < N; j++)
+            free(sub[j]);
+    free(sub);
+    free(clen);
+    free(tmp);
+    return ret;
+}
+
+unsigned char *rans_compress_to_4x16(unsigned char *in, unsigned int in_size,
+                                     unsigned char *out,
+                                     unsigned int *out_size, int order)
+{
+    unsigned char *end;
+    int alloced = 0;
+
+    if (!out) {
+        *out_size = rans_compress_bound_4x16(in_size, order);
+        if (!(out = malloc(*out_size)))
+            return NULL;
+        alloced = 1;
+    }
+
+    end = (order & RANS_ORDER_STRIPE)
+        ? compress_stripe(in, in_size, out, out + *out_size, order)
+        : compress_block(in, in_size, out, out + *out_size, order);
+    if (!end) {
+        if (alloced)
+            free(out);
+        return NULL;
+    }
+
+    *out_size = end - out;
+    return out;
+}
+
+unsigned char *rans_compress_4x16(unsigned char *in, unsigned int in_size,
+                                  unsigned int *out_size, int order)
+{
+    return rans_compress_to_4x16(in, in_size, NULL, out_size, order);
+}
+
+// Uncompresses the data after the flags and size of a non-striped stream.
+static int uncompress_block(const uint8_t *cp, const uint8_t *end, int flags,
+                            uint8_t *out, uint32_t osz)
+{
+    int N = (flags & RANS_ORDER_X32) ? 32 : 4, nsym = 0, n, ret = -1;
+    uint8_t P[16] = {0}, *meta_buf = NULL, *body = NULL, *rle_out = NULL;
+    uint32_t plen = osz, lit_len = 0, meta_len = 0, body_len;
+    const uint8_t *meta = NULL;
+
+    if (!osz)
+        return 0;
+
+    if (flags & RANS_ORDER_PACK) {
+        if (!(n = hts_unpack_meta(cp, end, osz, P, &nsym, &plen)))
+            return -1;
+        cp += n;
+    }
+
+    if (flags & RANS_ORDER_RLE) {
+        uint32_t u_meta, c_meta;
+        if (!(n = var_get_u32(cp, end, &u_meta)))
+            return -1;
+        cp += n;
+        if (!(n = var_get_u32(cp, end, &lit_len)))
+            return -1;
+        cp += n;
+        meta_len = u_meta / 2;
+        if (lit_len > plen || meta_len > (uint64_t) plen * 5 + 263)
+            return -1;
+        if (u_meta & 1) {
+            if (meta_len > end - cp)
+                return -1;
+            meta = cp;
+            cp += meta_len;
+        } else {
+            if (!(n = var_get_u32(cp, end, &c_meta)))
+                return -1;
+            cp += n;
+            if (c_meta > end - cp || !(meta_buf = malloc(meta_len + 1)))
+                return -1;
+            if (!rans_dec_O0(cp, cp + c_meta, meta_buf, meta_len, 4))
+                goto err;
+            cp += c_meta;
+            meta = meta_buf;
+        }
+    }
+
+    body_len = (flags & RANS_ORDER_RLE) ? lit_len : plen;
+    if (flags & (RANS_ORDER_RLE | RANS_ORDER_PACK)) {
+        if (!(body = malloc(body_len + 1)))
+            goto err;
+    } else {
+        body = out;
+    }
+
+    if (flags & RANS_ORDER_CAT) {
+        if (body_len > end - cp)
+            goto err;
+        memcpy(body, cp, body_len);
+    } else if (flags & 1) {
+        if (!rans_dec_O1(cp, end, body, body_len, N))
+            goto err;
+    } else {
+        if (!rans_dec_O0(cp, end, body, body_len, N))
+            goto err;
+    }
+
+    if (flags & RANS_ORDER_RLE) {
+        rle_out = (flags & RANS_ORDER_PACK) ? malloc(plen + 1) : out;
+        if (!rle_out
+            || rle_decode(body, lit_len, meta, meta_len, rle_out, plen) < 0)
+            goto err;
+        free(body);
+        body = rle_out;
+        rle_out = NULL;
+    }
+
+    if (flags & RANS_ORDER_PACK)
+        hts_unpack(body, P, nsym, out, osz);
+
+    ret = 0;
+
+ err:
+    if (body != out)
+        free(body);
+    if (rle_out != out)
+        free(rle_out);
+    free(meta_buf);
+    return ret;
+}
+
+static int uncompress_stream(const uint8_t *in, uint32_t in_size,
+                             uint8_t *out, uint32_t *out_size,
+                             int allow_stripe);
+
+static int uncompress_stripe(const uint8_t *cp, const uint8_t *end,
+                             uint8_t *out, uint32_t osz)
+{
+    uint32_t clen[256], i, k;
+    uint8_t *tmp;
+    int N, j, n;
+
+    if (cp >= end || !(N = *cp++))
+        return -1;
+    for (j = 0; j < N; j++) {
+        if (!(n = var_get_u32(cp, end, &clen[j])))
+            return -1;
+        cp += n;
+    }
+
+    if (!(tmp = malloc(osz / N + 1)))
+        return -1;
+    for (j = 0; j < N; j++) {
+        uint32_t ulen = osz / N + (j < osz % N);
+        if (clen[j] > end - cp
+            || uncompress_stream(cp, clen[j], tmp, &ulen, 0) < 0
+            || ulen != osz / N + (j < osz % N)) {
+            free(tmp);
+            return -1;
+        }
+        for (i = j, k = 0; i < osz; i += N)
+            out[i] = tmp[k++];
+        cp += clen[j];
+    }
+
+    free(tmp);
+    return 0;
+}
+
+static int uncompress_stream(const uint8_t *in, uint32_t in_size,
+                             uint8_t *out, uint32_t *out_size,
+                             int allow_stripe)
+{
+    const uint8_t *cp = in, *end = in + in_size;
+    uint32_t osz;
+    int flags, n;
+
+    if (!in_size)
+        return -1;
+    flags = *cp++;
+
+    if (flags & RANS_ORDER_NOSZ) {
+        osz = *out_size;
+    } else {
+        if (!(n = var_get_u32(cp, end, &osz)) || osz > *out_size)
+            return -1;
+        cp += n;
+    }
+
+    if (flags & RANS_ORDER_STRIPE) {
+        if (!allow_stripe || uncompress_stripe(cp, end, out, osz) < 0)
+            return -1;
+    } else if (uncompress_block(cp, end, flags, out, osz) < 0) {
+        return -1;
+    }
+
+    *out_size = osz;
+    return 0;
+}
+
+unsigned char *rans_uncompress_to_4x16(unsigned char *in, unsigned int in_size,
+                                       unsigned char *out,
+                                       unsigned int *out_size)
+{
+    uint32_t osz;
+    int alloced = 0;
+
+    if (!in_size)
+        return NULL;
+
+    if (!out) {
+        if (in[0] & RANS_ORDER_NOSZ) {
+            osz = *out_size;
+        } else if (!var_get_u32(in + 1, in + in_size, &osz)) {
+            return NULL;
+        }
+        if (osz > INT_MAX || !(out = malloc(osz ? osz : 1)))
+            return NULL;
+        *out_size = osz;
+        alloced = 1;
+    }
+
+    if (uncompress_stream(in, in_size, out, out_size, 1) < 0) {
+        if (alloced)
+            free(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+unsigned char *rans_uncompress_4x16(unsigned char *in, unsigned int in_size,
+                                    unsigned int *out_size)
+{
+    return rans_uncompress_to_4x16(in, in_size, NULL, out_size);
+}
@@ -0,0 +1,76 @@
+/* rans_word.h is derived from rans_byte.h, originally from
+ * https://github.com/rygorous/ryg_rans
+ *
+ * This is a public-domain implementation of several rANS variants. rANS is an
+ * entropy coder from the ANS family, as described in Jarek Duda's paper
+ * "Asymmetric numeral systems" (http://arxiv.org/abs/1311.2540).
+ */
+
+/*-------------------------------------------------------------------------- */
+
+// rANS encoder/decoder with 16-bit renormalisation, as used by the CRAM 3.1
+// rANS Nx16 codec.  The state is kept in [RANS_WORD_L, RANS_WORD_L << 16),
+// so at most one 16-bit word is moved per symbol.  See rANS_byte.h for the
+// general notes on encoding in reverse.
+
+#ifndef RANS_WORD_HEADER
+#define RANS_WORD_HEADER
+
+#include <stdint.h>
+
+#define RANS_WORD_L (1u << 15)  // lower bound of our normalization interval
+
+typedef uint32_t RansWordState;
+
+// Initialize a rANS encoder.
+static inline void RansWordEncInit(RansWordState* r)
+{
+    *r = RANS_WORD_L;
+}
+
+// Encodes a single symbol with range start "start" and frequency "freq".
+// All frequencies are assumed to sum to "1 << scale_bits", and the
+// resulting 16-bit words get written backwards to ptr (which is updated).
+static inline void RansWordEncPut(RansWordState* r, uint8_t** pptr,
+                                  uint32_t start, uint32_t freq,
+                                  uint32_t scale_bits)
+{
+    uint32_t x = *r;
+    uint32_t x_max = ((RANS_WORD_L >> scale_bits) << 16) * freq;
+
+    if (x >= x_max) {
+        uint8_t* ptr = *pptr;
+        ptr -= 2;
+        ptr[0] = (uint8_t) (x & 0xff);
+        ptr[1] = (uint8_t) ((x >> 8) & 0xff);
+        x >>= 16;
+        *pptr = ptr;
+    }
+
+    // x = C(s,x)
+    *r = ((x / freq) << scale_bits) + (x % freq) + start;
+}
+
+// Flushes the rANS encoder.
+static inline void RansWordEncFlush(RansWordState* r, uint8_t** pptr)
+{
+    uint32_t x = *r;
+    uint8_t* ptr = *pptr;
+
+    ptr -= 4;
+    ptr[0] = (uint8_t) (x >> 0);
+    ptr[1] = (uint8_t) (x >> 8);
+    ptr[2] = (uint8_t) (x >> 16);
+    ptr[3] = (uint8_t) (x >> 24);
+
+    *pptr = ptr;
+}
+
+// Initializes a rANS decoder from the four bytes at ptr.
+static inline RansWordState RansWordDecInit(const uint8_t* ptr)
+{
+    return  (uint32_t) ptr[0]        | ((uint32_t) ptr[1] << 8)
+         | ((uint32_t) ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+#endif // RANS_WORD_HEADER
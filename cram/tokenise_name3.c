@@ -0,0 +1,716 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The CRAM 3.1 read name tokeniser.
+ *
+ * Each name is split into alphabetic, numeric and punctuation tokens.
+ * Token i of every name is compared against token i of the previous name,
+ * and described as a match, a small numeric delta or a new value.  Token
+ * position 0 says whether the name is a duplicate of an earlier one, and
+ * if not, which earlier name the comparisons are made against.
+ *
+ * The token types and values for each position go to separate streams,
+ * so every stream holds similar data and compresses well with rANS Nx16
+ * or, for small blocks, the adaptive arithmetic coder.
+ *
+ * The data starts with the uncompressed size and the number of names as
+ * 32-bit little endian values, followed by a byte that is 1 for adaptive
+ * arithmetic coded streams or 0 for rANS Nx16.  Then
+ * for each stream there is a byte holding the token type in the bottom 6
+ * bits, 0x80 if this is the first stream of a new token position, and
+ * 0x40 if it is a copy of an earlier stream.  A copy is followed by the
+ * position and type of the stream it duplicates.  Otherwise a uint7 length
+ * and the compressed data follow.  When the first stream of a position is
+ * not the type stream, the type stream is taken to be that type for every
+ * name.
+ */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../htslib/khash.h"
+#include "../htslib/kstring.h"
+#include "tokenise_name3.h"
+#include "arith_dynamic.h"
+#include "rANS_static4x16.h"
+#include "varint.h"
+
+enum name_type {
+    N_TYPE = 0, N_ALPHA, N_CHAR, N_DIGITS0, N_DZLEN, N_DUP, N_DIFF,
+    N_DIGITS, N_DDELTA, N_DDELTA0, N_MATCH, N_NOP, N_END
+};
+
+// Token positions per name, including position 0 and the N_END token.
+// Stream copies store the position in a byte, so this cannot exceed 256.
+#define MAX_TOKENS 128
+#define MAX_TYPES  16
+#define MAX_DIGITS 9 // So numeric tokens fit in 32 bits
+
+#define DESC(t,type) ((t)*MAX_TYPES + (type))
+
+KHASH_MAP_INIT_STR(tok3_name, int)
+
+/* ------------------------------------------------------------------------
+ * Encoder
+ */
+
+typedef struct {
+    int type;      // N_ALPHA, N_CHAR, N_DIGITS or N_DIGITS0
+    int start;     // offset within the name
+    int len;
+    uint32_t val;  // for N_DIGITS and N_DIGITS0
+} token;
+
+static inline int is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline int is_alpha(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/*
+ * Splits name into tokens.  Digit runs too long for 32 bits are treated
+ * as text, and anything beyond the token limit goes into one final text
+ * token.
+ *
+ * Returns the number of tokens.
+ */
+static int tokenise(const char *name, int len, token *tok) {
+    int i = 0, n = 0;
+
+    while (i < len) {
+        int j = i + 1;
+
+        tok[n].start = i;
+        tok[n].val = 0;
+        if (n == MAX_TOKENS-3) {
+            j = len;
+            tok[n].type = N_ALPHA;
+        } else if (is_digit(name[i])) {
+            while (j < len && is_digit(name[j]))
+                j++;
+            if (j - i > MAX_DIGITS) {
+                tok[n].type = N_ALPHA;
+            } else {
+                int k;
+                for (k = i; k < j; k++)
+                    tok[n].val = tok[n].val * 10 + name[k] - '0';
+                tok[n].type = name[i] == '0' && j - i > 1
+                    ? N_DIGITS0 : N_DIGITS;
+            }
+        } else if (is_alpha(name[i])) {
+            while (j < len && is_alpha(name[j]))
+                j++;
+            tok[n].type = N_ALPHA;
+        } else {
+            tok[n].type = N_CHAR;
+        }
+        tok[n].len = j - i;
+        n++;
+        i = j;
+    }
+
+    return n;
+}
+
+static inline int put_u8(kstring_t *desc, int t, int type, uint32_t v) {
+    return kputc(v & 0xff, &desc[DESC(t, type)]) < 0 ? -1 : 0;
+}
+
+static inline int put_u32(kstring_t *desc, int t, int type, uint32_t v) {
+    unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+    return kputsn((char *)b, 4, &desc[DESC(t, type)]) < 0 ? -1 : 0;
+}
+
+/*
+ * Describes token t of name against the matching token of the previous
+ * name, if any.
+ */
+static int encode_token(kstring_t *desc, int t, const char *name,
+                        const token *c, const char *pname, const token *p) {
+    int err = 0;
+
+    if (p && c->type == p->type && c->len == p->len
+        && memcmp(name + c->start, pname + p->start, c->len) == 0)
+        return put_u8(desc, t, N_TYPE, N_MATCH);
+
+    // Small increments of a number, keeping any leading zeros
+    if (p && (c->type == N_DIGITS || c->type == N_DIGITS0)
+        && (p->type == N_DIGITS || p->type == N_DIGITS0)
+        && c->val > p->val && c->val - p->val < 256) {
+        if (c->type == N_DIGITS) {
+            err |= put_u8(desc, t, N_TYPE, N_DDELTA);
+            err |= put_u8(desc, t, N_DDELTA, c->val - p->val);
+            return err;
+        }
+        if (c->len == p->len) {
+            err |= put_u8(desc, t, N_TYPE, N_DDELTA0);
+            err |= put_u8(desc, t, N_DDELTA0, c->val - p->val);
+            return err;
+        }
+    }
+
+    err |= put_u8(desc, t, N_TYPE, c->type);
+    switch (c->type) {
+    case N_DIGITS:
+        err |= put_u32(desc, t, N_DIGITS, c->val);
+        break;
+    case N_DIGITS0:
+        err |= put_u32(desc, t, N_DIGITS0, c->val);
+        err |= put_u8(desc, t, N_DZLEN, c->len);
+        break;
+    case N_CHAR:
+        err |= put_u8(desc, t, N_CHAR, (unsigned char)name[c->start]);
+        break;
+    default: // N_ALPHA
+        err |= kputsn(name + c->start, c->len,
+                      &desc[DESC(t, N_ALPHA)]) < 0;
+        err |= kputc(0, &desc[DESC(t, N_ALPHA)]) < 0;
+        break;
+    }
+
+    return err ? -1 : 0;
+}
+
+/*
+ * Appends the uint7 size and rANS Nx16 or arithmetic coded form of a
+ * stream to out, choosing whichever of the methods allowed by level is
+ * smallest.  The two codecs share the meaning of these flags.
+ */
+static int compress_stream(kstring_t *out, const kstring_t *s, int type,
+                           int level, int use_arith) {
+    static const int orders[] = {
+        RANS_ORDER_CAT, 0, 1,
+        RANS_ORDER_RLE, RANS_ORDER_RLE | 1,
+        RANS_ORDER_PACK, RANS_ORDER_PACK | 1,
+        RANS_ORDER_PACK | RANS_ORDER_RLE, RANS_ORDER_PACK | RANS_ORDER_RLE | 1,
+        // 32-bit values; only tried for the numeric streams
+        RANS_ORDER_STRIPE | (4<<8), RANS_ORDER_STRIPE | (4<<8) | 1,
+    };
+    int norders = level < 4 ? 3 : level < 6 ? 9 : 11;
+    int numeric = type == N_DIGITS || type == N_DIGITS0
+        || type == N_DUP || type == N_DIFF;
+    unsigned char *best = NULL, *tmp = NULL;
+    unsigned int best_len = 0;
+    uint8_t len[5];
+    int i, ret = -1;
+
+    for (i = 0; i < norders; i++) {
+        unsigned int clen = use_arith
+            ? arith_compress_bound(s->l, orders[i])
+            : rans_compress_bound_4x16(s->l, orders[i]);
+        unsigned char *t;
+
+        if ((orders[i] & RANS_ORDER_STRIPE) && !numeric)
+            continue;
+        if (!(t = realloc(tmp, clen)))
+            goto err;
+        tmp = t;
+        if (!(use_arith
+              ? arith_compress_to((unsigned char *)s->s, s->l, tmp, &clen,
+                                  orders[i])
+              : rans_compress_to_4x16((unsigned char *)s->s, s->l, tmp, &clen,
+                                      orders[i])))
+            continue;
+        if (!best || clen < best_len) {
+            t = best; best = tmp; tmp = t;
+            best_len = clen;
+        }
+    }
+    if (!best)
+        goto err;
+
+    if (kputsn((char *)len, var_put_u32(len, NULL, best_len), out) < 0
+        || kputsn((char *)best, best_len, out) < 0)
+        goto err;
+    ret = 0;
+
+ err:
+    free(best);
+    free(tmp);
+    return ret;
+}
+
+// Returns the type held by every entry of the stream, or -1 if it varies
+static int constant_type(const kstring_t *s) {
+    size_t i;
+    for (i = 1; i < s->l; i++)
+        if (s->s[i] != s->s[0])
+            return -1;
+    return s->l ? (unsigned char)s->s[0] : -1;
+}
+
+/*
+ * Appends the streams to out, in order of token position and then type.
+ */
+static int write_streams(kstring_t *out, kstring_t *desc, int ntok,
+                         int level, int use_arith) {
+    char *written = calloc(ntok, MAX_TYPES);
+    int t, type, i, ret = -1;
+
+    if (!written)
+        return -1;
+
+    for (t = 0; t < ntok; t++) {
+        int ctype = constant_type(&desc[DESC(t, N_TYPE)]);
+        int order[MAX_TYPES], n = 0;
+
+        if (!desc[DESC(t, N_TYPE)].l)
+            continue; // No names
+        // A constant type stream is implied by the first data stream
+        if (ctype > N_TYPE && ctype < MAX_TYPES && desc[DESC(t, ctype)].l)
+            order[n++] = ctype;
+        else
+            order[n++] = ctype = N_TYPE;
+        for (type = N_TYPE+1; type < MAX_TYPES; type++)
+            if (type != ctype && desc[DESC(t, type)].l)
+                order[n++] = type;
+
+        for (i = 0; i < n; i++) {
+            int id = DESC(t, order[i]), d;
+            int ttype = order[i] | (i == 0 ? 0x80 : 0);
+            kstring_t *s = &desc[id];
+
+            // Identical streams are stored once
+            for (d = 0; d < ntok * MAX_TYPES; d++)
+                if (written[d] && desc[d].l == s->l
+                    && memcmp(desc[d].s, s->s, s->l) == 0)
+                    break;
+
+            if (d < ntok * MAX_TYPES) {
+                if (kputc(ttype | 0x40, out) < 0
+                    || kputc(d / MAX_TYPES, out) < 0
+                    || kputc(d % MAX_TYPES, out) < 0)
+                    goto err;
+            } else {
+                if (kputc(ttype, out) < 0
+                    || compress_stream(out, s, order[i], level,
+                                       use_arith) < 0)
+                    goto err;
+            }
+            written[id] = 1;
+        }
+    }
+    ret = 0;
+
+ err:
+    free(written);
+    return ret;
+}
+
+unsigned char *tok3_encode_names(char *blk, int len, int level,
+                                 int use_arith, int *out_len)
+{
+    kstring_t *desc = NULL, out = {0, 0, NULL};
+    khash_t(tok3_name) *hash = NULL;
+    token tok[2][MAX_TOKENS], *ctok = tok[0], *ptok = NULL;
+    char *names = NULL, *pname = NULL, *name;
+    int ntok = 0, pntok = 0, max_t = 1, nnames = 0, i, err = 0;
+    unsigned char hdr[9];
+
+    if (len < 0)
+        return NULL;
+
+    // A private NUL terminated copy, so names can be used as hash keys
+    if (!(names = malloc(len + 1)))
+        goto err;
+    memcpy(names, blk, len);
+    names[len] = 0;
+
+    if (!(desc = calloc(MAX_TOKENS * MAX_TYPES, sizeof(*desc)))
+        || !(hash = kh_init(tok3_name)))
+        goto err;
+
+    for (name = names; name < names + len; nnames++) {
+        int nlen = strlen(name), r;
+        khiter_t k;
+
+        ntok = tokenise(name, nlen, ctok);
+
+        k = kh_put(tok3_name, hash, name, &r);
+        if (r < 0)
+            goto err;
+        if (r == 0) {
+            err |= put_u8(desc, 0, N_TYPE, N_DUP);
+            err |= put_u32(desc, 0, N_DUP, nnames - kh_val(hash, k));
+        } else {
+            err |= put_u8(desc, 0, N_TYPE, N_DIFF);
+            err |= put_u32(desc, 0, N_DIFF, nnames ? 1 : 0);
+            if (max_t < ntok + 2)
+                max_t = ntok + 2;
+            for (i = 0; i < ntok; i++)
+                err |= encode_token(desc, i + 1, name, &ctok[i], pname,
+                                    i < pntok ? &ptok[i] : NULL);
+            err |= put_u8(desc, ntok + 1, N_TYPE, N_END);
+        }
+        if (err)
+            goto err;
+        kh_val(hash, k) = nnames;
+
+        pname = name;
+        pntok = ntok;
+        ptok = ctok;
+        ctok = tok[ctok == tok[0]];
+        name += nlen + 1;
+    }
+
+    hdr[0] = len;       hdr[1] = len >> 8;
+    hdr[2] = len >> 16; hdr[3] = len >> 24;
+    hdr[4] = nnames;       hdr[5] = nnames >> 8;
+    hdr[6] = nnames >> 16; hdr[7] = nnames >> 24;
+    hdr[8] = use_arith ? 1 : 0;
+    if (kputsn((char *)hdr, 9, &out) < 0
+        || write_streams(&out, desc, max_t, level, use_arith) < 0)
+        goto err;
+
+    for (i = 0; i < MAX_TOKENS * MAX_TYPES; i++)
+        free(desc[i].s);
+    free(desc);
+    kh_destroy(tok3_name, hash);
+    free(names);
+
+    *out_len = out.l;
+    return (unsigned char *)out.s;
+
+ err:
+    if (desc) {
+        for (i = 0; i < MAX_TOKENS * MAX_TYPES; i++)
+            free(desc[i].s);
+        free(desc);
+    }
+    if (hash)
+        kh_destroy(tok3_name, hash);
+    free(names);
+    free(out.s);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------
+ * Decoder
+ */
+
+typedef struct {
+    unsigned char *buf;
+    uint32_t len, pos;
+} stream;
+
+// A decoded token, kept so later names can refer back to it
+typedef struct {
+    uint32_t start, len;  // within the output
+    uint32_t val;         // for numeric tokens
+} dec_token;
+
+static inline int get_u8(stream *s, uint32_t *v) {
+    if (s->len - s->pos < 1)
+        return -1;
+    *v = s->buf[s->pos++];
+    return 0;
+}
+
+static inline int get_u32(stream *s, uint32_t *v) {
+    const unsigned char *b = s->buf + s->pos;
+    if (s->len - s->pos < 4)
+        return -1;
+    *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    s->pos += 4;
+    return 0;
+}
+
+// Writes v in decimal, zero padded to width, at out[*op] before end
+static int put_number(unsigned char *out, uint32_t *op, uint32_t end,
+                      uint32_t v, uint32_t width) {
+    unsigned char tmp[10];
+    uint32_t n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+
+    if (width < n)
+        width = n;
+    if (end - *op < width)
+        return -1;
+    for (; width > n; width--)
+        out[(*op)++] = '0';
+    while (n)
+        out[(*op)++] = tmp[--n];
+
+    return 0;
+}
+
+// Reads the streams following the header into desc
+static int read_streams(const unsigned char *cp, const unsigned char *end,
+                        stream *desc, uint32_t nnames, int use_arith) {
+    int t = -1;
+
+    while (cp < end) {
+        int ttype = *cp++, type = ttype & 63, id;
+        stream *s;
+
+        if (ttype & 0x80) {
+            if (++t >= MAX_TOKENS)
+                return -1;
+            if (type != N_TYPE) {
+                s = &desc[DESC(t, N_TYPE)];
+                if (!(s->buf = malloc(nnames ? nnames : 1)))
+                    return -1;
+                memset(s->buf, type, nnames);
+                s->len = nnames;
+            }
+        }
+        if (t < 0 || type >= MAX_TYPES)
+            return -1;
+        id = DESC(t, type);
+        s = &desc[id];
+        if (s->buf)
+            return -1;
+
+        if (ttype & 0x40) {
+            stream *d;
+            if (end - cp < 2 || cp[0] >= MAX_TOKENS || cp[1] >= MAX_TYPES)
+                return -1;
+            d = &desc[DESC(cp[0], cp[1])];
+            cp += 2;
+            if (!d->buf || !(s->buf = malloc(d->len ? d->len : 1)))
+                return -1;
+            memcpy(s->buf, d->buf, d->len);
+            s->len = d->len;
+        } else {
+            uint32_t clen;
+            unsigned int ulen;
+            int n = var_get_u32(cp, end, &clen);
+            if (!n || end - (cp + n) < clen)
+                return -1;
+            cp += n;
+            if (!(s->buf = use_arith
+                  ? arith_uncompress((unsigned char *)cp, clen, &ulen)
+                  : rans_uncompress_4x16((unsigned char *)cp, clen, &ulen)))
+                return -1;
+            s->len = ulen;
+            cp += clen;
+        }
+    }
+
+    return 0;
+}
+
+unsigned char *tok3_decode_names(unsigned char *in, unsigned int sz,
+                                 unsigned int *out_len)
+{
+    stream *desc = NULL;
+    dec_token *toks = NULL;
+    uint32_t *name_start = NULL, *name_tok = NULL, *name_ntok = NULL;
+    uint32_t ulen, nnames, n, op = 0, ntoks = 0, atoks = 0, end, i;
+    unsigned char *out = NULL;
+
+    if (sz < 9)
+        return NULL;
+    ulen   = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+    nnames = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+    if (in[8] > 1 || nnames > ulen || ulen == UINT32_MAX)
+        return NULL;
+
+    // Room for a terminator on the last name even if it had none
+    end = ulen + 1;
+    if (!(desc = calloc(MAX_TOKENS * MAX_TYPES, sizeof(*desc)))
+        || !(out = malloc(end))
+        || !(name_start = malloc((nnames + 1) * sizeof(*name_start)))
+        || !(name_tok   = malloc((nnames + 1) * sizeof(*name_tok)))
+        || !(name_ntok  = malloc((nnames + 1) * sizeof(*name_ntok))))
+        goto err;
+
+    if (read_streams(in + 9, in + sz, desc, nnames, in[8]) < 0)
+        goto err;
+
+    for (n = 0; n < nnames; n++) {
+        uint32_t type, dist, t;
+
+        name_start[n] = op;
+        if (get_u8(&desc[DESC(0, N_TYPE)], &type) < 0)
+            goto err;
+
+        if (type == N_DUP) {
+            uint32_t src, nlen;
+            if (get_u32(&desc[DESC(0, N_DUP)], &dist) < 0
+                || dist == 0 || dist > n)
+                goto err;
+            src = n - dist;
+            nlen = name_start[src+1] - name_start[src];
+            if (end - op < nlen)
+                goto err;
+            memcpy(out + op, out + name_start[src], nlen);
+            op += nlen;
+            name_tok[n]  = name_tok[src];
+            name_ntok[n] = name_ntok[src];
+            name_start[n+1] = op;
+            continue;
+        }
+
+        if (type != N_DIFF || get_u32(&desc[DESC(0, N_DIFF)], &dist) < 0
+            || dist > n)
+            goto err;
+
+        name_tok[n] = ntoks;
+        for (t = 1; ; t++) {
+            dec_token *p = NULL, *c;
+            uint32_t v, w;
+
+            if (t >= MAX_TOKENS
+                || get_u8(&desc[DESC(t, N_TYPE)], &type) < 0)
+                goto err;
+            if (type == N_END)
+                break;
+
+            if (ntoks == atoks) {
+                dec_token *tmp;
+                atoks = atoks ? atoks * 2 : 1024;
+                if (!(tmp = realloc(toks, atoks * sizeof(*toks))))
+                    goto err;
+                toks = tmp;
+            }
+            if (dist && t - 1 < name_ntok[n - dist])
+                p = &toks[name_tok[n - dist] + t - 1];
+            c = &toks[ntoks];
+            c->start = op;
+            c->val = 0;
+
+            switch (type) {
+            case N_ALPHA: {
+                stream *s = &desc[DESC(t, N_ALPHA)];
+                unsigned char *z;
+                if (s->pos >= s->len
+                    || !(z = memchr(s->buf + s->pos, 0, s->len - s->pos)))
+                    goto err;
+                w = z - (s->buf + s->pos);
+                if (end - op < w)
+                    goto err;
+                memcpy(out + op, s->buf + s->pos, w);
+                op += w;
+                s->pos += w + 1;
+                break;
+            }
+
+            case N_CHAR:
+                if (get_u8(&desc[DESC(t, N_CHAR)], &v) < 0 || op == end)
+                    goto err;
+                out[op++] = v;
+                break;
+
+            case N_DIGITS:
+                if (get_u32(&desc[DESC(t, N_DIGITS)], &v) < 0
+                    || put_number(out, &op, end, v, 0) < 0)
+                    goto err;
+                c->val = v;
+                break;
+
+            case N_DIGITS0:
+                if (get_u32(&desc[DESC(t, N_DIGITS0)], &v) < 0
+                    || get_u8(&desc[DESC(t, N_DZLEN)], &w) < 0
+                    || put_number(out, &op, end, v, w) < 0)
+                    goto err;
+                c->val = v;
+                break;
+
+            case N_DDELTA:
+            case N_DDELTA0:
+                if (!p || get_u8(&desc[DESC(t, type)], &v) < 0)
+                    goto err;
+                v += p->val;
+                if (put_number(out, &op, end, v,
+                               type == N_DDELTA0 ? p->len : 0) < 0)
+                    goto err;
+                c->val = v;
+                break;
+
+            case N_MATCH:
+                if (!p || end - op < p->len)
+                    goto err;
+                memcpy(out + op, out + p->start, p->len);
+                op += p->len;
+                c->val = p->val;
+                break;
+
+            case N_NOP:
+                break;
+
+            default:
+                goto err;
+            }
+
+            c->len = op - c->start;
+            ntoks++;
+        }
+        name_ntok[n] = ntoks - name_tok[n];
+
+        if (op == end)
+            goto err;
+        out[op++] = 0;
+        name_start[n+1] = op;
+    }
+
+    // The final terminator is optional
+    if (op == end && out[ulen] == 0)
+        op = ulen;
+    if (op != ulen)
+        goto err;
+
+    for (i = 0; i < MAX_TOKENS * MAX_TYPES; i++)
+        free(desc[i].buf);
+    free(desc);
+    free(toks);
+    free(name_start);
+    free(name_tok);
+    free(name_ntok);
+
+    *out_len = ulen;
+    return out;
+
+ err:
+    if (desc) {
+        for (i = 0; i < MAX_TOKENS * MAX_TYPES; i++)
+            free(desc[i].buf);
+        free(desc);
+    }
+    free(toks);
+    free(name_start);
+    free(name_tok);
+    free(name_ntok);
+    free(out);
+    return NULL;
+}
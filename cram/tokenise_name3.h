@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TOKENISE_NAME3_H
+#define TOKENISE_NAME3_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compresses a block of read names with the CRAM 3.1 name tokeniser.
+ *
+ * "blk" holds len bytes of names, each terminated by a NUL.  The last
+ * terminator may be omitted.  The token streams are compressed with the
+ * adaptive arithmetic coder if use_arith is set, or with rANS Nx16
+ * otherwise.  Higher levels try more variants of either for each stream.
+ *
+ * Returns the compressed data, with its size in *out_len, or NULL on
+ * failure.  The caller should free the result.
+ */
+unsigned char *tok3_encode_names(char *blk, int len, int level,
+                                 int use_arith, int *out_len);
+
+/*
+ * Uncompresses sz bytes of name tokeniser data.
+ *
+ * Returns the NUL terminated names, with their total size in *out_len, or
+ * NULL on failure.  The caller should free the result.
+ */
+unsigned char *tok3_decode_names(unsigned char *in, unsigned int sz,
+                                 unsigned int *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TOKENISE_NAME3_H */
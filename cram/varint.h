@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2026 Genome Research Ltd.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *    3. Neither the names Genome Research Ltd and Wellcome Trust Sanger
+ *       Institute nor the names of its contributors may be used to endorse
+ *       or promote products derived from this software without specific
+ *       prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY GENOME RESEARCH LTD AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL GENOME RESEARCH
+ * LTD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The uint7 variable sized integer encoding used by the CRAM 3.1 codecs.
+ * Values are stored big-endian in 7-bit groups, with the top bit of each
+ * byte set when more bytes follow.
+ */
+
+#ifndef CRAM_VARINT_H
+#define CRAM_VARINT_H
+
+#include <stdint.h>
+
+/*
+ * Writes i to cp, which must not go beyond endp.
+ * Returns the number of bytes written, or 0 if there was no room.
+ */
+static inline int var_put_u32(uint8_t *cp, const uint8_t *endp, uint32_t i)
+{
+    uint8_t buf[5];
+    int n = 0, j;
+
+    do {
+        buf[n++] = i & 0x7f;
+        i >>= 7;
+    } while (i);
+
+    if (endp && endp - cp < n)
+        return 0;
+
+    for (j = n-1; j >= 0; j--)
+        *cp++ = buf[j] | (j ? 0x80 : 0);
+
+    return n;
+}
+
+/*
+ * Reads a value from cp, which must not go beyond endp, into *i.
+ * Returns the number of bytes read, or 0 if the value is truncated or
+ * too large.
+ */
+static inline int var_get_u32(const uint8_t *cp, const uint8_t *endp,
+                              uint32_t *i)
+{
+    const uint8_t *op = cp;
+    uint32_t j = 0;
+    int c;
+
+    do {
+        if (cp >= endp || cp - op >= 5)
+            return 0;
+        c = *cp++;
+        j = (j << 7) | (c & 0x7f);
+    } while (c & 0x80);
+
+    *i = j;
+    return cp - op;
+}
+
+#endif /* CRAM_VARINT_H */
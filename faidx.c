@@ -35,10 +35,18 @@ DEALINGS IN THE SOFTWARE.  */
 #include <limits.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "htslib/bgzf.h"
 #include "htslib/faidx.h"
 #include "htslib/hfile.h"
+#include "htslib/hts_endian.h"
 #include "htslib/khash.h"
 #include "htslib/kstring.h"
 #include "hts_internal.h"
@@ -49,6 +57,7 @@ typedef struct {
     uint64_t len;
     uint64_t seq_offset;
     uint64_t qual_offset;
+    uint64_t bin_offset; // offset of the sequence in fai->bin
 } faidx1_t;
 KHASH_MAP_INIT_STR(s, faidx1_t)
 
@@ -58,8 +67,26 @@ struct __faidx_t {
     char **name;
     khash_t(s) *hash;
     enum fai_format_options format;
+
+    // Memory mapped data when loaded with FAI_MMAP.  Either the line-free
+    // ".bin" sidecar (bin) or the uncompressed FASTA file itself (map).
+    const char *map, *bin;
+    size_t map_len, bin_len;
+    unsigned bin_flags;
 };
 
+/*
+ * The ".bin" sidecar holds every sequence in index order with no line
+ * breaks or headers, after a 16 byte header of:
+ *
+ *   "FAIBIN\1\0"  magic and format version
+ *   uint32_t      flags (little endian); FAI_BIN_UPPER if no lower case
+ *   uint32_t      number of sequences
+ */
+#define FAI_BIN_MAGIC "FAIBIN\1\0"
+#define FAI_BIN_HDR_LEN 16
+#define FAI_BIN_UPPER 1
+
 static int fai_name2id(void *v, const char *ref)
 {
     faidx_t *fai = (faidx_t *)v;
@@ -429,6 +456,11 @@ void fai_destroy(faidx_t *fai)
     free(fai->name);
     kh_destroy(s, fai->hash);
     if (fai->bgzf) bgzf_close(fai->bgzf);
+#ifdef HAVE_MMAP
+    if (fai->map) munmap((void *) fai->map, fai->map_len);
+    if (fai->bin) munmap((void *) (fai->bin - FAI_BIN_HDR_LEN),
+                         fai->bin_len + FAI_BIN_HDR_LEN);
+#endif
     free(fai);
 }
 
@@ -540,6 +572,194 @@ int fai_build(const char *fn) {
 }
 
 
+static hts_pos_t fai_retrieve_into(const faidx_t *fai, const faidx1_t *val,
+                                   uint64_t offset, hts_pos_t beg,
+                                   hts_pos_t end, char *dst);
+
+#ifdef HAVE_MMAP
+// Maps an entire local file read-only.  Returns 0 on success, -1 on failure.
+static int fai_map_file(const char *fn, const char **map, size_t *len,
+                        struct stat *sbuf)
+{
+    void *m;
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, sbuf) != 0 || !S_ISREG(sbuf->st_mode)
+        || sbuf->st_size == 0 || (uint64_t) sbuf->st_size > SIZE_MAX) {
+        close(fd);
+        return -1;
+    }
+    m = mmap(NULL, sbuf->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return -1;
+    *map = m;
+    *len = sbuf->st_size;
+    return 0;
+}
+
+/*
+ * Writes the line-free ".bin" sidecar for fai to fnbin, via a temporary
+ * file that is renamed into place once complete.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+static int fai_build_bin(faidx_t *fai, const char *fnbin)
+{
+    kstring_t tmp = KS_INITIALIZE;
+    uint8_t hdr[FAI_BIN_HDR_LEN];
+    const size_t bufsz = 1<<20;
+    uint32_t flags = FAI_BIN_UPPER;
+    char *buf = NULL;
+    hFILE *fp;
+    int i;
+
+    if (!(buf = malloc(bufsz))) return -1;
+    if (!(fp = hts_open_tmpfile(fnbin, "wx", &tmp))) {
+        hts_log_warning("Couldn't create %s : %s", fnbin, strerror(errno));
+        free(buf);
+        return -1;
+    }
+
+    memcpy(hdr, FAI_BIN_MAGIC, 8);
+    u32_to_le(0, hdr + 8);
+    u32_to_le(fai->n, hdr + 12);
+    if (hwrite(fp, hdr, FAI_BIN_HDR_LEN) != FAI_BIN_HDR_LEN) goto fail;
+
+    for (i = 0; i < fai->n; i++) {
+        khint_t k = kh_get(s, fai->hash, fai->name[i]);
+        const faidx1_t *val = &kh_val(fai->hash, k);
+        hts_pos_t pos, len, j;
+        for (pos = 0; pos < val->len; pos += len) {
+            len = val->len - pos < bufsz ? val->len - pos : bufsz;
+            if (fai_retrieve_into(fai, val, val->seq_offset, pos, pos + len,
+                                  buf) != len)
+                goto fail;
+            if (flags & FAI_BIN_UPPER) {
+                for (j = 0; j < len; j++) {
+                    if (buf[j] >= 'a' && buf[j] <= 'z') {
+                        flags &= ~FAI_BIN_UPPER;
+                        break;
+                    }
+                }
+            }
+            if (hwrite(fp, buf, len) != len) goto fail;
+        }
+    }
+
+    u32_to_le(flags, hdr + 8);
+    if (hseek(fp, 0, SEEK_SET) != 0
+        || hwrite(fp, hdr, FAI_BIN_HDR_LEN) != FAI_BIN_HDR_LEN)
+        goto fail;
+    if (hclose(fp) != 0) {
+        fp = NULL;
+        goto fail;
+    }
+    if (rename(tmp.s, fnbin) < 0) {
+        fp = NULL;
+        goto fail;
+    }
+
+    free(buf);
+    free(tmp.s);
+    return 0;
+
+ fail:
+    hts_log_warning("Failed to write %s : %s", fnbin, strerror(errno));
+    if (fp) hclose_abruptly(fp);
+    unlink(tmp.s);
+    free(tmp.s);
+    free(buf);
+    return -1;
+}
+
+/*
+ * Maps the ".bin" sidecar if it exists and matches the index, setting
+ * up the bin_offset of each sequence.
+ *
+ * Returns 0 on success, -1 if unusable.
+ */
+static int fai_map_bin(faidx_t *fai, const char *fnbin,
+                       const struct stat *fa_sbuf)
+{
+    const char *map;
+    size_t len;
+    struct stat sbuf;
+    uint64_t offset = FAI_BIN_HDR_LEN;
+    int i;
+
+    if (fai_map_file(fnbin, &map, &len, &sbuf) < 0) return -1;
+
+    if (len < FAI_BIN_HDR_LEN || memcmp(map, FAI_BIN_MAGIC, 8) != 0
+        || le_to_u32((const uint8_t *) map + 12) != (uint32_t) fai->n
+        || sbuf.st_mtime < fa_sbuf->st_mtime) {
+        hts_log_warning("Ignoring out of date or invalid %s", fnbin);
+        goto fail;
+    }
+
+    for (i = 0; i < fai->n; i++) {
+        khint_t k = kh_get(s, fai->hash, fai->name[i]);
+        kh_val(fai->hash, k).bin_offset = offset - FAI_BIN_HDR_LEN;
+        offset += kh_val(fai->hash, k).len;
+    }
+    if (offset != len) {
+        hts_log_warning("Ignoring %s as its size does not match the index",
+                        fnbin);
+        goto fail;
+    }
+
+    fai->bin_flags = le_to_u32((const uint8_t *) map + 8);
+    fai->bin = map + FAI_BIN_HDR_LEN;
+    fai->bin_len = len - FAI_BIN_HDR_LEN;
+    return 0;
+
+ fail:
+    munmap((void *) map, len);
+    return -1;
+}
+#endif
+
+/*
+ * Sets up memory mapped access for FAI_MMAP.  This is only possible for
+ * uncompressed local files.  A line-free ".bin" sidecar is used when
+ * present (or built, if FAI_CREATE is set), otherwise the FASTA/FASTQ file
+ * itself is mapped.  Failure here is not an error; fetches simply fall
+ * back to reading through the BGZF handle.
+ */
+static void fai_mmap(faidx_t *fai, const char *fn, int flags, int format)
+{
+#ifdef HAVE_MMAP
+    kstring_t fnbin = KS_INITIALIZE;
+    struct stat sbuf;
+
+    if (fai->bgzf->is_compressed || hisremote(fn))
+        return;
+
+    if (fai_map_file(fn, &fai->map, &fai->map_len, &sbuf) < 0) {
+        fai->map = NULL;
+        return;
+    }
+
+    if (format != FAI_FASTA || ksprintf(&fnbin, "%s.bin", fn) < 0)
+        goto out;
+
+    if (fai_map_bin(fai, fnbin.s, &sbuf) == 0)
+        goto out;
+
+    if ((flags & FAI_CREATE) && fai_build_bin(fai, fnbin.s) == 0)
+        fai_map_bin(fai, fnbin.s, &sbuf);
+
+ out:
+    free(fnbin.s);
+#else
+    hts_log_info("Memory mapping is not supported on this platform");
+#endif
+}
+
+int fai_mapped_upper(const faidx_t *fai)
+{
+    return fai->bin && (fai->bin_flags & FAI_BIN_UPPER);
+}
+
 static faidx_t *fai_load3_core(const char *fn, const char *fnfai, const char *fngzi,
                    int flags, int format)
 {
@@ -653,6 +873,10 @@ static faidx_t *fai_load3_core(const char *fn, const char *fnfai, const char *fn
             goto fail;
         }
     }
+
+    if (flags & FAI_MMAP)
+        fai_mmap(fai, fn, flags, format);
+
     free(fai_kstr.s);
     free(gzi_kstr.s);
     return fai;
@@ -689,42 +913,113 @@ faidx_t *fai_load_format(const char *fn, enum fai_format_options format) {
 }
 
 
-static char *fai_retrieve(const faidx_t *fai, const faidx1_t *val,
-                          uint64_t offset, hts_pos_t beg, hts_pos_t end, hts_pos_t *len) {
-    char *s;
-    size_t l;
-    int c = 0;
+/*
+ * Copies bases beg to end (exclusive) of the sequence or quality data
+ * starting at offset into dst.  Whole lines are copied directly from the
+ * decompressed BGZF block using the index's line geometry, skipping the
+ * line terminators, instead of examining each character in turn.
+ *
+ * Returns the number of bases copied on success;
+ *         -1 on failure.
+ */
+static hts_pos_t fai_retrieve_into(const faidx_t *fai, const faidx1_t *val,
+                                   uint64_t offset, hts_pos_t beg,
+                                   hts_pos_t end, char *dst)
+{
+    BGZF *fp = fai->bgzf;
+    uint64_t line_pos = beg % val->line_blen;
+    size_t l = 0, n = end - beg;
     int ret;
 
-    if ((uint64_t) end - (uint64_t) beg >= SIZE_MAX - 2) {
-        hts_log_error("Range %"PRId64"..%"PRId64" too big", beg, end);
-        *len = -1;
-        return NULL;
+    if (fai->bin && offset == val->seq_offset) {
+        memcpy(dst, fai->bin + val->bin_offset + beg, n);
+        return n;
+    }
+
+    if (fai->map) {
+        uint64_t pos = offset + beg / val->line_blen * val->line_len
+            + line_pos;
+        while (l < n) {
+            size_t len = val->line_blen - line_pos;
+            if (len > n - l) len = n - l;
+            if (pos + len > fai->map_len) {
+                hts_log_error("Failed to retrieve block: unexpected end of file");
+                return -1;
+            }
+            memcpy(dst + l, fai->map + pos, len);
+            l += len;
+            pos += len + val->line_len - val->line_blen;
+            line_pos = 0;
+        }
+        return l;
     }
 
-    ret = bgzf_useek(fai->bgzf,
+    ret = bgzf_useek(fp,
                      offset
                      + beg / val->line_blen * val->line_len
-                     + beg % val->line_blen, SEEK_SET);
+                     + line_pos, SEEK_SET);
 
     if (ret < 0) {
-        *len = -1;
         hts_log_error("Failed to retrieve block. (Seeking in a compressed, .gzi unindexed, file?)");
+        return -1;
+    }
+
+    while (l < n) {
+        size_t avail, len;
+
+        if (fp->block_offset >= fp->block_length) {
+            if (bgzf_read_block(fp) < 0 || fp->block_length == 0) {
+                hts_log_error("Failed to retrieve block: %s",
+                              fp->block_length == 0
+                              ? "unexpected end of file"
+                              : "error reading file");
+                return -1;
+            }
+            continue;
+        }
+
+        avail = fp->block_length - fp->block_offset;
+        if (line_pos >= val->line_blen) {
+            // Skip over the end of line characters
+            len = val->line_len - line_pos;
+            if (len > avail) len = avail;
+            line_pos += len;
+            if (line_pos >= val->line_len) line_pos = 0;
+        } else {
+            len = val->line_blen - line_pos;
+            if (len > avail) len = avail;
+            if (len > n - l) len = n - l;
+            memcpy(dst + l,
+                   (char *) fp->uncompressed_block + fp->block_offset, len);
+            l += len;
+            line_pos += len;
+        }
+        fp->block_offset += len;
+        fp->uncompressed_address += len;
+    }
+
+    return l;
+}
+
+static char *fai_retrieve(const faidx_t *fai, const faidx1_t *val,
+                          uint64_t offset, hts_pos_t beg, hts_pos_t end, hts_pos_t *len) {
+    char *s;
+    hts_pos_t l;
+
+    if ((uint64_t) end - (uint64_t) beg >= SIZE_MAX - 2) {
+        hts_log_error("Range %"PRId64"..%"PRId64" too big", beg, end);
+        *len = -1;
         return NULL;
     }
 
-    l = 0;
     s = (char*)malloc((size_t) end - beg + 2);
     if (!s) {
         *len = -1;
         return NULL;
     }
 
-    while ( l < end - beg && (c=bgzf_getc(fai->bgzf))>=0 )
-        if (isgraph(c)) s[l++] = c;
-    if (c < 0) {
-        hts_log_error("Failed to retrieve block: %s",
-            c == -1 ? "unexpected end of file" : "error reading file");
+    l = fai_retrieve_into(fai, val, offset, beg, end, s);
+    if (l < 0) {
         free(s);
         *len = -1;
         return NULL;
@@ -735,6 +1030,26 @@ static char *fai_retrieve(const faidx_t *fai, const faidx1_t *val,
     return s;
 }
 
+// As fai_retrieve(), but into a caller-supplied buffer of buf_size bytes.
+static hts_pos_t fai_retrieve_buf(const faidx_t *fai, const faidx1_t *val,
+                                  uint64_t offset, hts_pos_t beg,
+                                  hts_pos_t end, char *buf, size_t buf_size)
+{
+    hts_pos_t l;
+
+    if (end < beg || (uint64_t) end - (uint64_t) beg >= buf_size) {
+        hts_log_error("Buffer of %zu bytes too small for range "
+                      "%"PRId64"..%"PRId64, buf_size, beg, end);
+        return -1;
+    }
+
+    l = fai_retrieve_into(fai, val, offset, beg, end, buf);
+    if (l < 0) return -1;
+
+    buf[l] = '\0';
+    return l;
+}
+
 static int fai_get_val(const faidx_t *fai, const char *str,
                        hts_pos_t *len, faidx1_t *val, hts_pos_t *fbeg, hts_pos_t *fend) {
     khiter_t iter;
@@ -872,6 +1187,57 @@ char *faidx_fetch_seq64(const faidx_t *fai, const char *c_name, hts_pos_t p_beg_
     return fai_retrieve(fai, &val, val.seq_offset, p_beg_i, p_end_i + 1, len);
 }
 
+hts_pos_t faidx_fetch_seq_buf(const faidx_t *fai, const char *c_name,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                              char *buf, size_t buf_size)
+{
+    faidx1_t val;
+    hts_pos_t len;
+
+    // Adjust position
+    if (faidx_adjust_position(fai, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+
+    // Now retrieve the sequence
+    return fai_retrieve_buf(fai, &val, val.seq_offset, p_beg_i, p_end_i + 1,
+                            buf, buf_size);
+}
+
+const char *faidx_seq_view(const faidx_t *fai, const char *c_name,
+                           hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                           hts_pos_t *len)
+{
+    faidx1_t val;
+    uint64_t pos;
+
+    // Adjust position
+    if (faidx_adjust_position(fai, &val, c_name, &p_beg_i, &p_end_i, len)) {
+        return NULL;
+    }
+
+    if (fai->bin) {
+        *len = p_end_i - p_beg_i + 1;
+        return fai->bin + val.bin_offset + p_beg_i;
+    }
+
+    // Without the sidecar, only regions within a single line are contiguous
+    if (!fai->map || p_beg_i / val.line_blen != p_end_i / val.line_blen) {
+        *len = -1;
+        return NULL;
+    }
+
+    pos = val.seq_offset + p_beg_i / val.line_blen * val.line_len
+        + p_beg_i % val.line_blen;
+    if (pos + (p_end_i - p_beg_i + 1) > fai->map_len) {
+        *len = -1;
+        return NULL;
+    }
+
+    *len = p_end_i - p_beg_i + 1;
+    return fai->map + pos;
+}
+
 char *faidx_fetch_seq(const faidx_t *fai, const char *c_name, int p_beg_i, int p_end_i, int *len)
 {
     hts_pos_t len64;
@@ -893,6 +1259,23 @@ char *faidx_fetch_qual64(const faidx_t *fai, const char *c_name, hts_pos_t p_beg
     return fai_retrieve(fai, &val, val.qual_offset, p_beg_i, p_end_i + 1, len);
 }
 
+hts_pos_t faidx_fetch_qual_buf(const faidx_t *fai, const char *c_name,
+                               hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                               char *buf, size_t buf_size)
+{
+    faidx1_t val;
+    hts_pos_t len;
+
+    // Adjust position
+    if (faidx_adjust_position(fai, &val, c_name, &p_beg_i, &p_end_i, &len)) {
+        return len;
+    }
+
+    // Now retrieve the sequence
+    return fai_retrieve_buf(fai, &val, val.qual_offset, p_beg_i, p_end_i + 1,
+                            buf, buf_size);
+}
+
 char *faidx_fetch_qual(const faidx_t *fai, const char *c_name, int p_beg_i, int p_end_i, int *len)
 {
     hts_pos_t len64;
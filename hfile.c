@@ -615,12 +615,44 @@ static size_t blksize(int fd)
 #endif
 }
 
+int hfile_file_identity(hFILE *fp, hfile_identity *id)
+{
+    int fd = -1;
+    if (fp->backend == &fd_backend) fd = ((hFILE_fd *) fp)->fd;
+#ifdef HAVE_IO_URING
+    else fd = hfile_uring_fd(fp);
+#endif
+    if (fd < 0) return -1;
+
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) != 0) return -1;
+    if (!S_ISREG(sbuf.st_mode)) return -1;
+
+    id->dev = sbuf.st_dev;
+    id->ino = sbuf.st_ino;
+    id->size = sbuf.st_size;
+    id->mtime = sbuf.st_mtime;
+#if defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    id->mtime_nsec = sbuf.st_mtim.tv_nsec;
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+    id->mtime_nsec = sbuf.st_mtimespec.tv_nsec;
+#else
+    id->mtime_nsec = 0;
+#endif
+    return 0;
+}
+
 static hFILE *hopen_fd(const char *filename, const char *mode)
 {
     hFILE_fd *fp = NULL;
     int fd = open(filename, hfile_oflags(mode), 0666);
     if (fd < 0) goto error;
 
+#ifdef HAVE_IO_URING
+    hFILE *ufp = hopen_uring(fd, mode);
+    if (ufp) return ufp;
+#endif
+
     fp = (hFILE_fd *) hfile_init(sizeof (hFILE_fd), mode, blksize(fd));
     if (fp == NULL) goto error;
 
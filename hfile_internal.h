@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.  */
 #define HFILE_INTERNAL_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "htslib/hts_defs.h"
 #include "htslib/hfile.h"
@@ -57,6 +58,27 @@ struct BGZF;
  */
 struct hFILE *bgzf_hfile(struct BGZF *fp);
 
+/*!
+  @abstract  Identifies the local file underlying an hFILE, if any.
+
+  @param fp   The file stream
+  @param id   Filled in with device, inode, size and modification time,
+              including nanoseconds where the platform records them
+
+  @return Returns 0 on success, or -1 if the stream is not backed by a
+  regular local file (pipes, sockets, in-memory and remote streams).
+
+  @notes  Used to recognise that independently opened streams refer to
+  the same unchanged file, so that data derived from one may be reused
+  by the others.
+ */
+typedef struct hfile_identity {
+    uint64_t dev, ino;
+    int64_t size, mtime, mtime_nsec;
+} hfile_identity;
+
+int hfile_file_identity(hFILE *fp, hfile_identity *id);
+
 /*!
   @abstract Closes all hFILE plugins that have been loaded
 */
@@ -109,6 +131,17 @@ hFILE *hfile_init_fixed(size_t struct_size, const char *mode,
    even if fp is NULL.  This takes care to preserve errno.)  */
 void hfile_destroy(hFILE *fp);
 
+#ifdef HAVE_IO_URING
+/* Opens an io_uring stream on fd, a regular file opened for plain reading or
+   writing.  Returns NULL (leaving fd open) if io_uring can't be used for it,
+   in which case the ordinary file descriptor backend should be used.  */
+hFILE *hopen_uring(int fd, const char *mode);
+
+/* Returns the file descriptor behind an io_uring stream, or -1 if fp is
+   some other kind of stream.  */
+int hfile_uring_fd(hFILE *fp);
+#endif
+
 
 struct hFILE_scheme_handler {
     /* Opens a stream when dispatched by hopen(); should call hfile_init()
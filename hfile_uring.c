@@ -0,0 +1,518 @@
+/*  hfile_uring.c -- local file backend for hFILE using Linux io_uring.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "hfile_internal.h"
+
+/*
+ * Regular files opened for plain reading or writing are driven through an
+ * io_uring instance, talking to the kernel directly rather than through
+ * liburing.  Each stream owns a small ring of buffers ("slots"), used in
+ * FIFO order:
+ *
+ * Reading: slots hold consecutive pieces of the file starting at the
+ * current position.  After a seek only one slot is requested, so random
+ * access (as from index iterators) doesn't read much it won't use.  Each
+ * slot read through in order doubles the number kept in flight, up to
+ * URING_SLOTS, and all new requests are submitted with a single system
+ * call.  Seeking waits for outstanding reads and discards them.  A short
+ * read is only taken as end of file if it stops at the file's size;
+ * otherwise the rest of the slot is requested again.
+ *
+ * Writing: data is copied into a slot and the write is submitted without
+ * waiting for it.  Only when every slot is in use do we wait for the
+ * oldest to complete.  Errors are reported by a later write, flush or
+ * close.  Flushing waits for all writes before syncing as usual.
+ *
+ * If the ring can't be set up (old kernel, seccomp filters, locked memory
+ * limits) hopen_uring() fails and the caller falls back to the plain file
+ * descriptor backend.
+ */
+
+#define URING_SLOTS 8
+#define URING_SLOT_SIZE 65536
+
+enum slot_state { SLOT_FREE, SLOT_BUSY, SLOT_DONE };
+
+typedef struct {
+    char *buf;
+    off_t offset;           // File offset of buf[0]
+    size_t len;             // Bytes requested
+    size_t done;            // Reading: bytes already in buf
+    ssize_t res;            // Result, once SLOT_DONE
+    enum slot_state state;
+} uring_slot;
+
+typedef struct {
+    hFILE base;
+    int fd;
+    int is_write;
+
+    // The ring itself
+    int ring_fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned to_submit;     // Queued but not yet passed to the kernel
+
+    uring_slot slot[URING_SLOTS];
+    int head, count;        // Slots in use, oldest first
+    int depth;              // Reading: slots to keep in flight
+    off_t pos;              // Offset of the next read or write
+    int err;                // Writing: errno of a failed earlier write
+} hFILE_uring;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit,
+                       unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                         min_complete, flags, NULL, 0);
+}
+
+// Checks the kernel can do plain reads and writes (added in Linux 5.6)
+static int uring_probe(int ring_fd)
+{
+    struct io_uring_probe *probe;
+    int ok = 0;
+
+    probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (!probe) return 0;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+                probe, 256) == 0 && probe->last_op >= IORING_OP_WRITE)
+        ok = (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+            && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+static void uring_unmap(hFILE_uring *fp)
+{
+    if (fp->sqes) munmap(fp->sqes, fp->sqes_size);
+    if (fp->cq_ptr && fp->cq_ptr != fp->sq_ptr)
+        munmap(fp->cq_ptr, fp->cq_size);
+    if (fp->sq_ptr) munmap(fp->sq_ptr, fp->sq_size);
+    if (fp->ring_fd >= 0) close(fp->ring_fd);
+}
+
+static int uring_init(hFILE_uring *fp)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    fp->ring_fd = uring_setup(URING_SLOTS, &p);
+    if (fp->ring_fd < 0) return -1;
+    if (!uring_probe(fp->ring_fd)) { errno = ENOSYS; return -1; }
+
+    fp->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    fp->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (fp->cq_size > fp->sq_size) fp->sq_size = fp->cq_size;
+        fp->cq_size = fp->sq_size;
+    }
+
+    fp->sq_ptr = mmap(NULL, fp->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fp->ring_fd,
+                      IORING_OFF_SQ_RING);
+    if (fp->sq_ptr == MAP_FAILED) { fp->sq_ptr = NULL; return -1; }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        fp->cq_ptr = fp->sq_ptr;
+    } else {
+        fp->cq_ptr = mmap(NULL, fp->cq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fp->ring_fd,
+                          IORING_OFF_CQ_RING);
+        if (fp->cq_ptr == MAP_FAILED) { fp->cq_ptr = NULL; return -1; }
+    }
+
+    fp->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    fp->sqes = mmap(NULL, fp->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fp->ring_fd,
+                    IORING_OFF_SQES);
+    if (fp->sqes == MAP_FAILED) { fp->sqes = NULL; return -1; }
+
+    sq = (char *) fp->sq_ptr;
+    fp->sq_tail  = (unsigned *) (sq + p.sq_off.tail);
+    fp->sq_mask  = (unsigned *) (sq + p.sq_off.ring_mask);
+    fp->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+    cq = (char *) fp->cq_ptr;
+    fp->cq_head = (unsigned *) (cq + p.cq_off.head);
+    fp->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    fp->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    fp->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+// Queues a read or write for slot i.  The ring has as many entries as
+// there are slots, so there is always room.
+static void uring_queue(hFILE_uring *fp, int i)
+{
+    uring_slot *s = &fp->slot[i];
+    unsigned tail = *fp->sq_tail, idx = tail & *fp->sq_mask;
+    struct io_uring_sqe *sqe = &fp->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = fp->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fp->fd;
+    sqe->off = s->offset + s->done;
+    sqe->addr = (uintptr_t) (s->buf + s->done);
+    sqe->len = s->len - s->done;
+    sqe->user_data = i;
+
+    fp->sq_array[idx] = idx;
+    __atomic_store_n(fp->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    fp->to_submit++;
+    s->state = SLOT_BUSY;
+}
+
+// Passes queued requests to the kernel, optionally waiting for at least
+// one to complete, then collects any completions.
+static int uring_submit(hFILE_uring *fp, int wait)
+{
+    unsigned head, tail;
+
+    if (fp->to_submit || wait) {
+        int ret;
+        do {
+            ret = uring_enter(fp->ring_fd, fp->to_submit, wait ? 1 : 0,
+                              wait ? IORING_ENTER_GETEVENTS : 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) return -1;
+        fp->to_submit -= ret < fp->to_submit ? ret : fp->to_submit;
+    }
+
+    head = *fp->cq_head;
+    tail = __atomic_load_n(fp->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &fp->cqes[head & *fp->cq_mask];
+        uring_slot *s = &fp->slot[cqe->user_data];
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+            uring_queue(fp, (int) cqe->user_data);
+        } else {
+            s->res = cqe->res < 0 ? cqe->res : (ssize_t) s->done + cqe->res;
+            s->state = SLOT_DONE;
+        }
+    }
+    __atomic_store_n(fp->cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int uring_wait(hFILE_uring *fp, int i)
+{
+    while (fp->slot[i].state == SLOT_BUSY)
+        if (uring_submit(fp, 1) < 0) return -1;
+    return 0;
+}
+
+// Waits for the oldest slot and releases it.  For output this also
+// finishes off short writes and notes any errors.
+static int uring_retire(hFILE_uring *fp)
+{
+    uring_slot *s = &fp->slot[fp->head];
+    int ret = uring_wait(fp, fp->head);
+
+    if (fp->is_write && s->state == SLOT_DONE && !fp->err) {
+        if (s->res < 0) {
+            fp->err = -s->res;
+        } else {
+            // Short write; finish it synchronously
+            size_t done = s->res;
+            while (done < s->len) {
+                ssize_t n = pwrite(fp->fd, s->buf + done, s->len - done,
+                                   s->offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) { fp->err = n < 0 ? errno : EIO; break; }
+                done += n;
+            }
+        }
+    }
+
+    s->state = SLOT_FREE;
+    fp->head = (fp->head + 1) % URING_SLOTS;
+    fp->count--;
+    return ret;
+}
+
+// Waits for everything outstanding and empties the slot ring
+static int uring_drain(hFILE_uring *fp)
+{
+    int ret = 0;
+    while (fp->count > 0)
+        if (uring_retire(fp) < 0) ret = -1;
+    return ret;
+}
+
+// Reading: keeps fp->depth slots in flight beyond the current position.
+static int uring_readahead(hFILE_uring *fp)
+{
+    off_t next = fp->pos;
+    if (fp->count > 0) {
+        uring_slot *last = &fp->slot[(fp->head + fp->count-1) % URING_SLOTS];
+        next = last->offset + last->len;
+    }
+
+    while (fp->count < fp->depth) {
+        int i = (fp->head + fp->count) % URING_SLOTS;
+        uring_slot *s = &fp->slot[i];
+        if (!s->buf && !(s->buf = malloc(URING_SLOT_SIZE))) {
+            if (fp->count > 0) break; // Make do with what we have
+            return -1;
+        }
+        s->offset = next;
+        s->len = URING_SLOT_SIZE;
+        s->done = 0;
+        uring_queue(fp, i);
+        fp->count++;
+        next += URING_SLOT_SIZE;
+    }
+
+    return uring_submit(fp, 0);
+}
+
+static ssize_t uring_read(hFILE *fpv, void *buffer, size_t nbytes)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    uring_slot *s;
+    struct stat st;
+    off_t avail;
+
+    if (fp->count == 0 && uring_readahead(fp) < 0) return -1;
+
+    for (;;) {
+        s = &fp->slot[fp->head];
+        if (uring_wait(fp, fp->head) < 0) return -1;
+        if (s->res < 0) {
+            int err = -s->res;
+            uring_drain(fp);
+            errno = err;
+            return -1;
+        }
+
+        avail = s->offset + s->res - fp->pos;
+        if (avail > 0) break;
+
+        // Short read.  Unless it stopped at the end of the file, ask for
+        // the rest of the slot.
+        if (fstat(fp->fd, &st) < 0) return -1;
+        if (fp->pos >= st.st_size) {
+            // End of file.  Discard the read-ahead so that a later read
+            // looks again, as the file may grow.
+            if (uring_drain(fp) < 0) return -1;
+            fp->depth = 1;
+            return 0;
+        }
+        s->done = s->res;
+        uring_queue(fp, fp->head);
+        if (uring_submit(fp, 0) < 0) return -1;
+    }
+    if (nbytes > avail) nbytes = avail;
+
+    memcpy(buffer, s->buf + (fp->pos - s->offset), nbytes);
+    fp->pos += nbytes;
+
+    if (fp->pos == s->offset + s->len) {
+        // Finished with this slot, so read further ahead
+        uring_retire(fp);
+        fp->depth = fp->depth * 2 < URING_SLOTS ? fp->depth * 2 : URING_SLOTS;
+        if (uring_readahead(fp) < 0) return -1;
+    }
+
+    return nbytes;
+}
+
+static ssize_t uring_write(hFILE *fpv, const void *buffer, size_t nbytes)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    uring_slot *s;
+    int i;
+
+    if (fp->err) { errno = fp->err; return -1; }
+
+    if (fp->count == URING_SLOTS) {
+        // All busy; wait for the oldest
+        if (uring_retire(fp) < 0) return -1;
+        if (fp->err) { errno = fp->err; return -1; }
+    }
+
+    i = (fp->head + fp->count) % URING_SLOTS;
+    s = &fp->slot[i];
+    if (!s->buf && !(s->buf = malloc(URING_SLOT_SIZE))) return -1;
+
+    if (nbytes > URING_SLOT_SIZE) nbytes = URING_SLOT_SIZE;
+    memcpy(s->buf, buffer, nbytes);
+    s->offset = fp->pos;
+    s->len = nbytes;
+    s->done = 0;
+    uring_queue(fp, i);
+    fp->count++;
+    fp->pos += nbytes;
+
+    if (uring_submit(fp, 0) < 0) return -1;
+    return nbytes;
+}
+
+static off_t uring_seek(hFILE *fpv, off_t offset, int whence)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    struct stat st;
+
+    if (uring_drain(fp) < 0) return -1;
+    if (fp->err) { errno = fp->err; return -1; }
+
+    switch (whence) {
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += fp->pos; break;
+    case SEEK_END:
+        if (fstat(fp->fd, &st) < 0) return -1;
+        offset += st.st_size;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (offset < 0) { errno = EINVAL; return -1; }
+
+    fp->pos = offset;
+    fp->depth = 1;
+    return offset;
+}
+
+static int uring_flush(hFILE *fpv)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    int ret;
+
+    if (uring_drain(fp) < 0) return -1;
+    if (fp->err) { errno = fp->err; return -1; }
+
+    do {
+#ifdef HAVE_FDATASYNC
+        ret = fdatasync(fp->fd);
+#elif defined(HAVE_FSYNC)
+        ret = fsync(fp->fd);
+#else
+        ret = 0;
+#endif
+        // As for fd_flush() in hfile.c
+        if (ret < 0 && (errno == EINVAL || errno == ENOTSUP)) ret = 0;
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static int uring_close(hFILE *fpv)
+{
+    hFILE_uring *fp = (hFILE_uring *) fpv;
+    int i, ret, err = 0;
+
+    if (uring_drain(fp) < 0) err = errno;
+    if (fp->err) err = fp->err;
+    uring_unmap(fp);
+    for (i = 0; i < URING_SLOTS; i++)
+        free(fp->slot[i].buf);
+
+    do {
+        ret = close(fp->fd);
+    } while (ret < 0 && errno == EINTR);
+
+    if (err) { errno = err; return -1; }
+    return ret;
+}
+
+static const struct hFILE_backend uring_backend =
+{
+    uring_read, uring_write, uring_seek, uring_flush, uring_close
+};
+
+hFILE *hopen_uring(int fd, const char *mode)
+{
+    hFILE_uring *fp = NULL;
+    struct stat st;
+    int i, is_write = strchr(mode, 'w') != NULL;
+
+    // Appending or updating is left to the plain backend, as are pipes etc
+    if (strchr(mode, 'a') || strchr(mode, '+')
+        || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    fp = (hFILE_uring *) hfile_init(sizeof(hFILE_uring), mode,
+                                    is_write ? URING_SLOT_SIZE : 0);
+    if (fp == NULL) return NULL;
+
+    fp->fd = fd;
+    fp->is_write = is_write;
+    fp->ring_fd = -1;
+    fp->sq_ptr = fp->cq_ptr = NULL;
+    fp->sqes = NULL;
+    fp->to_submit = 0;
+    for (i = 0; i < URING_SLOTS; i++) {
+        fp->slot[i].buf = NULL;
+        fp->slot[i].state = SLOT_FREE;
+    }
+    fp->head = fp->count = 0;
+    fp->depth = 2;
+    fp->pos = 0;
+    fp->err = 0;
+
+    if (uring_init(fp) < 0) {
+        int save = errno;
+        uring_unmap(fp);
+        hfile_destroy(&fp->base);
+        errno = save;
+        return NULL;
+    }
+
+    fp->base.backend = &uring_backend;
+    return &fp->base;
+}
+
+int hfile_uring_fd(hFILE *fp)
+{
+    return fp->backend == &uring_backend ? ((hFILE_uring *) fp)->fd : -1;
+}
+
+#endif // HAVE_IO_URING
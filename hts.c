@@ -759,6 +759,14 @@ int hts_opt_add(hts_opt **opts, const char *c_arg) {
              strcmp(o->arg, "USE_LZMA") == 0)
         o->opt = CRAM_OPT_USE_LZMA, o->val.i = atoi(val);
 
+    else if (strcmp(o->arg, "use_arith") == 0 ||
+             strcmp(o->arg, "USE_ARITH") == 0)
+        o->opt = CRAM_OPT_USE_ARITH, o->val.i = atoi(val);
+
+    else if (strcmp(o->arg, "ref_cache_size") == 0 ||
+             strcmp(o->arg, "REF_CACHE_SIZE") == 0)
+        o->opt = CRAM_OPT_REF_CACHE_SIZE, o->val.i = atoi(val);
+
     else if (strcmp(o->arg, "reference") == 0 ||
              strcmp(o->arg, "REFERENCE") == 0)
         o->opt = CRAM_OPT_REFERENCE, o->val.s = val;
@@ -775,6 +783,10 @@ int hts_opt_add(hts_opt **opts, const char *c_arg) {
              strcmp(o->arg, "NTHREADS") == 0)
         o->opt = HTS_OPT_NTHREADS, o->val.i = atoi(val);
 
+    else if (strcmp(o->arg, "bam_decode") == 0 ||
+             strcmp(o->arg, "BAM_DECODE") == 0)
+        o->opt = HTS_OPT_BAM_DECODE, o->val.i = atoi(val);
+
     else if (strcmp(o->arg, "cache_size") == 0 ||
              strcmp(o->arg, "CACHE_SIZE") == 0) {
         char *endp;
@@ -821,7 +833,9 @@ int hts_opt_add(hts_opt **opts, const char *c_arg) {
 
     else if (strcmp(o->arg, "level") == 0 ||
              strcmp(o->arg, "LEVEL") == 0)
-        o->opt = HTS_OPT_COMPRESSION_LEVEL, o->val.i = strtol(val, NULL, 0);
+        o->opt = HTS_OPT_COMPRESSION_LEVEL,
+        o->val.i = strcmp(val, "auto") == 0
+            ? BGZF_LEVEL_AUTO : strtol(val, NULL, 0);
 
     else {
         hts_log_error("Unknown option '%s'", o->arg);
@@ -1190,7 +1204,8 @@ int hts_close(htsFile *fp)
     case binary_format:
     case bam:
     case bcf:
-        ret = bgzf_close(fp->fp.bgzf);
+        ret = sam_state_destroy(fp);
+        ret |= bgzf_close(fp->fp.bgzf);
         break;
 
     case cram:
@@ -1214,7 +1229,10 @@ int hts_close(htsFile *fp)
     case fastq_format:
     case sam:
     case vcf:
-        ret = sam_state_destroy(fp);
+        if (fp->format.format == vcf)
+            ret = vcf_state_destroy(fp);
+        else
+            ret = sam_state_destroy(fp);
 
         if (fp->format.compression != no_compression)
             ret |= bgzf_close(fp->fp.bgzf);
@@ -1318,6 +1336,13 @@ int hts_set_opt(htsFile *fp, enum hts_fmt_option opt, ...) {
         return hts_set_thread_pool(fp, p);
     }
 
+    case HTS_OPT_BAM_DECODE: {
+        va_start(args, opt);
+        int enable = va_arg(args, int);
+        va_end(args);
+        return sam_set_bam_decode(fp, enable);
+    }
+
     case HTS_OPT_CACHE_SIZE: {
         va_start(args, opt);
         int cache_size = va_arg(args, int);
@@ -1332,6 +1357,8 @@ int hts_set_opt(htsFile *fp, enum hts_fmt_option opt, ...) {
         va_end(args);
         if (fp->is_bgzf)
             fp->fp.bgzf->compress_level = level;
+        else if (level == BGZF_LEVEL_AUTO)
+            return 0; // Only BGZF adapts; CRAM keeps its own level
     }
 
     default:
@@ -1352,9 +1379,13 @@ BGZF *hts_get_bgzfp(htsFile *fp);
 
 int hts_set_threads(htsFile *fp, int n)
 {
-    if (fp->format.format == sam) {
+    // Text outputs become SAM or VCF once a header is written, when
+    // vcf_hdr_write() swaps the SAM_state for a VCF_state if need be
+    if (fp->format.format == sam || fp->format.format == text_format) {
         return sam_set_threads(fp, n);
-    } else if (fp->format.compression == bgzf) {
+    } else if (fp->format.format == vcf) {
+        return vcf_set_threads(fp, n);
+    } else if (hts_bgzf_threaded(fp)) {
         return bgzf_mt(hts_get_bgzfp(fp), n, 256/*unused*/);
     } else if (fp->format.format == cram) {
         return hts_set_opt(fp, CRAM_OPT_NTHREADS, n);
@@ -1365,7 +1396,9 @@ int hts_set_threads(htsFile *fp, int n)
 int hts_set_thread_pool(htsFile *fp, htsThreadPool *p) {
     if (fp->format.format == sam || fp->format.format == text_format) {
         return sam_set_thread_pool(fp, p);
-    } else if (fp->format.compression == bgzf) {
+    } else if (fp->format.format == vcf) {
+        return vcf_set_thread_pool(fp, p);
+    } else if (hts_bgzf_threaded(fp)) {
         return bgzf_thread_pool(hts_get_bgzfp(fp), p->pool, p->qsize);
     } else if (fp->format.format == cram) {
         return hts_set_opt(fp, CRAM_OPT_THREAD_POOL, p);
@@ -1420,6 +1453,10 @@ hFILE *hts_open_tmpfile(const char *fname, const char *mode, kstring_t *tmpname)
 // future is uncertain. Things will probably have to change with hFILE...
 BGZF *hts_get_bgzfp(htsFile *fp)
 {
+    // The caller is going to use the BGZF handle directly, so threaded
+    // VCF reading has to stop until the next vcf_read()
+    if (fp->format.format == vcf && fp->state && fp->is_bgzf)
+        vcf_state_pause(fp, 0);
     if (fp->is_bgzf)
         return fp->fp.bgzf;
     else
@@ -1427,6 +1464,8 @@ BGZF *hts_get_bgzfp(htsFile *fp)
 }
 int hts_useek(htsFile *fp, off_t uoffset, int where)
 {
+    if (fp->format.format == vcf && fp->state)
+        vcf_state_pause(fp, 1);
     if (fp->is_bgzf)
         return bgzf_useek(fp->fp.bgzf, uoffset, where);
     else
@@ -70,6 +70,11 @@ int hts_idx_fmt(hts_idx_t *idx);
 // Construct a unique filename based on fname and open it.
 struct hFILE *hts_open_tmpfile(const char *fname, const char *mode, kstring_t *tmpname);
 
+// Returns true if fai (loaded with FAI_MMAP) has every sequence available
+// as an upper-case view via faidx_seq_view().
+struct __faidx_t;
+int fai_mapped_upper(const struct __faidx_t *fai);
+
 // Check that index is capable of storing items in range beg..end
 int hts_idx_check_range(hts_idx_t *idx, int tid, hts_pos_t beg, hts_pos_t end);
 
@@ -126,6 +131,54 @@ int bgzf_idx_push(BGZF *fp, hts_idx_t *hidx, int tid, hts_pos_t beg, hts_pos_t e
  */
 void bgzf_idx_amend_last(BGZF *fp, hts_idx_t *hidx, uint64_t offset);
 
+/*
+ * Makes fp responsible for destroying the thread pool it was given by
+ * bgzf_thread_pool(), so the pool outlives other users that are shut down
+ * before bgzf_close().
+ *
+ * Returns 0 on success,
+ *        -1 if fp has no thread pool
+ */
+int bgzf_thread_pool_adopt(BGZF *fp);
+
+/*
+ * Returns the thread pool fp is using, or NULL if it is not multi-threaded.
+ */
+struct hts_tpool *bgzf_thread_pool_get(BGZF *fp);
+
+/*
+ * Copies the number of blocks queued so far at each BGZF_LEVEL_AUTO
+ * compression level into counts[0..n-1].  Returns the number of levels
+ * copied, or -1 if fp is not a multi-threaded writer.
+ */
+int bgzf_auto_level_counts(BGZF *fp, uint64_t *counts, int n);
+
+/*
+ * Whether fp's BGZF handle can use threads: BGZF files, and plain gzip
+ * ones being read.
+ */
+static inline int hts_bgzf_threaded(const htsFile *fp) {
+    return fp->format.compression == bgzf
+        || (fp->format.compression == gzip && !fp->is_write);
+}
+
+// Used internally in the VCF format multi-threading.
+int vcf_state_destroy(htsFile *fp);
+int vcf_set_thread_pool(htsFile *fp, htsThreadPool *p);
+int vcf_set_threads(htsFile *fp, int nthreads);
+void vcf_state_pause(htsFile *fp, int discard);
+
+/*
+ * Convert n BCF FORMAT values at src to the 32-bit values returned by
+ * bcf_get_format_values(), translating the missing and vector end markers.
+ * Return non-zero if any vector end marker was seen.  These use vector
+ * instructions where the CPU supports them (simd.c).
+ */
+int bcf_fmt_widen_int8(int32_t *dst, const uint8_t *src, size_t n);
+int bcf_fmt_widen_int16(int32_t *dst, const uint8_t *src, size_t n);
+int bcf_fmt_copy32(uint32_t *dst, const uint8_t *src, size_t n,
+                   uint32_t vector_end);
+
 static inline int find_file_extension(const char *fn, char ext_out[static HTS_MAX_EXT_LEN])
 {
     const char *delim = fn ? strstr(fn, HTS_IDX_DELIM) : NULL, *ext;
@@ -91,6 +91,7 @@ HTSLIB_ALL = \
 	$(HTSDIR)/hfile_net.c \
 	$(HTSDIR)/hfile_s3.c \
 	$(HTSDIR)/hfile_s3_write.c \
+	$(HTSDIR)/hfile_uring.c \
 	$(HTSDIR)/hts.c \
 	$(HTSDIR)/hts_internal.h \
 	$(HTSDIR)/hts_os.c \
@@ -99,6 +100,8 @@ HTSLIB_ALL = \
 	$(HTSDIR)/kstring.c \
 	$(HTSDIR)/md5.c \
 	$(HTSDIR)/multipart.c \
+	$(HTSDIR)/pinflate.c \
+	$(HTSDIR)/pinflate_internal.h \
 	$(HTSDIR)/plugin.c \
 	$(HTSDIR)/probaln.c \
 	$(HTSDIR)/realn.c \
@@ -115,6 +118,10 @@ HTSLIB_ALL = \
 	$(HTSDIR)/vcf.c \
 	$(HTSDIR)/vcf_sweep.c \
 	$(HTSDIR)/vcfutils.c \
+	$(HTSDIR)/cram/arith_dynamic.c \
+	$(HTSDIR)/cram/arith_dynamic.h \
+	$(HTSDIR)/cram/c_range_coder.h \
+	$(HTSDIR)/cram/c_simple_model.h \
 	$(HTSDIR)/cram/cram.h \
 	$(HTSDIR)/cram/cram_codecs.c \
 	$(HTSDIR)/cram/cram_codecs.h \
@@ -132,19 +139,29 @@ HTSLIB_ALL = \
 	$(HTSDIR)/cram/cram_stats.c \
 	$(HTSDIR)/cram/cram_stats.h \
 	$(HTSDIR)/cram/cram_structs.h \
+	$(HTSDIR)/cram/fqzcomp_qual.c \
+	$(HTSDIR)/cram/fqzcomp_qual.h \
 	$(HTSDIR)/cram/mFILE.c \
 	$(HTSDIR)/cram/mFILE.h \
 	$(HTSDIR)/cram/misc.h \
 	$(HTSDIR)/cram/open_trace_file.c \
 	$(HTSDIR)/cram/open_trace_file.h \
 	$(HTSDIR)/cram/os.h \
+	$(HTSDIR)/cram/pack.c \
+	$(HTSDIR)/cram/pack.h \
 	$(HTSDIR)/cram/pooled_alloc.c \
 	$(HTSDIR)/cram/pooled_alloc.h \
 	$(HTSDIR)/cram/rANS_byte.h \
 	$(HTSDIR)/cram/rANS_static.c \
 	$(HTSDIR)/cram/rANS_static.h \
+	$(HTSDIR)/cram/rANS_static4x16.h \
+	$(HTSDIR)/cram/rANS_static4x16pr.c \
+	$(HTSDIR)/cram/rANS_word.h \
 	$(HTSDIR)/cram/string_alloc.c \
 	$(HTSDIR)/cram/string_alloc.h \
+	$(HTSDIR)/cram/tokenise_name3.c \
+	$(HTSDIR)/cram/tokenise_name3.h \
+	$(HTSDIR)/cram/varint.h \
 	$(HTSDIR)/os/lzma_stub.h \
 	$(HTSDIR)/os/rand.c
 
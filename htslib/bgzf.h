@@ -49,6 +49,12 @@ extern "C" {
 #define BGZF_ERR_MT     16 // stream cannot be multi-threaded
 #define BGZF_ERR_CRC    32
 
+/* Value for compress_level (or HTS_OPT_COMPRESSION_LEVEL) that lets a
+ * multi-threaded writer pick the level for each block, trading ratio for
+ * speed as the compression threads become busy or idle.  Without threads
+ * the default level is used. */
+#define BGZF_LEVEL_AUTO (-3)
+
 struct hFILE;
 struct hts_tpool;
 struct kstring_t;
@@ -271,10 +277,32 @@ typedef struct BGZF BGZF;
      *
      * @param fp    BGZF file handler
      * @param size  size of cache in bytes; 0 to disable caching (default)
+     *
+     * Decompressed blocks are held in a single least-recently-used cache
+     * shared by every handle that enables caching.  Handles opened on the
+     * same local file share cached blocks.  The cache's byte budget is
+     * the largest size requested by any attached handle, and it is
+     * emptied once the last such handle is closed.  Caching is not used
+     * on multi-threaded handles.
      */
     HTSLIB_EXPORT
     void bgzf_set_cache_size(BGZF *fp, int size);
 
+    typedef struct bgzf_cache_stats_t {
+        uint64_t hits, misses, evictions;
+        size_t bytes_used, bytes_budget;
+        int nblocks;
+    } bgzf_cache_stats_t;
+
+    /**
+     * Report usage of the shared decompressed block cache.
+     *
+     * @param stats  Filled in with lookup hit and miss counts, the number
+     *               of blocks evicted, and current memory use and budget
+     */
+    HTSLIB_EXPORT
+    void bgzf_cache_stats(bgzf_cache_stats_t *stats);
+
     /**
      * Flush the file if the remaining buffer size is smaller than _size_
      * @return      0 if flushing succeeded or was not needed; negative on error
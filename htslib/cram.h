@@ -55,8 +55,36 @@ enum cram_block_method {
     LZMA     = 3,
     RANS     = 4,  // Generic; either order
     RANS0    = 4,
+    RANSPR   = 5,  // rANS Nx16 (CRAM 3.1); generic for all RANS_PR*
+    ARITH    = 6,  // Adaptive arithmetic coder (CRAM 3.1); all ARITH_PR*
+    FQZ      = 7,  // fqzcomp quality codec (CRAM 3.1)
+    TOK3     = 8,  // Read name tokeniser (CRAM 3.1)
     RANS1    = 10, // Not externalised; stored as RANS (generic)
     GZIP_RLE = 11, // NB: not externalised in CRAM
+
+    // rANS Nx16 variants, named after the order/flags byte they use.
+    // Not externalised; all stored as RANSPR.
+    RANS_PR0   = 5,
+    RANS_PR1   = 12,
+    RANS_PR64  = 13,
+    RANS_PR65  = 14,
+    RANS_PR128 = 15,
+    RANS_PR129 = 16,
+    RANS_PR192 = 17,
+    RANS_PR193 = 18,
+
+    // Adaptive arithmetic coder variants, using the same flags.
+    // Not externalised; all stored as ARITH.
+    ARITH_PR0   = 6,
+    ARITH_PR1   = 19,
+    ARITH_PR64  = 20,
+    ARITH_PR65  = 21,
+    ARITH_PR128 = 22,
+    ARITH_PR129 = 23,
+    ARITH_PR192 = 24,
+    ARITH_PR193 = 25,
+
+    TOKA = 26, // Name tokeniser with arithmetic coding; stored as TOK3
 };
 
 enum cram_content_type {
@@ -82,6 +110,19 @@ typedef struct refs_t refs_t;
 
 struct hFILE;
 
+/*
+ * Reference cache statistics, as filled out by the CRAM_OPT_REF_CACHE_STATS
+ * option.  These cover every file handle sharing the same refs_t.
+ */
+typedef struct cram_ref_cache_stats {
+    int64_t hits;         // requests for an already loaded sequence
+    int64_t misses;       // requests which had to load sequence
+    int64_t evictions;    // unused sequences freed to keep within budget
+    int64_t bytes_loaded; // total bytes of sequence loaded
+    int64_t bytes_cached; // bytes of whole sequences currently loaded
+    int64_t max_cached;   // high water mark of bytes_cached
+} cram_ref_cache_stats;
+
 // Accessor functions
 
 /*
@@ -106,6 +106,7 @@ void fai_destroy(faidx_t *fai);
 
 enum fai_load_options {
     FAI_CREATE = 0x01,
+    FAI_MMAP   = 0x02,
 };
 
 /// Load FASTA indexes.
@@ -122,6 +123,19 @@ The bgzip index is only needed if fn is compressed.
 If (flags & FAI_CREATE) is true, the index files will be built using
 fai_build3() if they are not already present.
 
+If (flags & FAI_MMAP) is true and fn is an uncompressed local file, the
+sequence data is memory mapped so that fetches copy directly from the
+mapping and faidx_seq_view() can be used.  If a line-free copy of the
+sequences, as written by a previous load with FAI_CREATE|FAI_MMAP, exists in
+a sidecar file named fn with ".bin" appended, that is mapped too so that
+views of any region are available.  The mapped pages are shared by all
+processes using the same files.  If mapping is not possible, including
+when HTSlib was built without mmap() support, the flag is silently ignored.
+
+CRAM reference loading uses a ".bin" sidecar directly only when the whole
+reference is upper case.  Otherwise each sequence is copied into memory
+and converted, as it would be without a sidecar.
+
 The struct returned by a successful call should be freed via fai_destroy()
 when it is no longer needed.
 */
@@ -239,6 +253,47 @@ by end users by calling `free()` on it.
 HTSLIB_EXPORT
 char *faidx_fetch_seq64(const faidx_t *fai, const char *c_name, hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
 
+/// Fetch the sequence in a region into a caller-supplied buffer
+/** @param  fai  Pointer to the faidx_t struct
+    @param  c_name Region name
+    @param  p_beg_i  Beginning position number (zero-based)
+    @param  p_end_i  End position number (zero-based)
+    @param  buf  Buffer to fill
+    @param  buf_size  Size of buf, which must be at least the region
+                      length plus one
+    @return      Number of bases stored in buf; -2 if c_name not present,
+                 -1 general error (including buf being too small)
+
+The sequence stored is NUL-terminated.  As nothing is allocated, this is
+the preferred interface for callers fetching many small regions.
+*/
+HTSLIB_EXPORT
+hts_pos_t faidx_fetch_seq_buf(const faidx_t *fai, const char *c_name,
+                              hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                              char *buf, size_t buf_size);
+
+/// Return a pointer to the sequence of a region within a memory mapping
+/** @param  fai  Pointer to the faidx_t struct, loaded with FAI_MMAP
+    @param  c_name Region name
+    @param  p_beg_i  Beginning position number (zero-based)
+    @param  p_end_i  End position number (zero-based)
+    @param  len  Length of the region; -2 if c_name not present, -1 if no
+                 view is available
+    @return      Pointer to the sequence; null if no view is available
+
+No copy is made, so the returned sequence is not NUL-terminated and must
+not be modified.  It remains valid until fai_destroy() is called.
+
+A view is available for any region when the ".bin" sidecar is in use, or
+for regions within a single line of an uncompressed mapped file.  Otherwise
+NULL is returned and the caller should use faidx_fetch_seq_buf() or
+faidx_fetch_seq64() instead.
+*/
+HTSLIB_EXPORT
+const char *faidx_seq_view(const faidx_t *fai, const char *c_name,
+                           hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                           hts_pos_t *len);
+
 /// Fetch the quality string in a region for FASTQ files
 /** @param  fai  Pointer to the faidx_t struct
     @param  c_name Region name
@@ -267,6 +322,22 @@ by end users by calling `free()` on it.
 HTSLIB_EXPORT
 char *faidx_fetch_qual64(const faidx_t *fai, const char *c_name, hts_pos_t p_beg_i, hts_pos_t p_end_i, hts_pos_t *len);
 
+/// Fetch the quality string in a region into a caller-supplied buffer
+/** @param  fai  Pointer to the faidx_t struct
+    @param  c_name Region name
+    @param  p_beg_i  Beginning position number (zero-based)
+    @param  p_end_i  End position number (zero-based)
+    @param  buf  Buffer to fill
+    @param  buf_size  Size of buf, which must be at least the region
+                      length plus one
+    @return      Number of values stored in buf; -2 if c_name not present,
+                 -1 general error (including buf being too small)
+*/
+HTSLIB_EXPORT
+hts_pos_t faidx_fetch_qual_buf(const faidx_t *fai, const char *c_name,
+                               hts_pos_t p_beg_i, hts_pos_t p_end_i,
+                               char *buf, size_t buf_size);
+
 /// Query if sequence is present
 /**   @param  fai  Pointer to the faidx_t struct
       @param  seq  Sequence name
@@ -308,6 +308,9 @@ enum hts_fmt_option {
     CRAM_OPT_STORE_MD,
     CRAM_OPT_STORE_NM,
     CRAM_OPT_RANGE_NOSEEK, // CRAM_OPT_RANGE minus the seek
+    CRAM_OPT_USE_ARITH,
+    CRAM_OPT_REF_CACHE_SIZE,  // int, megabytes of reference to keep loaded
+    CRAM_OPT_REF_CACHE_STATS, // cram_ref_cache_stats *, filled out
 
     // General purpose
     HTS_OPT_COMPRESSION_LEVEL = 100,
@@ -315,6 +318,10 @@ enum hts_fmt_option {
     HTS_OPT_THREAD_POOL,
     HTS_OPT_CACHE_SIZE,
     HTS_OPT_BLOCK_SIZE,
+    // Also decode BAM records on the BGZF thread pool.  The file is read
+    // ahead, so use sam_tell() rather than bgzf_tell() for the end of the
+    // record returned by sam_read1().
+    HTS_OPT_BAM_DECODE,
 };
 
 // For backwards compatibility
@@ -586,6 +593,9 @@ int hts_set_thread_pool(htsFile *fp, htsThreadPool *p);
              This may not work for all file types (currently it is bgzf only).
   @param fp  The file handle
   @param n   The size of cache, in bytes
+  @discussion The cache is shared between all handles that enable it, so
+  handles open on the same file reuse each other's blocks.  See
+  bgzf_set_cache_size() for details.
 */
 HTSLIB_EXPORT
 void hts_set_cache_size(htsFile *fp, int n);
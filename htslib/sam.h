@@ -1001,6 +1001,68 @@ bam1_t *bam_copy1(bam1_t *bdst, const bam1_t *bsrc) HTS_RESULT_USED;
 HTSLIB_EXPORT
 bam1_t *bam_dup1(const bam1_t *bsrc);
 
+/// Opaque arena for storing many alignment records contiguously
+typedef struct bam_arena_t bam_arena_t;
+
+/// Create an arena for alignment records
+/**
+   @param block_size  Size of each block of memory allocated, or 0 for a
+                      default of 1Mb
+   @return Pointer to the new arena on success; NULL on failure
+
+   Records allocated from an arena are packed into large blocks, avoiding
+   a separate heap allocation for each one.  They are all released
+   together by bam_arena_reset() or bam_arena_destroy().
+ */
+HTSLIB_EXPORT
+bam_arena_t *bam_arena_init(size_t block_size);
+
+/// Duplicate an alignment record into an arena
+/**
+   @param a     Arena
+   @param bsrc  Source alignment record
+   @return Pointer to the new alignment record on success; NULL on failure
+
+   The bam1_t struct and its data are both stored in the arena, with
+   the BAM_USER_OWNS_STRUCT and BAM_USER_OWNS_DATA policies set.  If the
+   record grows, its data is moved to the heap as described for
+   bam_set_mempolicy(), so bam_destroy1() should be called on records that
+   may have been modified.  It is not needed otherwise.
+ */
+HTSLIB_EXPORT
+bam1_t *bam_arena_dup1(bam_arena_t *a, const bam1_t *bsrc);
+
+/// Copy alignment record data into an arena
+/**
+   @param a     Arena
+   @param bdst  Destination alignment record
+   @param bsrc  Source alignment record
+   @return bdst on success; NULL on failure
+
+   As bam_copy1(), but the variable-length data is stored in the arena and
+   BAM_USER_OWNS_DATA is set on @p bdst.  Any data @p bdst owned before
+   is freed.
+ */
+HTSLIB_EXPORT
+bam1_t *bam_arena_copy1(bam_arena_t *a, bam1_t *bdst, const bam1_t *bsrc) HTS_RESULT_USED;
+
+/// Release all records stored in an arena, keeping its memory for reuse
+/**
+   @param a  Arena
+
+   Any records or data allocated from the arena must not be used after
+   this call.
+ */
+HTSLIB_EXPORT
+void bam_arena_reset(bam_arena_t *a);
+
+/// Free an arena and all the records stored in it
+/**
+   @param a  Arena, may be NULL
+ */
+HTSLIB_EXPORT
+void bam_arena_destroy(bam_arena_t *a);
+
 /// Calculate query length from CIGAR data
 /**
    @param n_cigar   Number of items in @p cigar
@@ -1342,6 +1404,16 @@ const char *sam_parse_region(sam_hdr_t *h, const char *s, int *tid,
  */
     HTSLIB_EXPORT
     int sam_read1(samFile *fp, sam_hdr_t *h, bam1_t *b) HTS_RESULT_USED;
+/// sam_tell - Get the virtual offset of the end of the last record read
+/** @param fp   Pointer to the source file
+ *  @return The BGZF virtual offset just past the last record returned by
+ *          sam_read1(), or -1 if the file is not BGZF compressed
+ *
+ *  This is usually the same as bgzf_tell(), but with HTS_OPT_BAM_DECODE the
+ *  BGZF layer has been read further ahead than the records returned.
+ */
+    HTSLIB_EXPORT
+    int64_t sam_tell(samFile *fp);
 /// sam_write1 - Write a record to a file
 /** @param fp    Pointer to the destination file
  *  @param h     Pointer to the header structure previously read
@@ -1351,6 +1423,30 @@ const char *sam_parse_region(sam_hdr_t *h, const char *s, int *tid,
     HTSLIB_EXPORT
     int sam_write1(samFile *fp, const sam_hdr_t *h, const bam1_t *b) HTS_RESULT_USED;
 
+/// sam_read_batch - Read up to n records from a file
+/** @param fp    Pointer to the source file
+ *  @param h     Pointer to the header previously read (fully or partially)
+ *  @param recs  Array of n record placeholders, e.g. from bam_init1()
+ *  @param n     Number of records wanted
+ *  @return Number of records read (fewer than n only at end of stream, and
+ *          0 once it is reached), < -1 on error
+ *
+ *  This is equivalent to calling sam_read1() for each of recs[0] to
+ *  recs[n-1] in turn, but avoids some per-record overheads.  On error the
+ *  contents of recs are undefined.
+ */
+    HTSLIB_EXPORT
+    int sam_read_batch(samFile *fp, sam_hdr_t *h, bam1_t **recs, int n) HTS_RESULT_USED;
+/// sam_write_batch - Write n records to a file
+/** @param fp    Pointer to the destination file
+ *  @param h     Pointer to the header structure previously read
+ *  @param recs  Array of n records to be written, in order
+ *  @param n     Number of records
+ *  @return 0 on successfully writing all the records, -1 on error
+ */
+    HTSLIB_EXPORT
+    int sam_write_batch(samFile *fp, const sam_hdr_t *h, bam1_t **recs, int n) HTS_RESULT_USED;
+
     /*************************************
      *** Manipulating auxiliary fields ***
      *************************************/
@@ -1367,6 +1463,21 @@ const char *sam_parse_region(sam_hdr_t *h, const char *s, int *tid,
 HTSLIB_EXPORT
 uint8_t *bam_aux_get(const bam1_t *b, const char tag[2]);
 
+/// Return pointers to several aux records, in a single pass
+/** @param b    Pointer to the bam record
+    @param n    Number of tags wanted
+    @param tags Array of n desired aux tags
+    @param out  Array of n pointers, set to the tag data or NULL
+    @return The number of tags found, or -1 on error
+    Each element of @p out is set as bam_aux_get() would for the
+    corresponding tag, but the aux data is only walked once for all of
+    them.  If any tag is not present, errno is set to ENOENT.  If the aux
+    data is corrupt, errno is set to EINVAL and -1 is returned.
+ */
+HTSLIB_EXPORT
+int bam_aux_get_many(const bam1_t *b, int n, const char *const *tags,
+                     uint8_t **out);
+
 /// Get an integer aux value
 /** @param s Pointer to the tag data, as returned by bam_aux_get()
     @return The value, or 0 if the tag was not an integer type
@@ -63,7 +63,10 @@ extern const tbx_conf_t tbx_conf_gff, tbx_conf_bed, tbx_conf_psltbl, tbx_conf_sa
     HTSLIB_EXPORT
     int tbx_name2id(tbx_t *tbx, const char *ss);
 
-    /* Internal helper function used by tbx_itr_next() */
+    /* Internal helper function used by tbx_itr_next().  Multi-threaded
+       VCF reading is paused so the BGZF handle can be used directly.  The
+       next vcf_read() resumes from the last bgzf_seek() if any, otherwise
+       from the next unread record if the file has not been moved. */
     HTSLIB_EXPORT
     BGZF *hts_get_bgzfp(htsFile *fp);
 
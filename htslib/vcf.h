@@ -169,6 +169,22 @@ typedef struct {
     int len;                // vector length, 1 for scalars
 } bcf_info_t;
 
+/**
+ *  A read-only view of the values of one FORMAT or INFO field in a record,
+ *  filled in by bcf_get_format_view() or bcf_get_info_view().  The values
+ *  are not copied, so the view is only valid until the record is modified,
+ *  re-read or destroyed.
+ */
+typedef struct {
+    const uint8_t *p;   // the values, as stored in BCF (little-endian)
+    int type;           // one of BCF_BT_* types, the native width of the values
+    int n;              // number of values per sample (or in total for INFO)
+    int size;           // bytes per sample, i.e. the stride between samples
+    int nsmpl;          // number of samples, 1 for INFO fields
+    bcf_fmt_t *fmt;     // the underlying FORMAT field, or NULL for INFO
+    bcf_info_t *info;   // the underlying INFO field, or NULL for FORMAT
+} bcf_view_t;
+
 
 #define BCF1_DIRTY_ID  1
 #define BCF1_DIRTY_ALS 2
@@ -381,10 +397,29 @@ typedef struct {
 On errors which are not critical for reading, such as missing header
 definitions in vcf files, zero will be returned but v->errcode will have been
 set to one of BCF_ERR* codes and must be checked before calling bcf_write().
+
+When threads have been added to a VCF file, lines are parsed ahead of the
+caller.  The header must then not be modified until reading has finished,
+v->max_unpack is taken from the first call, and fp->line is not filled in.
      */
     HTSLIB_EXPORT
     int bcf_read(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v) HTS_RESULT_USED;
 
+    /**
+     *  bcf_read_batch() - read up to n records at once
+     *  @param fp  The file to read the records from
+     *  @param h   The header for the vcf/bcf file
+     *  @param v   Array of n bcf1_t structures to populate
+     *  @param n   Number of records wanted
+     *  @return the number of records read, which is less than n only at end
+     *  of file; < -1 on critical error
+     *
+     *  As calling bcf_read() on v[0] to v[n-1] in turn.  The errcode of each
+     *  record must still be checked.
+     */
+    HTSLIB_EXPORT
+    int bcf_read_batch(htsFile *fp, const bcf_hdr_t *h, bcf1_t **v, int n) HTS_RESULT_USED;
+
     /**
      *  bcf_unpack() - unpack/decode a BCF record (fills the bcf1_t::d field)
      *
@@ -427,6 +462,16 @@ set to one of BCF_ERR* codes and must be checked before calling bcf_write().
     HTSLIB_EXPORT
     int bcf_write(htsFile *fp, bcf_hdr_t *h, bcf1_t *v) HTS_RESULT_USED;
 
+    /// Write n VCF or BCF records, as bcf_write() on each in turn
+    /** @param  fp  The file to write to
+        @param  h   The header for the vcf/bcf file
+        @param  v   Array of n bcf1_t structures to write
+        @param  n   Number of records
+        @return 0 on success; -1 on error
+     */
+    HTSLIB_EXPORT
+    int bcf_write_batch(htsFile *fp, bcf_hdr_t *h, bcf1_t **v, int n) HTS_RESULT_USED;
+
     /**
      *  The following functions work only with VCFs and should rarely be called
      *  directly. Usually one wants to use their bcf_* alternatives, which work
@@ -1052,6 +1097,70 @@ set to one of BCF_ERR* codes and must be checked before calling bcf_write().
     HTSLIB_EXPORT
     int bcf_get_format_values(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, void **dst, int *ndst, int type);
 
+    /**
+     *  bcf_get_format_values_many() - get several FORMAT fields at once
+     *  @param hdr:    BCF header
+     *  @param line:   BCF record
+     *  @param n:      number of tags wanted
+     *  @param tags:   array of n FORMAT tags to retrieve
+     *  @param types:  array of n types, as for bcf_get_format_values()
+     *  @param dst:    array of n buffers, each used as by bcf_get_format_values()
+     *  @param ndst:   array of n buffer sizes
+     *  @param ret:    array of n results, set to what bcf_get_format_values()
+     *                 would return for the corresponding tag
+     *  @return  the number of tags fetched successfully, or -1 on error
+     *
+     *  The record's FORMAT fields are searched once for all of the tags.
+     *
+     *  Example:
+     *      const char *tags[] = { "GT", "DP", "AD", "GQ" };
+     *      int types[] = { BCF_HT_INT, BCF_HT_INT, BCF_HT_INT, BCF_HT_INT };
+     *      void *dst[4] = { NULL }; int ndst[4] = { 0 }, ret[4];
+     *      bcf_get_format_values_many(hdr, line, 4, tags, types, dst, ndst, ret);
+     */
+    HTSLIB_EXPORT
+    int bcf_get_format_values_many(const bcf_hdr_t *hdr, bcf1_t *line, int n,
+                                   const char *const *tags, const int *types,
+                                   void **dst, int *ndst, int *ret);
+
+    /**
+     *  bcf_get_format_view() - get FORMAT values without copying them
+     *  @param hdr:    BCF header
+     *  @param line:   BCF record
+     *  @param tag:    FORMAT tag to retrieve
+     *  @param view:   set to describe the values in the record
+     *  @return  the number of values, including vector end markers, or
+     *          -1 .. no such FORMAT tag defined in the header
+     *          -3 .. tag is not present in the VCF record
+     *
+     *  Unlike bcf_get_format_values(), the values keep their native BCF
+     *  type and nothing is allocated.  Read them with the bcf_view_*()
+     *  functions below, or directly from view->p when the type is known.
+     *
+     *  Example:
+     *      bcf_view_t v;
+     *      int i, j;
+     *      if ( bcf_get_format_view(hdr, line, "DP", &v) > 0 )
+     *          for (i=0; i<v.nsmpl; i++)
+     *              for (j=0; j<v.n; j++)
+     *              {
+     *                  int32_t dp = bcf_view_int32(&v, i, j);
+     *                  if ( dp==bcf_int32_vector_end ) break;
+     *                  // .. do something ..
+     *              }
+     */
+    HTSLIB_EXPORT
+    int bcf_get_format_view(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, bcf_view_t *view);
+
+    /**
+     *  bcf_get_info_view() - get INFO values without copying them
+     *
+     *  As bcf_get_format_view(), with view->nsmpl set to 1.  Flags have no
+     *  values, so view->n is 0 for them.
+     */
+    HTSLIB_EXPORT
+    int bcf_get_info_view(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, bcf_view_t *view);
+
 
 
     /**************************************************************************
@@ -1360,6 +1469,57 @@ static inline int bcf_float_is_vector_end(float f)
     return u.i==bcf_float_vector_end ? 1 : 0;
 }
 
+/// Return a pointer to the first value of a sample in a bcf_view_t
+static inline const uint8_t *bcf_view_sample(const bcf_view_t *v, int isample)
+{
+    return v->p + (size_t) isample * v->size;
+}
+
+/// Return an integer value from a bcf_view_t
+/** @param v       View from bcf_get_format_view() or bcf_get_info_view()
+    @param isample Sample index, 0 for INFO
+    @param i       Value index within the sample, less than v->n
+    @return The value, with the missing and vector end markers translated
+    to bcf_int32_missing and bcf_int32_vector_end as by
+    bcf_get_format_int32().  For types other than BCF_BT_INT8, BCF_BT_INT16
+    and BCF_BT_INT32, bcf_int32_missing is returned.
+*/
+static inline int32_t bcf_view_int32(const bcf_view_t *v, int isample, int i)
+{
+    const uint8_t *q = bcf_view_sample(v, isample);
+    int32_t x;
+    switch (v->type) {
+        case BCF_BT_INT8:
+            x = le_to_i8(q + i);
+            if ( x==bcf_int8_missing ) return bcf_int32_missing;
+            if ( x==bcf_int8_vector_end ) return bcf_int32_vector_end;
+            return x;
+        case BCF_BT_INT16:
+            x = le_to_i16(q + i * 2);
+            if ( x==bcf_int16_missing ) return bcf_int32_missing;
+            if ( x==bcf_int16_vector_end ) return bcf_int32_vector_end;
+            return x;
+        case BCF_BT_INT32:
+            return le_to_i32(q + i * 4);
+        default:
+            return bcf_int32_missing;
+    }
+}
+
+/// Return a floating point value from a bcf_view_t
+/** As bcf_view_int32(), for views of type BCF_BT_FLOAT.  Test the result
+    with bcf_float_is_missing() and bcf_float_is_vector_end().  For other
+    types, a missing value is returned.
+*/
+static inline float bcf_view_float(const bcf_view_t *v, int isample, int i)
+{
+    float f;
+    if ( v->type==BCF_BT_FLOAT )
+        return le_to_float(bcf_view_sample(v, isample) + i * 4);
+    bcf_float_set_missing(f);
+    return f;
+}
+
 static inline int bcf_format_gt(bcf_fmt_t *fmt, int isample, kstring_t *str)
 {
     uint32_t e = 0;
@@ -0,0 +1,2 @@
+HTSLIB_static_LDFLAGS = 
+HTSLIB_static_LIBS = -lz -lm -lbz2 -llzma -lcurl
@@ -0,0 +1,649 @@
+/*  pinflate.c -- deflate decoding from arbitrary block boundaries.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+/*
+ * A deflate (RFC 1951) decoder that can start at any block boundary, for
+ * the multi-threaded gzip reader in bgzf.c.  It accepts the same streams
+ * as zlib, as used by inflate_gzip_block().  The approach of finding
+ * block boundaries by trial decoding and resolving the unknown window
+ * afterwards follows pugz (Kerbiriou and Chikhi, 2019).
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "htslib/hts_endian.h"
+#include "pinflate_internal.h"
+
+/*
+ * Huffman decode tables.
+ *
+ * Codes up to TABLE_BITS long are looked up directly; longer ones go via
+ * a subtable indexed by their remaining bits.  Each entry packs the
+ * number of bits to consume (bits 0-3), the entry type (4-7), the number
+ * of extra bits to read or subtable index bits (8-15) and a value such as
+ * a literal, base length or distance, or subtable offset (16-31).
+ */
+
+enum { E_LIT, E_LEN, E_EOB, E_DIST, E_SUB, E_BAD };
+
+#define ENTRY(type, extra, value) \
+    ((uint32_t) (value) << 16 | (uint32_t) (extra) << 8 | (type) << 4)
+#define E_NBITS(e) ((e) & 15)
+#define E_TYPE(e)  (((e) >> 4) & 15)
+#define E_EXTRA(e) (((e) >> 8) & 255)
+#define E_VALUE(e) ((e) >> 16)
+
+#define LITLEN_BITS 10
+#define DIST_BITS   8
+#define CODES_BITS  7
+
+// Worst cases, with a 32-entry subtable per long literal/length code and a
+// 128-entry one per long distance code.
+#define LITLEN_SIZE ((1 << LITLEN_BITS) + 288 * 32)
+#define DIST_SIZE   ((1 << DIST_BITS) + 32 * 128)
+#define CODES_SIZE  (1 << CODES_BITS)
+#define TABLES_SIZE (LITLEN_SIZE + DIST_SIZE + CODES_SIZE)
+
+static uint32_t litlen_info[288], dist_info[32], codes_info[19];
+static uint32_t fixed_litlen[LITLEN_SIZE], fixed_dist[DIST_SIZE];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static const uint8_t codes_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static inline unsigned reverse_bits(unsigned code, int len) {
+    unsigned r = 0;
+    while (len--) {
+        r = r << 1 | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+/*
+ * Builds a decode table for the n code lengths in lens, with info[i]
+ * giving the entry for symbol i.  Returns 0 on success, or -1 if the
+ * lengths do not make a valid code.  As in zlib, incomplete codes are only
+ * allowed where a single symbol has a 1-bit code (or none have codes), and
+ * only if allow_incomplete is set.
+ */
+static int build_table(uint32_t *table, int tbits, const uint8_t *lens,
+                       int n, const uint32_t *info, int allow_incomplete) {
+    int count[16] = { 0 }, next[16];
+    int len, max, i, j, left = 1;
+
+    for (i = 0; i < n; i++)
+        count[lens[i]]++;
+    for (max = 15; max > 0 && !count[max]; max--)
+        ;
+    for (len = 1; len <= 15; len++) {
+        left = (left << 1) - count[len];
+        if (left < 0)
+            return -1;  // Over-subscribed
+    }
+    if (left > 0 && (!allow_incomplete || max > 1))
+        return -1;
+
+    count[0] = 0;
+    next[0] = 0;
+    for (len = 1; len <= 15; len++)
+        next[len] = (next[len - 1] + count[len - 1]) << 1;
+
+    int tsize = 1 << tbits, sub_bits = max > tbits ? max - tbits : 0;
+    int used = tsize;
+    for (i = 0; i < tsize; i++)
+        table[i] = ENTRY(E_BAD, 0, 0);
+
+    for (i = 0; i < n; i++) {
+        if (!(len = lens[i]))
+            continue;
+        unsigned rev = reverse_bits(next[len]++, len);
+        if (len <= tbits) {
+            for (j = rev; j < tsize; j += 1 << len)
+                table[j] = info[i] | len;
+        } else {
+            uint32_t *p = &table[rev & (tsize - 1)];
+            if (E_TYPE(*p) != E_SUB) {
+                *p = ENTRY(E_SUB, sub_bits, used) | tbits;
+                for (j = 0; j < 1 << sub_bits; j++)
+                    table[used + j] = ENTRY(E_BAD, 0, 0);
+                used += 1 << sub_bits;
+            }
+            uint32_t *sub = &table[E_VALUE(*p)];
+            for (j = rev >> tbits; j < 1 << sub_bits; j += 1 << (len - tbits))
+                sub[j] = info[i] | (len - tbits);
+        }
+    }
+
+    return 0;
+}
+
+static void init_tables(void) {
+    static const uint16_t len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16_t dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    uint8_t lens[288];
+    int i;
+
+    for (i = 0; i < 256; i++)
+        litlen_info[i] = ENTRY(E_LIT, 0, i);
+    litlen_info[256] = ENTRY(E_EOB, 0, 0);
+    for (i = 0; i < 29; i++)
+        litlen_info[257 + i] = ENTRY(E_LEN, len_extra[i], len_base[i]);
+    litlen_info[286] = litlen_info[287] = ENTRY(E_BAD, 0, 0);
+
+    for (i = 0; i < 30; i++)
+        dist_info[i] = ENTRY(E_DIST, i < 2 ? 0 : i / 2 - 1, dist_base[i]);
+    dist_info[30] = dist_info[31] = ENTRY(E_BAD, 0, 0);
+
+    for (i = 0; i < 19; i++)
+        codes_info[i] = ENTRY(E_LIT, 0, i);
+
+    for (i = 0; i < 288; i++)
+        lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    build_table(fixed_litlen, LITLEN_BITS, lens, 288, litlen_info, 0);
+    for (i = 0; i < 32; i++)
+        lens[i] = 5;
+    build_table(fixed_dist, DIST_BITS, lens, 32, dist_info, 0);
+}
+
+/*
+ * Bit reader.  Past the end of the input it supplies zeros; callers use
+ * bits_pos() to check whether they have run off the end.
+ */
+
+typedef struct {
+    const uint8_t *in;
+    size_t len;
+    size_t next;     // Next byte to load
+    uint64_t buf;
+    int cnt;         // Number of bits in buf
+} bits_t;
+
+// Makes sure at least 56 bits are buffered
+static inline void bits_refill(bits_t *b) {
+    if (b->next + 8 <= b->len) {
+        int nbytes = (63 - b->cnt) >> 3;
+        b->buf |= le_to_u64(b->in + b->next) << b->cnt;
+        b->next += nbytes;
+        b->cnt += nbytes * 8;
+    } else {
+        while (b->cnt <= 56) {
+            if (b->next < b->len)
+                b->buf |= (uint64_t) b->in[b->next] << b->cnt;
+            b->next++;
+            b->cnt += 8;
+        }
+    }
+}
+
+static inline uint64_t bits_pos(const bits_t *b) {
+    return (uint64_t) b->next * 8 - b->cnt;
+}
+
+static inline void bits_init(bits_t *b, const uint8_t *in, size_t len,
+                             uint64_t pos) {
+    b->in = in;
+    b->len = len;
+    b->next = pos >> 3;
+    b->buf = 0;
+    b->cnt = 0;
+    bits_refill(b);
+    b->buf >>= pos & 7;
+    b->cnt -= pos & 7;
+}
+
+static inline void bits_skip(bits_t *b, int n) {
+    b->buf >>= n;
+    b->cnt -= n;
+}
+
+// Gets n bits, which must already be buffered
+static inline unsigned bits_get(bits_t *b, int n) {
+    unsigned v = b->buf & ((1ULL << n) - 1);
+    bits_skip(b, n);
+    return v;
+}
+
+// Looks up the next symbol in table
+static inline uint32_t bits_decode(bits_t *b, const uint32_t *table,
+                                   int tbits) {
+    uint32_t e = table[b->buf & ((1 << tbits) - 1)];
+    if (E_TYPE(e) == E_SUB) {
+        bits_skip(b, tbits);
+        e = table[E_VALUE(e) + (b->buf & ((1 << E_EXTRA(e)) - 1))];
+    }
+    bits_skip(b, E_NBITS(e));
+    return e;
+}
+
+/*
+ * Reads the code lengths of a dynamic Huffman block, after its 3 bit
+ * header, and builds its tables.  In strict mode incomplete codes are
+ * rejected.  Returns 0 on success or -1 on invalid data.
+ */
+static int read_tables(bits_t *b, uint32_t *tables, int strict) {
+    uint32_t *litlen = tables, *dist = tables + LITLEN_SIZE;
+    uint32_t *codes = dist + DIST_SIZE;
+    uint8_t lens[286 + 30], cl[19] = { 0 };
+    int i;
+
+    bits_refill(b);
+    int nlit = bits_get(b, 5) + 257;
+    int ndist = bits_get(b, 5) + 1;
+    int ncodes = bits_get(b, 4) + 4;
+    if (nlit > 286 || ndist > 30)
+        return -1;
+
+    for (i = 0; i < ncodes; i++) {
+        if (b->cnt < 3)
+            bits_refill(b);
+        cl[codes_order[i]] = bits_get(b, 3);
+    }
+    if (build_table(codes, CODES_BITS, cl, 19, codes_info, 0) < 0)
+        return -1;
+
+    for (i = 0; i < nlit + ndist; ) {
+        bits_refill(b);
+        uint32_t e = bits_decode(b, codes, CODES_BITS);
+        if (E_TYPE(e) == E_BAD)
+            return -1;
+        unsigned sym = E_VALUE(e);
+        if (sym < 16) {
+            lens[i++] = sym;
+            continue;
+        }
+
+        int rep, v = 0;
+        if (sym == 16) {
+            if (i == 0)
+                return -1;
+            v = lens[i - 1];
+            rep = 3 + bits_get(b, 2);
+        } else if (sym == 17) {
+            rep = 3 + bits_get(b, 3);
+        } else {
+            rep = 11 + bits_get(b, 7);
+        }
+        if (i + rep > nlit + ndist)
+            return -1;
+        while (rep--)
+            lens[i++] = v;
+    }
+
+    if (!lens[256])
+        return -1;  // No end-of-block code
+    if (build_table(litlen, LITLEN_BITS, lens, nlit, litlen_info,
+                    !strict) < 0)
+        return -1;
+    if (build_table(dist, DIST_BITS, lens + nlit, ndist, dist_info,
+                    !strict) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int chunk_grow(pinf_chunk *c, size_t extra) {
+    if (c->out_size - c->out_len >= extra)
+        return 0;
+    size_t new_size = c->out_size ? c->out_size * 2 : 1 << 20;
+    while (new_size - c->out_len < extra)
+        new_size *= 2;
+    pinf_sym *out = realloc(c->out, new_size * sizeof(*out));
+    if (!out)
+        return -1;
+    c->out = out;
+    c->out_size = new_size;
+    return 0;
+}
+
+static int chunk_add_member(pinf_chunk *c, uint64_t pos,
+                            uint32_t crc, uint32_t isize) {
+    if (c->nmembers == c->mmembers) {
+        size_t m = c->mmembers ? c->mmembers * 2 : 16;
+        pinf_member *members = realloc(c->members, m * sizeof(*members));
+        if (!members)
+            return -1;
+        c->members = members;
+        c->mmembers = m;
+    }
+    pinf_member *m = &c->members[c->nmembers++];
+    m->out_pos = c->out_len;
+    m->bit_pos = pos;
+    m->crc = crc;
+    m->isize = isize;
+    return 0;
+}
+
+int64_t pinf_gzip_header(const uint8_t *in, size_t len) {
+    static const uint8_t magic[3] = { 31, 139, 8 };
+    size_t p = 10;
+
+    if (len < 4)
+        return memcmp(in, magic, len) == 0 ? 0 : -1;
+    if (memcmp(in, magic, 3) != 0 || (in[3] & 0xe0))
+        return -1;
+    if (len < p)
+        return 0;
+
+    int flags = in[3];
+    if (flags & 4) {  // FEXTRA
+        if (len < p + 2)
+            return 0;
+        p += 2 + le_to_u16(in + p);
+    }
+    if (flags & 8) {  // FNAME
+        while (p < len && in[p])
+            p++;
+        p++;
+    }
+    if (flags & 16) { // FCOMMENT
+        while (p < len && in[p])
+            p++;
+        p++;
+    }
+    if (flags & 2)    // FHCRC
+        p += 2;
+
+    return p <= len ? p : 0;
+}
+
+/*
+ * The decoder proper.  With strict set, blocks must use complete codes;
+ * this is used when looking for block boundaries.
+ */
+static int decode(const uint8_t *in, size_t len, int eof,
+                  uint64_t start, uint64_t stop, int strict, pinf_chunk *c) {
+    const uint64_t avail = (uint64_t) len * 8;
+    uint64_t last_pos = start, member_pos = 0;
+    size_t last_out = c->out_len, last_members = c->nmembers;
+    size_t member_out = 0;
+    bits_t b;
+
+    pthread_once(&tables_once, init_tables);
+    if (!c->tables && !(c->tables = malloc(TABLES_SIZE * sizeof(uint32_t))))
+        goto error;
+
+    bits_init(&b, in, len, start);
+    for (;;) {
+        // At a block boundary
+        uint64_t pos = bits_pos(&b);
+        if (pos > avail)
+            goto need_input;
+        last_pos = pos;
+        last_out = c->out_len;
+        last_members = c->nmembers;
+        if (pos >= stop) {
+            c->end = pos;
+            return PINF_STOP;
+        }
+
+        const uint32_t *litlen, *dist;
+        bits_refill(&b);
+        int final = bits_get(&b, 1);
+        switch (bits_get(&b, 2)) {
+        case 0: { // Stored
+            bits_skip(&b, b.cnt & 7);
+            bits_refill(&b);
+            unsigned n = bits_get(&b, 16);
+            if (n != (~bits_get(&b, 16) & 0xffff))
+                goto bad;
+            if (chunk_grow(c, n) < 0)
+                goto error;
+            while (n--) {
+                if (b.cnt < 8)
+                    bits_refill(&b);
+                c->out[c->out_len++] = bits_get(&b, 8);
+            }
+            litlen = NULL;
+            dist = NULL;
+            break;
+        }
+
+        case 1: // Fixed Huffman codes
+            litlen = fixed_litlen;
+            dist = fixed_dist;
+            break;
+
+        case 2: // Dynamic Huffman codes
+            if (read_tables(&b, c->tables, strict) < 0)
+                goto bad;
+            litlen = c->tables;
+            dist = c->tables + LITLEN_SIZE;
+            break;
+
+        default:
+            goto bad;
+        }
+
+        while (litlen) {
+            if (c->out_size - c->out_len < 258 && chunk_grow(c, 258) < 0)
+                goto error;
+            bits_refill(&b);
+            // Runaway decoding of the zeros past the end of input
+            if (b.next > len && bits_pos(&b) > avail)
+                goto need_input;
+
+            uint32_t e = bits_decode(&b, litlen, LITLEN_BITS);
+            if (E_TYPE(e) == E_LIT) {
+                c->out[c->out_len++] = E_VALUE(e);
+                continue;
+            }
+            if (E_TYPE(e) == E_EOB)
+                break;
+            if (E_TYPE(e) != E_LEN)
+                goto bad;
+            unsigned length = E_VALUE(e) + bits_get(&b, E_EXTRA(e));
+
+            e = bits_decode(&b, dist, DIST_BITS);
+            if (E_TYPE(e) != E_DIST)
+                goto bad;
+            size_t d = E_VALUE(e) + bits_get(&b, E_EXTRA(e));
+
+            pinf_sym *o = c->out + c->out_len;
+            unsigned i;
+            if (d <= c->out_len) {
+                const pinf_sym *s = o - d;
+                for (i = 0; i < length; i++)
+                    o[i] = s[i];
+            } else {
+                // Refers to the window before start
+                if (d > c->out_len + PINF_WINDOW)
+                    goto bad;
+                for (i = 0; i < length; i++) {
+                    size_t src = c->out_len + i + PINF_WINDOW - d;
+                    o[i] = src < PINF_WINDOW
+                        ? 256 + src : c->out[src - PINF_WINDOW];
+                }
+            }
+            c->out_len += length;
+        }
+
+        if (!final)
+            continue;
+
+        // End of a gzip member: byte-aligned CRC32 and ISIZE
+        bits_skip(&b, b.cnt & 7);
+        bits_refill(&b);
+        uint32_t crc = bits_get(&b, 32);
+        bits_refill(&b);
+        uint32_t isize = bits_get(&b, 32);
+        pos = bits_pos(&b);
+        if (pos > avail)
+            goto need_input;
+        if (chunk_add_member(c, pos, crc, isize) < 0)
+            goto error;
+        member_pos = pos;
+        member_out = c->out_len;
+
+        if (pos == avail) {
+            if (!eof)
+                goto need_input;
+            c->end = pos;
+            return PINF_END;
+        }
+
+        // Another member follows
+        int64_t hlen = pinf_gzip_header(in + pos / 8, len - pos / 8);
+        if (hlen < 0)
+            goto bad;
+        if (hlen == 0)
+            goto need_input;
+        bits_init(&b, in, len, pos + hlen * 8);
+    }
+
+ need_input:
+    if (!eof) {
+        c->out_len = last_out;
+        c->nmembers = last_members;
+        c->end = last_pos;
+        return PINF_NEED_INPUT;
+    }
+    // Truncated
+
+ bad:
+    // Errors close to the end of a partial buffer may be due to the data
+    // running out, so leave those to be retried with more input.
+    if (!eof && bits_pos(&b) + 64 > avail)
+        goto need_input;
+
+ error:
+    if (member_pos > last_pos) {
+        // Keep the member that ended before the bad data
+        c->out_len = member_out;
+        c->end = member_pos;
+        return PINF_ERROR;
+    }
+    c->out_len = last_out;
+    c->nmembers = last_members;
+    c->end = last_pos;
+    return PINF_ERROR;
+}
+
+int pinf_decode(const uint8_t *in, size_t len, int eof,
+                uint64_t start, uint64_t stop, pinf_chunk *c) {
+    return decode(in, len, eof, start, stop, 0, c);
+}
+
+// Checks whether a plausible block header starts at pos
+static int valid_header(const uint8_t *in, size_t len, uint64_t pos,
+                        uint32_t *tables) {
+    bits_t b;
+    bits_init(&b, in, len, pos);
+    bits_skip(&b, 1);
+    switch (bits_get(&b, 2)) {
+    case 0:
+        bits_skip(&b, b.cnt & 7);
+        bits_refill(&b);
+        if (bits_get(&b, 16) != (~bits_get(&b, 16) & 0xffff))
+            return 0;
+        break;
+
+    case 1:
+        break;
+
+    case 2:
+        if (read_tables(&b, tables, 1) < 0)
+            return 0;
+        break;
+
+    default:
+        return 0;
+    }
+
+    return bits_pos(&b) <= (uint64_t) len * 8;
+}
+
+int64_t pinf_find_block(const uint8_t *in, size_t len,
+                        uint64_t from, uint64_t to, pinf_chunk *scratch) {
+    uint64_t p;
+
+    pthread_once(&tables_once, init_tables);
+    if (!scratch->tables
+        && !(scratch->tables = malloc(TABLES_SIZE * sizeof(uint32_t))))
+        return -1;
+
+    for (p = from; p < to && p / 8 + 8 <= len; p++) {
+        // Quick checks for BFINAL=0, BTYPE=2 and in-range HLIT and HDIST
+        uint64_t w = le_to_u64(in + p / 8) >> (p & 7);
+        if ((w & 7) != 4 || ((w >> 3) & 31) > 29 || ((w >> 8) & 31) > 29)
+            continue;
+
+        bits_t b;
+        bits_init(&b, in, len, p + 3);
+        if (read_tables(&b, scratch->tables, 1) < 0)
+            continue;
+
+        // Decode the whole block, and look at the next header
+        scratch->out_len = 0;
+        scratch->nmembers = 0;
+        if (decode(in, len, 0, p, p + 1, 1, scratch) != PINF_STOP)
+            continue;
+        if (!valid_header(in, len, scratch->end, scratch->tables))
+            continue;
+
+        return p;
+    }
+
+    return -1;
+}
+
+int pinf_resolve(uint8_t *dst, const pinf_sym *sym, size_t n,
+                 const uint8_t *window, size_t wlen) {
+    const unsigned lowest = 256 + PINF_WINDOW - wlen;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned v = sym[i];
+        if (v < 256) {
+            dst[i] = v;
+        } else {
+            if (v < lowest)
+                return -1;
+            dst[i] = window[v - 256];
+        }
+    }
+
+    return 0;
+}
+
+void pinf_chunk_free(pinf_chunk *c) {
+    free(c->out);
+    free(c->members);
+    free(c->tables);
+    memset(c, 0, sizeof(*c));
+}
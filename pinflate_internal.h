@@ -0,0 +1,138 @@
+/*  pinflate_internal.h -- deflate decoding from arbitrary block boundaries.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#ifndef PINFLATE_INTERNAL_H
+#define PINFLATE_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multi-member gzip streams are decoded in pieces starting at deflate
+ * block boundaries, without knowing the preceding output.  Back-references
+ * into that unknown 32KiB window are kept as placeholder symbols, which
+ * are resolved once the preceding piece has been decoded (see
+ * pinf_resolve).  This is what allows plain gzip, unlike BGZF, to be
+ * decompressed in parallel.
+ *
+ * All positions are bit offsets into the input buffer passed in.
+ */
+
+#define PINF_WINDOW 32768
+
+// Decoded output.  Values below 256 are literal bytes; 256 + i is byte i
+// of the window preceding the start of the decode.
+typedef uint16_t pinf_sym;
+
+// The end of a gzip member, as given by its trailer.
+typedef struct {
+    size_t out_pos;     // Output length at the end of the member
+    uint64_t bit_pos;   // Input position after the trailer
+    uint32_t crc;
+    uint32_t isize;
+} pinf_member;
+
+typedef struct {
+    pinf_sym *out;
+    size_t out_len, out_size;
+    pinf_member *members;  // Member ends seen, in order
+    size_t nmembers, mmembers;
+    uint64_t end;          // Where decoding stopped
+    uint32_t *tables;      // Scratch space for Huffman tables
+} pinf_chunk;
+
+enum pinf_status {
+    PINF_STOP,        // Reached a block boundary at or after the stop point
+    PINF_END,         // Reached the end of the final gzip member
+    PINF_NEED_INPUT,  // Ran out of input; stopped at the last boundary
+    PINF_ERROR,       // Invalid data, truncated input or out of memory
+};
+
+/// Decode a deflate stream from a block boundary
+/** @param in     Input buffer
+    @param len    Length of @p in, in bytes
+    @param eof    Set if @p in extends to the end of the gzip stream
+    @param start  Bit position of the block header to start from
+    @param stop   Stop at the first block boundary at or after this position
+    @param c      Output, appended to
+    @return A pinf_status value
+
+Decoding continues across gzip member boundaries, recording each member's
+trailer in c->members.  On return c->end is the bit position of the block
+boundary reached (or the end of the stream for PINF_END), and c->out holds
+the output up to that point.  On PINF_NEED_INPUT and PINF_ERROR, output
+and members after the last complete block are discarded.  The exception
+is a PINF_ERROR after the end of a member, as from trailing garbage, which
+keeps the output up to that member's end and sets c->end to the position
+after its trailer.  This is not a block boundary, so decoding can't be
+continued from there.
+
+Calling again with @p start set to c->end continues the decode.
+*/
+int pinf_decode(const uint8_t *in, size_t len, int eof,
+                uint64_t start, uint64_t stop, pinf_chunk *c);
+
+/// Find a deflate block boundary
+/** @param in       Input buffer
+    @param len      Length of @p in, in bytes
+    @param from     First bit position to try
+    @param to       Bit position to stop looking at
+    @param scratch  Used for trial decodes
+    @return Bit position of the boundary found, or -1 if there isn't one
+
+This looks for a dynamic Huffman block header with complete codes, that
+decodes without error and is followed by another valid block header.
+Only data in @p in is used, so results are reproducible given the same
+buffer contents.  False positives are possible, but rare.
+*/
+int64_t pinf_find_block(const uint8_t *in, size_t len,
+                        uint64_t from, uint64_t to, pinf_chunk *scratch);
+
+/// Parse a gzip member header
+/** @return The header length in bytes; 0 if @p len is too short to tell;
+            or -1 if the data is not a gzip header
+*/
+int64_t pinf_gzip_header(const uint8_t *in, size_t len);
+
+/// Convert decoded symbols to bytes
+/** @param dst     Output buffer, @p n bytes long
+    @param sym     Symbols to convert
+    @param n       Number of symbols
+    @param window  The 32KiB preceding the decode start
+    @param wlen    How many bytes at the end of @p window are valid
+    @return 0 on success; -1 if a symbol refers to an invalid window byte
+*/
+int pinf_resolve(uint8_t *dst, const pinf_sym *sym, size_t n,
+                 const uint8_t *window, size_t wlen);
+
+/// Free memory held by a chunk, leaving it empty
+void pinf_chunk_free(pinf_chunk *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
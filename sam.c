@@ -471,6 +471,127 @@ bam1_t *bam_dup1(const bam1_t *bsrc)
     return bdst;
 }
 
+/*************************
+ *** BAM record arenas ***
+ *************************/
+
+// Default size of each arena block
+#define BAM_ARENA_BLOCK (1<<20)
+
+typedef struct bam_arena_block {
+    struct bam_arena_block *next;
+    size_t size, used;
+} bam_arena_block;
+
+struct bam_arena_t {
+    bam_arena_block *head, *curr, *tail;
+    size_t block_size;
+};
+
+bam_arena_t *bam_arena_init(size_t block_size)
+{
+    bam_arena_t *a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    a->block_size = block_size ? block_size : BAM_ARENA_BLOCK;
+    return a;
+}
+
+// Returns len bytes, 8-byte aligned, from the arena.  Blocks kept by
+// bam_arena_reset() are used first; new ones are added at the end.
+static void *bam_arena_alloc(bam_arena_t *a, size_t len)
+{
+    bam_arena_block *blk;
+
+    len = (len + 7) & ~(size_t)7;
+    for (blk = a->curr; blk; blk = blk->next) {
+        if (blk->size - blk->used >= len)
+            break;
+    }
+
+    if (!blk) {
+        size_t size = len > a->block_size ? len : a->block_size;
+        blk = malloc(sizeof(*blk) + size);
+        if (!blk) return NULL;
+        blk->next = NULL;
+        blk->size = size;
+        blk->used = 0;
+        if (a->tail)
+            a->tail->next = blk;
+        else
+            a->head = blk;
+        a->tail = blk;
+    }
+
+    // Keep going from here; any space in skipped blocks waits for a reset
+    a->curr = blk;
+    void *p = (uint8_t *)(blk + 1) + blk->used;
+    blk->used += len;
+    return p;
+}
+
+bam1_t *bam_arena_dup1(bam_arena_t *a, const bam1_t *bsrc)
+{
+    size_t hdr_len = (sizeof(bam1_t) + 7) & ~(size_t)7;
+    bam1_t *bdst;
+
+    if (!a || !bsrc) return NULL;
+    bdst = bam_arena_alloc(a, hdr_len + bsrc->l_data);
+    if (!bdst) return NULL;
+
+    // Arena memory is reused, so clear it as bam_init1() would
+    memset(bdst, 0, sizeof(*bdst));
+    bdst->core = bsrc->core;
+    bdst->id = bsrc->id;
+    bdst->data = (uint8_t *)bdst + hdr_len;
+    bdst->l_data = bsrc->l_data;
+    bdst->m_data = bsrc->l_data;
+    bdst->mempolicy = BAM_USER_OWNS_STRUCT | BAM_USER_OWNS_DATA;
+    memcpy(bdst->data, bsrc->data, bsrc->l_data);
+    return bdst;
+}
+
+bam1_t *bam_arena_copy1(bam_arena_t *a, bam1_t *bdst, const bam1_t *bsrc)
+{
+    uint8_t *data;
+
+    if (!a) return NULL;
+    if (!(data = bam_arena_alloc(a, bsrc->l_data)))
+        return NULL;
+    memcpy(data, bsrc->data, bsrc->l_data);
+
+    if ((bam_get_mempolicy(bdst) & BAM_USER_OWNS_DATA) == 0)
+        free(bdst->data);
+    bdst->data = data;
+    bdst->l_data = bsrc->l_data;
+    bdst->m_data = bsrc->l_data;
+    bdst->core = bsrc->core;
+    bdst->id = bsrc->id;
+    bam_set_mempolicy(bdst, bam_get_mempolicy(bdst) | BAM_USER_OWNS_DATA);
+    return bdst;
+}
+
+void bam_arena_reset(bam_arena_t *a)
+{
+    bam_arena_block *blk;
+
+    if (!a) return;
+    for (blk = a->head; blk; blk = blk->next)
+        blk->used = 0;
+    a->curr = a->head;
+}
+
+void bam_arena_destroy(bam_arena_t *a)
+{
+    bam_arena_block *blk, *next;
+
+    if (!a) return;
+    for (blk = a->head; blk; blk = next) {
+        next = blk->next;
+        free(blk);
+    }
+    free(a);
+}
+
 static void bam_cigar2rqlens(int n_cigar, const uint32_t *cigar,
                              hts_pos_t *rlen, hts_pos_t *qlen)
 {
@@ -600,11 +721,65 @@ static int fixup_missing_qname_nul(bam1_t *b) {
  * Note a second interface that returns a bam pointer instead would avoid bam_copy1
  * in multi-threaded handling.  This may be worth considering for htslib2.
  */
+// Fills in the core part of b from the fixed-length fields x[] of a record
+// of block_len bytes, returning the size of the variable-length data it
+// needs or -1 if the fields are inconsistent.
+static int64_t bam_decode_core(bam1_core_t *c, uint32_t x[8],
+                               int32_t block_len, int is_be)
+{
+    int i;
+    int64_t new_l_data;
+
+    if (is_be) {
+        for (i = 0; i < 8; ++i) ed_swap_4p(x + i);
+    }
+    c->tid = x[0]; c->pos = (int32_t)x[1];
+    c->bin = x[2]>>16; c->qual = x[2]>>8&0xff; c->l_qname = x[2]&0xff;
+    c->l_extranul = (c->l_qname%4 != 0)? (4 - c->l_qname%4) : 0;
+    c->flag = x[3]>>16; c->n_cigar = x[3]&0xffff;
+    c->l_qseq = x[4];
+    c->mtid = x[5]; c->mpos = (int32_t)x[6]; c->isize = (int32_t)x[7];
+
+    new_l_data = (int64_t) block_len - 32 + c->l_extranul;
+    if (new_l_data > INT_MAX || c->l_qseq < 0 || c->l_qname < 1) return -1;
+    if (((uint64_t) c->n_cigar << 2) + c->l_qname + c->l_extranul
+        + (((uint64_t) c->l_qseq + 1) >> 1) + c->l_qseq > (uint64_t) new_l_data)
+        return -1;
+    return new_l_data;
+}
+
+// Byte-swaps, recovers long CIGARs from the CG tag and recomputes the bin
+// of a record once its data has been read.  Returns -1 if it is invalid.
+static int bam_decode_finish(bam1_t *b, int is_be)
+{
+    bam1_core_t *c = &b->core;
+
+    if (is_be) swap_data(c, b->l_data, b->data, 0);
+    if (bam_tag2cigar(b, 0, 0) < 0)
+        return -1;
+
+    if (c->n_cigar > 0) { // recompute "bin" and check CIGAR-qlen consistency
+        hts_pos_t rlen, qlen;
+        bam_cigar2rqlens(c->n_cigar, bam_get_cigar(b), &rlen, &qlen);
+        if ((b->core.flag & BAM_FUNMAP) || rlen == 0) rlen = 1;
+        b->core.bin = hts_reg2bin(b->core.pos, b->core.pos + rlen, 14, 5);
+        // Sanity check for broken CIGAR alignments
+        if (c->l_qseq > 0 && !(c->flag & BAM_FUNMAP) && qlen != c->l_qseq) {
+            hts_log_error("CIGAR and query sequence lengths differ for %s",
+                    bam_get_qname(b));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int bam_read1(BGZF *fp, bam1_t *b)
 {
     bam1_core_t *c = &b->core;
     int32_t block_len, ret, i;
-    uint32_t x[8], new_l_data;
+    uint32_t x[8];
+    int64_t new_l_data;
 
     b->l_data = 0;
 
@@ -616,20 +791,7 @@ int bam_read1(BGZF *fp, bam1_t *b)
         ed_swap_4p(&block_len);
     if (block_len < 32) return -4;  // block_len includes core data
     if (bgzf_read(fp, x, 32) != 32) return -3;
-    if (fp->is_be) {
-        for (i = 0; i < 8; ++i) ed_swap_4p(x + i);
-    }
-    c->tid = x[0]; c->pos = (int32_t)x[1];
-    c->bin = x[2]>>16; c->qual = x[2]>>8&0xff; c->l_qname = x[2]&0xff;
-    c->l_extranul = (c->l_qname%4 != 0)? (4 - c->l_qname%4) : 0;
-    c->flag = x[3]>>16; c->n_cigar = x[3]&0xffff;
-    c->l_qseq = x[4];
-    c->mtid = x[5]; c->mpos = (int32_t)x[6]; c->isize = (int32_t)x[7];
-
-    new_l_data = block_len - 32 + c->l_extranul;
-    if (new_l_data > INT_MAX || c->l_qseq < 0 || c->l_qname < 1) return -4;
-    if (((uint64_t) c->n_cigar << 2) + c->l_qname + c->l_extranul
-        + (((uint64_t) c->l_qseq + 1) >> 1) + c->l_qseq > (uint64_t) new_l_data)
+    if ((new_l_data = bam_decode_core(c, x, block_len, fp->is_be)) < 0)
         return -4;
     if (realloc_bam_data(b, new_l_data) < 0) return -4;
     b->l_data = new_l_data;
@@ -643,22 +805,50 @@ int bam_read1(BGZF *fp, bam1_t *b)
     if (b->l_data < c->l_qname ||
         bgzf_read(fp, b->data + c->l_qname, b->l_data - c->l_qname) != b->l_data - c->l_qname)
         return -4;
-    if (fp->is_be) swap_data(c, b->l_data, b->data, 0);
-    if (bam_tag2cigar(b, 0, 0) < 0)
+    if (bam_decode_finish(b, fp->is_be) < 0)
         return -4;
 
-    if (c->n_cigar > 0) { // recompute "bin" and check CIGAR-qlen consistency
-        hts_pos_t rlen, qlen;
-        bam_cigar2rqlens(c->n_cigar, bam_get_cigar(b), &rlen, &qlen);
-        if ((b->core.flag & BAM_FUNMAP) || rlen == 0) rlen = 1;
-        b->core.bin = hts_reg2bin(b->core.pos, b->core.pos + rlen, 14, 5);
-        // Sanity check for broken CIGAR alignments
-        if (c->l_qseq > 0 && !(c->flag & BAM_FUNMAP) && qlen != c->l_qseq) {
-            hts_log_error("CIGAR and query sequence lengths differ for %s",
-                    bam_get_qname(b));
-            return -4;
-        }
+    return 4 + block_len;
+}
+
+// As bam_read1(), but decoding a record from the len bytes at data.
+// Used by the multi-threaded BAM reader.
+static int bam_parse_block(const uint8_t *data, size_t len, int is_be,
+                           bam1_t *b)
+{
+    bam1_core_t *c = &b->core;
+    int32_t block_len, i;
+    uint32_t x[8];
+    int64_t new_l_data;
+
+    b->l_data = 0;
+
+    if (len < 4) return -2; // truncated
+    memcpy(&block_len, data, 4);
+    if (is_be)
+        ed_swap_4p(&block_len);
+    if (block_len < 32) return -4;
+    if (len < 36) return -3;
+    memcpy(x, data + 4, 32);
+    if ((new_l_data = bam_decode_core(c, x, block_len, is_be)) < 0)
+        return -4;
+    if (realloc_bam_data(b, new_l_data) < 0) return -4;
+    b->l_data = new_l_data;
+
+    data += 36; len -= 36;
+    if (len < c->l_qname) return -4;
+    memcpy(b->data, data, c->l_qname);
+    data += c->l_qname; len -= c->l_qname;
+    if (b->data[c->l_qname - 1] != '\0') {
+        if (fixup_missing_qname_nul(b) < 0) return -4;
     }
+    for (i = 0; i < c->l_extranul; ++i) b->data[c->l_qname+i] = '\0';
+    c->l_qname += c->l_extranul;
+    if (b->l_data < c->l_qname || len < b->l_data - c->l_qname)
+        return -4;
+    memcpy(b->data + c->l_qname, data, b->l_data - c->l_qname);
+    if (bam_decode_finish(b, is_be) < 0)
+        return -4;
 
     return 4 + block_len;
 }
@@ -931,7 +1121,11 @@ int sam_idx_save(htsFile *fp) {
     if (fp->format.format == bam || fp->format.format == bcf ||
         fp->format.format == vcf || fp->format.format == sam) {
         int ret;
-        if ((ret = sam_state_destroy(fp)) < 0) {
+        if (fp->format.format == vcf)
+            ret = vcf_state_destroy(fp);
+        else
+            ret = sam_state_destroy(fp);
+        if (ret < 0) {
             errno = -ret;
             return -1;
         }
@@ -951,12 +1145,18 @@ int sam_idx_save(htsFile *fp) {
     return 0;
 }
 
+static int bam_read1_hdr(htsFile *fp, sam_hdr_t *h, bam1_t *b, int decode);
+
 static int sam_readrec(BGZF *ignored, void *fpv, void *bv, int *tid, hts_pos_t *beg, hts_pos_t *end)
 {
     htsFile *fp = (htsFile *)fpv;
     bam1_t *b = bv;
     fp->line.l = 0;
-    int ret = sam_read1(fp, fp->bam_header, b);
+    // Iterators use bgzf_tell() after each record to find the end of a
+    // chunk, so BAM is read directly rather than via the decode read-ahead
+    int ret = fp->format.format == bam
+        ? bam_read1_hdr(fp, fp->bam_header, b, 0)
+        : sam_read1(fp, fp->bam_header, b);
     if (ret >= 0) {
         *tid = b->core.tid;
         *beg = b->core.pos;
@@ -2084,11 +2284,7 @@ int sam_parse1(kstring_t *s, sam_hdr_t *h, bam1_t *b)
         i = (c->l_qseq + 1) >> 1;
         _get_mem(uint8_t, &t, b, i);
 
-        unsigned int lqs2 = c->l_qseq&~1, i;
-        for (i = 0; i < lqs2; i+=2)
-            t[i>>1] = (seq_nt16_table[(unsigned char)q[i]] << 4) | seq_nt16_table[(unsigned char)q[i+1]];
-        for (; i < c->l_qseq; ++i)
-            t[i>>1] = seq_nt16_table[(unsigned char)q[i]] << ((~i&1)<<2);
+        sam_seq_pack(t, q, c->l_qseq);
     } else c->l_qseq = 0;
     // qual
     _get_mem(uint8_t, &t, b, c->l_qseq);
@@ -2223,10 +2419,19 @@ typedef struct sp_bams {
 
     bam1_t *bams;
     int nbams, abams; // used and alloc
+    int last_ret;     // BAM reading: error for the record after the last
+    uint64_t *voffs;  // BAM reading: virtual offset after each record
 
     struct SAM_state *fd;
 } sp_bams;
 
+// BAM reading: the virtual offset of position pos in sp_lines data.
+// Entries are made at each BGZF block boundary.
+typedef struct sp_voff {
+    int pos;
+    uint64_t voff;
+} sp_voff;
+
 // Input job - a block of SAM text
 typedef struct sp_lines {
     struct sp_lines *next;
@@ -2236,6 +2441,9 @@ typedef struct sp_lines {
     int data_size;
     int alloc;
 
+    sp_voff *voffs;
+    int nvoffs, avoffs;
+
     struct SAM_state *fd;
     sp_bams *bams;
 } sp_lines;
@@ -2271,6 +2479,22 @@ typedef struct SAM_state {
     // One of the E* errno codes
     int errcode;
 
+    // BAM reading: partial record left over from the last block read, and
+    // the number of blocks dispatched but not yet collected.  is_be is
+    // copied from the BGZF so the workers don't race with its bitfields.
+    kstring_t frag;
+    uint64_t frag_voff;
+    int nqueued;
+    int eof;
+    int is_be;
+
+    // BAM reading: the BGZF position after the data read ahead so far, and
+    // the virtual offset of the end of the last record returned (if
+    // tell_set), as bgzf_tell() would give without the read-ahead
+    uint64_t read_voff;
+    int tell_set;
+    uint64_t tell_voff;
+
     htsFile *fp;
 } SAM_state;
 
@@ -2282,7 +2506,8 @@ static SAM_state *sam_state_create(htsFile *fp) {
     // be a redirect call with an additional 'S' mode.  This in turn would
     // correctly set the designed format to sam instead of a generic
     // text_format.
-    if (fp->format.format != sam && fp->format.format != text_format)
+    if (fp->format.format != sam && fp->format.format != text_format &&
+        !(fp->format.format == bam && !fp->is_write))
         return NULL;
 
     SAM_state *fd = calloc(1, sizeof(*fd));
@@ -2317,6 +2542,7 @@ static void sam_free_sp_bams(sp_bams *b) {
         }
         free(b->bams);
     }
+    free(b->voffs);
     free(b);
 }
 
@@ -2399,6 +2625,7 @@ int sam_state_destroy(htsFile *fp) {
         while (l) {
             sp_lines *n = l->next;
             free(l->data);
+            free(l->voffs);
             free(l);
             l = n;
         }
@@ -2414,6 +2641,7 @@ int sam_state_destroy(htsFile *fp) {
 
         if (fd->curr_bam)
             sam_free_sp_bams(fd->curr_bam);
+        free(fd->frag.s);
 
         // Decrement counter by one, maybe destroying too.
         // This is to permit the caller using bam_hdr_destroy
@@ -2436,6 +2664,7 @@ static void cleanup_sp_lines(void *arg) {
     assert(gl->next == NULL);
 
     free(gl->data);
+    free(gl->voffs);
     sam_free_sp_bams(gl->bams);
     free(gl);
 }
@@ -2894,7 +3123,7 @@ int sam_set_thread_pool(htsFile *fp, htsThreadPool *p) {
         return -1;
     }
 
-    if (fp->format.compression == bgzf)
+    if (hts_bgzf_threaded(fp))
         return bgzf_thread_pool(fp->fp.bgzf, p->pool, p->qsize);
 
     return 0;
@@ -2918,23 +3147,452 @@ int sam_set_threads(htsFile *fp, int nthreads) {
     return 0;
 }
 
+int sam_state_take_pool(htsFile *fp, htsThreadPool *p) {
+    SAM_state *fd = (SAM_state *)fp->state;
+    if (!fd || fd->h)
+        return -1;
+
+    p->pool = fd->p;
+    p->qsize = 0;
+    int own = fd->own_pool;
+    fd->own_pool = 0;
+    sam_state_destroy(fp);
+
+    return own;
+}
+
+// Returns the virtual offset of position pos in gl->data, starting the
+// search from entry *v of gl->voffs.  Positions on a block boundary are
+// given the offset of the start of the next block, as bgzf_tell() would.
+static uint64_t sp_lines_voff(const sp_lines *gl, int pos, int *v) {
+    while (*v + 1 < gl->nvoffs && gl->voffs[*v + 1].pos <= pos)
+        (*v)++;
+    return gl->voffs[*v].voff + (pos - gl->voffs[*v].pos);
+}
+
+// Records the virtual offset of the current end of l->data.
+static int sp_lines_add_voff(sp_lines *l, int pos, uint64_t voff) {
+    if (l->nvoffs == l->avoffs) {
+        int n = l->avoffs ? l->avoffs * 2 : 64;
+        sp_voff *v = realloc(l->voffs, n * sizeof(*v));
+        if (!v)
+            return -1;
+        l->voffs = v;
+        l->avoffs = n;
+    }
+    l->voffs[l->nvoffs].pos = pos;
+    l->voffs[l->nvoffs].voff = voff;
+    l->nvoffs++;
+    return 0;
+}
+
+// Run from one of the worker threads.
+// Decodes a block of raw BAM records read by bam_dispatch_block().  Any
+// error is recorded in last_ret so the records before it can still be
+// returned in order.
+static void *bam_decode_worker(void *arg) {
+    sp_lines *gl = (sp_lines *)arg;
+    SAM_state *fd = gl->fd;
+    int is_be = fd->is_be;
+    sp_bams *gb = NULL;
+    bam1_t *b;
+    int i, v = 0, ret = 0;
+
+    pthread_mutex_lock(&fd->lines_m);
+    if (fd->bams) {
+        gb = fd->bams;
+        fd->bams = gb->next;
+    }
+    pthread_mutex_unlock(&fd->lines_m);
+
+    if (gb == NULL) {
+        gb = calloc(1, sizeof(*gb));
+        if (!gb)
+            goto err;
+        gb->abams = 100;
+        gb->bams = calloc(gb->abams, sizeof(*b));
+        gb->voffs = malloc(gb->abams * sizeof(*gb->voffs));
+        if (!gb->bams || !gb->voffs)
+            goto err;
+        gb->fd = fd;
+    }
+    gb->serial = gl->serial;
+    gb->next = NULL;
+
+    i = 0;
+    uint8_t *cp = (uint8_t *)gl->data, *cp_end = cp + gl->data_size;
+    while (cp < cp_end) {
+        if (i >= gb->abams) {
+            int old_abams = gb->abams;
+            uint64_t *vo = realloc(gb->voffs, 2 * gb->abams * sizeof(*vo));
+            if (!vo)
+                goto err;
+            gb->voffs = vo;
+            b = realloc(gb->bams, 2 * gb->abams * sizeof(*b));
+            if (!b)
+                goto err;
+            gb->abams *= 2;
+            memset(&b[old_abams], 0, (gb->abams - old_abams)*sizeof(*b));
+            gb->bams = b;
+        }
+
+        if ((ret = bam_parse_block(cp, cp_end - cp, is_be, &gb->bams[i])) < 0)
+            break;
+        cp += ret;
+        gb->voffs[i] = sp_lines_voff(gl, (char *)cp - gl->data, &v);
+        ret = 0;
+        i++;
+    }
+    gb->nbams = i;
+    gb->last_ret = ret;
+
+    pthread_mutex_lock(&fd->lines_m);
+    gl->next = fd->lines;
+    fd->lines = gl;
+    pthread_mutex_unlock(&fd->lines_m);
+    return gb;
+
+ err:
+    sam_state_err(fd, ENOMEM);
+    sam_free_sp_bams(gb);
+    cleanup_sp_lines(gl);
+    return NULL;
+}
+
+// Reads the next block of BAM data, trims it to the last whole record and
+// sends it to bam_decode_worker().  The data is read one BGZF block at a
+// time, noting the virtual offset of each so the workers can work out
+// where each record ends.
+//
+// Returns 0 on success,
+//         1 on EOF (nothing dispatched),
+//        -1 on error
+static int bam_dispatch_block(htsFile *fp) {
+    SAM_state *fd = (SAM_state *)fp->state;
+    BGZF *bfp = fp->fp.bgzf;
+    sp_lines *l = NULL;
+
+    pthread_mutex_lock(&fd->lines_m);
+    if (fd->lines) {
+        l = fd->lines;
+        fd->lines = l->next;
+    }
+    pthread_mutex_unlock(&fd->lines_m);
+
+    if (l == NULL) {
+        l = calloc(1, sizeof(*l));
+        if (!l)
+            return -1;
+        l->alloc = NM;
+        l->data = malloc(l->alloc);
+        if (!l->data) {
+            free(l);
+            return -1;
+        }
+        l->fd = fd;
+    }
+    l->next = NULL;
+
+    if (l->alloc < fd->frag.l + NM/2) {
+        char *rp = realloc(l->data, fd->frag.l + NM/2);
+        if (!rp)
+            goto err;
+        l->alloc = fd->frag.l + NM/2;
+        l->data = rp;
+    }
+    memcpy(l->data, fd->frag.s, fd->frag.l);
+    l->data_size = fd->frag.l;
+    l->nvoffs = 0;
+    if (fd->frag.l > 0 && sp_lines_add_voff(l, 0, fd->frag_voff) < 0)
+        goto err;
+    if (sp_lines_add_voff(l, l->data_size, bgzf_tell(bfp)) < 0)
+        goto err;
+    fd->frag.l = 0;
+
+    for (;;) {
+        while (l->data_size < l->alloc) {
+            // Stop at the end of each BGZF block, or just load the next
+            // one if at the end already
+            size_t want = l->alloc - l->data_size;
+            int avail = bfp->block_length - bfp->block_offset;
+            if (avail <= 0)
+                want = 1;
+            else if (want > avail)
+                want = avail;
+            ssize_t nbytes = bgzf_read(bfp, l->data + l->data_size, want);
+            if (nbytes < 0)
+                goto err;
+            if (nbytes == 0)
+                break;
+            l->data_size += nbytes;
+            if (sp_lines_add_voff(l, l->data_size, bgzf_tell(bfp)) < 0)
+                goto err;
+        }
+        if (l->data_size < l->alloc) {
+            // EOF; any truncated record is reported by the worker
+            fd->eof = 1;
+            break;
+        }
+
+        // Find the end of the last whole record
+        size_t pos = 0;
+        for (;;) {
+            int32_t block_len;
+            if (l->data_size - pos < 4)
+                break;
+            memcpy(&block_len, l->data + pos, 4);
+            if (bfp->is_be)
+                ed_swap_4p(&block_len);
+            if (block_len < 32) {
+                // Invalid; leave it for the worker to report
+                pos = l->data_size;
+                break;
+            }
+            if (l->data_size - pos - 4 < block_len)
+                break;
+            pos += 4 + block_len;
+        }
+
+        if (pos > 0) {
+            if (kputsn(l->data + pos, l->data_size - pos, ks_clear(&fd->frag)) < 0)
+                goto err;
+            int v = 0;
+            fd->frag_voff = sp_lines_voff(l, pos, &v);
+            l->data_size = pos;
+            break;
+        }
+
+        // A single record larger than the buffer
+        char *rp = realloc(l->data, l->alloc * 2);
+        if (!rp)
+            goto err;
+        l->alloc *= 2;
+        l->data = rp;
+    }
+    fd->read_voff = bgzf_tell(bfp);
+
+    if (l->data_size == 0) {
+        pthread_mutex_lock(&fd->lines_m);
+        l->next = fd->lines;
+        fd->lines = l;
+        pthread_mutex_unlock(&fd->lines_m);
+        return 1;
+    }
+
+    l->serial = fd->serial++;
+    if (hts_tpool_dispatch3(fd->p, fd->q, bam_decode_worker, l,
+                            cleanup_sp_lines, cleanup_sp_bams, 0) < 0)
+        goto err;
+    fd->nqueued++;
+    return 0;
+
+ err:
+    free(l->data);
+    free(l->voffs);
+    free(l);
+    return -1;
+}
+
+static int bam_decode_start(htsFile *fp);
+
+// Multi-threaded bam_read1().  The file is read by the calling thread, so
+// seeks (for example by iterators) can be detected between calls, but the
+// records are decoded on the thread pool.  The BGZF position is left where
+// the read-ahead got to; the virtual offset of the end of each record
+// returned is kept for sam_tell().
+static int bam_read1_mt(htsFile *fp, bam1_t *b) {
+    SAM_state *fd = (SAM_state *)fp->state;
+    BGZF *bfp = fp->fp.bgzf;
+
+    if (bfp->seeked || bgzf_tell(bfp) != fd->read_voff) {
+        // Seeked, or read by something else such as an iterator, so the
+        // blocks read ahead are no longer wanted.  Start again from the
+        // new position.
+        int ret;
+        if ((ret = sam_state_destroy(fp)) < 0) {
+            errno = -ret;
+            return -2;
+        }
+        if (!sam_state_create(fp))
+            return -2;
+        if ((ret = bam_decode_start(fp)) != 0)
+            return ret < 0 ? -2 : bam_read1(bfp, b);
+        fd = (SAM_state *)fp->state;
+    }
+
+    sp_bams *gb = fd->curr_bam;
+    while (!gb) {
+        if (fd->errcode) {
+            errno = fd->errcode;
+            return -2;
+        }
+
+        // Keep the queue full
+        int qsize = hts_tpool_process_qsize(fd->q);
+        while (!fd->eof && fd->nqueued < qsize) {
+            int r = bam_dispatch_block(fp);
+            if (r < 0) {
+                sam_state_err(fd, errno ? errno : EIO);
+                break;
+            }
+            if (r > 0)
+                break;
+        }
+        if (fd->nqueued == 0) {
+            if (fd->errcode)
+                return -2;
+            // At EOF the read-ahead has stopped where bam_read1() would
+            fd->tell_voff = fd->read_voff;
+            fd->tell_set = 1;
+            return -1;
+        }
+
+        hts_tpool_result *r = hts_tpool_next_result_wait(fd->q);
+        if (!r)
+            return -2;
+        fd->nqueued--;
+        gb = (sp_bams *)hts_tpool_result_data(r);
+        hts_tpool_delete_result(r, 0);
+        if (!gb)
+            return -2;
+        fd->curr_bam = gb;
+        fd->curr_idx = 0;
+    }
+
+    if (fd->curr_idx == gb->nbams) {
+        // Only reached for a block that ended in an error
+        return gb->last_ret;
+    }
+
+    bam1_t *src = &gb->bams[fd->curr_idx++];
+    if (!(bam_get_mempolicy(b) & BAM_USER_OWNS_DATA)) {
+        // Swap rather than copy; our old data is recycled via the block
+        bam1_t tmp = *src;
+        src->core = b->core;
+        src->l_data = b->l_data;
+        src->m_data = b->m_data;
+        src->data = b->data;
+        b->core = tmp.core;
+        b->l_data = tmp.l_data;
+        b->m_data = tmp.m_data;
+        b->data = tmp.data;
+    } else if (!bam_copy1(b, src)) {
+        return -2;
+    }
+
+    fd->tell_voff = gb->voffs[fd->curr_idx - 1];
+    fd->tell_set = 1;
+
+    if (fd->curr_idx == gb->nbams && !gb->last_ret) {
+        pthread_mutex_lock(&fd->lines_m);
+        gb->next = fd->bams;
+        fd->bams = gb;
+        pthread_mutex_unlock(&fd->lines_m);
+
+        fd->curr_bam = NULL;
+        fd->curr_idx = 0;
+    }
+
+    return 0;
+}
+
+// Starts decoding BAM records on the thread pool used by the BGZF layer,
+// once the first record is read.  The SAM_state is created here but the
+// pool is only looked up then, so the order in which this and
+// hts_set_threads() are called does not matter.
+int sam_set_bam_decode(htsFile *fp, int enable) {
+    if (fp->format.format != bam || fp->is_write)
+        return 0;
+
+    if (!enable) {
+        if (fp->state && ((SAM_state *)fp->state)->p) {
+            hts_log_error("Cannot stop BAM decoding threads once reading has started");
+            return -1;
+        }
+        return sam_state_destroy(fp);
+    }
+
+    if (fp->state)
+        return 0;
+    return sam_state_create(fp) ? 0 : -1;
+}
+
+// Attaches the BGZF thread pool to a SAM_state made by sam_set_bam_decode().
+// Returns 0 on success,
+//         1 if there is no pool (the state is dropped),
+//        -1 on error
+static int bam_decode_start(htsFile *fp) {
+    SAM_state *fd = (SAM_state *)fp->state;
+    hts_tpool *p = bgzf_thread_pool_get(fp->fp.bgzf);
+
+    if (!p) {
+        sam_state_destroy(fp);
+        return 1;
+    }
+
+    pthread_mutex_init(&fd->lines_m, NULL);
+    pthread_mutex_init(&fd->command_m, NULL);
+    pthread_cond_init(&fd->command_c, NULL);
+    fd->p = p;
+    fd->q = hts_tpool_process_init(fd->p, 2*hts_tpool_size(fd->p), 0);
+    if (!fd->q) {
+        sam_state_destroy(fp);
+        return -1;
+    }
+    fd->is_be = fp->fp.bgzf->is_be;
+    fd->read_voff = bgzf_tell(fp->fp.bgzf);
+    fp->fp.bgzf->seeked = 0;
+
+    return 0;
+}
+
+// Reads a BAM record and checks its reference ids against h.  If decode is
+// zero, any HTS_OPT_BAM_DECODE read-ahead is bypassed so that bgzf_tell()
+// gives the end of the record, as iterators need.
+// Returns 0 on success,
+//        -1 on EOF,
+//       <-1 on error
+static int bam_read1_hdr(htsFile *fp, sam_hdr_t *h, bam1_t *b, int decode)
+{
+    int r;
+    if (decode && fp->state && !((SAM_state *)fp->state)->p &&
+        (r = bam_decode_start(fp)) < 0)
+        return -2;
+    if (decode && fp->state)
+        r = bam_read1_mt(fp, b);
+    else
+        r = bam_read1(fp->fp.bgzf, b);
+    if (h && r >= 0) {
+        if (b->core.tid  >= h->n_targets || b->core.tid  < -1 ||
+            b->core.mtid >= h->n_targets || b->core.mtid < -1) {
+            errno = ERANGE;
+            return -3;
+        }
+    }
+    return r;
+}
+
+int64_t sam_tell(htsFile *fp)
+{
+    if (fp->format.format == bam && fp->state) {
+        SAM_state *fd = (SAM_state *)fp->state;
+        BGZF *bfp = fp->fp.bgzf;
+        if (fd->p && fd->tell_set && !bfp->seeked
+            && bgzf_tell(bfp) == fd->read_voff)
+            return fd->tell_voff;
+    }
+
+    return fp->is_bgzf ? bgzf_tell(fp->fp.bgzf) : -1;
+}
+
 // Returns 0 on success,
 //        -1 on EOF,
 //       <-1 on error
 int sam_read1(htsFile *fp, sam_hdr_t *h, bam1_t *b)
 {
     switch (fp->format.format) {
-    case bam: {
-        int r = bam_read1(fp->fp.bgzf, b);
-        if (h && r >= 0) {
-            if (b->core.tid  >= h->n_targets || b->core.tid  < -1 ||
-                b->core.mtid >= h->n_targets || b->core.mtid < -1) {
-                errno = ERANGE;
-                return -3;
-            }
-        }
-        return r;
-        }
+    case bam:
+        return bam_read1_hdr(fp, h, b, 1);
 
     case cram: {
         int ret = cram_get_bam_seq(fp->fp.cram, &b);
@@ -3046,6 +3704,94 @@ int sam_read1(htsFile *fp, sam_hdr_t *h, bam1_t *b)
     }
 }
 
+// Returns the number of records read, 0 at end of file or <-1 on error
+int sam_read_batch(htsFile *fp, sam_hdr_t *h, bam1_t **recs, int n)
+{
+    int i, r = 0;
+
+    switch (fp->format.format) {
+    case bam:
+        if (!fp->state) {
+            BGZF *bfp = fp->fp.bgzf;
+            for (i = 0; i < n; i++) {
+                if ((r = bam_read1(bfp, recs[i])) < 0)
+                    break;
+                bam1_core_t *c = &recs[i]->core;
+                if (h && (c->tid  >= h->n_targets || c->tid  < -1 ||
+                          c->mtid >= h->n_targets || c->mtid < -1)) {
+                    errno = ERANGE;
+                    return -3;
+                }
+            }
+            break;
+        }
+        // fall through
+
+    default:
+        for (i = 0; i < n; i++) {
+            if ((r = sam_read1(fp, h, recs[i])) < 0)
+                break;
+        }
+        break;
+    }
+
+    return r < -1 ? r : i;
+}
+
+/*
+ * Write an integer to cp, which must have room for it, and return a
+ * pointer to the byte after it.  Unlike kputw() there is no resizing or
+ * NUL termination, so callers reserve space for a whole CIGAR string or
+ * B array at once.  The digit count is found without branching.
+ */
+static inline char *sam_put_u32(char *cp, uint32_t x)
+{
+    static const char dig2r[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+    int l = 1 + (x >= 10) + (x >= 100) + (x >= 1000) + (x >= 10000)
+        + (x >= 100000) + (x >= 1000000) + (x >= 10000000)
+        + (x >= 100000000) + (x >= 1000000000);
+    char *end = cp + l;
+
+    while (x >= 100) {
+        end -= 2;
+        memcpy(end, &dig2r[2*(x%100)], 2);
+        x /= 100;
+    }
+    if (x >= 10)
+        memcpy(cp, &dig2r[2*x], 2);
+    else
+        *cp = '0' + x;
+    return cp + l;
+}
+
+static inline char *sam_put_i32(char *cp, int32_t x)
+{
+    uint32_t u = x;
+    if (x < 0) {
+        *cp++ = '-';
+        u = -u;
+    }
+    return sam_put_u32(cp, u);
+}
+
+// Reserve room for n items of up to item_len bytes each
+static inline int sam_reserve(kstring_t *str, size_t n, size_t item_len)
+{
+    if (n > (SIZE_MAX - str->l - 2) / item_len)
+        return -1;
+    return ks_resize(str, str->l + n * item_len + 2);
+}
+
 static int sam_format1_append(const bam_hdr_t *h, const bam1_t *b, kstring_t *str)
 {
     int i, r = 0;
@@ -3065,10 +3811,15 @@ static int sam_format1_append(const bam_hdr_t *h, const bam1_t *b, kstring_t *st
     r |= kputw(c->qual, str); r |= kputc_('\t', str); // qual
     if (c->n_cigar) { // cigar
         uint32_t *cigar = bam_get_cigar(b);
+        char *cp;
+        // 28 bit lengths have at most 9 digits, plus the operator
+        if (sam_reserve(str, c->n_cigar, 10) < 0) goto mem_err;
+        cp = str->s + str->l;
         for (i = 0; i < c->n_cigar; ++i) {
-            r |= kputw(bam_cigar_oplen(cigar[i]), str);
-            r |= kputc_(bam_cigar_opchr(cigar[i]), str);
+            cp = sam_put_u32(cp, bam_cigar_oplen(cigar[i]));
+            *cp++ = bam_cigar_opchr(cigar[i]);
         }
+        str->l = cp - str->s;
     } else r |= kputc_('*', str);
     r |= kputc_('\t', str);
     if (c->mtid < 0) r |= kputsn_("*\t", 2, str); // mate chr
@@ -3084,8 +3835,7 @@ static int sam_format1_append(const bam_hdr_t *h, const bam1_t *b, kstring_t *st
         if (ks_resize(str, str->l+2+2*c->l_qseq) < 0) goto mem_err;
         char *cp = str->s + str->l;
 
-        // Sequence, 2 bases at a time
-        nibble2base(s, cp, c->l_qseq);
+        sam_seq_unpack(cp, s, c->l_qseq);
         cp[c->l_qseq] = '\t';
         cp += c->l_qseq+1;
 
@@ -3095,10 +3845,8 @@ static int sam_format1_append(const bam_hdr_t *h, const bam1_t *b, kstring_t *st
         if (s[0] == 0xff) {
             cp[i++] = '*';
         } else {
-            // local copy of c->l_qseq to aid unrolling
-            uint32_t lqseq = c->l_qseq;
-            for (i = 0; i < lqseq; ++i)
-                cp[i]=s[i]+33;
+            sam_qual_format(cp, s, c->l_qseq);
+            i = c->l_qseq;
         }
         cp[i] = 0;
         cp += i;
@@ -3176,30 +3924,43 @@ static int sam_format1_append(const bam_hdr_t *h, const bam1_t *b, kstring_t *st
             if ((end - s) / sub_type_size < n)
                 goto bad_aux;
             r |= kputsn_("B:", 2, str); r |= kputc_(sub_type, str); // write the type
+            char *cp;
             switch (sub_type) {
             case 'c':
-                if (ks_resize(str, str->l + n*2) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputw(*(int8_t*)s, str); ++s;}
+                if (sam_reserve(str, n, 5) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_i32(cp, *(int8_t*)s); ++s;}
+                str->l = cp - str->s;
                 break;
             case 'C':
-                if (ks_resize(str, str->l + n*2) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputw(*(uint8_t*)s, str); ++s;}
+                if (sam_reserve(str, n, 4) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_u32(cp, *(uint8_t*)s); ++s;}
+                str->l = cp - str->s;
                 break;
             case 's':
-                if (ks_resize(str, str->l + n*4) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputw(le_to_i16(s), str); s += 2; }
+                if (sam_reserve(str, n, 7) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_i32(cp, le_to_i16(s)); s += 2; }
+                str->l = cp - str->s;
                 break;
             case 'S':
-                if (ks_resize(str, str->l + n*4) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputw(le_to_u16(s), str); s += 2; }
+                if (sam_reserve(str, n, 6) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_u32(cp, le_to_u16(s)); s += 2; }
+                str->l = cp - str->s;
                 break;
             case 'i':
-                if (ks_resize(str, str->l + n*6) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputw(le_to_i32(s), str); s += 4; }
+                if (sam_reserve(str, n, 12) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_i32(cp, le_to_i32(s)); s += 4; }
+                str->l = cp - str->s;
                 break;
             case 'I':
-                if (ks_resize(str, str->l + n*6) < 0) goto mem_err;
-                for (i = 0; i < n; ++i) {r |= kputc_(',', str); r |= kputuw(le_to_u32(s), str); s += 4; }
+                if (sam_reserve(str, n, 11) < 0) goto mem_err;
+                cp = str->s + str->l;
+                for (i = 0; i < n; ++i) {*cp++ = ','; cp = sam_put_u32(cp, le_to_u32(s)); s += 4; }
+                str->l = cp - str->s;
                 break;
             case 'f':
                 if (ks_resize(str, str->l + n*8) < 0) goto mem_err;
@@ -3367,6 +4128,39 @@ int sam_write1(htsFile *fp, const sam_hdr_t *h, const bam1_t *b)
     }
 }
 
+int sam_write_batch(htsFile *fp, const sam_hdr_t *h, bam1_t **recs, int n)
+{
+    int i;
+
+    if (n > 0 && fp->format.format == binary_format) {
+        fp->format.category = sequence_data;
+        fp->format.format = bam;
+    }
+
+    switch (fp->format.format) {
+    case bam:
+        for (i = 0; i < n; i++) {
+            if (bam_write_idx1(fp, h, recs[i]) < 0)
+                return -1;
+        }
+        return 0;
+
+    case cram:
+        for (i = 0; i < n; i++) {
+            if (cram_put_bam_seq(fp->fp.cram, recs[i]) < 0)
+                return -1;
+        }
+        return 0;
+
+    default:
+        for (i = 0; i < n; i++) {
+            if (sam_write1(fp, h, recs[i]) < 0)
+                return -1;
+        }
+        return 0;
+    }
+}
+
 /************************
  *** Auxiliary fields ***
  ************************/
@@ -3505,6 +4299,45 @@ uint8_t *bam_aux_get(const bam1_t *b, const char tag[2])
     errno = EINVAL;
     return NULL;
 }
+
+int bam_aux_get_many(const bam1_t *b, int n, const char *const *tags,
+                     uint8_t **out)
+{
+    uint8_t *s, *end;
+    int i, nfound = 0;
+
+    for (i = 0; i < n; i++)
+        out[i] = NULL;
+    s = bam_get_aux(b);
+    end = b->data + b->l_data;
+    while (nfound < n && s != NULL && end - s >= 3) {
+        uint8_t *t = s, *e;
+        s += 2;
+        e = skip_aux(s, end);
+        for (i = 0; i < n; i++) {
+            if (out[i] || t[0] != (uint8_t) tags[i][0]
+                || t[1] != (uint8_t) tags[i][1])
+                continue;
+            // Check the tag value is valid and complete
+            if (e == NULL || ((*s == 'Z' || *s == 'H') && *(e - 1) != '\0'))
+                goto bad_aux;
+            out[i] = s;
+            nfound++;
+        }
+        s = e;
+    }
+    if (nfound < n) {
+        if (s == NULL) goto bad_aux;
+        errno = ENOENT;
+    }
+    return nfound;
+
+ bad_aux:
+    hts_log_error("Corrupted aux data for read %s", bam_get_qname(b));
+    errno = EINVAL;
+    return -1;
+}
+
 // s MUST BE returned by bam_aux_get()
 int bam_aux_del(bam1_t *b, uint8_t *s)
 {
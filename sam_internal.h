@@ -36,6 +36,26 @@ int sam_state_destroy(samFile *fp);
 int sam_set_thread_pool(htsFile *fp, htsThreadPool *p);
 int sam_set_threads(htsFile *fp, int nthreads);
 
+// Destroys a SAM_state that has not been used yet, handing its thread pool
+// to the caller.  Used when a text-mode output turns out to be VCF.
+// Returns 1 if the pool was owned by the state, 0 if not, -1 on failure.
+int sam_state_take_pool(htsFile *fp, htsThreadPool *p);
+
+// Enables or disables decoding of BAM records on the BGZF thread pool
+// (HTS_OPT_BAM_DECODE).  Returns 0 on success, -1 on failure.
+int sam_set_bam_decode(htsFile *fp, int enable);
+
+// Packs len bases of SEQ text into dst, two per byte, as seq_nt16_table
+// codes.  Uses vector instructions where the CPU supports them (simd.c).
+void sam_seq_pack(uint8_t *dst, const char *seq, size_t len);
+
+// The reverse of sam_seq_pack(): expands len packed bases from nib into
+// dst as text.  Does not add a terminating NUL.
+void sam_seq_unpack(char *dst, const uint8_t *nib, size_t len);
+
+// Writes len BAM quality values into dst as phred+33 text.
+void sam_qual_format(char *dst, const uint8_t *qual, size_t len);
+
 // bam1_t data (re)allocation
 int sam_realloc_bam_data(bam1_t *b, size_t desired);
 
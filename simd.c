@@ -0,0 +1,499 @@
+/*  simd.c -- SIMD kernels for SAM text and BCF FORMAT data.
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#define HTS_BUILDING_LIBRARY // Enables HTSLIB_EXPORT, see htslib/hts_defs.h
+#include <config.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "htslib/sam.h"
+#include "htslib/vcf.h"
+#include "htslib/hts_endian.h"
+#include "sam_internal.h"
+#include "hts_internal.h"
+
+/*
+ * The vector kernels need per-function target attributes and
+ * __builtin_cpu_supports(), so they are only built for x86-64 with a
+ * compiler known to provide them.  Everything else uses the scalar code.
+ */
+#if defined(__x86_64__) && \
+    ((defined(__clang__) && __clang_major__ >= 4) || \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 5))
+#define BUILDING_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+static void seq_pack_scalar(uint8_t *dst, const char *seq, size_t len)
+{
+    size_t i, len2 = len & ~(size_t) 1;
+    for (i = 0; i < len2; i += 2)
+        dst[i>>1] = (seq_nt16_table[(unsigned char)seq[i]] << 4)
+            | seq_nt16_table[(unsigned char)seq[i+1]];
+    if (i < len)
+        dst[i>>1] = seq_nt16_table[(unsigned char)seq[i]] << 4;
+}
+
+static void seq_unpack_scalar(char *dst, const uint8_t *nib, size_t len)
+{
+    if (len > 0) // nibble2base() writes dst[0] even when len is zero
+        nibble2base((uint8_t *) nib, dst, len);
+}
+
+static void qual_format_scalar(char *dst, const uint8_t *qual, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        dst[i] = qual[i] + 33;
+}
+
+/*
+ * The 8 and 16 bit missing and vector end markers are the two most
+ * negative values, so sign extending them is right apart from an offset.
+ */
+#define INT8_FIX  (INT32_MIN - INT8_MIN)
+#define INT16_FIX (INT32_MIN - INT16_MIN)
+
+static int fmt_widen_int8_scalar(int32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i;
+    int vend = 0;
+    for (i = 0; i < n; i++) {
+        int32_t v = (int8_t) src[i];
+        vend |= v == bcf_int8_vector_end;
+        dst[i] = v <= bcf_int8_vector_end ? v + INT8_FIX : v;
+    }
+    return vend;
+}
+
+static int fmt_widen_int16_scalar(int32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i;
+    int vend = 0;
+    for (i = 0; i < n; i++) {
+        int32_t v = le_to_i16(src + i * 2);
+        vend |= v == bcf_int16_vector_end;
+        dst[i] = v <= bcf_int16_vector_end ? v + INT16_FIX : v;
+    }
+    return vend;
+}
+
+static int fmt_copy32_scalar(uint32_t *dst, const uint8_t *src, size_t n,
+                             uint32_t vector_end)
+{
+    size_t i;
+    int vend = 0;
+    for (i = 0; i < n; i++) {
+        dst[i] = le_to_u32(src + i * 4);
+        vend |= dst[i] == vector_end;
+    }
+    return vend;
+}
+
+#ifdef BUILDING_SIMD_X86
+
+/*
+ * The vector code handles the common bases A, C, G, T and N in either case.
+ * Their low nibbles (1, 3, 7, 4 and 14) are all different, so one shuffle
+ * gives the nt16 code and another the letter it came from.  Comparing that
+ * letter with the input (folded to upper case) detects anything else, in
+ * which case the block is done by the scalar code.  Unused letter slots
+ * hold a value whose low nibble differs from the slot, so never match.
+ */
+#define SEQ_CODES    0, 1, 0, 2, 8, 0, 0, 4, 0, 0, 0, 0, 0, 0, 15, 0
+#define SEQ_LETTERS  -1, 'A', -1, 'C', 'T', -1, -1, 'G', \
+                     -1, -1, -1, -1, -1, -1, 'N', 0
+
+__attribute__((target("ssse3")))
+static void seq_pack_ssse3(uint8_t *dst, const char *seq, size_t len)
+{
+    const __m128i codes = _mm_setr_epi8(SEQ_CODES);
+    const __m128i letters = _mm_setr_epi8(SEQ_LETTERS);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i upper = _mm_set1_epi8((char) 0xdf);
+    const __m128i weights = _mm_set1_epi16(0x0110); // 16 * even + odd
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(seq + i));
+        __m128i idx = _mm_and_si128(in, nibble);
+        __m128i ok = _mm_cmpeq_epi8(_mm_shuffle_epi8(letters, idx),
+                                    _mm_and_si128(in, upper));
+        if (_mm_movemask_epi8(ok) != 0xffff) {
+            seq_pack_scalar(dst + (i>>1), seq + i, 16);
+            continue;
+        }
+        __m128i pairs = _mm_maddubs_epi16(_mm_shuffle_epi8(codes, idx),
+                                          weights);
+        _mm_storel_epi64((__m128i *)(dst + (i>>1)),
+                         _mm_packus_epi16(pairs, pairs));
+    }
+    seq_pack_scalar(dst + (i>>1), seq + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void seq_pack_avx2(uint8_t *dst, const char *seq, size_t len)
+{
+    const __m256i codes = _mm256_setr_epi8(SEQ_CODES, SEQ_CODES);
+    const __m256i letters = _mm256_setr_epi8(SEQ_LETTERS, SEQ_LETTERS);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i upper = _mm256_set1_epi8((char) 0xdf);
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(seq + i));
+        __m256i idx = _mm256_and_si256(in, nibble);
+        __m256i ok = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(letters, idx),
+                                       _mm256_and_si256(in, upper));
+        if (_mm256_movemask_epi8(ok) != -1) {
+            seq_pack_scalar(dst + (i>>1), seq + i, 32);
+            continue;
+        }
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_shuffle_epi8(codes, idx),
+                                             weights);
+        // packus works within each 128-bit lane, so gather the two
+        // 64-bit results into the low half
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(pairs, pairs), 0x08);
+        _mm_storeu_si128((__m128i *)(dst + (i>>1)),
+                         _mm256_castsi256_si128(packed));
+    }
+    seq_pack_scalar(dst + (i>>1), seq + i, len - i);
+}
+
+/*
+ * Expanding SEQ is a shuffle of each nibble through seq_nt16_str, followed
+ * by interleaving the high (first) and low (second) base of each byte.
+ */
+#define SEQ_BASES  '=', 'A', 'C', 'M', 'G', 'R', 'S', 'V', \
+                   'T', 'W', 'Y', 'H', 'K', 'D', 'B', 'N'
+
+__attribute__((target("ssse3")))
+static void seq_unpack_ssse3(char *dst, const uint8_t *nib, size_t len)
+{
+    const __m128i bases = _mm_setr_epi8(SEQ_BASES);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(nib + (i>>1)));
+        __m128i hi = _mm_shuffle_epi8(bases,
+                        _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+        __m128i lo = _mm_shuffle_epi8(bases, _mm_and_si128(in, nibble));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + i + 16),
+                         _mm_unpackhi_epi8(hi, lo));
+    }
+    seq_unpack_scalar(dst + i, nib + (i>>1), len - i);
+}
+
+__attribute__((target("avx2")))
+static void seq_unpack_avx2(char *dst, const uint8_t *nib, size_t len)
+{
+    const __m256i bases = _mm256_setr_epi8(SEQ_BASES, SEQ_BASES);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(nib + (i>>1)));
+        __m256i hi = _mm256_shuffle_epi8(bases,
+                        _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+        __m256i lo = _mm256_shuffle_epi8(bases, _mm256_and_si256(in, nibble));
+        // unpack works within each 128-bit lane, so swap the middle
+        // quarters back into order
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32),
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    seq_unpack_scalar(dst + i, nib + (i>>1), len - i);
+}
+
+// SSE2 is part of the x86-64 baseline, so needs no target attribute
+static void qual_format_sse2(char *dst, const uint8_t *qual, size_t len)
+{
+    const __m128i offset = _mm_set1_epi8(33);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(qual + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(in, offset));
+    }
+    qual_format_scalar(dst + i, qual + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void qual_format_avx2(char *dst, const uint8_t *qual, size_t len)
+{
+    const __m256i offset = _mm256_set1_epi8(33);
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(qual + i));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_add_epi8(in, offset));
+    }
+    qual_format_sse2(dst + i, qual + i, len - i);
+}
+
+/*
+ * BCF FORMAT widening.  Values at or below the vector end marker get the
+ * offset that moves them to the 32-bit markers; vector end markers are
+ * looked for in the narrow input, before widening.
+ */
+__attribute__((target("sse4.1")))
+static int fmt_widen_int8_sse41(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i vend8 = _mm_set1_epi8(bcf_int8_vector_end);
+    const __m128i limit = _mm_set1_epi32(bcf_int8_vector_end + 1);
+    const __m128i fix = _mm_set1_epi32(INT8_FIX);
+    __m128i seen = _mm_setzero_si128();
+    size_t i;
+    int k;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        seen = _mm_or_si128(seen, _mm_cmpeq_epi8(in, vend8));
+        for (k = 0; k < 4; k++) {
+            __m128i w = _mm_cvtepi8_epi32(in);
+            w = _mm_add_epi32(w, _mm_and_si128(_mm_cmplt_epi32(w, limit),
+                                               fix));
+            _mm_storeu_si128((__m128i *)(dst + i + k * 4), w);
+            in = _mm_srli_si128(in, 4);
+        }
+    }
+    return _mm_movemask_epi8(seen)
+        | fmt_widen_int8_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int fmt_widen_int8_avx2(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i vend8 = _mm_set1_epi8(bcf_int8_vector_end);
+    const __m256i limit = _mm256_set1_epi32(bcf_int8_vector_end + 1);
+    const __m256i fix = _mm256_set1_epi32(INT8_FIX);
+    __m128i seen = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        seen = _mm_or_si128(seen, _mm_cmpeq_epi8(in, vend8));
+        __m256i a = _mm256_cvtepi8_epi32(in);
+        __m256i b = _mm256_cvtepi8_epi32(_mm_srli_si128(in, 8));
+        a = _mm256_add_epi32(a, _mm256_and_si256(
+                _mm256_cmpgt_epi32(limit, a), fix));
+        b = _mm256_add_epi32(b, _mm256_and_si256(
+                _mm256_cmpgt_epi32(limit, b), fix));
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), b);
+    }
+    return _mm_movemask_epi8(seen)
+        | fmt_widen_int8_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static int fmt_widen_int16_sse41(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i vend16 = _mm_set1_epi16(bcf_int16_vector_end);
+    const __m128i limit = _mm_set1_epi32(bcf_int16_vector_end + 1);
+    const __m128i fix = _mm_set1_epi32(INT16_FIX);
+    __m128i seen = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        seen = _mm_or_si128(seen, _mm_cmpeq_epi16(in, vend16));
+        __m128i a = _mm_cvtepi16_epi32(in);
+        __m128i b = _mm_cvtepi16_epi32(_mm_srli_si128(in, 8));
+        a = _mm_add_epi32(a, _mm_and_si128(_mm_cmplt_epi32(a, limit), fix));
+        b = _mm_add_epi32(b, _mm_and_si128(_mm_cmplt_epi32(b, limit), fix));
+        _mm_storeu_si128((__m128i *)(dst + i), a);
+        _mm_storeu_si128((__m128i *)(dst + i + 4), b);
+    }
+    return _mm_movemask_epi8(seen)
+        | fmt_widen_int16_scalar(dst + i, src + i * 2, n - i);
+}
+
+__attribute__((target("avx2")))
+static int fmt_widen_int16_avx2(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m256i vend16 = _mm256_set1_epi16(bcf_int16_vector_end);
+    const __m256i limit = _mm256_set1_epi32(bcf_int16_vector_end + 1);
+    const __m256i fix = _mm256_set1_epi32(INT16_FIX);
+    __m256i seen = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+        seen = _mm256_or_si256(seen, _mm256_cmpeq_epi16(in, vend16));
+        __m256i a = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(in));
+        __m256i b = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(in, 1));
+        a = _mm256_add_epi32(a, _mm256_and_si256(
+                _mm256_cmpgt_epi32(limit, a), fix));
+        b = _mm256_add_epi32(b, _mm256_and_si256(
+                _mm256_cmpgt_epi32(limit, b), fix));
+        _mm256_storeu_si256((__m256i *)(dst + i), a);
+        _mm256_storeu_si256((__m256i *)(dst + i + 8), b);
+    }
+    return _mm256_movemask_epi8(seen)
+        | fmt_widen_int16_scalar(dst + i, src + i * 2, n - i);
+}
+
+// 32-bit integers and floats need no conversion, only the vector end check
+static int fmt_copy32_sse2(uint32_t *dst, const uint8_t *src, size_t n,
+                           uint32_t vector_end)
+{
+    const __m128i vend = _mm_set1_epi32(vector_end);
+    __m128i seen = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        seen = _mm_or_si128(seen, _mm_cmpeq_epi32(in, vend));
+        _mm_storeu_si128((__m128i *)(dst + i), in);
+    }
+    return _mm_movemask_epi8(seen)
+        | fmt_copy32_scalar(dst + i, src + i * 4, n - i, vector_end);
+}
+
+__attribute__((target("avx2")))
+static int fmt_copy32_avx2(uint32_t *dst, const uint8_t *src, size_t n,
+                           uint32_t vector_end)
+{
+    const __m256i vend = _mm256_set1_epi32(vector_end);
+    __m256i seen = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        seen = _mm256_or_si256(seen, _mm256_cmpeq_epi32(in, vend));
+        _mm256_storeu_si256((__m256i *)(dst + i), in);
+    }
+    return _mm256_movemask_epi8(seen)
+        | fmt_copy32_sse2(dst + i, src + i * 4, n - i, vector_end);
+}
+
+static void (*seq_pack_fn)(uint8_t *, const char *, size_t) = seq_pack_scalar;
+static void (*seq_unpack_fn)(char *, const uint8_t *, size_t)
+    = seq_unpack_scalar;
+static void (*qual_format_fn)(char *, const uint8_t *, size_t)
+    = qual_format_sse2;
+static int (*fmt_widen_int8_fn)(int32_t *, const uint8_t *, size_t)
+    = fmt_widen_int8_scalar;
+static int (*fmt_widen_int16_fn)(int32_t *, const uint8_t *, size_t)
+    = fmt_widen_int16_scalar;
+static int (*fmt_copy32_fn)(uint32_t *, const uint8_t *, size_t, uint32_t)
+    = fmt_copy32_sse2;
+
+__attribute__((constructor))
+static void simd_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        seq_pack_fn = seq_pack_avx2;
+        seq_unpack_fn = seq_unpack_avx2;
+        qual_format_fn = qual_format_avx2;
+        fmt_widen_int8_fn = fmt_widen_int8_avx2;
+        fmt_widen_int16_fn = fmt_widen_int16_avx2;
+        fmt_copy32_fn = fmt_copy32_avx2;
+        return;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        seq_pack_fn = seq_pack_ssse3;
+        seq_unpack_fn = seq_unpack_ssse3;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        fmt_widen_int8_fn = fmt_widen_int8_sse41;
+        fmt_widen_int16_fn = fmt_widen_int16_sse41;
+    }
+}
+
+void sam_seq_pack(uint8_t *dst, const char *seq, size_t len)
+{
+    seq_pack_fn(dst, seq, len);
+}
+
+void sam_seq_unpack(char *dst, const uint8_t *nib, size_t len)
+{
+    seq_unpack_fn(dst, nib, len);
+}
+
+void sam_qual_format(char *dst, const uint8_t *qual, size_t len)
+{
+    qual_format_fn(dst, qual, len);
+}
+
+int bcf_fmt_widen_int8(int32_t *dst, const uint8_t *src, size_t n)
+{
+    return fmt_widen_int8_fn(dst, src, n);
+}
+
+int bcf_fmt_widen_int16(int32_t *dst, const uint8_t *src, size_t n)
+{
+    return fmt_widen_int16_fn(dst, src, n);
+}
+
+int bcf_fmt_copy32(uint32_t *dst, const uint8_t *src, size_t n,
+                   uint32_t vector_end)
+{
+    return fmt_copy32_fn(dst, src, n, vector_end);
+}
+
+#else
+
+void sam_seq_pack(uint8_t *dst, const char *seq, size_t len)
+{
+    seq_pack_scalar(dst, seq, len);
+}
+
+void sam_seq_unpack(char *dst, const uint8_t *nib, size_t len)
+{
+    seq_unpack_scalar(dst, nib, len);
+}
+
+void sam_qual_format(char *dst, const uint8_t *qual, size_t len)
+{
+    qual_format_scalar(dst, qual, len);
+}
+
+int bcf_fmt_widen_int8(int32_t *dst, const uint8_t *src, size_t n)
+{
+    return fmt_widen_int8_scalar(dst, src, n);
+}
+
+int bcf_fmt_widen_int16(int32_t *dst, const uint8_t *src, size_t n)
+{
+    return fmt_widen_int16_scalar(dst, src, n);
+}
+
+int bcf_fmt_copy32(uint32_t *dst, const uint8_t *src, size_t n,
+                   uint32_t vector_end)
+{
+    return fmt_copy32_scalar(dst, src, n, vector_end);
+}
+
+#endif
@@ -81,6 +81,23 @@ char *slurp(const char *filename)
 hFILE *fin = NULL;
 hFILE *fout = NULL;
 
+#define BIG_SIZE 1000000
+
+void fill_pattern(char *buf, off_t off, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) buf[i] = (off + i) % 251;
+}
+
+void check_pattern(const char *buf, off_t off, size_t len, const char *message)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        if (buf[i] != (char) ((off + i) % 251))
+            fail("%s: wrong data at offset %lld", message,
+                 (long long) (off + i));
+}
+
 void reopen(const char *infname, const char *outfname)
 {
     if (fin) { if (hclose(fin) != 0) fail("hclose(input)"); }
@@ -191,6 +208,43 @@ int main(void)
     if (hclose(fin) != 0) fail("hclose(input)");
     if (hclose(fout) != 0) fail("hclose(output)");
 
+    // Bigger than the io_uring backend's read-ahead, when that is in use
+    fout = hopen("test/hfile_big.tmp", "w");
+    if (fout == NULL) fail("hopen(\"test/hfile_big.tmp\")");
+    for (off = 0; off < BIG_SIZE; off += n) {
+        n = BIG_SIZE - off < sizeof buffer ? BIG_SIZE - off : sizeof buffer;
+        fill_pattern(buffer, off, n);
+        if (hwrite(fout, buffer, n) != n) fail("hwrite(big)");
+    }
+    if (hclose(fout) != 0) fail("hclose(test/hfile_big.tmp)");
+
+    fin = hopen("test/hfile_big.tmp", "r");
+    if (fin == NULL) fail("hopen(\"test/hfile_big.tmp\") for reading");
+    for (i = 0, off = 0; (n = hread(fin, buffer, size[i++ % 5])) > 0; off += n)
+        check_pattern(buffer, off, n, "big");
+    if (n < 0) fail("hread(big)");
+    if (off != BIG_SIZE) fail("big: read %lld bytes", (long long) off);
+    for (off = BIG_SIZE - 1000; off >= 0; off -= 300007) {
+        if (hseek(fin, off, SEEK_SET) != off) fail("hseek(big)");
+        if ((n = hread(fin, buffer, 1000)) != 1000) fail("hread(big/seek)");
+        check_pattern(buffer, off, n, "big/seek");
+    }
+
+    // Data appended after reaching the end is seen after seeking back
+    if (hseek(fin, BIG_SIZE, SEEK_SET) != BIG_SIZE) fail("hseek(big/end)");
+    if (hgetc(fin) != EOF) fail("big: no EOF");
+    fout = hopen("test/hfile_big.tmp", "a");
+    if (fout == NULL) fail("hopen(\"test/hfile_big.tmp\") for appending");
+    fill_pattern(buffer, BIG_SIZE, 1000);
+    if (hwrite(fout, buffer, 1000) != 1000) fail("hwrite(big/append)");
+    if (hclose(fout) != 0) fail("hclose(test/hfile_big.tmp) for appending");
+    if (hseek(fin, 0, SEEK_SET) != 0) fail("hseek(big/start)");
+    if (hseek(fin, BIG_SIZE, SEEK_SET) != BIG_SIZE) fail("hseek(big/grown)");
+    if ((n = hread(fin, buffer, sizeof buffer)) != 1000)
+        fail("big: read %d bytes after growing", (int) n);
+    check_pattern(buffer, BIG_SIZE, n, "big/grown");
+    if (hclose(fin) != 0) fail("hclose(test/hfile_big.tmp) for reading");
+
     fout = hopen("test/hfile_chars.tmp", "w");
     if (fout == NULL) fail("hopen(\"test/hfile_chars.tmp\")");
     for (i = 0; i < 256; i++)
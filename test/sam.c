@@ -24,6 +24,8 @@ DEALINGS IN THE SOFTWARE.  */
 
 #include <config.h>
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,8 +41,10 @@ DEALINGS IN THE SOFTWARE.  */
 #undef HTS_DEPRECATED
 #define HTS_DEPRECATED(message)
 
+#include "../htslib/bgzf.h"
 #include "../htslib/sam.h"
 #include "../htslib/faidx.h"
+#include "../htslib/cram.h"
 #include "../htslib/khash.h"
 #include "../htslib/hts_log.h"
 
@@ -276,6 +280,16 @@ static int aux_fields1(void)
     size_t nvals, i;
 
     if (sam_read1(in, header, aln) >= 0) {
+        const char *many_tags[] = { "Xi", "Y8", "XA", "Q1", "Xi" };
+        uint8_t *many[5];
+        errno = 0;
+        if (bam_aux_get_many(aln, 5, many_tags, many) != 4 || errno != ENOENT)
+            fail("bam_aux_get_many() did not find 4 of 5 tags");
+        else if (many[0] != bam_aux_get(aln, "Xi") || many[4] != many[0]
+                 || many[1] != bam_aux_get(aln, "Y8")
+                 || many[2] != bam_aux_get(aln, "XA") || many[3] != NULL)
+            fail("bam_aux_get_many() results differ from bam_aux_get()");
+
         if ((p = check_bam_aux_get(aln, "XA", 'A')) && bam_aux2A(p) != 'k')
             fail("XA field is '%c', expected 'k'", bam_aux2A(p));
 
@@ -1487,7 +1501,73 @@ static void faidx1(const char *filename)
     if (n != n_exp)
         fail("%s: faidx_nseq returned %d, expected %d", filename, n, n_exp);
 
+    // Check that windows fetched into a buffer match the whole sequence
+    for (n = 0; n < faidx_nseq(fai); n++) {
+        const char *name = faidx_iseq(fai, n);
+        hts_pos_t seq_len = faidx_seq_len(fai, name), len, beg, i;
+        char *seq = faidx_fetch_seq64(fai, name, 0, seq_len - 1, &len);
+        char buf[64];
+        if (!seq || len != seq_len) {
+            fail("%s: faidx_fetch_seq64 failed for %s", filename, name);
+            free(seq);
+            continue;
+        }
+        for (i = 0; i < len; i++) {
+            if (!isgraph((unsigned char) seq[i])) {
+                fail("%s: non-sequence character in %s at %"PRIhts_pos,
+                     filename, name, i);
+                break;
+            }
+        }
+        for (beg = 0; beg < len; beg += 37) {
+            hts_pos_t end = beg + 50 < len ? beg + 50 : len - 1;
+            hts_pos_t got = faidx_fetch_seq_buf(fai, name, beg, end,
+                                                buf, sizeof(buf));
+            if (got != end - beg + 1 || memcmp(buf, seq + beg, got) != 0
+                || buf[got] != '\0') {
+                fail("%s: faidx_fetch_seq_buf mismatch for %s:%"PRIhts_pos
+                     "-%"PRIhts_pos, filename, name, beg, end);
+                break;
+            }
+        }
+        free(seq);
+    }
+
+    fai_destroy(fai);
+
+    // Memory mapped access should give the same results
+    fai = fai_load3(tmpfilename, NULL, NULL, FAI_CREATE|FAI_MMAP);
+    if (fai == NULL) { fail("can't load faidx file %s", tmpfilename); return; }
+    for (n = 0; n < faidx_nseq(fai); n++) {
+        const char *name = faidx_iseq(fai, n), *view;
+        hts_pos_t seq_len = faidx_seq_len(fai, name), len, vlen;
+        char *seq = faidx_fetch_seq64(fai, name, 0, seq_len - 1, &len);
+        if (!seq || len != seq_len) {
+            fail("%s: mmap faidx_fetch_seq64 failed for %s", filename, name);
+            free(seq);
+            continue;
+        }
+        view = faidx_seq_view(fai, name, 0, seq_len - 1, &vlen);
+#ifdef HAVE_MMAP
+        // FAI_CREATE should have made a .bin sidecar for FASTA input,
+        // so every region ought to be viewable
+        if (!view && n_fq_exp == 0)
+            fail("%s: faidx_seq_view failed for %s", filename, name);
+#endif
+        if (view && (vlen != len || memcmp(view, seq, len) != 0))
+            fail("%s: faidx_seq_view mismatch for %s", filename, name);
+        view = faidx_seq_view(fai, name, 1, 3, &vlen);
+#ifdef HAVE_MMAP
+        if (!view && n_fq_exp == 0)
+            fail("%s: faidx_seq_view failed for %s:2-4", filename, name);
+#endif
+        if (view && (vlen != 3 || memcmp(view, seq + 1, 3) != 0))
+            fail("%s: faidx_seq_view mismatch for %s:2-4", filename, name);
+        free(seq);
+    }
     fai_destroy(fai);
+    if (snprintf(line, sizeof(line), "%s.bin", tmpfilename) < sizeof(line))
+        unlink(line);
 }
 
 static void test_empty_sam_file(const char *filename)
@@ -1837,6 +1917,795 @@ static void test_mempolicy(void)
     }
 }
 
+static void test_bam_decode(void)
+{
+    const char *sam_name = "test/ce#1000.sam";
+    const char *bam_name = "test/bam_decode.tmp.bam";
+    samFile *in = NULL, *out = NULL, *plain = NULL, *mt = NULL;
+    sam_hdr_t *header = NULL, *h1 = NULL, *h2 = NULL;
+    bam1_t *b = bam_init1(), *b2 = bam_init1();
+    kstring_t ks1 = KS_INITIALIZE, ks2 = KS_INITIALIZE;
+    int i, r1, r2, nrecs = 0;
+    int64_t start, mid = 0;
+    hts_idx_t *idx1 = NULL, *idx2 = NULL;
+    hts_itr_t *itr1 = NULL, *itr2 = NULL;
+
+    if (!b || !b2) {
+        fail("bam_init1()");
+        goto cleanup;
+    }
+
+    // Write enough records to span several decode blocks
+    in = sam_open(sam_name, "r");
+    out = sam_open(bam_name, "wb");
+    if (!in || !out) {
+        fail("sam_open");
+        goto cleanup;
+    }
+    header = sam_hdr_read(in);
+    if (!header || sam_hdr_write(out, header) < 0) {
+        fail("copying header from \"%s\"", sam_name);
+        goto cleanup;
+    }
+    while ((r1 = sam_read1(in, header, b)) >= 0) {
+        for (i = 0; i < 20; i++) {
+            if (sam_write1(out, header, b) < 0) {
+                fail("sam_write1() to \"%s\"", bam_name);
+                goto cleanup;
+            }
+        }
+    }
+    if (r1 < -1) {
+        fail("sam_read1() from \"%s\"", sam_name);
+        goto cleanup;
+    }
+    if (sam_close(out) < 0) {
+        out = NULL;
+        fail("sam_close(\"%s\")", bam_name);
+        goto cleanup;
+    }
+    out = NULL;
+
+    plain = sam_open(bam_name, "r");
+    mt = sam_open(bam_name, "r");
+    if (!plain || !mt) {
+        fail("sam_open(\"%s\")", bam_name);
+        goto cleanup;
+    }
+    if (hts_set_opt(mt, HTS_OPT_BAM_DECODE, 1) < 0
+        || hts_set_threads(mt, 2) < 0) {
+        fail("enabling BAM decode threads");
+        goto cleanup;
+    }
+    h1 = sam_hdr_read(plain);
+    h2 = sam_hdr_read(mt);
+    if (!h1 || !h2) {
+        fail("sam_hdr_read(\"%s\")", bam_name);
+        goto cleanup;
+    }
+    start = bgzf_tell(plain->fp.bgzf);
+
+    for (;;) {
+        r1 = sam_read1(plain, h1, b);
+        r2 = sam_read1(mt, h2, b2);
+        if ((r1 >= 0) != (r2 >= 0) || (r1 < 0 && r1 != r2)) {
+            fail("sam_read1() returned %d unthreaded, %d threaded", r1, r2);
+            goto cleanup;
+        }
+        if (r1 < 0)
+            break;
+        if (sam_format1(h1, b, ks_clear(&ks1)) < 0
+            || sam_format1(h2, b2, ks_clear(&ks2)) < 0) {
+            fail("sam_format1()");
+            goto cleanup;
+        }
+        if (ks1.l != ks2.l || memcmp(ks1.s, ks2.s, ks1.l) != 0) {
+            fail("record %d differs when decoded on threads", nrecs);
+            goto cleanup;
+        }
+        if (sam_tell(plain) != bgzf_tell(plain->fp.bgzf)
+            || sam_tell(mt) != bgzf_tell(plain->fp.bgzf)) {
+            fail("offset after record %d is %"PRId64" unthreaded, "
+                 "%"PRId64" threaded", nrecs, bgzf_tell(plain->fp.bgzf),
+                 sam_tell(mt));
+            goto cleanup;
+        }
+        if (nrecs == 1000)
+            mid = sam_tell(mt);
+        // Seek back part way through, dropping the read-ahead, to the
+        // start and then to an offset given by sam_tell()
+        if (++nrecs == 5000 || nrecs == 7000) {
+            int64_t to = nrecs == 5000 ? start : mid;
+            if (bgzf_seek(plain->fp.bgzf, to, SEEK_SET) < 0
+                || bgzf_seek(mt->fp.bgzf, to, SEEK_SET) < 0) {
+                fail("bgzf_seek()");
+                goto cleanup;
+            }
+        }
+        // Decoding should carry on after a seek
+        if (nrecs > 7000 && !mt->state) {
+            fail("threaded BAM decoding stopped after bgzf_seek()");
+            goto cleanup;
+        }
+    }
+    if (nrecs <= 7000) {
+        fail("too few records read from \"%s\"", bam_name);
+        goto cleanup;
+    }
+    if (sam_tell(mt) != bgzf_tell(plain->fp.bgzf)) {
+        fail("offset at EOF is %"PRId64" unthreaded, %"PRId64" threaded",
+             bgzf_tell(plain->fp.bgzf), sam_tell(mt));
+        goto cleanup;
+    }
+
+    // Iterators read the file directly, so bgzf_tell() stays correct, and
+    // sam_read1() picks up again from wherever they left the file
+    if (sam_index_build(bam_name, 0) < 0) {
+        fail("sam_index_build(\"%s\")", bam_name);
+        goto cleanup;
+    }
+    idx1 = sam_index_load(plain, bam_name);
+    idx2 = sam_index_load(mt, bam_name);
+    if (!idx1 || !idx2) {
+        fail("sam_index_load(\"%s\")", bam_name);
+        goto cleanup;
+    }
+    for (i = 0; i < 2; i++) {
+        const char *reg = i == 0 ? "CHROMOSOME_I:100-110"
+                                 : "CHROMOSOME_I:40-50";
+        int n = 0, more = 0;
+        hts_itr_destroy(itr1);
+        hts_itr_destroy(itr2);
+        itr1 = sam_itr_querys(idx1, h1, reg);
+        itr2 = sam_itr_querys(idx2, h2, reg);
+        if (!itr1 || !itr2) {
+            fail("sam_itr_querys(\"%s\")", reg);
+            goto cleanup;
+        }
+        // Read the region, then carry on with sam_read1() for a while
+        while (more <= 100) {
+            if (!more) {
+                r1 = sam_itr_next(plain, itr1, b);
+                r2 = sam_itr_next(mt, itr2, b2);
+                if (r1 == -1 && r2 == -1) {
+                    more = 1;
+                    continue;
+                }
+            } else {
+                r1 = sam_read1(plain, h1, b);
+                r2 = sam_read1(mt, h2, b2);
+                more++;
+            }
+            if (r1 < 0 || r2 < 0) {
+                fail("reading %s returned %d unthreaded, %d threaded",
+                     reg, r1, r2);
+                goto cleanup;
+            }
+            if (sam_format1(h1, b, ks_clear(&ks1)) < 0
+                || sam_format1(h2, b2, ks_clear(&ks2)) < 0) {
+                fail("sam_format1()");
+                goto cleanup;
+            }
+            if (ks1.l != ks2.l || memcmp(ks1.s, ks2.s, ks1.l) != 0) {
+                fail("record %d from %s differs when decoded on threads",
+                     n, reg);
+                goto cleanup;
+            }
+            if (sam_tell(mt) != bgzf_tell(plain->fp.bgzf)) {
+                fail("offset after record %d from %s is %"PRId64
+                     " unthreaded, %"PRId64" threaded", n, reg,
+                     bgzf_tell(plain->fp.bgzf), sam_tell(mt));
+                goto cleanup;
+            }
+            n++;
+        }
+        if (n <= 100) {
+            fail("no records read from %s", reg);
+            goto cleanup;
+        }
+    }
+
+ cleanup:
+    if (in) sam_close(in);
+    if (out) sam_close(out);
+    if (plain) sam_close(plain);
+    if (mt) sam_close(mt);
+    sam_hdr_destroy(header);
+    sam_hdr_destroy(h1);
+    sam_hdr_destroy(h2);
+    hts_itr_destroy(itr1);
+    hts_itr_destroy(itr2);
+    hts_idx_destroy(idx1);
+    hts_idx_destroy(idx2);
+    bam_destroy1(b);
+    bam_destroy1(b2);
+    ks_free(&ks1);
+    ks_free(&ks2);
+}
+
+static void test_batch_io(void)
+{
+    const char *sam_name = "test/ce#1000.sam";
+    const char *bam_name = "test/batch_io.tmp.bam";
+    samFile *in = NULL, *out = NULL;
+    sam_hdr_t *header = NULL, *h2 = NULL;
+    bam1_t *recs[64] = { NULL }, *b = bam_init1();
+    kstring_t ks1 = KS_INITIALIZE, ks2 = KS_INITIALIZE;
+    int i, n, r, nrecs = 0;
+
+    for (i = 0; i < 64; i++) {
+        if (!(recs[i] = bam_init1())) {
+            fail("bam_init1()");
+            goto cleanup;
+        }
+    }
+
+    in = sam_open(sam_name, "r");
+    out = sam_open(bam_name, "wb");
+    if (!in || !out || !b) {
+        fail("sam_open");
+        goto cleanup;
+    }
+    header = sam_hdr_read(in);
+    if (!header || sam_hdr_write(out, header) < 0) {
+        fail("copying header from \"%s\"", sam_name);
+        goto cleanup;
+    }
+    while ((n = sam_read_batch(in, header, recs, 64)) > 0) {
+        if (sam_write_batch(out, header, recs, n) < 0) {
+            fail("sam_write_batch() to \"%s\"", bam_name);
+            goto cleanup;
+        }
+        nrecs += n;
+    }
+    if (n < 0 || nrecs != 1000) {
+        fail("sam_read_batch() returned %d after %d records", n, nrecs);
+        goto cleanup;
+    }
+    r = sam_close(out);
+    out = NULL;
+    if (r < 0) {
+        fail("sam_close(\"%s\")", bam_name);
+        goto cleanup;
+    }
+
+    // Read back in odd-sized batches and check against the original
+    sam_close(in);
+    in = sam_open(sam_name, "r");
+    out = sam_open(bam_name, "r");
+    sam_hdr_destroy(header);
+    header = NULL;
+    if (!in || !out || !(header = sam_hdr_read(in))
+        || !(h2 = sam_hdr_read(out))) {
+        fail("reopening \"%s\"", bam_name);
+        goto cleanup;
+    }
+    nrecs = 0;
+    while ((n = sam_read_batch(out, h2, recs, 7)) > 0) {
+        for (i = 0; i < n; i++, nrecs++) {
+            if (sam_read1(in, header, b) < 0
+                || sam_format1(header, b, ks_clear(&ks1)) < 0
+                || sam_format1(h2, recs[i], ks_clear(&ks2)) < 0
+                || strcmp(ks1.s, ks2.s) != 0) {
+                fail("record %d differs after batched I/O", nrecs);
+                goto cleanup;
+            }
+        }
+    }
+    if (n < 0 || nrecs != 1000)
+        fail("sam_read_batch() returned %d after %d records", n, nrecs);
+
+ cleanup:
+    if (in) sam_close(in);
+    if (out) sam_close(out);
+    sam_hdr_destroy(header);
+    sam_hdr_destroy(h2);
+    for (i = 0; i < 64; i++)
+        bam_destroy1(recs[i]);
+    bam_destroy1(b);
+    ks_free(&ks1);
+    ks_free(&ks2);
+}
+
+static void test_bam_arena(void)
+{
+    const char *sam_name = "test/ce#1000.sam";
+    samFile *in = NULL;
+    sam_hdr_t *header = NULL;
+    bam_arena_t *arena = bam_arena_init(4096);
+    bam1_t *b = bam_init1(), *copy = bam_init1(), *recs[1000];
+    kstring_t ks1 = KS_INITIALIZE, ks2 = KS_INITIALIZE;
+    int pass, i, r, nrecs = 0;
+
+    if (!arena || !b || !copy) {
+        fail("allocating arena test data");
+        goto cleanup;
+    }
+
+    // Fill the arena twice, resetting in between to check blocks are reused
+    for (pass = 0; pass < 2; pass++) {
+        in = sam_open(sam_name, "r");
+        if (!in || !(header = sam_hdr_read(in))) {
+            fail("sam_open(\"%s\")", sam_name);
+            goto cleanup;
+        }
+        // Dirty the records about to be reused, so anything not cleared
+        // by bam_arena_dup1() shows up below
+        for (i = 0; pass > 0 && i < nrecs; i++)
+            memset(recs[i], 0xff, sizeof(*recs[i]));
+        bam_arena_reset(arena);
+        for (nrecs = 0; nrecs < 1000; nrecs++) {
+            bam1_t expected;
+            if ((r = sam_read1(in, header, b)) < 0)
+                break;
+            if (!(recs[nrecs] = bam_arena_dup1(arena, b))) {
+                fail("bam_arena_dup1()");
+                goto cleanup;
+            }
+            memset(&expected, 0, sizeof(expected));
+            expected.core = b->core;
+            expected.id = b->id;
+            expected.data = recs[nrecs]->data;
+            expected.l_data = expected.m_data = b->l_data;
+            expected.mempolicy = BAM_USER_OWNS_STRUCT | BAM_USER_OWNS_DATA;
+            if (memcmp(&expected, recs[nrecs], sizeof(expected)) != 0) {
+                fail("arena record %d not cleared on pass %d", nrecs, pass);
+                goto cleanup;
+            }
+        }
+        if (nrecs != 1000) {
+            fail("read %d records from \"%s\"", nrecs, sam_name);
+            goto cleanup;
+        }
+        sam_close(in);
+
+        in = sam_open(sam_name, "r");
+        sam_hdr_destroy(header);
+        if (!in || !(header = sam_hdr_read(in))) {
+            fail("sam_open(\"%s\")", sam_name);
+            goto cleanup;
+        }
+        for (i = 0; i < nrecs; i++) {
+            if (sam_read1(in, header, b) < 0
+                || sam_format1(header, b, ks_clear(&ks1)) < 0
+                || sam_format1(header, recs[i], ks_clear(&ks2)) < 0
+                || strcmp(ks1.s, ks2.s) != 0) {
+                fail("arena record %d differs", i);
+                goto cleanup;
+            }
+        }
+        sam_close(in);
+        in = NULL;
+        sam_hdr_destroy(header);
+        header = NULL;
+    }
+
+    // Growing a record moves its data out of the arena
+    if (bam_aux_update_str(recs[10], "ZZ", 12, "lengthy text") < 0
+        || (bam_get_mempolicy(recs[10]) & BAM_USER_OWNS_DATA) != 0) {
+        fail("bam_aux_update_str() on arena record");
+        goto cleanup;
+    }
+    bam_destroy1(recs[10]);
+
+    if (!bam_arena_copy1(arena, copy, recs[20])
+        || copy->l_data != recs[20]->l_data
+        || memcmp(copy->data, recs[20]->data, copy->l_data) != 0
+        || (bam_get_mempolicy(copy) & BAM_USER_OWNS_DATA) == 0)
+        fail("bam_arena_copy1()");
+
+ cleanup:
+    if (in) sam_close(in);
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    bam_destroy1(copy);
+    bam_arena_destroy(arena);
+    ks_free(&ks1);
+    ks_free(&ks2);
+}
+
+static void test_seq_parse(void)
+{
+    // Long enough to use the vector SEQ packing, with runs of plain bases
+    // broken by other codes and lower case
+    static const char bases[] = "ACGTNacgtnACGTACGTACGTACGT=MRSVWYHKDBX.";
+    static const char hdr_text[] = "@SQ\tSN:one\tLN:1000\n";
+    sam_hdr_t *header = sam_hdr_parse(sizeof(hdr_text) - 1, hdr_text);
+    bam1_t *b = bam_init1();
+    kstring_t line = KS_INITIALIZE;
+    int len, i;
+    uint32_t seed = 1;
+
+    if (!header || !b) {
+        fail("creating SEQ parsing test data");
+        goto cleanup;
+    }
+
+    for (len = 1; len <= 200; len++) {
+        char seq[201];
+        for (i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            // Mostly ACGT, sometimes anything from bases[]
+            int r = (seed >> 16) & 0x7fff;
+            seq[i] = r % 8 ? "ACGT"[r % 4] : bases[r % (sizeof(bases) - 1)];
+        }
+        seq[len] = '\0';
+        ks_clear(&line);
+        ksprintf(&line, "r%d\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t*", len, seq);
+        if (sam_parse1(&line, header, b) < 0) {
+            fail("sam_parse1() for sequence length %d", len);
+            goto cleanup;
+        }
+        uint8_t *s = bam_get_seq(b);
+        for (i = 0; i < len; i++) {
+            if (bam_seqi(s, i) != seq_nt16_table[(unsigned char) seq[i]]) {
+                fail("SEQ base %d of %d parsed as %d, expected %d", i, len,
+                     bam_seqi(s, i), seq_nt16_table[(unsigned char) seq[i]]);
+                goto cleanup;
+            }
+        }
+        if ((len & 1) && (s[len / 2] & 0x0f) != 0)
+            fail("SEQ padding not zero for length %d", len);
+    }
+
+ cleanup:
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    ks_free(&line);
+}
+
+#ifdef HAVE_MMAP
+// Reads back each record of fn, returning the base at ref_pos of the first
+// read covering it.  Returns -1 on failure.
+static int cram_mapped_base(const char *fn, const char *ref_fn,
+                            hts_pos_t ref_pos, int nrecs)
+{
+    samFile *in = sam_open(fn, "r");
+    sam_hdr_t *header = NULL;
+    bam1_t *b = bam_init1();
+    int n = 0, base = -1;
+
+    if (!in || !b || hts_set_fai_filename(in, ref_fn) < 0
+        || hts_set_opt(in, CRAM_OPT_IGNORE_MD5, 1) < 0
+        || !(header = sam_hdr_read(in))) {
+        fail("opening \"%s\" for reading", fn);
+        goto cleanup;
+    }
+    while (sam_read1(in, header, b) >= 0) {
+        n++;
+        if (base < 0 && b->core.pos <= ref_pos && bam_endpos(b) > ref_pos)
+            base = seq_nt16_str[bam_seqi(bam_get_seq(b), ref_pos - b->core.pos)];
+    }
+    if (n != nrecs) {
+        fail("read %d records from \"%s\", expected %d", n, fn, nrecs);
+        base = -1;
+    }
+
+ cleanup:
+    if (in) sam_close(in);
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    return base;
+}
+#endif
+
+static void test_cram_mapped_ref(void)
+{
+#ifdef HAVE_MMAP
+    // CRAM should decode against the upper case ".bin" sidecar.  This is
+    // shown by altering a base in the sidecar and seeing it in the output.
+    static const char ref_fn[] = "test/sam_mapped_ref.tmp.fa";
+    static const char bin_fn[] = "test/sam_mapped_ref.tmp.fa.bin";
+    static const char fai_fn[] = "test/sam_mapped_ref.tmp.fa.fai";
+    static const char cram_fn[] = "test/sam_mapped_ref.tmp.cram";
+    const hts_pos_t ref_len = 2000, alt_pos = 1234;
+    const int read_len = 100, nrecs = 19;
+    char ref[2000 + 1], alt;
+    kstring_t text = KS_INITIALIZE;
+    sam_hdr_t *header = NULL;
+    samFile *out = NULL;
+    bam1_t *b = bam_init1();
+    faidx_t *fai = NULL;
+    FILE *fp = NULL;
+    hts_pos_t len;
+    uint32_t seed = 1;
+    int i, base;
+
+    for (i = 0; i < ref_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        ref[i] = "ACGT"[(seed >> 16) & 3];
+    }
+    ref[ref_len] = '\0';
+
+    if (!(fp = fopen(ref_fn, "w"))) {
+        fail("creating \"%s\"", ref_fn);
+        goto cleanup;
+    }
+    fputs(">mapped\n", fp);
+    for (i = 0; i < ref_len; i += 60)
+        fprintf(fp, "%.60s\n", ref + i);
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        fail("writing \"%s\"", ref_fn);
+        goto cleanup;
+    }
+    fp = NULL;
+
+    fai = fai_load3(ref_fn, NULL, NULL, FAI_CREATE|FAI_MMAP);
+    if (!fai || !faidx_seq_view(fai, "mapped", 0, ref_len - 1, &len)) {
+        fail("building sidecar for \"%s\"", ref_fn);
+        goto cleanup;
+    }
+    fai_destroy(fai);
+    fai = NULL;
+
+    ksprintf(&text, "@SQ\tSN:mapped\tLN:%"PRIhts_pos"\n", ref_len);
+    if (!b || !(header = sam_hdr_parse(text.l, text.s))
+        || !(out = sam_open(cram_fn, "wc"))
+        || hts_set_fai_filename(out, ref_fn) < 0
+        || sam_hdr_write(out, header) < 0) {
+        fail("opening \"%s\" for writing", cram_fn);
+        goto cleanup;
+    }
+    for (i = 0; i < nrecs; i++) {
+        ks_clear(&text);
+        ksprintf(&text, "r%d\t0\tmapped\t%d\t60\t%dM\t*\t0\t0\t%.*s\t*",
+                 i, i * read_len + 1, read_len,
+                 read_len, ref + i * read_len);
+        if (sam_parse1(&text, header, b) < 0 || sam_write1(out, header, b) < 0) {
+            fail("writing record %d to \"%s\"", i, cram_fn);
+            goto cleanup;
+        }
+    }
+    if (sam_close(out) < 0) {
+        out = NULL;
+        fail("closing \"%s\"", cram_fn);
+        goto cleanup;
+    }
+    out = NULL;
+
+    base = cram_mapped_base(cram_fn, ref_fn, alt_pos, nrecs);
+    if (base != ref[alt_pos]) {
+        fail("\"%s\" gave %c at %"PRIhts_pos", expected %c",
+             cram_fn, base, alt_pos + 1, ref[alt_pos]);
+        goto cleanup;
+    }
+
+    // Alter the sidecar in place, keeping it newer than the FASTA file
+    alt = ref[alt_pos] == 'A' ? 'C' : 'A';
+    if (!(fp = fopen(bin_fn, "r+b"))
+        || fseek(fp, -(long) (ref_len - alt_pos), SEEK_END) != 0
+        || fputc(alt, fp) == EOF) {
+        fail("altering \"%s\"", bin_fn);
+        goto cleanup;
+    }
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        fail("altering \"%s\"", bin_fn);
+        goto cleanup;
+    }
+    fp = NULL;
+
+    base = cram_mapped_base(cram_fn, ref_fn, alt_pos, nrecs);
+    if (base != alt)
+        fail("\"%s\" gave %c at %"PRIhts_pos", expected %c from \"%s\"",
+             cram_fn, base, alt_pos + 1, alt, bin_fn);
+
+ cleanup:
+    if (fp) fclose(fp);
+    if (out) sam_close(out);
+    fai_destroy(fai);
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    ks_free(&text);
+    unlink(bin_fn);
+    unlink(fai_fn);
+    unlink(ref_fn);
+    unlink(cram_fn);
+#endif
+}
+
+static void test_cram_ref_cache(void)
+{
+    // Reads switch between four references, each a good fraction of the
+    // 1MB cache, so that decoding has to both reuse and evict them.
+    static const char ref_fn[] = "test/sam_ref_cache.tmp.fa";
+    static const char fai_fn[] = "test/sam_ref_cache.tmp.fa.fai";
+    static const char cram_fn[] = "test/sam_ref_cache.tmp.cram";
+    static const int order[] = { 0, 1, 0, 1, 2, 3, 2, 3, 0 };
+    const int nref = 4, ref_len = 400000, read_len = 100, per_slice = 20;
+    const int64_t limit = 1 << 20;
+    const int nrecs = per_slice * sizeof(order) / sizeof(*order);
+    char *ref = malloc((size_t) nref * ref_len);
+    kstring_t text = KS_INITIALIZE;
+    cram_ref_cache_stats st;
+    sam_hdr_t *header = NULL;
+    samFile *in = NULL, *out = NULL;
+    bam1_t *b = bam_init1();
+    FILE *fp = NULL;
+    uint32_t seed = 1;
+    int i, j, n = 0;
+
+    if (!ref || !b) {
+        fail("out of memory");
+        goto cleanup;
+    }
+    for (i = 0; i < nref * ref_len; i++) {
+        seed = seed * 1103515245 + 12345;
+        ref[i] = "ACGT"[(seed >> 16) & 3];
+    }
+
+    if (!(fp = fopen(ref_fn, "w"))) {
+        fail("creating \"%s\"", ref_fn);
+        goto cleanup;
+    }
+    for (i = 0; i < nref; i++) {
+        fprintf(fp, ">ref%d\n", i);
+        for (j = 0; j < ref_len; j += 60)
+            fprintf(fp, "%.*s\n", ref_len - j < 60 ? ref_len - j : 60,
+                    ref + (size_t) i * ref_len + j);
+    }
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        fail("writing \"%s\"", ref_fn);
+        goto cleanup;
+    }
+    fp = NULL;
+
+    kputs("@HD\tVN:1.6\tSO:unsorted\n", &text);
+    for (i = 0; i < nref; i++)
+        ksprintf(&text, "@SQ\tSN:ref%d\tLN:%d\n", i, ref_len);
+    if (!(header = sam_hdr_parse(text.l, text.s))
+        || !(out = sam_open(cram_fn, "wc"))
+        || hts_set_fai_filename(out, ref_fn) < 0
+        || hts_set_opt(out, CRAM_OPT_SEQS_PER_SLICE, per_slice) < 0
+        || sam_hdr_write(out, header) < 0) {
+        fail("opening \"%s\" for writing", cram_fn);
+        goto cleanup;
+    }
+    // Each slice covers all of one reference, so it is loaded in full
+    for (i = 0; i < nrecs; i++) {
+        int tid = order[i / per_slice];
+        int pos = (i % per_slice) * ((ref_len - read_len) / (per_slice - 1));
+        ks_clear(&text);
+        ksprintf(&text, "r%d\t0\tref%d\t%d\t60\t%dM\t*\t0\t0\t%.*s\t*",
+                 i, tid, pos + 1, read_len,
+                 read_len, ref + (size_t) tid * ref_len + pos);
+        if (sam_parse1(&text, header, b) < 0
+            || sam_write1(out, header, b) < 0) {
+            fail("writing record %d to \"%s\"", i, cram_fn);
+            goto cleanup;
+        }
+    }
+    if (sam_close(out) < 0) {
+        out = NULL;
+        fail("closing \"%s\"", cram_fn);
+        goto cleanup;
+    }
+    out = NULL;
+    sam_hdr_destroy(header);
+    header = NULL;
+
+    if (!(in = sam_open(cram_fn, "r"))
+        || hts_set_fai_filename(in, ref_fn) < 0
+        || hts_set_opt(in, CRAM_OPT_REF_CACHE_SIZE, (int) (limit >> 20)) < 0
+        || !(header = sam_hdr_read(in))) {
+        fail("opening \"%s\" for reading", cram_fn);
+        goto cleanup;
+    }
+    while (sam_read1(in, header, b) >= 0) {
+        if (b->core.tid != order[n / per_slice]) {
+            fail("record %d from \"%s\" is on ref%d, expected ref%d",
+                 n, cram_fn, b->core.tid, order[n / per_slice]);
+            goto cleanup;
+        }
+        n++;
+        if (hts_set_opt(in, CRAM_OPT_REF_CACHE_STATS, &st) < 0) {
+            fail("getting reference cache statistics");
+            goto cleanup;
+        }
+        if (st.bytes_cached > limit) {
+            fail("%"PRId64" bytes of reference cached after record %d, "
+                 "limit %"PRId64, st.bytes_cached, n, limit);
+            goto cleanup;
+        }
+    }
+    if (n != nrecs) {
+        fail("read %d records from \"%s\", expected %d", n, cram_fn, nrecs);
+        goto cleanup;
+    }
+
+    // All four are loaded, two are reused while still cached and the
+    // second use of ref0 comes after it has been evicted
+    if (st.misses < nref + 1 || st.hits < 4 || st.evictions < 3
+        || st.bytes_loaded != st.misses * ref_len
+        || st.max_cached > limit)
+        fail("reference cache statistics: %"PRId64" hits, %"PRId64
+             " misses, %"PRId64" evictions, %"PRId64" bytes loaded, "
+             "%"PRId64" bytes at most", st.hits, st.misses, st.evictions,
+             st.bytes_loaded, st.max_cached);
+
+ cleanup:
+    if (fp) fclose(fp);
+    if (in) sam_close(in);
+    if (out) sam_close(out);
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    ks_free(&text);
+    free(ref);
+    unlink(fai_fn);
+    unlink(ref_fn);
+    unlink(cram_fn);
+}
+
+static void test_format_roundtrip(void)
+{
+    // Long enough to use the vector SEQ and QUAL formatting, with integers
+    // of every length in the CIGAR and B arrays
+    static const char hdr_text[] = "@SQ\tSN:one\tLN:1000\n";
+    static const char arrays[] =
+        "\tXc:B:c,-128,127,0,-1\tXC:B:C,0,255,9,10"
+        "\tXs:B:s,-32768,32767,-99,100\tXS:B:S,0,65535,999,1000"
+        "\tXi:B:i,-2147483648,2147483647,-99999,100000"
+        "\tXI:B:I,0,4294967295,999999999,1000000000";
+    sam_hdr_t *header = sam_hdr_parse(sizeof(hdr_text) - 1, hdr_text);
+    bam1_t *b = bam_init1();
+    kstring_t line = KS_INITIALIZE, expected = KS_INITIALIZE;
+    kstring_t out = KS_INITIALIZE;
+    int len, i;
+    uint32_t seed = 1;
+
+    if (!header || !b) {
+        fail("creating format test data");
+        goto cleanup;
+    }
+
+    for (len = 1; len <= 200; len++) {
+        char seq[201], qual[201];
+        for (i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            int r = (seed >> 16) & 0x7fff;
+            seq[i] = seq_nt16_str[r & 15];
+            qual[i] = '!' + r % 94;
+        }
+        seq[len] = qual[len] = '\0';
+        ks_clear(&line);
+        ksprintf(&line, "r%d\t0\tone\t1\t60\t", len);
+        // Alternate matches with deletions of increasing length
+        for (i = 0; i < len; i++) {
+            uint32_t del = 1;
+            int j;
+            for (j = 0; j < i % 10; j++) del *= 10;
+            ksprintf(&line, "1M%uD", i % 10 == 9 ? (1U << 28) - 1 : del);
+        }
+        ksprintf(&line, "1S\t*\t0\t0\t%sA\t%s!\tXn:i:%d%s",
+                 seq, qual, -len * 12345, arrays);
+        // sam_parse1() modifies the line, so keep a copy to compare with
+        ks_clear(&expected);
+        kputsn(line.s, line.l, &expected);
+        if (sam_parse1(&line, header, b) < 0) {
+            fail("sam_parse1() for format test length %d", len);
+            goto cleanup;
+        }
+        if (sam_format1(header, b, &out) < 0) {
+            fail("sam_format1() for format test length %d", len);
+            goto cleanup;
+        }
+        if (strcmp(out.s, expected.s) != 0) {
+            fail("sam_format1() output differs for length %d:\n"
+                 "expected %s\ngot      %s", len, expected.s, out.s);
+            goto cleanup;
+        }
+    }
+
+ cleanup:
+    sam_hdr_destroy(header);
+    bam_destroy1(b);
+    ks_free(&line);
+    ks_free(&expected);
+    ks_free(&out);
+}
+
 int main(int argc, char **argv)
 {
     int i;
@@ -1861,6 +2730,13 @@ int main(int argc, char **argv)
     check_big_ref(0);
     check_big_ref(1);
     test_mempolicy();
+    test_bam_decode();
+    test_batch_io();
+    test_bam_arena();
+    test_seq_parse();
+    test_format_roundtrip();
+    test_cram_mapped_ref();
+    test_cram_ref_cache();
     set_qname();
     for (i = 1; i < argc; i++) faidx1(argv[i]);
 
@@ -27,7 +27,9 @@ DEALINGS IN THE SOFTWARE.  */
 #include <stdio.h>
 
 #include "../htslib/hts.h"
+#include "../htslib/bgzf.h"
 #include "../htslib/vcf.h"
+#include "../htslib/tbx.h"
 #include "../htslib/kstring.h"
 #include "../htslib/kseq.h"
 
@@ -566,12 +568,491 @@ void test_open_format() {
         error("Expected failure for wrong extension 'vcf.bvcf.bgz'");
 }
 
+static int read_vcf_lines(const char *fname, int nthreads, kstring_t *out)
+{
+    htsFile *fp = hts_open(fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", fname, strerror(errno));
+    if (nthreads && hts_set_threads(fp, nthreads) < 0)
+        error("hts_set_threads : %s", strerror(errno));
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+
+    int r, n = 0;
+    out->l = 0;
+    while ((r = bcf_read1(fp, hdr, rec)) >= 0) {
+        if (vcf_format1(hdr, rec, out) < 0) error("vcf_format1");
+        n++;
+    }
+    if (r < -1) error("bcf_read1");
+
+    bcf_destroy1(rec);
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", fname);
+    return n;
+}
+
+void test_threaded_read(const char *fname)
+{
+    char *gz_fname = malloc(strlen(fname)+4);
+    if (!gz_fname) error("malloc : %s", strerror(errno));
+    sprintf(gz_fname, "%s.gz", fname);
+
+    kstring_t plain = {0,0,0}, threaded = {0,0,0};
+    int n = read_vcf_lines(gz_fname, 0, &plain);
+    if (read_vcf_lines(gz_fname, 2, &threaded) != n
+        || plain.l != threaded.l || memcmp(plain.s, threaded.s, plain.l) != 0)
+        error("Threaded VCF reading differs for %s", gz_fname);
+
+    // Stop early and destroy the header before closing, as many callers do.
+    htsFile *fp = hts_open(gz_fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", gz_fname, strerror(errno));
+    if (hts_set_threads(fp, 2) < 0) error("hts_set_threads");
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+    if (bcf_read1(fp, hdr, rec) < 0) error("bcf_read1");
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", gz_fname);
+    bcf_destroy1(rec);
+
+    free(plain.s);
+    free(threaded.s);
+    free(gz_fname);
+}
+
+static void check_vcf_pos(htsFile *fp, bcf_hdr_t *hdr, bcf1_t *rec,
+                          hts_pos_t pos, const char *what)
+{
+    if (bcf_read1(fp, hdr, rec) < 0)
+        error("%s: bcf_read1 failed", what);
+    if (rec->pos != pos)
+        error("%s: expected POS %"PRIhts_pos", got %"PRIhts_pos,
+              what, pos + 1, rec->pos + 1);
+}
+
+void test_threaded_seek(const char *fname)
+{
+    // Enough records for several blocks of threaded parsing
+    enum { NREC = 40000, STEP = 10 };
+    char *gz_fname = malloc(strlen(fname)+13);
+    if (!gz_fname) error("malloc : %s", strerror(errno));
+    sprintf(gz_fname, "%s.seek.vcf.gz", fname);
+
+    BGZF *bgz = bgzf_open(gz_fname, "w");
+    if (!bgz) error("Failed to open \"%s\" : %s", gz_fname, strerror(errno));
+    kstring_t str = {0,0,0};
+    kputs("##fileformat=VCFv4.2\n##contig=<ID=1>\n"
+          "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n", &str);
+    int i;
+    for (i = 0; i < NREC; i++)
+        ksprintf(&str, "1\t%d\t.\tA\tC\t.\t.\t.\n", i * STEP + 1);
+    if (bgzf_write(bgz, str.s, str.l) != str.l) error("bgzf_write");
+    if (bgzf_close(bgz) < 0) error("bgzf_close(%s)", gz_fname);
+    if (tbx_index_build(gz_fname, 0, &tbx_conf_vcf) < 0)
+        error("tbx_index_build(%s)", gz_fname);
+    tbx_t *tbx = tbx_index_load(gz_fname);
+    if (!tbx) error("tbx_index_load(%s)", gz_fname);
+
+    // Find the virtual offset of a record near the end
+    int64_t voff = -1;
+    bgz = bgzf_open(gz_fname, "r");
+    if (!bgz) error("Failed to open \"%s\" : %s", gz_fname, strerror(errno));
+    for (i = -3; i <= NREC - 100; i++) {
+        voff = bgzf_tell(bgz);
+        if (bgzf_getline(bgz, '\n', &str) < 0) error("bgzf_getline");
+    }
+    bgzf_close(bgz);
+
+    // Using the BGZF handle without moving it, as hts_check_EOF() does,
+    // must not lose any records read ahead
+    htsFile *fp = hts_open(gz_fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", gz_fname, strerror(errno));
+    if (hts_set_threads(fp, 4) < 0) error("hts_set_threads");
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+    for (i = 0; i < NREC; i++) {
+        if (i == 10 && hts_check_EOF(fp) != 1) error("hts_check_EOF");
+        check_vcf_pos(fp, hdr, rec, i * STEP, "after hts_check_EOF");
+    }
+    if (bcf_read1(fp, hdr, rec) != -1) error("Expected EOF after check");
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", gz_fname);
+
+    fp = hts_open(gz_fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", gz_fname, strerror(errno));
+    if (hts_set_threads(fp, 2) < 0) error("hts_set_threads");
+    hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+
+    for (i = 0; i < 5; i++)
+        check_vcf_pos(fp, hdr, rec, i * STEP, "before iterator");
+
+    // Iterator reads use the BGZF handle under the reader
+    hts_itr_t *itr = tbx_itr_querys(tbx, "1:200001-200100");
+    if (!itr) error("tbx_itr_querys");
+    int n = 0;
+    while (tbx_itr_next(fp, tbx, itr, &str) >= 0) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "1\t%d\t", 200001 + n * STEP);
+        if (strncmp(str.s, expected, strlen(expected)) != 0)
+            error("Unexpected iterator record \"%s\"", str.s);
+        n++;
+    }
+    if (n != 10) error("Expected 10 iterator records, got %d", n);
+    tbx_itr_destroy(itr);
+
+    // Carry on with vcf_read after a seek
+    if (bgzf_seek(hts_get_bgzfp(fp), voff, SEEK_SET) < 0) error("bgzf_seek");
+    for (i = NREC - 100; i < NREC; i++)
+        check_vcf_pos(fp, hdr, rec, i * STEP, "after seek");
+    if (bcf_read1(fp, hdr, rec) != -1) error("Expected EOF after seek");
+
+    // And again, backwards, having hit EOF
+    if (bgzf_seek(hts_get_bgzfp(fp), voff, SEEK_SET) < 0) error("bgzf_seek");
+    check_vcf_pos(fp, hdr, rec, (NREC - 100) * STEP, "after second seek");
+
+    bcf_destroy1(rec);
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", gz_fname);
+    tbx_destroy(tbx);
+    free(str.s);
+    free(gz_fname);
+}
+
+static void slurp_file(const char *fname, kstring_t *str)
+{
+    BGZF *fp = bgzf_open(fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", fname, strerror(errno));
+    str->l = 0;
+    for (;;) {
+        if (ks_resize(str, str->l + 65536) < 0) error("ks_resize");
+        ssize_t n = bgzf_read(fp, str->s + str->l, 65536);
+        if (n < 0) error("bgzf_read(%s)", fname);
+        if (n == 0) break;
+        str->l += n;
+    }
+    if (bgzf_close(fp) < 0) error("bgzf_close(%s)", fname);
+}
+
+static void write_vcf_copies(const char *in_fname, const char *out_fname,
+                             const char *mode, int nthreads)
+{
+    htsFile *fp = hts_open(in_fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", in_fname, strerror(errno));
+    htsFile *out = hts_open(out_fname, mode);
+    if (!out) error("Failed to open \"%s\" : %s", out_fname, strerror(errno));
+    if (nthreads && hts_set_threads(out, nthreads) < 0)
+        error("hts_set_threads");
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+    if (bcf_hdr_write(out, hdr) != 0) error("bcf_hdr_write");
+    if (nthreads && !out->state)
+        error("No threaded VCF writer for \"%s\" mode \"%s\"",
+              out_fname, mode);
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+
+    // Repeat records to fill several output blocks
+    int r, i;
+    while ((r = bcf_read1(fp, hdr, rec)) >= 0) {
+        for (i = 0; i < 300; i++)
+            if (bcf_write1(out, hdr, rec) != 0) error("bcf_write1");
+    }
+    if (r < -1) error("bcf_read1");
+
+    // Destroy the header first; queued records must still be written.
+    bcf_destroy1(rec);
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", in_fname);
+    if (hts_close(out) != 0) error("hts_close(%s)", out_fname);
+}
+
+void test_threaded_write(const char *fname)
+{
+    static const char *modes[] = { "w", "wz" };
+    char *gz_fname = malloc(strlen(fname)+4);
+    char *st_fname = malloc(strlen(fname)+11);
+    char *mt_fname = malloc(strlen(fname)+11);
+    if (!gz_fname || !st_fname || !mt_fname)
+        error("malloc : %s", strerror(errno));
+    sprintf(gz_fname, "%s.gz", fname);
+    kstring_t expected = {0,0,0}, threaded = {0,0,0};
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        sprintf(st_fname, "%s.st.vcf%s", fname, i ? ".gz" : "");
+        sprintf(mt_fname, "%s.mt.vcf%s", fname, i ? ".gz" : "");
+        write_vcf_copies(gz_fname, st_fname, modes[i], 0);
+        write_vcf_copies(gz_fname, mt_fname, modes[i], 2);
+
+        slurp_file(st_fname, &expected);
+        slurp_file(mt_fname, &threaded);
+        if (expected.l != threaded.l
+            || memcmp(expected.s, threaded.s, expected.l) != 0)
+            error("Threaded VCF writing differs for %s", mt_fname);
+    }
+
+    free(expected.s);
+    free(threaded.s);
+    free(gz_fname);
+    free(st_fname);
+    free(mt_fname);
+}
+
+void test_batch_io(const char *fname)
+{
+    // Batched reads of the BCF file, written back out in batches as VCF
+    char *out_fname = malloc(strlen(fname)+11);
+    if (!out_fname) error("malloc : %s", strerror(errno));
+    sprintf(out_fname, "%s.batch.vcf", fname);
+
+    htsFile *fp = hts_open(fname, "r");
+    if (!fp) error("Failed to open \"%s\" : %s", fname, strerror(errno));
+    htsFile *out = hts_open(out_fname, "w");
+    if (!out) error("Failed to open \"%s\" : %s", out_fname, strerror(errno));
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    if (!hdr) error("bcf_hdr_read : %s", strerror(errno));
+    if (bcf_hdr_write(out, hdr) != 0) error("bcf_hdr_write");
+
+    bcf1_t *recs[3];
+    int i, n;
+    for (i = 0; i < 3; i++)
+        if (!(recs[i] = bcf_init1())) error("bcf_init1 : %s", strerror(errno));
+    while ((n = bcf_read_batch(fp, hdr, recs, 3)) > 0)
+        if (bcf_write_batch(out, hdr, recs, n) != 0) error("bcf_write_batch");
+    if (n < 0) error("bcf_read_batch");
+
+    for (i = 0; i < 3; i++)
+        bcf_destroy1(recs[i]);
+    bcf_hdr_destroy(hdr);
+    if (hts_close(fp) != 0) error("hts_close(%s)", fname);
+    if (hts_close(out) != 0) error("hts_close(%s)", out_fname);
+
+    kstring_t expected = {0,0,0}, batched = {0,0,0};
+    read_vcf_lines(fname, 0, &expected);
+    read_vcf_lines(out_fname, 0, &batched);
+    if (expected.l != batched.l || memcmp(expected.s, batched.s, expected.l) != 0)
+        error("Batched VCF reading and writing differs for %s", out_fname);
+
+    free(expected.s);
+    free(batched.s);
+    free(out_fname);
+}
+
+void test_get_format_values_many(void)
+{
+    // Enough samples for the vector code, with every BCF integer width,
+    // floats, and vector end markers followed by other values
+    enum { NSMPL = 37, NPER = 3, NTAGS = 4 };
+    const char *tags[NTAGS] = { "I8", "I16", "I32", "FL" };
+    int types[NTAGS] = { BCF_HT_INT, BCF_HT_INT, BCF_HT_INT, BCF_HT_REAL };
+    int32_t limits[3] = { 100, 30000, 2000000000 };
+    int32_t ivals[3][NSMPL*NPER];
+    float fvals[NSMPL*NPER];
+    void *dst[NTAGS+1] = { NULL };
+    int ndst[NTAGS+1] = { 0 }, ret[NTAGS+1];
+    int i, j, k;
+    uint32_t seed = 1;
+    char name[16];
+
+    bcf_hdr_t *hdr = bcf_hdr_init("w");
+    if (!hdr) error("bcf_hdr_init : %s", strerror(errno));
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+    check0(bcf_hdr_append(hdr, "##contig=<ID=1>"));
+    for (i = 0; i < 3; i++) {
+        kstring_t line = {0,0,0};
+        ksprintf(&line, "##FORMAT=<ID=%s,Number=.,Type=Integer,Description=\"Test\">", tags[i]);
+        check0(bcf_hdr_append(hdr, line.s));
+        free(line.s);
+    }
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=FL,Number=.,Type=Float,Description=\"Test\">"));
+    for (i = 0; i < NSMPL; i++) {
+        sprintf(name, "S%d", i);
+        check0(bcf_hdr_add_sample(hdr, name));
+    }
+    check0(bcf_hdr_sync(hdr));
+
+    for (i = 0; i < NSMPL*NPER; i++) {
+        for (k = 0; k < 3; k++) {
+            seed = seed * 1103515245 + 12345;
+            int r = (seed >> 8) & 0xffff;
+            if (r % 10 == 0)
+                ivals[k][i] = bcf_int32_missing;
+            else if (r % 10 == 1)
+                ivals[k][i] = bcf_int32_vector_end;
+            else
+                ivals[k][i] = (int32_t) ((r - 32768) * (int64_t) limits[k] / 32768);
+        }
+        if (ivals[0][i] == bcf_int32_missing)
+            bcf_float_set_missing(fvals[i]);
+        else if (ivals[0][i] == bcf_int32_vector_end)
+            bcf_float_set_vector_end(fvals[i]);
+        else
+            fvals[i] = ivals[2][i] / 1000.0f;
+    }
+    rec->rid = 0;
+    rec->pos = 0;
+    for (k = 0; k < 3; k++)
+        check0(bcf_update_format_int32(hdr, rec, tags[k], ivals[k], NSMPL*NPER));
+    check0(bcf_update_format_float(hdr, rec, "FL", fvals, NSMPL*NPER));
+
+    // Ask for a missing tag too
+    const char *all_tags[NTAGS+1] = { "I8", "I16", "I32", "FL", "GT" };
+    int all_types[NTAGS+1] = { BCF_HT_INT, BCF_HT_INT, BCF_HT_INT, BCF_HT_REAL, BCF_HT_INT };
+    if (bcf_get_format_values_many(hdr, rec, NTAGS+1, all_tags, all_types,
+                                   dst, ndst, ret) != NTAGS)
+        error("bcf_get_format_values_many() found the wrong number of tags");
+    if (ret[NTAGS] != -1)
+        error("bcf_get_format_values_many() returned %d for GT", ret[NTAGS]);
+
+    for (k = 0; k < NTAGS; k++) {
+        if (ret[k] != NSMPL*NPER)
+            error("bcf_get_format_values_many() returned %d for %s", ret[k], tags[k]);
+        // Compare with the values set, with vector end extended to the
+        // end of each sample, and with bcf_get_format_values()
+        uint32_t *got = dst[k];
+        for (i = 0; i < NSMPL; i++) {
+            int vend = 0;
+            for (j = 0; j < NPER; j++) {
+                int32_t in = ivals[k < 3 ? k : 0][i*NPER+j];
+                uint32_t expected;
+                vend |= in == bcf_int32_vector_end;
+                if (k < 3) {
+                    expected = vend ? (uint32_t) bcf_int32_vector_end : (uint32_t) in;
+                } else {
+                    float f = fvals[i*NPER+j];
+                    if (vend) bcf_float_set_vector_end(f);
+                    memcpy(&expected, &f, sizeof(expected));
+                }
+                if (got[i*NPER+j] != expected)
+                    error("%s sample %d value %d: got %08x expected %08x",
+                          tags[k], i, j, got[i*NPER+j], expected);
+            }
+        }
+        void *single = NULL;
+        int nsingle = 0;
+        if (bcf_get_format_values(hdr, rec, tags[k], &single, &nsingle, types[k]) != ret[k]
+            || memcmp(single, dst[k], ret[k] * sizeof(uint32_t)) != 0)
+            error("bcf_get_format_values_many() differs from bcf_get_format_values() for %s", tags[k]);
+        free(single);
+    }
+
+    for (k = 0; k < NTAGS+1; k++)
+        free(dst[k]);
+    bcf_destroy1(rec);
+    bcf_hdr_destroy(hdr);
+}
+
+void test_format_views(void)
+{
+    enum { NSMPL = 3 };
+    int32_t gt[NSMPL*2] = { bcf_gt_unphased(0), bcf_gt_phased(1),
+                            bcf_gt_missing, bcf_gt_unphased(1),
+                            bcf_gt_unphased(1), bcf_int32_vector_end };
+    int32_t dp[NSMPL] = { 1000, bcf_int32_missing, -5 };
+    int32_t ad[NSMPL*2] = { 7, 3, bcf_int32_missing, bcf_int32_missing, 0, 120 };
+    int32_t big = 100000;
+    float fl[NSMPL], af[2] = { 0.25f, 0.5f };
+    const char *int_tags[] = { "GT", "DP", "AD" };
+    int32_t *ivals = NULL;
+    float *fvals = NULL;
+    int i, j, k, n, nivals = 0, nfvals = 0;
+    bcf_view_t v;
+    char name[16];
+
+    bcf_hdr_t *hdr = bcf_hdr_init("w");
+    if (!hdr) error("bcf_hdr_init : %s", strerror(errno));
+    bcf1_t *rec = bcf_init1();
+    if (!rec) error("bcf_init1 : %s", strerror(errno));
+    check0(bcf_hdr_append(hdr, "##contig=<ID=1>"));
+    check0(bcf_hdr_append(hdr, "##INFO=<ID=AF,Number=A,Type=Float,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##INFO=<ID=BIG,Number=1,Type=Integer,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##INFO=<ID=FLG,Number=0,Type=Flag,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=AD,Number=R,Type=Integer,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=FL,Number=1,Type=Float,Description=\"Test\">"));
+    check0(bcf_hdr_append(hdr, "##FORMAT=<ID=NO,Number=1,Type=Float,Description=\"Test\">"));
+    for (i = 0; i < NSMPL; i++) {
+        sprintf(name, "S%d", i);
+        check0(bcf_hdr_add_sample(hdr, name));
+    }
+    check0(bcf_hdr_sync(hdr));
+
+    fl[0] = 1.5f;
+    bcf_float_set_missing(fl[1]);
+    fl[2] = -2.0f;
+    check0(bcf_update_alleles_str(hdr, rec, "A,C"));
+    check0(bcf_update_info_float(hdr, rec, "AF", af, 1));
+    check0(bcf_update_info_int32(hdr, rec, "BIG", &big, 1));
+    check0(bcf_update_info_flag(hdr, rec, "FLG", NULL, 1));
+    check0(bcf_update_genotypes(hdr, rec, gt, NSMPL*2));
+    check0(bcf_update_format_int32(hdr, rec, "DP", dp, NSMPL));
+    check0(bcf_update_format_int32(hdr, rec, "AD", ad, NSMPL*2));
+    check0(bcf_update_format_float(hdr, rec, "FL", fl, NSMPL));
+
+    // Integer views give the same values as bcf_get_format_int32()
+    for (k = 0; k < 3; k++) {
+        n = bcf_get_format_int32(hdr, rec, int_tags[k], &ivals, &nivals);
+        if (bcf_get_format_view(hdr, rec, int_tags[k], &v) != n || n <= 0)
+            error("bcf_get_format_view(%s) size mismatch", int_tags[k]);
+        if (v.nsmpl != NSMPL || !v.fmt || v.info || v.n * NSMPL != n)
+            error("bcf_get_format_view(%s) bad view", int_tags[k]);
+        for (i = 0; i < NSMPL; i++)
+            for (j = 0; j < v.n; j++)
+                if (bcf_view_int32(&v, i, j) != ivals[i*v.n+j])
+                    error("bcf_view_int32(%s, %d, %d) = %d, expected %d",
+                          int_tags[k], i, j, bcf_view_int32(&v, i, j), ivals[i*v.n+j]);
+    }
+    // DP needs 16 bits, AD fits in 8
+    check0(bcf_get_format_view(hdr, rec, "DP", &v) == NSMPL && v.type == BCF_BT_INT16 ? 0 : -1);
+    check0(bcf_get_format_view(hdr, rec, "AD", &v) == NSMPL*2 && v.type == BCF_BT_INT8 ? 0 : -1);
+
+    n = bcf_get_format_float(hdr, rec, "FL", &fvals, &nfvals);
+    if (bcf_get_format_view(hdr, rec, "FL", &v) != n || v.type != BCF_BT_FLOAT)
+        error("bcf_get_format_view(FL) bad view");
+    for (i = 0; i < NSMPL; i++) {
+        float f = bcf_view_float(&v, i, 0);
+        if (memcmp(&f, &fvals[i], sizeof(f)) != 0)
+            error("bcf_view_float(FL, %d) mismatch", i);
+    }
+
+    if (bcf_get_format_view(hdr, rec, "XX", &v) != -1)
+        error("bcf_get_format_view() found an undefined tag");
+    if (bcf_get_format_view(hdr, rec, "NO", &v) != -3)
+        error("bcf_get_format_view() found an absent tag");
+
+    if (bcf_get_info_view(hdr, rec, "AF", &v) != 1 || v.nsmpl != 1
+        || !v.info || v.fmt || bcf_view_float(&v, 0, 0) != 0.25f)
+        error("bcf_get_info_view(AF) bad view");
+    if (bcf_get_info_view(hdr, rec, "BIG", &v) != 1 || v.type != BCF_BT_INT32
+        || bcf_view_int32(&v, 0, 0) != big)
+        error("bcf_get_info_view(BIG) bad view");
+    if (bcf_get_info_view(hdr, rec, "FLG", &v) != 0)
+        error("bcf_get_info_view(FLG) bad view");
+    if (bcf_get_info_view(hdr, rec, "DP", &v) != -1)
+        error("bcf_get_info_view() found a FORMAT tag");
+
+    free(ivals);
+    free(fvals);
+    bcf_destroy1(rec);
+    bcf_hdr_destroy(hdr);
+}
+
 int main(int argc, char **argv)
 {
     char *fname = argc>1 ? argv[1] : "rmme.bcf";
 
     // format test. quiet unless there's a failure
     test_get_format_values(fname);
+    test_get_format_values_many();
+    test_format_views();
 
     // main test. writes to stdout
     write_bcf(fname);
@@ -582,5 +1063,9 @@ int main(int argc, char **argv)
     test_get_info_values(fname);
     test_invalid_end_tag();
     test_open_format();
+    test_threaded_read(fname);
+    test_threaded_seek(fname);
+    test_threaded_write(fname);
+    test_batch_io(fname);
     return 0;
 }
@@ -45,6 +45,9 @@ test_multi_ref($opts,4);
 
 test_view($opts,0);
 test_view($opts,4);
+test_ref_prefetch($opts,0);
+test_ref_prefetch($opts,4);
+test_cram_thread_output($opts);
 
 test_MD($opts);
 
@@ -514,6 +517,131 @@ sub test_multi_ref
     }
 }
 
+sub fake_ref_prefetch_data
+{
+    my ($sam) = @_;
+
+    # Load the ce.fa sequences so reads can be taken from them.  Every
+    # reference gets reads, so decoding has to switch between all of them.
+    my (@names, %seqs, $name);
+    open(my $fa, '<', "ce.fa") || die "Couldn't open ce.fa : $!\n";
+    while (<$fa>) {
+        chomp;
+        if (/^>(\S+)/) {
+            $name = $1;
+            push(@names, $name);
+            $seqs{$name} = '';
+        } else {
+            s/\s+//g;
+            $seqs{$name} .= uc($_);
+        }
+    }
+    close($fa) || die "Error reading ce.fa : $!\n";
+
+    my @reads;
+    open(my $out, '>', $sam) || die "Couldn't open $sam : $!\n";
+    print $out "\@HD\tVN:1.4\tSO:coordinate\n";
+    foreach $name (@names) {
+        print $out "\@SQ\tSN:$name\tLN:", length($seqs{$name}), "\n";
+    }
+    foreach $name (@names) {
+        my $len = length($seqs{$name});
+        my $step = $len > 100000 ? 997 : 97;
+        for (my $pos = 1; $pos + 50 <= $len; $pos += $step) {
+            my $seq = substr($seqs{$name}, $pos - 1, 50);
+            # Add a mismatch to some reads so the reference matters
+            if ($pos % 3 == 0) {
+                my $b = substr($seq, 25, 1) eq 'A' ? 'C' : 'A';
+                substr($seq, 25, 1, $b);
+            }
+            my $rec = "r$name.$pos\t0\t$name\t$pos\t40\t50M\t*\t0\t0\t$seq\t" . ('I' x 50) . "\n";
+            push(@reads, [$name, $pos, $rec]);
+            print $out $rec;
+        }
+    }
+    close($out) || die "Error writing $sam : $!\n";
+    return \@reads;
+}
+
+sub test_ref_prefetch
+{
+    my ($opts, $nthreads) = @_;
+    my $tv_args = $nthreads ? "-\@$nthreads" : "";
+    my $base = "ref_prefetch.$nthreads.tmp";
+
+    # Decode a multi-reference CRAM using an external reference.  The
+    # reference for the following slices is loaded ahead of time, so
+    # sequential reads and region queries that jump between references
+    # (including back to earlier ones) must still get the right sequence.
+    my $reads = fake_ref_prefetch_data("$base.sam");
+    print "test_view testing multi-reference CRAM decoding with external reference:\n";
+    $test_view_failures = 0;
+
+    testv $opts, "./test_view $tv_args -t ce.fa -S -C -o seqs_per_slice=50 -x $base.cram.crai $base.sam > $base.cram";
+    testv $opts, "./test_view $tv_args -i reference=ce.fa $base.cram > $base.sam_";
+    testv $opts, "./compare_sam.pl -nomd $base.sam $base.sam_";
+
+    my @regions = (['CHROMOSOME_III', 1000, 3000],
+                   ['CHROMOSOME_I', 500000, 520000],
+                   ['CHROMOSOME_MtDNA', 1, 5000],
+                   ['CHROMOSOME_II', 2000, 2100],
+                   ['CHROMOSOME_I', 10000, 12000],
+                   ['CHROMOSOME_X', 4000, 5000],
+                   ['CHROMOSOME_III', 4500, 5000]);
+    open(my $exp, '>', "$base.reg.sam") || die "Couldn't open $base.reg.sam : $!\n";
+    foreach my $reg (@regions) {
+        my ($chr, $beg, $end) = @$reg;
+        foreach my $r (@$reads) {
+            print $exp $$r[2]
+                if ($$r[0] eq $chr && $$r[1] <= $end && $$r[1] + 49 >= $beg);
+        }
+    }
+    close($exp) || die "Error writing $base.reg.sam : $!\n";
+
+    my $regions = join(' ', map { "$$_[0]:$$_[1]-$$_[2]" } @regions);
+    testv $opts, "./test_view $tv_args -i reference=ce.fa $base.cram $regions > $base.reg.sam_";
+    testv $opts, "./compare_sam.pl -nomd $base.reg.sam $base.reg.sam_";
+
+    if ($test_view_failures == 0) {
+        passed($opts, "multi-reference CRAM with external reference");
+    } else {
+        failed($opts, "multi-reference CRAM with external reference", "$test_view_failures subtests failed");
+    }
+}
+
+sub test_cram_thread_output
+{
+    my ($opts) = @_;
+
+    # Containers, and the codec trials for each block, are compressed
+    # concurrently, but the codecs chosen must not depend on which thread
+    # finishes first.  Output written with and without threads should be
+    # identical.
+    print "test_view testing CRAM 3.1 output is independent of threading:\n";
+    $test_view_failures = 0;
+
+    my @inputs = (["ce#1000.sam", "-t ce.fa -o seqs_per_slice=100"],
+                  ["ce#large_seq.sam", "-t ce.fa -o seqs_per_slice=100"],
+                  ["ce#unmap.sam", "-t ce.fa -o seqs_per_slice=100"],
+                  ["ce#1000.sam", "-t ce.fa -o seqs_per_slice=50 -o slices_per_container=3"],
+                  ["multi_ref.tmp.sam", "-o no_ref=1 -o seqs_per_slice=100"]);
+    for (my $i = 0; $i < @inputs; $i++) {
+        my ($sam, $args) = @{$inputs[$i]};
+        my $base = "thread_output.$i";
+        foreach my $nthreads (0, 4) {
+            my $tv_args = $nthreads ? "-\@$nthreads" : "";
+            testv $opts, "./test_view $tv_args $args -S -C -o version=3.1 -o level=7 $sam > $base.thr$nthreads.tmp.cram";
+        }
+        testv $opts, "cmp $base.thr0.tmp.cram $base.thr4.tmp.cram";
+    }
+
+    if ($test_view_failures == 0) {
+        passed($opts, "threaded CRAM 3.1 output");
+    } else {
+        failed($opts, "threaded CRAM 3.1 output", "$test_view_failures subtests failed");
+    }
+}
+
 sub test_view
 {
     my ($opts, $nthreads) = @_;
@@ -569,6 +697,16 @@ sub test_view
         testv $opts, "./test_view $tv_args $cram.bam > $cram.bam.sam_";
         testv $opts, "./compare_sam.pl $md $sam $cram.bam.sam_";
 
+        # SAM -> CRAM3.1 -> SAM
+        $cram = "$base.tmp.31.cram";
+        testv $opts, "./test_view $tv_args -t $ref -S -C -o VERSION=3.1 $sam > $cram";
+        testv $opts, "./test_view $tv_args -D $cram > $cram.sam_";
+        testv $opts, "./compare_sam.pl $md $sam $cram.sam_";
+
+        # CRAM3.1 -> SAM with a bounded reference cache
+        testv $opts, "./test_view $tv_args -i ref_cache_size=1 -D $cram > $cram.sam_";
+        testv $opts, "./compare_sam.pl $md $sam $cram.sam_";
+
         # CRAM3 -> CRAM2
         $cram = "$base.tmp.cram";
         testv $opts, "./test_view $tv_args -t $ref -C -o VERSION=2.1 $cram > $cram.cram";
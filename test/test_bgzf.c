@@ -29,15 +29,19 @@ DEALINGS IN THE SOFTWARE.
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "../htslib/bgzf.h"
 #include "../htslib/hfile.h"
+#include "../htslib/hts_log.h"
 #include "../hfile_internal.h"
+#include "../hts_internal.h"
 
 const char *bgzf_suffix = ".gz";
 const char *idx_suffix  = ".gzi";
@@ -820,6 +824,220 @@ static int test_tell_seek_getc(Files *f, const char *mode,
     return -1;
 }
 
+static int read_all_compare(BGZF *bgz, Files *f, const char *func) {
+    unsigned char buf[BUFSZ];
+    size_t pos = 0;
+    ssize_t got;
+
+    if (try_bgzf_seek(bgz, 0, SEEK_SET, f->tmp_bgzf, func) != 0) return -1;
+    do {
+        got = try_bgzf_read(bgz, buf, BUFSZ, f->tmp_bgzf, func);
+        if (got < 0) return -1;
+        if (compare_buffers(f->text + pos, buf,
+                            got <= f->ltext - pos ? got : f->ltext - pos, got,
+                            "text", f->tmp_bgzf, func) != 0) return -1;
+        pos += got;
+    } while (got > 0);
+
+    if (pos != f->ltext) {
+        fprintf(stderr, "%s : Expected %zu bytes, got %zu\n",
+                func, f->ltext, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static int test_shared_cache(Files *f, int cache_size) {
+    BGZF* bgz1 = NULL, *bgz2 = NULL;
+    bgzf_cache_stats_t before, after;
+
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "w", __func__);
+    if (!bgz1) goto fail;
+    if (try_bgzf_write(bgz1, f->text, f->ltext, f->tmp_bgzf, __func__) < 0)
+        goto fail;
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz1) goto fail;
+    bgz2 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz2) goto fail;
+    bgzf_set_cache_size(bgz1, cache_size);
+    bgzf_set_cache_size(bgz2, cache_size);
+
+    bgzf_cache_stats(&before);
+    if (read_all_compare(bgz1, f, __func__) != 0) goto fail;
+    if (read_all_compare(bgz2, f, __func__) != 0) goto fail;
+    if (read_all_compare(bgz1, f, __func__) != 0) goto fail;
+    bgzf_cache_stats(&after);
+
+    if (after.bytes_used > after.bytes_budget) {
+        fprintf(stderr, "%s : Cache holds %zu bytes, over budget of %zu\n",
+                __func__, after.bytes_used, after.bytes_budget);
+        goto fail;
+    }
+    if (cache_size >= f->ltext * 2) {
+        // Everything fits, so the second and third passes should all hit
+        if (after.hits == before.hits || after.evictions != before.evictions) {
+            fprintf(stderr, "%s : Expected cache hits without eviction\n",
+                    __func__);
+            goto fail;
+        }
+    } else if (after.evictions == before.evictions) {
+        fprintf(stderr, "%s : Expected cache evictions\n", __func__);
+        goto fail;
+    }
+
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (try_bgzf_close(&bgz2, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgzf_cache_stats(&after);
+    if (after.nblocks != 0 || after.bytes_used != 0) {
+        fprintf(stderr, "%s : Cache not emptied on close\n", __func__);
+        goto fail;
+    }
+
+    return 0;
+
+ fail:
+    if (bgz1) bgzf_close(bgz1);
+    if (bgz2) bgzf_close(bgz2);
+    return -1;
+}
+
+// Sets the modification time of fn to sec seconds and nsec nanoseconds
+static int set_mtime(const char *fn, time_t sec, long nsec, const char *func) {
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = sec;
+    times[0].tv_nsec = times[1].tv_nsec = nsec;
+    if (utimensat(AT_FDCWD, fn, times, 0) != 0) {
+        fprintf(stderr, "%s : Couldn't set times on %s : %s\n",
+                func, fn, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// A file rewritten in place with the same size, within the same second,
+// must not be served from blocks cached for its old contents
+static int test_shared_cache_rewrite(Files *f) {
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC) || defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+    BGZF* bgz1 = NULL, *bgz2 = NULL;
+    unsigned char *text2 = NULL, buf[BUFSZ];
+    time_t now = time(NULL);
+    size_t i, pos = 0;
+    ssize_t got;
+
+    text2 = malloc(f->ltext);
+    if (!text2) goto fail;
+    for (i = 0; i < f->ltext; i++)
+        text2[i] = f->text[i] ^ 1;
+
+    // Level 0, so both versions are the same size
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "w0", __func__);
+    if (!bgz1) goto fail;
+    if (try_bgzf_write(bgz1, f->text, f->ltext, f->tmp_bgzf, __func__) < 0)
+        goto fail;
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (set_mtime(f->tmp_bgzf, now, 100000000, __func__) != 0) goto fail;
+
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz1) goto fail;
+    bgzf_set_cache_size(bgz1, 1000000);
+    if (read_all_compare(bgz1, f, __func__) != 0) goto fail;
+
+    bgz2 = try_bgzf_open(f->tmp_bgzf, "w0", __func__);
+    if (!bgz2) goto fail;
+    if (try_bgzf_write(bgz2, text2, f->ltext, f->tmp_bgzf, __func__) < 0)
+        goto fail;
+    if (try_bgzf_close(&bgz2, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (set_mtime(f->tmp_bgzf, now, 200000000, __func__) != 0) goto fail;
+
+    bgz2 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz2) goto fail;
+    bgzf_set_cache_size(bgz2, 1000000);
+    do {
+        got = try_bgzf_read(bgz2, buf, BUFSZ, f->tmp_bgzf, __func__);
+        if (got < 0) goto fail;
+        if (compare_buffers(text2 + pos, buf,
+                            got <= f->ltext - pos ? got : f->ltext - pos, got,
+                            "rewritten text", f->tmp_bgzf, __func__) != 0)
+            goto fail;
+        pos += got;
+    } while (got > 0);
+    if (pos != f->ltext) {
+        fprintf(stderr, "%s : Expected %zu bytes, got %zu\n",
+                __func__, f->ltext, pos);
+        goto fail;
+    }
+
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (try_bgzf_close(&bgz2, f->tmp_bgzf, __func__) != 0) goto fail;
+    free(text2);
+    return 0;
+
+ fail:
+    if (bgz1) bgzf_close(bgz1);
+    if (bgz2) bgzf_close(bgz2);
+    free(text2);
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+// The shared budget follows the largest size asked for by the handles
+// still attached, and shrinks when they go away
+static int expect_cache_budget(size_t budget, const char *when,
+                               const char *func) {
+    bgzf_cache_stats_t stats;
+    bgzf_cache_stats(&stats);
+    if (stats.bytes_budget != budget || stats.bytes_used > budget) {
+        fprintf(stderr, "%s : %s, cache budget %zu holding %zu bytes, "
+                "expected budget %zu\n", func, when, stats.bytes_budget,
+                stats.bytes_used, budget);
+        return -1;
+    }
+    return 0;
+}
+
+static int test_shared_cache_budget(Files *f) {
+    BGZF* bgz1 = NULL, *bgz2 = NULL;
+
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "w", __func__);
+    if (!bgz1) goto fail;
+    if (try_bgzf_write(bgz1, f->text, f->ltext, f->tmp_bgzf, __func__) < 0)
+        goto fail;
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgz1 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz1) goto fail;
+    bgz2 = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz2) goto fail;
+    bgzf_set_cache_size(bgz1, 1000000);
+    bgzf_set_cache_size(bgz2, 100000);
+    if (read_all_compare(bgz1, f, __func__) != 0) goto fail;
+    if (expect_cache_budget(1000000, "both open", __func__) != 0) goto fail;
+
+    if (try_bgzf_close(&bgz1, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (expect_cache_budget(100000, "after close", __func__) != 0) goto fail;
+
+    bgzf_set_cache_size(bgz2, 50000);
+    if (expect_cache_budget(50000, "after shrinking", __func__) != 0)
+        goto fail;
+    if (read_all_compare(bgz2, f, __func__) != 0) goto fail;
+    if (expect_cache_budget(50000, "after reading", __func__) != 0) goto fail;
+
+    bgzf_set_cache_size(bgz2, 0);
+    if (expect_cache_budget(0, "after disabling", __func__) != 0) goto fail;
+    if (try_bgzf_close(&bgz2, f->tmp_bgzf, __func__) != 0) goto fail;
+    return 0;
+
+ fail:
+    if (bgz1) bgzf_close(bgz1);
+    if (bgz2) bgzf_close(bgz2);
+    return -1;
+}
+
 static int test_tell_read(Files *f, const char *mode) {
 
     BGZF* bgz = NULL;
@@ -924,6 +1142,224 @@ static int test_bgzf_getline(Files *f, const char *mode, int nthreads) {
     return -1;
 }
 
+// Writing with BGZF_LEVEL_AUTO.  Enough blocks are written for the level
+// to be adjusted a few times, and the data must read back unchanged.
+static int test_auto_level(Files *f, int nthreads) {
+    BGZF* bgz = NULL;
+    kstring_t text = { 0, 0, NULL };
+    unsigned char bg_buf[BUFSZ];
+    unsigned int i, x = 54321;
+    ssize_t bg_got;
+    size_t pos = 0;
+    uint64_t counts[10];
+    int n, nlevels = 0;
+
+    // Enough blocks for the level to be adjusted several times
+    for (i = 0; i < 500000; i++) {
+        x = x * 1103515245 + 12345;
+        if (ksprintf(&text, "%07u\t%08x\n", i, x) < 0)
+            goto fail;
+    }
+
+    bgz = try_bgzf_open(f->tmp_bgzf, "w", __func__);
+    if (!bgz) goto fail;
+    if (nthreads > 0 && try_bgzf_mt(bgz, nthreads, __func__) != 0) goto fail;
+    bgz->compress_level = BGZF_LEVEL_AUTO;
+    if (try_bgzf_write(bgz, text.s, text.l, f->tmp_bgzf, __func__) < 0)
+        goto fail;
+
+    // Writing from memory is faster than compressing, so with threads the
+    // queue fills and the level should be lowered from where it started
+    if (nthreads > 0) {
+        if (bgzf_flush(bgz) != 0) {
+            fprintf(stderr, "%s : bgzf_flush failed on %s\n",
+                    __func__, f->tmp_bgzf);
+            goto fail;
+        }
+        n = bgzf_auto_level_counts(bgz, counts, 10);
+        for (i = 0; i < n; i++)
+            nlevels += counts[i] > 0;
+        if (nlevels < 2) {
+            fprintf(stderr, "%s : Expected more than one compression level "
+                    "with %d threads, got %d\n", __func__, nthreads, nlevels);
+            goto fail;
+        }
+    }
+    if (try_bgzf_close(&bgz, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgz = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz) goto fail;
+    if (try_bgzf_compression(bgz, 2, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    do {
+        bg_got = try_bgzf_read(bgz, bg_buf, BUFSZ, f->tmp_bgzf, __func__);
+        if (bg_got < 0) goto fail;
+        if (pos + bg_got > text.l
+            || memcmp(text.s + pos, bg_buf, bg_got) != 0) {
+            fprintf(stderr, "%s : Got wrong data from %s, pos %zu\n",
+                    __func__, f->tmp_bgzf, pos);
+            goto fail;
+        }
+        pos += bg_got;
+    } while (bg_got > 0);
+
+    if (pos != text.l) {
+        fprintf(stderr, "%s : bgzf_read got %zu bytes; expected %zu\n",
+                __func__, pos, text.l);
+        goto fail;
+    }
+    if (try_bgzf_close(&bgz, f->tmp_bgzf, __func__) != 0) goto fail;
+    if (test_check_EOF(f->tmp_bgzf, 1) != 0) goto fail;
+
+    free(ks_release(&text));
+    return 0;
+
+ fail:
+    if (bgz) bgzf_close(bgz);
+    free(ks_release(&text));
+    return -1;
+}
+
+static int write_gzip_member(const char *name, const char *mode,
+                             const void *data, size_t len, const char *func) {
+    gzFile gz = gzopen(name, mode);
+    if (!gz) {
+        fprintf(stderr, "%s : Couldn't gzopen %s : %s\n",
+                func, name, strerror(errno));
+        return -1;
+    }
+    if (gzwrite(gz, data, len) != len) {
+        fprintf(stderr, "%s : Failed to write %s\n", func, name);
+        gzclose(gz);
+        return -1;
+    }
+    if (gzclose(gz) != Z_OK) {
+        fprintf(stderr, "%s : Error on closing %s\n", func, name);
+        return -1;
+    }
+    return 0;
+}
+
+// Reading plain gzip with threads.  The text needs to be big enough and
+// not too compressible so the input is split between several decode jobs.
+static int test_gzip_mt_read(Files *f, int nthreads) {
+    BGZF* bgz = NULL;
+    kstring_t text = { 0, 0, NULL };
+    unsigned char bg_buf[BUFSZ];
+    unsigned int i, x = 12345;
+    ssize_t bg_got;
+    int res;
+    size_t pos = 0;
+    struct stat st;
+
+    for (i = 0; i < 200000; i++) {
+        x = x * 1103515245 + 12345;
+        if (ksprintf(&text, "%07u\t%08x%08x\n", i, x, x * 2654435761U) < 0)
+            goto fail;
+    }
+
+    // Two members, one from our usual text
+    if (write_gzip_member(f->tmp_bgzf, "wb", text.s, text.l, __func__) != 0
+        || stat(f->tmp_bgzf, &st) != 0
+        || write_gzip_member(f->tmp_bgzf, "ab", f->text, f->ltext,
+                             __func__) != 0)
+        goto fail;
+    if (kputsn((const char *) f->text, f->ltext, &text) < 0) goto fail;
+
+    bgz = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz) goto fail;
+    if (try_bgzf_mt(bgz, nthreads, __func__) != 0) goto fail;
+    if (try_bgzf_compression(bgz, 1, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    do {
+        bg_got = try_bgzf_read(bgz, bg_buf, BUFSZ, f->tmp_bgzf, __func__);
+        if (bg_got < 0) goto fail;
+        if (pos + bg_got > text.l
+            || memcmp(text.s + pos, bg_buf, bg_got) != 0) {
+            fprintf(stderr, "%s : Got wrong data from %s, pos %zu\n",
+                    __func__, f->tmp_bgzf, pos);
+            goto fail;
+        }
+        pos += bg_got;
+    } while (bg_got > 0);
+
+    if (pos != text.l) {
+        fprintf(stderr, "%s : bgzf_read got %zu bytes; expected %zu\n",
+                __func__, pos, text.l);
+        goto fail;
+    }
+    if (try_bgzf_close(&bgz, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    // Trailing zero padding should give an error, but only after all the
+    // data has been returned
+    static const char zeros[1000];
+    FILE *fp = try_fopen(f->tmp_bgzf, "ab");
+    if (!fp) goto fail;
+    if (fwrite(zeros, 1, sizeof(zeros), fp) != sizeof(zeros)) {
+        fclose(fp);
+        goto fail;
+    }
+    if (try_fclose(&fp, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgz = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz) goto fail;
+    if (try_bgzf_mt(bgz, nthreads, __func__) != 0) goto fail;
+    enum htsLogLevel level = hts_get_log_level();
+    hts_set_log_level(HTS_LOG_OFF);
+    // bgzf_read() discards a partial read on error, so check the blocks
+    pos = 0;
+    while ((res = bgzf_read_block(bgz)) == 0 && bgz->block_length > 0) {
+        bg_got = bgz->block_length;
+        if (pos + bg_got > text.l
+            || memcmp(text.s + pos, bgz->uncompressed_block, bg_got) != 0)
+            break;
+        pos += bg_got;
+    }
+    hts_set_log_level(level);
+    if (pos != text.l || res >= 0) {
+        fprintf(stderr, "%s : Got %zu of %zu bytes then %d from %s "
+                "with trailing padding\n", __func__, pos, text.l, res,
+                f->tmp_bgzf);
+        goto fail;
+    }
+    bgzf_close(bgz);
+    bgz = NULL;
+
+    // Corrupt the first member's CRC, which should be noticed
+    fp = try_fopen(f->tmp_bgzf, "r+b");
+    if (!fp) goto fail;
+    if (fseek(fp, st.st_size - 8, SEEK_SET) != 0 || fputc(0, fp) == EOF
+        || fseek(fp, st.st_size - 7, SEEK_SET) != 0 || fputc(0, fp) == EOF) {
+        fclose(fp);
+        goto fail;
+    }
+    if (try_fclose(&fp, f->tmp_bgzf, __func__) != 0) goto fail;
+
+    bgz = try_bgzf_open(f->tmp_bgzf, "r", __func__);
+    if (!bgz) goto fail;
+    if (try_bgzf_mt(bgz, nthreads, __func__) != 0) goto fail;
+    hts_set_log_level(HTS_LOG_OFF);
+    while ((bg_got = bgzf_read(bgz, bg_buf, BUFSZ)) > 0)
+        ;
+    // Reading again should fail in the same way
+    ssize_t bg_again = bgzf_read(bgz, bg_buf, BUFSZ);
+    hts_set_log_level(level);
+    if (bg_got == 0 || bg_again >= 0) {
+        fprintf(stderr, "%s : Corrupt CRC not detected in %s\n",
+                __func__, f->tmp_bgzf);
+        goto fail;
+    }
+    bgzf_close(bgz);
+
+    free(ks_release(&text));
+    return 0;
+
+ fail:
+    if (bgz) bgzf_close(bgz);
+    free(ks_release(&text));
+    return -1;
+}
+
 int main(int argc, char **argv) {
     Files f = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0 };
     int retval = EXIT_FAILURE;
@@ -991,6 +1427,12 @@ int main(int argc, char **argv) {
     if (test_tell_seek_getc(&f, "wu", 1000000, 1) != 0) goto out;
     if (test_tell_seek_getc(&f, "wu", 1000000, 2) != 0) goto out;
 
+    // Block cache shared between handles
+    if (test_shared_cache(&f, 1000000) != 0) goto out;
+    if (test_shared_cache(&f, 200000) != 0) goto out;
+    if (test_shared_cache_rewrite(&f) != 0) goto out;
+    if (test_shared_cache_budget(&f) != 0) goto out;
+
     // bgzf_tell and bgzf_read
     if (test_tell_read(&f, "w") != 0) goto out;
     if (test_tell_read(&f, "wu") != 0) goto out;
@@ -1000,6 +1442,15 @@ int main(int argc, char **argv) {
     if (test_bgzf_getline(&f, "w", 1) != 0) goto out;
     if (test_bgzf_getline(&f, "w", 2) != 0) goto out;
 
+    // Adaptive compression level
+    if (test_auto_level(&f, 0) != 0) goto out;
+    if (test_auto_level(&f, 1) != 0) goto out;
+    if (test_auto_level(&f, 4) != 0) goto out;
+
+    // Plain gzip with threads
+    if (test_gzip_mt_read(&f, 1) != 0) goto out;
+    if (test_gzip_mt_read(&f, 4) != 0) goto out;
+
     retval = EXIT_SUCCESS;
 
  out:
@@ -0,0 +1,837 @@
+/*  test_cram_codecs.c -- CRAM entropy codec round-trip tests
+
+    Copyright (C) 2026 Genome Research Ltd.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../cram/rANS_static4x16.h"
+#include "../cram/arith_dynamic.h"
+#include "../cram/tokenise_name3.h"
+#include "../cram/fqzcomp_qual.h"
+#include "../cram/cram.h"
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Fills buf with data of varying entropy and structure
+static void gen_data(unsigned char *buf, unsigned int len, int kind) {
+    unsigned int i;
+    for (i = 0; i < len; i++) {
+        switch (kind) {
+        case 0: // incompressible
+            buf[i] = rnd();
+            break;
+        case 1: // small alphabet, suits PACK
+            buf[i] = "ACGT"[rnd() % 4];
+            break;
+        case 2: // skewed, suits order-0
+            buf[i] = rnd() % 10 ? 'I' : '!' + rnd() % 40;
+            break;
+        case 3: // long runs, suits RLE
+            buf[i] = i && rnd() % 16 ? buf[i-1] : rnd() % 12;
+            break;
+        case 4: // constant
+            buf[i] = 'x';
+            break;
+        default: // depends on the previous symbol, suits order-1
+            buf[i] = i ? buf[i-1] + rnd() % 3 : 0;
+            break;
+        }
+    }
+}
+
+static int test_rans4x16(void) {
+    static const int orders[] = {
+        0, 1, 0x40, 0x41, 0x80, 0x81, 0xc0, 0xc1,
+        0x04, 0x05, 0x44, 0x45, 0xc4, 0xc5,
+        RANS_ORDER_CAT, RANS_ORDER_NOSZ | 1,
+        RANS_ORDER_STRIPE | (4<<8), RANS_ORDER_STRIPE | (3<<8) | 0xc5,
+    };
+    // Sizes either side of the 32-way rounds and order-1 chunk boundaries
+    static const unsigned int sizes[] = {
+        0, 1, 2, 31, 32, 33, 63, 64, 65, 127, 129, 1000, 4097, 70001,
+    };
+    unsigned int i, j;
+    int kind, failures = 0;
+
+    for (kind = 0; kind < 6; kind++) {
+        for (i = 0; i < sizeof(sizes)/sizeof(*sizes); i++) {
+            unsigned int len = sizes[i];
+            unsigned char *in = malloc(len + 1);
+            if (!in) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+            gen_data(in, len, kind);
+
+            for (j = 0; j < sizeof(orders)/sizeof(*orders); j++) {
+                unsigned int clen, ulen = len;
+                unsigned char *comp, *uncomp;
+
+                comp = rans_compress_4x16(in, len, &clen, orders[j]);
+                if (!comp) {
+                    fprintf(stderr, "rans_compress_4x16 failed for kind %d "
+                            "len %u order 0x%x\n", kind, len, orders[j]);
+                    failures++;
+                    continue;
+                }
+
+                uncomp = rans_uncompress_4x16(comp, clen, &ulen);
+                if (!uncomp || ulen != len || memcmp(in, uncomp, len) != 0) {
+                    fprintf(stderr, "rans_uncompress_4x16 mismatch for kind "
+                            "%d len %u order 0x%x\n", kind, len, orders[j]);
+                    failures++;
+                }
+
+                // Truncated data must fail cleanly
+                if (clen > 1) {
+                    unsigned int tlen = len;
+                    unsigned char *t = rans_uncompress_4x16(comp, clen / 2,
+                                                            &tlen);
+                    if (t && tlen == len && len
+                        && memcmp(in, t, len) == 0) {
+                        fprintf(stderr, "Truncated data decoded for kind %d "
+                                "len %u order 0x%x\n", kind, len, orders[j]);
+                        failures++;
+                    }
+                    free(t);
+                }
+
+                free(comp);
+                free(uncomp);
+            }
+            free(in);
+        }
+    }
+
+    return failures;
+}
+
+static int test_arith(void) {
+    static const int orders[] = {
+        0, 1, 0x40, 0x41, 0x80, 0x81, 0xc0, 0xc1,
+        ARITH_EXT, ARITH_CAT, ARITH_NOSZ | 1,
+        ARITH_STRIPE | (4<<8), ARITH_STRIPE | (3<<8) | 0xc1,
+    };
+    static const unsigned int sizes[] = { 0, 1, 2, 3, 4, 5, 100, 4097, 70001 };
+    unsigned int i, j;
+    int kind, failures = 0;
+
+    for (kind = 0; kind < 6; kind++) {
+        for (i = 0; i < sizeof(sizes)/sizeof(*sizes); i++) {
+            unsigned int len = sizes[i];
+            unsigned char *in = malloc(len + 1);
+            if (!in) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+            gen_data(in, len, kind);
+
+            for (j = 0; j < sizeof(orders)/sizeof(*orders); j++) {
+                unsigned int clen, ulen = len;
+                unsigned char *comp, *uncomp;
+
+                comp = arith_compress(in, len, &clen, orders[j]);
+                if (!comp) {
+                    fprintf(stderr, "arith_compress failed for kind %d "
+                            "len %u order 0x%x\n", kind, len, orders[j]);
+                    failures++;
+                    continue;
+                }
+
+                uncomp = arith_uncompress(comp, clen, &ulen);
+                if (!uncomp || ulen != len || memcmp(in, uncomp, len) != 0) {
+                    fprintf(stderr, "arith_uncompress mismatch for kind "
+                            "%d len %u order 0x%x\n", kind, len, orders[j]);
+                    failures++;
+                }
+
+                // Truncated data must fail cleanly
+                if (clen > 1) {
+                    unsigned int tlen = len;
+                    unsigned char *t = arith_uncompress(comp, clen / 2, &tlen);
+                    if (t && tlen == len && len
+                        && memcmp(in, t, len) == 0) {
+                        fprintf(stderr, "Truncated data decoded for kind %d "
+                                "len %u order 0x%x\n", kind, len, orders[j]);
+                        failures++;
+                    }
+                    free(t);
+                }
+
+                free(comp);
+                free(uncomp);
+            }
+            free(in);
+        }
+    }
+
+    return failures;
+}
+
+// Fills buf with len bytes of NUL terminated read names of the given kind
+static unsigned int gen_names(char *buf, unsigned int len, int kind) {
+    unsigned int i = 0, n = 0, tile = 1101, x = 1000, y = 900;
+
+    while (i + 100 < len) {
+        switch (kind) {
+        case 0: // Illumina, mostly increasing
+            x += rnd() % 300;
+            if (rnd() % 50 == 0)
+                tile++, x = rnd() % 1000;
+            i += sprintf(buf + i, "HSQ1008:141:D0CC8ACXX:3:%u:%u:%u",
+                         tile, x, y + rnd() % 20000) + 1;
+            break;
+        case 1: // Pairs, sometimes far apart
+            if (n > 10 && rnd() % 2) {
+                // Reuse an earlier name from a few back
+                unsigned int j = i, back = 1 + rnd() % 8;
+                while (j > 0 && back) {
+                    j--;
+                    while (j > 0 && buf[j-1])
+                        j--;
+                    back--;
+                }
+                strcpy(buf + i, buf + j);
+                i += strlen(buf + j) + 1;
+            } else {
+                i += sprintf(buf + i, "SRR%06u.%u", 65390, n) + 1;
+            }
+            break;
+        case 2: // Leading zeros, long digit runs and empty names
+            i += sprintf(buf + i, "r%05u_%u%09u#0/%u", n, rnd() % 100,
+                         rnd(), 1 + rnd() % 2) + 1;
+            if (rnd() % 10 == 0)
+                buf[i++] = 0;
+            break;
+        case 3: // Many tokens
+            i += sprintf(buf + i, "%s", "a.") + 1;
+            while (i < len - 10 && rnd() % 200)
+                i += sprintf(buf + i - 1, "%u.", rnd() % 4);
+            break;
+        default: // Arbitrary bytes
+            buf[i++] = rnd() % 8 ? rnd() : 0;
+            break;
+        }
+        n++;
+    }
+
+    return i;
+}
+
+static int test_tok3(void) {
+    static const unsigned int sizes[] = { 0, 200, 5000, 100000 };
+    unsigned int i;
+    int kind, level, arith, failures = 0;
+    char *in = malloc(100000);
+
+    if (!in) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (kind = 0; kind < 5; kind++) {
+        for (i = 0; i < sizeof(sizes)/sizeof(*sizes); i++) {
+            unsigned int len = gen_names(in, sizes[i], kind);
+            for (level = 1; level <= 9; level += 4) {
+              for (arith = 0; arith < 2; arith++) {
+                unsigned int ulen, unterminated;
+                int clen;
+                unsigned char *comp, *uncomp;
+
+                // Also check a final name without its terminator
+                for (unterminated = 0; unterminated <= (len > 0);
+                     unterminated++) {
+                    unsigned int l = len - unterminated;
+                    comp = tok3_encode_names(in, l, level, arith, &clen);
+                    if (!comp) {
+                        fprintf(stderr, "tok3_encode_names failed for kind "
+                                "%d len %u level %d arith %d\n", kind, l,
+                                level, arith);
+                        failures++;
+                        continue;
+                    }
+
+                    uncomp = tok3_decode_names(comp, clen, &ulen);
+                    if (!uncomp || ulen != l || memcmp(in, uncomp, l) != 0) {
+                        fprintf(stderr, "tok3_decode_names mismatch for kind "
+                                "%d len %u level %d arith %d\n", kind, l,
+                                level, arith);
+                        failures++;
+                    }
+                    free(uncomp);
+
+                    // Truncated data must fail cleanly
+                    if (clen > 1) {
+                        unsigned char *t = tok3_decode_names(comp, clen / 2,
+                                                             &ulen);
+                        if (t && ulen == l && memcmp(in, t, l) == 0) {
+                            fprintf(stderr, "Truncated names decoded for "
+                                    "kind %d len %u\n", kind, l);
+                            failures++;
+                        }
+                        free(t);
+                    }
+                    free(comp);
+                }
+              }
+            }
+        }
+    }
+
+    free(in);
+    return failures;
+}
+
+// Fills buf with quality strings for the records in s
+static void gen_quals(unsigned char *buf, fqz_slice *s, int kind) {
+    unsigned int i = 0, j;
+    int r;
+
+    for (r = 0; r < s->num_records; r++) {
+        unsigned char q = 30;
+        for (j = 0; j < s->len[r]; j++, i++) {
+            switch (kind) {
+            case 0: // Illumina style, drifting down along the read
+                if (rnd() % 4 == 0)
+                    q += rnd() % 5 - (j > s->len[r] / 2 ? 3 : 2);
+                if (q > 41)
+                    q = rnd() % 2 ? 2 : 41;
+                buf[i] = q;
+                break;
+            case 1: // Binned
+                buf[i] = "\x02\x0c\x17\x25"[rnd() % 7 ? 3 : rnd() % 3];
+                break;
+            case 2: // Duplicate records
+                buf[i] = r && j < s->len[r-1] && rnd() % 3
+                    ? buf[i - s->len[r-1]] : rnd() % 40;
+                break;
+            case 3: // Constant
+                buf[i] = 0xff;
+                break;
+            default: // Arbitrary
+                buf[i] = rnd();
+                break;
+            }
+        }
+    }
+}
+
+static int test_fqzcomp(void) {
+    static const int nrecs[] = { 1, 2, 100, 3000 };
+    unsigned int i;
+    int kind, fixed, level, r, failures = 0;
+
+    for (kind = 0; kind < 5; kind++) {
+        for (fixed = 0; fixed < 2; fixed++) {
+            for (i = 0; i < sizeof(nrecs)/sizeof(*nrecs); i++) {
+                fqz_slice s;
+                unsigned char *in;
+                size_t len = 0;
+
+                s.num_records = nrecs[i];
+                s.len = malloc(s.num_records * sizeof(*s.len));
+                s.flags = malloc(s.num_records * sizeof(*s.flags));
+                if (!s.len || !s.flags) {
+                    fprintf(stderr, "Out of memory\n");
+                    return failures + 1;
+                }
+                for (r = 0; r < s.num_records; r++) {
+                    s.len[r] = fixed ? 100 : rnd() % 300;
+                    s.flags[r] = (r & 1 ? FQZ_FREAD2 : 0)
+                        | (rnd() % 2 ? FQZ_FREVERSE : 0);
+                    len += s.len[r];
+                }
+                if (!(in = malloc(len + 1))) {
+                    fprintf(stderr, "Out of memory\n");
+                    return failures + 1;
+                }
+                gen_quals(in, &s, kind);
+
+                for (level = 1; level <= 9; level += 8) {
+                    size_t clen, ulen;
+                    unsigned char *comp, *uncomp, *t;
+
+                    comp = fqz_compress(&s, in, len, &clen, level);
+                    if (!comp) {
+                        if (len == 0)
+                            continue;
+                        fprintf(stderr, "fqz_compress failed for kind %d "
+                                "records %d level %d\n", kind,
+                                s.num_records, level);
+                        failures++;
+                        continue;
+                    }
+
+                    uncomp = fqz_decompress(comp, clen, &ulen);
+                    if (!uncomp || ulen != len
+                        || memcmp(in, uncomp, len) != 0) {
+                        fprintf(stderr, "fqz_decompress mismatch for kind "
+                                "%d records %d level %d\n", kind,
+                                s.num_records, level);
+                        failures++;
+                    }
+                    free(uncomp);
+
+                    // Truncated data must fail cleanly
+                    t = fqz_decompress(comp, clen / 2, &ulen);
+                    if (t && ulen == len && memcmp(in, t, len) == 0) {
+                        fprintf(stderr, "Truncated qualities decoded for "
+                                "kind %d records %d\n", kind,
+                                s.num_records);
+                        failures++;
+                    }
+                    free(t);
+                    free(comp);
+                }
+
+                // Lengths must add up to the data size
+                if (len) {
+                    size_t clen;
+                    unsigned char *comp = fqz_compress(&s, in, len - 1,
+                                                       &clen, 5);
+                    if (comp) {
+                        fprintf(stderr, "fqz_compress accepted bad record "
+                                "lengths\n");
+                        failures++;
+                        free(comp);
+                    }
+                }
+
+                free(in);
+                free(s.len);
+                free(s.flags);
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Bulk ITF8 column decoding must match decoding one value at a time
+static int test_itf8_column(void) {
+    static const int32_t fixed[] = {
+        0, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456,
+        INT32_MAX, -1, INT32_MIN,
+    };
+    int kind, failures = 0;
+
+    for (kind = 0; kind < 4; kind++) {
+        cram_block_slice_hdr h = {0};
+        cram_slice s = {0};
+        cram_block *b = cram_new_block(EXTERNAL, 7);
+        cram_codec *c;
+        char id = 7;
+        int32_t *col = NULL;
+        int i, n = 0, nvals = 0;
+
+        if (!b)
+            return failures + 1;
+
+        // Long runs of small values mixed with the odd large one
+        for (i = 0; i < 10000; i++) {
+            int32_t v = kind == 0 ? rnd() % 100
+                : kind == 1 ? fixed[rnd() % (sizeof(fixed)/sizeof(*fixed))]
+                : rnd() % 50 ? rnd() % 128 : (int32_t)rnd();
+            if (kind == 3 && i == 9999)
+                break;
+            itf8_put_blk(b, v);
+            nvals++;
+        }
+        // A truncated final value must not be returned
+        if (kind == 3)
+            BLOCK_APPEND_CHAR(b, 0xe0);
+        b->uncomp_size = BLOCK_SIZE(b);
+        b->idx = 0;
+
+        h.num_blocks = 1;
+        s.hdr = &h;
+        s.block = &b;
+
+        c = cram_decoder_init(E_EXTERNAL, &id, 1, E_INT, 3);
+        if (!c) {
+            cram_free_block(b);
+            return failures + 1;
+        }
+
+        col = cram_external_decode_int_all(&s, c, &n);
+        if (!col || n != nvals || b->idx != b->uncomp_size - (kind == 3)) {
+            fprintf(stderr, "ITF8 column kind %d: got %d of %d values\n",
+                    kind, n, nvals);
+            failures++;
+        } else {
+            b->idx = 0;
+            for (i = 0; i < n; i++) {
+                int32_t v, one = 1;
+                if (c->decode(&s, c, NULL, (char *)&v, &one) != 0 ||
+                    v != col[i]) {
+                    fprintf(stderr, "ITF8 column kind %d: mismatch at %d\n",
+                            kind, i);
+                    failures++;
+                    break;
+                }
+            }
+        }
+
+        free(col);
+        c->free(c);
+        cram_free_block(b);
+    }
+
+    return failures;
+
+ block_err:
+    return failures + 1;
+}
+
+/*
+ * Known answer tests.  These streams were laid out by hand following the
+ * CRAM codec specification, not made with our encoders, so they check the
+ * decoders against the format rather than just against the encoders.
+ */
+
+#define KAT_X32 "abacbccdcadaabacbccdcadaabacbccdcadaabacbccdcada" \
+                "abacbccdcadaabacbccdca"
+#define KAT_O1 "abcabcabcabdabcabcabcaab"
+#define KAT_RUNS "aaaaaaaabbbbbbbbbbbbcdddddddddddddddddeeeeeeeeeeee" \
+                 "eeeeeeeef"
+
+// Order-0, 4 states: "abracadabra"
+static const unsigned char kat_rans_o0[] = {
+    0x00, 0x0b, 0x61, 0x62, 0x02, 0x72, 0x00, 0x8e, 0x48, 0x85, 0x68, 0x82,
+    0x74, 0x82, 0x74, 0x85, 0x68, 0x64, 0x40, 0x43, 0x00, 0x90, 0xc9, 0x21,
+    0x00, 0x4c, 0xad, 0x41, 0x00, 0xd0, 0x56, 0x02, 0x00,
+};
+
+// Order-0, 32 states (X32): KAT_X32
+static const unsigned char kat_rans_o0_x32[] = {
+    0x04, 0x46, 0x61, 0x62, 0x02, 0x00, 0x8a, 0x41, 0x85, 0x3e, 0x8a, 0x7e,
+    0x85, 0x03, 0x0e, 0xc5, 0x19, 0x00, 0xe5, 0xf7, 0x19, 0x00, 0xdd, 0xb2,
+    0x1c, 0x00, 0x91, 0x3c, 0x1c, 0x00, 0xe5, 0xf7, 0x19, 0x00, 0xf2, 0x98,
+    0x19, 0x00, 0x73, 0x69, 0x04, 0x00, 0x68, 0x6e, 0x09, 0x00, 0xaa, 0x79,
+    0x08, 0x00, 0xa6, 0x74, 0x04, 0x00, 0x68, 0x6e, 0x09, 0x00, 0x8c, 0xb1,
+    0x09, 0x00, 0xa6, 0x74, 0x04, 0x00, 0x41, 0xc7, 0x08, 0x00, 0x8c, 0xb1,
+    0x09, 0x00, 0x73, 0x69, 0x04, 0x00, 0x41, 0xc7, 0x08, 0x00, 0xaa, 0x79,
+    0x08, 0x00, 0x73, 0x69, 0x04, 0x00, 0x68, 0x6e, 0x09, 0x00, 0xaa, 0x79,
+    0x08, 0x00, 0xa6, 0x74, 0x04, 0x00, 0x68, 0x6e, 0x09, 0x00, 0x8c, 0xb1,
+    0x09, 0x00, 0xa6, 0x74, 0x04, 0x00, 0x41, 0xc7, 0x08, 0x00, 0x8c, 0xb1,
+    0x09, 0x00, 0x73, 0x69, 0x04, 0x00, 0x41, 0xc7, 0x08, 0x00, 0xaa, 0x79,
+    0x08, 0x00, 0x73, 0x69, 0x04, 0x00, 0x68, 0x6e, 0x09, 0x00,
+};
+
+// Order-1, 4 states, uncompressed 10-bit tables: KAT_O1
+static const unsigned char kat_rans_o1[] = {
+    0x01, 0x18, 0xa0, 0x00, 0x61, 0x62, 0x02, 0x00, 0x00, 0x00, 0x88, 0x00,
+    0x00, 0x02, 0x00, 0x00, 0x71, 0x87, 0x0f, 0x00, 0x01, 0x00, 0x02, 0x86,
+    0x6e, 0x81, 0x12, 0x00, 0x00, 0x88, 0x00, 0x00, 0x02, 0x00, 0x04, 0x4b,
+    0xdb, 0x00, 0x00, 0x93, 0x2d, 0x05, 0x00, 0x4b, 0xdb, 0x00, 0x00, 0x10,
+    0xa9, 0x06, 0x00,
+};
+
+// Order-1, 32 states: KAT_O1 three times
+static const unsigned char kat_rans_o1_x32[] = {
+    0x05, 0x48, 0xa0, 0x00, 0x61, 0x62, 0x02, 0x00, 0x00, 0x00, 0x83, 0x20,
+    0x82, 0x00, 0x82, 0x60, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x87, 0x44, 0x00,
+    0x01, 0x00, 0x02, 0x85, 0x4d, 0x82, 0x33, 0x00, 0x00, 0x88, 0x00, 0x00,
+    0x02, 0x00, 0x04, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x97,
+    0xd6, 0x02, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x4f,
+    0xae, 0x06, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x97,
+    0xd6, 0x02, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x18,
+    0x4d, 0x01, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x97,
+    0xd6, 0x02, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x4f,
+    0xae, 0x06, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x97,
+    0xd6, 0x02, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x18,
+    0x4d, 0x01, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x97,
+    0xd6, 0x02, 0x00, 0x18, 0x4d, 0x01, 0x00, 0xc0, 0x76, 0x01, 0x00, 0x4f,
+    0xae, 0x06, 0x00, 0x18, 0x4d, 0x01, 0x00, 0x38, 0xab, 0x3c, 0x00,
+};
+
+// CAT: "hello" stored raw
+static const unsigned char kat_rans_cat[] = {
+    0x20, 0x05, 0x68, 0x65, 0x6c, 0x6c, 0x6f,
+};
+
+// PACK (4 symbols, 4 per byte) then order-0
+static const unsigned char kat_rans_pack[] = {
+    0x80, 0x14, 0x04, 0x41, 0x43, 0x47, 0x54, 0x05, 0x1b, 0x50, 0xe4, 0xfa,
+    0x00, 0x86, 0x33, 0x86, 0x33, 0x8c, 0x67, 0x86, 0x33, 0x70, 0x19, 0x03,
+    0x00, 0x08, 0x80, 0x02, 0x00, 0x3b, 0x83, 0x02, 0x00, 0xd5, 0x8c, 0x02,
+    0x00,
+};
+
+// RLE with uncompressed meta data, then order-0: KAT_RUNS
+static const unsigned char kat_rans_rle[] = {
+    0x40, 0x3b, 0x13, 0x06, 0x04, 0x61, 0x62, 0x64, 0x65, 0x07, 0x0b, 0x10,
+    0x13, 0x61, 0x62, 0x04, 0x00, 0x85, 0x2e, 0x85, 0x2a, 0x85, 0x2a, 0x85,
+    0x2a, 0x85, 0x2a, 0x85, 0x2a, 0xb0, 0x21, 0x12, 0x00, 0x92, 0x53, 0x12,
+    0x00, 0x78, 0x05, 0x03, 0x00, 0x22, 0x08, 0x03, 0x00,
+};
+
+// PACK, RLE of the packed bytes 0x00 and 0x11, then CAT
+static const unsigned char kat_rans_pack_rle_cat[] = {
+    0xe0, 0x23, 0x04, 0x41, 0x43, 0x47, 0x54, 0x09, 0x0b, 0x07, 0x02, 0x00,
+    0x11, 0x01, 0x01, 0x00, 0x55, 0xa5, 0xaa, 0xea, 0x3f, 0x00,
+};
+
+// STRIPE, 4 order-0 sub-streams: 20 little endian 32-bit
+// values 1000, 1003, 1006, ...
+static const unsigned char kat_rans_stripe[] = {
+    0x08, 0x50, 0x04, 0x56, 0x19, 0x15, 0x15, 0x10, 0x00, 0x03, 0x06, 0x09,
+    0x0c, 0x0f, 0x12, 0x15, 0x18, 0x1b, 0x1e, 0x21, 0xe8, 0xeb, 0xee, 0xf1,
+    0xf4, 0xf7, 0xfa, 0xfd, 0x00, 0x81, 0x5c, 0x81, 0x4c, 0x81, 0x4c, 0x81,
+    0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81,
+    0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81,
+    0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x81, 0x4c, 0x50, 0x9a, 0x17,
+    0x00, 0xbb, 0xfa, 0x18, 0x00, 0x88, 0x0b, 0x19, 0x00, 0x56, 0x1c, 0x19,
+    0x00, 0x28, 0x50, 0xe4, 0xa0, 0xc0, 0xf1, 0x9c, 0x42, 0x10, 0x03, 0x04,
+    0x00, 0x00, 0x8c, 0x66, 0x93, 0x1a, 0x9a, 0xd3, 0x0e, 0x00, 0x9a, 0xd3,
+    0x0e, 0x00, 0x9a, 0xd3, 0x0e, 0x00, 0x9a, 0xd3, 0x0e, 0x00, 0x10, 0x00,
+    0x00, 0xa0, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+    0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x10, 0x00, 0x00, 0xa0, 0x00,
+    0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00,
+    0x00, 0x80, 0x00, 0x00,
+};
+
+// Order-0: "abracadabra"
+static const unsigned char kat_arith_o0[] = {
+    0x00, 0x0b, 0x73, 0x00, 0xd9, 0xe2, 0x74, 0x43, 0x14, 0xfb, 0x98, 0x56,
+    0xe4, 0xb3,
+};
+
+// Order-1: KAT_O1
+static const unsigned char kat_arith_o1[] = {
+    0x01, 0x18, 0x65, 0x00, 0xf8, 0x58, 0x78, 0x21, 0x0b, 0xb2, 0x82, 0x33,
+    0xf8, 0xb7, 0xa9, 0x71, 0x94,
+};
+
+// Order-0 with RLE: KAT_RUNS
+static const unsigned char kat_arith_rle[] = {
+    0x40, 0x3b, 0x67, 0x00, 0xf3, 0x7e, 0x6b, 0xcd, 0x32, 0xfb, 0x28, 0x98,
+    0x45, 0x8e, 0xa9, 0x6a, 0x00,
+};
+
+// CAT: "hello" stored raw
+static const unsigned char kat_arith_cat[] = {
+    0x20, 0x05, 0x68, 0x65, 0x6c, 0x6c, 0x6f,
+};
+
+// Order-0: 4500 bytes, 'b' every 7th and 'a' otherwise.  Long
+// enough for the model frequencies to be halved.
+static const unsigned char kat_arith_o0_long[] = {
+    0x00, 0xa3, 0x14, 0x63, 0x00, 0xff, 0xff, 0xe2, 0xd4, 0x5a, 0x9e, 0xcd,
+    0x31, 0x31, 0x88, 0xc0, 0x7a, 0x43, 0x9e, 0x81, 0xc5, 0xb8, 0x40, 0xb9,
+    0x2c, 0x1d, 0xa1, 0xef, 0xaa, 0xca, 0x76, 0xa3, 0x1d, 0x7c, 0xd7, 0xdd,
+    0xfa, 0x60, 0xaf, 0x6a, 0xc5, 0x0d, 0x29, 0x5a, 0x99, 0xcc, 0x93, 0x96,
+    0xc9, 0xd6, 0x17, 0xcb, 0xa5, 0x61, 0x92, 0x85, 0x92, 0x42, 0xd6, 0x40,
+    0x3b, 0x09, 0x28, 0x91, 0xbd, 0x65, 0x79, 0x02, 0xe3, 0xdf, 0xb4, 0x41,
+    0xda, 0x72, 0x40, 0xac, 0xbe, 0x9f, 0x64, 0xf6, 0x36, 0x30, 0x56, 0x80,
+    0xfa, 0x4e, 0xda, 0x53, 0x44, 0x84, 0xb3, 0x33, 0xd8, 0xb2, 0x1e, 0x24,
+    0xe1, 0xde, 0x7b, 0x45, 0xf1, 0x7c, 0xc2, 0xf5, 0x4e, 0xcf, 0x08, 0x9a,
+    0x3c, 0xfe, 0xb0, 0xbb, 0x1b, 0xb7, 0xdd, 0xb1, 0x33, 0xa8, 0xbf, 0x3c,
+    0xa3, 0xd6, 0x37, 0x05, 0x4b, 0x17, 0x92, 0x09, 0x61, 0x5c, 0x60, 0x5f,
+    0x77, 0x1f, 0x24, 0x5d, 0xfe, 0x61, 0xdc, 0xf2, 0x94, 0x53, 0xbe, 0x59,
+    0x3e, 0x78, 0xdd, 0xf9, 0x9c, 0x64, 0x53, 0xe8, 0x45, 0x9d, 0x11, 0xed,
+    0xed, 0xa0, 0x98, 0x58, 0x55, 0xc4, 0x40, 0xf3, 0x9b, 0x18, 0x70, 0xe2,
+    0x6e, 0xee, 0x1b, 0x42, 0x53, 0xd3, 0x16, 0xc3, 0xb4, 0xca, 0xae, 0x8c,
+    0x9e, 0x27, 0xb6, 0xe5, 0x14, 0x3e, 0x17, 0x06, 0xb8, 0x42, 0xe7, 0x75,
+    0x59, 0x63, 0xb3, 0x51, 0x7e, 0x98, 0x80, 0xf7, 0x37, 0x9f, 0x28, 0x88,
+    0xe7, 0x4e, 0xaf, 0x6d, 0xed, 0x63, 0xc7, 0x77, 0xf8, 0xaf, 0x83, 0x17,
+    0xd1, 0x6d, 0xfb, 0x09, 0xb3, 0xd4, 0xba, 0xae, 0x51, 0x6d, 0x8f, 0xb9,
+    0x15, 0x8e, 0x1a, 0x19, 0x6c, 0x56, 0x91, 0xc0, 0x09, 0x5b, 0x62, 0x35,
+    0xc7, 0xbb, 0x97, 0x9c, 0x1d, 0xa6, 0x0f, 0x6f, 0x52, 0xb8, 0x11, 0xa3,
+    0xbb, 0x49, 0x5a, 0x5f, 0x6e, 0xd4, 0xf5, 0x0f, 0xaf, 0x17, 0x69, 0x06,
+    0x0e, 0x33, 0x32, 0x17, 0xca, 0x59, 0x20, 0x6a, 0x91, 0x8c, 0x55, 0x5c,
+    0xb1, 0x49, 0x64, 0x9a, 0x03, 0xa7, 0x80, 0x93, 0xe9, 0x6e, 0xa1, 0x6a,
+    0x69, 0xef, 0x87, 0x79, 0xed, 0x69, 0x8a, 0x2e, 0xff, 0x04, 0xd2, 0x85,
+    0x7f, 0xff, 0x95, 0x36, 0xee, 0x1a, 0x05, 0xcd, 0x79, 0xce, 0x51, 0x38,
+    0xc8, 0x64, 0xa5, 0xa0, 0xfb, 0x05, 0x04, 0x53, 0x54, 0xea, 0x09, 0xbe,
+    0xca, 0xcd, 0x16, 0x4c, 0x4d, 0x5d, 0x4e, 0xbd, 0x93, 0x99, 0xcb, 0x44,
+    0x87, 0x61, 0xea, 0x5b, 0xdb, 0xcd, 0xcd, 0x69, 0xd4, 0x53, 0x2d, 0x1c,
+    0x12, 0xd1, 0x23,
+};
+
+// One parameter set with qmap, qtab, ptab, dtab, dedup and
+// fixed length records; the third record is a duplicate and
+// the second and third are reversed
+static const unsigned char kat_fqz_fixed[] = {
+    0x20, 0x05, 0x04, 0x00, 0x00, 0xf6, 0x04, 0x04, 0x00, 0x00, 0x23, 0x46,
+    0x47, 0x48, 0x49, 0x01, 0x01, 0xfe, 0xff, 0xff, 0x02, 0x04, 0xff, 0x01,
+    0x00, 0x07, 0xff, 0xff, 0xf8, 0x3e, 0x4e, 0x41, 0x57, 0x9a, 0xa6, 0x06,
+    0x71, 0xc8, 0x80, 0x5b,
+};
+
+// As above with variable lengths
+static const unsigned char kat_fqz_var[] = {
+    0x16, 0x05, 0x04, 0x00, 0x00, 0xf2, 0x01, 0x04, 0x00, 0x00, 0x35, 0x3a,
+    0x01, 0x01, 0xfe, 0xff, 0xff, 0x02, 0x04, 0xff, 0x01, 0x00, 0x06, 0xff,
+    0xff, 0xf9, 0x3b, 0xaf, 0x8b, 0x85, 0x27, 0xe6, 0xba, 0x04, 0x34, 0xc9,
+    0xc5, 0x43,
+};
+
+// IL:1:10, IL:1:11 and IL:1:11 with rANS Nx16 streams
+static const unsigned char kat_tok3_rans[] = {
+    0x18, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x80, 0x05, 0x20,
+    0x03, 0x06, 0x06, 0x05, 0x05, 0x1a, 0x00, 0x04, 0x00, 0x01, 0x00, 0x00,
+    0x98, 0x00, 0x88, 0x00, 0x00, 0x0c, 0x02, 0x00, 0x00, 0xa8, 0x00, 0x00,
+    0x00, 0xa8, 0x00, 0x00, 0x00, 0xa8, 0x00, 0x00, 0x06, 0x1a, 0x00, 0x08,
+    0x00, 0x01, 0x00, 0x00, 0x9c, 0x00, 0x84, 0x00, 0x00, 0xa2, 0x04, 0x00,
+    0x00, 0xa6, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00, 0x00, 0xa6, 0x00, 0x00,
+    0x80, 0x04, 0x20, 0x02, 0x01, 0x0a, 0x01, 0x05, 0x20, 0x03, 0x49, 0x4c,
+    0x00, 0x80, 0x04, 0x20, 0x02, 0x02, 0x0a, 0x02, 0x03, 0x20, 0x01, 0x3a,
+    0x80, 0x04, 0x20, 0x02, 0x07, 0x0a, 0x07, 0x1a, 0x00, 0x04, 0x00, 0x01,
+    0x00, 0x00, 0x98, 0x00, 0x88, 0x00, 0x00, 0x0c, 0x02, 0x00, 0x00, 0xa8,
+    0x00, 0x00, 0x00, 0xa8, 0x00, 0x00, 0x00, 0xa8, 0x00, 0x00, 0xc0, 0x02,
+    0x00, 0x42, 0x02, 0x02, 0x80, 0x04, 0x20, 0x02, 0x07, 0x08, 0x07, 0x19,
+    0x00, 0x04, 0x00, 0x0a, 0x00, 0x98, 0x00, 0x88, 0x00, 0x00, 0x0c, 0x02,
+    0x00, 0x00, 0xa8, 0x00, 0x00, 0x00, 0xa8, 0x00, 0x00, 0x00, 0xa8, 0x00,
+    0x00, 0x08, 0x03, 0x20, 0x01, 0x01, 0x80, 0x04, 0x20, 0x02, 0x0c, 0x0c,
+};
+
+// The same names with arithmetic coded streams
+static const unsigned char kat_tok3_arith[] = {
+    0x18, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x80, 0x05, 0x20,
+    0x03, 0x06, 0x06, 0x05, 0x05, 0x08, 0x00, 0x04, 0x02, 0x00, 0xfc, 0x71,
+    0xc7, 0x16, 0x06, 0x09, 0x00, 0x08, 0x02, 0x00, 0x71, 0x3e, 0x93, 0xc6,
+    0x00, 0x80, 0x04, 0x20, 0x02, 0x01, 0x0a, 0x01, 0x05, 0x20, 0x03, 0x49,
+    0x4c, 0x00, 0x80, 0x04, 0x20, 0x02, 0x02, 0x0a, 0x02, 0x03, 0x20, 0x01,
+    0x3a, 0x80, 0x04, 0x20, 0x02, 0x07, 0x0a, 0x07, 0x08, 0x00, 0x04, 0x02,
+    0x00, 0xfc, 0x71, 0xc7, 0x16, 0xc0, 0x02, 0x00, 0x42, 0x02, 0x02, 0x80,
+    0x04, 0x20, 0x02, 0x07, 0x08, 0x07, 0x09, 0x00, 0x04, 0x0b, 0x00, 0xe8,
+    0xba, 0x2e, 0x88, 0x00, 0x08, 0x03, 0x20, 0x01, 0x01, 0x80, 0x04, 0x20,
+    0x02, 0x0c, 0x0c,
+};
+
+enum kat_codec { KAT_RANS, KAT_ARITH, KAT_FQZ, KAT_TOK3 };
+
+static unsigned char *kat_decode(int codec, const unsigned char *in,
+                                 unsigned int in_size,
+                                 unsigned int *out_size) {
+    unsigned char *data = (unsigned char *)in, *out;
+    size_t len = 0;
+
+    switch (codec) {
+    case KAT_RANS:
+        return rans_uncompress_4x16(data, in_size, out_size);
+    case KAT_ARITH:
+        return arith_uncompress(data, in_size, out_size);
+    case KAT_TOK3:
+        return tok3_decode_names(data, in_size, out_size);
+    default:
+        out = fqz_decompress(data, in_size, &len);
+        *out_size = len;
+        return out;
+    }
+}
+
+#define KAT(codec, stream, expected, expected_len) \
+    { #stream, codec, stream, sizeof(stream), expected, expected_len }
+
+static int test_known_answers(void) {
+    static const char names[] = "IL:1:10\0IL:1:11\0IL:1:11";
+    static const char quals_fixed[] = "IIIIHHG#IIIHHGF#IIIHHGF##FGHHIII";
+    static const char quals_var[] = "::::::5::::55::::::::5";
+    unsigned char stripe[80], counts[4500];
+    unsigned int i;
+    int failures = 0;
+
+    for (i = 0; i < 20; i++) {
+        uint32_t v = 1000 + 3*i;
+        stripe[i*4]   = v;
+        stripe[i*4+1] = v >> 8;
+        stripe[i*4+2] = v >> 16;
+        stripe[i*4+3] = v >> 24;
+    }
+    for (i = 0; i < sizeof(counts); i++)
+        counts[i] = i % 7 ? 'a' : 'b';
+
+    {
+        const struct {
+            const char *name;
+            int codec;
+            const unsigned char *in;
+            unsigned int in_size;
+            const void *out;
+            unsigned int out_size;
+        } kat[] = {
+            KAT(KAT_RANS, kat_rans_o0, "abracadabra", 11),
+            KAT(KAT_RANS, kat_rans_o0_x32, KAT_X32, sizeof(KAT_X32) - 1),
+            KAT(KAT_RANS, kat_rans_o1, KAT_O1, sizeof(KAT_O1) - 1),
+            KAT(KAT_RANS, kat_rans_o1_x32, KAT_O1 KAT_O1 KAT_O1,
+                3 * (sizeof(KAT_O1) - 1)),
+            KAT(KAT_RANS, kat_rans_cat, "hello", 5),
+            KAT(KAT_RANS, kat_rans_pack, "ACGTTGCAAACCGGTTACGT", 20),
+            KAT(KAT_RANS, kat_rans_rle, KAT_RUNS, sizeof(KAT_RUNS) - 1),
+            KAT(KAT_RANS, kat_rans_pack_rle_cat,
+                "AAAAAAAACCCCCCGGGGGGGGGTTTTAAAAAAAA", 35),
+            KAT(KAT_RANS, kat_rans_stripe, stripe, sizeof(stripe)),
+            KAT(KAT_ARITH, kat_arith_o0, "abracadabra", 11),
+            KAT(KAT_ARITH, kat_arith_o1, KAT_O1, sizeof(KAT_O1) - 1),
+            KAT(KAT_ARITH, kat_arith_rle, KAT_RUNS, sizeof(KAT_RUNS) - 1),
+            KAT(KAT_ARITH, kat_arith_cat, "hello", 5),
+            KAT(KAT_ARITH, kat_arith_o0_long, counts, sizeof(counts)),
+            KAT(KAT_FQZ, kat_fqz_fixed, quals_fixed, sizeof(quals_fixed) - 1),
+            KAT(KAT_FQZ, kat_fqz_var, quals_var, sizeof(quals_var) - 1),
+            KAT(KAT_TOK3, kat_tok3_rans, names, sizeof(names)),
+            KAT(KAT_TOK3, kat_tok3_arith, names, sizeof(names)),
+        };
+
+        for (i = 0; i < sizeof(kat)/sizeof(*kat); i++) {
+            unsigned int len = 0;
+            unsigned char *out = kat_decode(kat[i].codec, kat[i].in,
+                                            kat[i].in_size, &len);
+            if (!out || len != kat[i].out_size
+                || memcmp(out, kat[i].out, len) != 0) {
+                fprintf(stderr, "Known answer test %s failed\n",
+                        kat[i].name);
+                failures++;
+            }
+            free(out);
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    int failures = 0;
+
+    failures += test_rans4x16();
+    failures += test_arith();
+    failures += test_tok3();
+    failures += test_fqzcomp();
+    failures += test_itf8_column();
+    failures += test_known_answers();
+
+    if (failures) {
+        fprintf(stderr, "%d test(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -36,16 +36,20 @@ DEALINGS IN THE SOFTWARE.  */
 #include <stdint.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "htslib/vcf.h"
 #include "htslib/bgzf.h"
 #include "htslib/tbx.h"
 #include "htslib/hfile.h"
 #include "hts_internal.h"
+#include "sam_internal.h"
 #include "htslib/hts_endian.h"
 #include "htslib/khash_str2int.h"
 #include "htslib/kstring.h"
 #include "htslib/sam.h"
+#include "htslib/thread_pool.h"
 
 #include "htslib/khash.h"
 KHASH_MAP_INIT_STR(vdict, bcf_idinfo_t)
@@ -1047,11 +1051,15 @@ bcf_hdr_t *bcf_hdr_init(const char *mode)
     return NULL;
 }
 
+static void vcf_state_release_hdr(const bcf_hdr_t *h);
+static int vcf_state_from_sam(htsFile *fp);
+
 void bcf_hdr_destroy(bcf_hdr_t *h)
 {
     int i;
     khint_t k;
     if (!h) return;
+    vcf_state_release_hdr(h);
     for (i = 0; i < 3; ++i) {
         vdict_t *d = (vdict_t*)h->dict[i];
         if (d == 0) continue;
@@ -1135,6 +1143,9 @@ int bcf_hdr_write(htsFile *hfp, bcf_hdr_t *h)
     }
     hfp->format.category = variant_data;
     if (hfp->format.format == vcf || hfp->format.format == text_format) {
+        if (hfp->format.format == text_format && hfp->state
+            && vcf_state_from_sam(hfp) < 0)
+            return -1;
         hfp->format.format = vcf;
         return vcf_hdr_write(hfp, h);
     }
@@ -1522,6 +1533,24 @@ int bcf_read(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
     return bcf_subset_format(h,v);
 }
 
+int bcf_read_batch(htsFile *fp, const bcf_hdr_t *h, bcf1_t **v, int n)
+{
+    int i, ret = 0;
+    if (fp->format.format == vcf) {
+        for (i = 0; i < n; i++)
+            if ((ret = vcf_read(fp, h, v[i])) != 0) break;
+    } else {
+        BGZF *bfp = fp->fp.bgzf;
+        for (i = 0; i < n; i++) {
+            ret = bcf_read1_core(bfp, v[i]);
+            if (ret == 0) ret = bcf_record_check(h, v[i]);
+            if (ret == 0 && h->keep_samples) ret = bcf_subset_format(h, v[i]);
+            if (ret != 0) break;
+        }
+    }
+    return ret < -1 ? ret : i;
+}
+
 int bcf_readrec(BGZF *fp, void *null, void *vv, int *tid, hts_pos_t *beg, hts_pos_t *end)
 {
     bcf1_t *v = (bcf1_t *) vv;
@@ -1819,6 +1848,14 @@ int bcf_write(htsFile *hfp, bcf_hdr_t *h, bcf1_t *v)
     return 0;
 }
 
+int bcf_write_batch(htsFile *hfp, bcf_hdr_t *h, bcf1_t **v, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (bcf_write(hfp, h, v[i]) != 0) return -1;
+    return 0;
+}
+
 /**********************
  *** VCF header I/O ***
  **********************/
@@ -2236,7 +2273,13 @@ static inline int align_mem(kstring_t *s)
 
 // p,q is the start and the end of the FORMAT field
 #define MAX_N_FMT 255   /* Limited by size of bcf1_t n_fmt field */
-static int vcf_parse_format(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q)
+// Returned by the vcf_parse_* functions when called with add_hdr == 0 and
+// the record uses a contig or tag that is missing from the header.  The
+// caller is expected to retry with add_hdr set, which is not thread safe.
+#define VCF_PARSE_NEED_HDR -3
+
+static int vcf_parse_format(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q,
+                            kstring_t *mem, int add_hdr)
 {
     if ( !bcf_hdr_nsamples(h) ) return 0;
 
@@ -2246,7 +2289,6 @@ static int vcf_parse_format(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v, char *p
     khint_t k;
     ks_tokaux_t aux1;
     vdict_t *d = (vdict_t*)h->dict[BCF_DT_ID];
-    kstring_t *mem = (kstring_t*)&h->mem;
     fmt_aux_t fmt[MAX_N_FMT];
     mem->l = 0;
 
@@ -2283,6 +2325,7 @@ static int vcf_parse_format(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v, char *p
                 v->errcode |= BCF_ERR_TAG_INVALID;
                 return -1;
             }
+            if (!add_hdr) return VCF_PARSE_NEED_HDR;
             hts_log_warning("FORMAT '%s' at %s:%"PRIhts_pos" is not defined in the header, assuming Type=String", t, bcf_seqname_safe(h,v), v->pos+1);
             kstring_t tmp = {0,0,0};
             int l;
@@ -2628,7 +2671,7 @@ static khint_t fix_chromosome(const bcf_hdr_t *h, vdict_t *d, const char *p) {
     return k;
 }
 
-static int vcf_parse_filter(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q) {
+static int vcf_parse_filter(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q, int add_hdr) {
     int i, n_flt = 1, max_n_flt = 0;
     char *r, *t;
     int32_t *a_flt = NULL;
@@ -2654,6 +2697,10 @@ static int vcf_parse_filter(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char
         k = kh_get(vdict, d, t);
         if (k == kh_end(d))
         {
+            if (!add_hdr) {
+                free(a_flt);
+                return VCF_PARSE_NEED_HDR;
+            }
             // Simple error recovery for FILTERs not defined in the header. It will not help when VCF header has
             // been already printed, but will enable tools like vcfcheck to proceed.
             hts_log_warning("FILTER '%s' is not defined in the header", t);
@@ -2683,7 +2730,7 @@ static int vcf_parse_filter(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char
     return 0;
 }
 
-static int vcf_parse_info(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q) {
+static int vcf_parse_info(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p, char *q, int add_hdr) {
     static int extreme_int_warned = 0, negative_rlen_warned = 0;
     int max_n_val = 0, overflow = 0;
     char *r, *key;
@@ -2714,6 +2761,10 @@ static int vcf_parse_info(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p
         k = kh_get(vdict, d, key);
         if (k == kh_end(d) || kh_val(d, k).info[BCF_HL_INFO] == 15)
         {
+            if (!add_hdr) {
+                free(a_val);
+                return VCF_PARSE_NEED_HDR;
+            }
             hts_log_warning("INFO '%s' is not defined in the header, assuming Type=String", key);
             kstring_t tmp = {0,0,0};
             int l;
@@ -2848,7 +2899,12 @@ static int vcf_parse_info(kstring_t *str, const bcf_hdr_t *h, bcf1_t *v, char *p
     return 0;
 }
 
-int vcf_parse(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
+// Parses one VCF line.  Scratch space for the FORMAT columns comes from mem.
+// If add_hdr is zero the header is treated as read-only, so this can be run
+// from several threads at once; VCF_PARSE_NEED_HDR is returned if the
+// record needs a dummy header line added.
+static int vcf_parse_line(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v,
+                          kstring_t *mem, int add_hdr)
 {
     int i = 0, ret = -2, overflow = 0;
     char *p, *q, *r, *t;
@@ -2873,6 +2929,7 @@ int vcf_parse(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
             k = kh_get(vdict, d, p);
             if (k == kh_end(d))
             {
+                if (!add_hdr) return VCF_PARSE_NEED_HDR;
                 hts_log_warning("Contig '%s' is not defined in the header. (Quick workaround: index the file with tabix.)", p);
                 v->errcode = BCF_ERR_CTG_UNDEF;
                 if ((k = fix_chromosome(h, d, p)) == kh_end(d)) {
@@ -2922,16 +2979,25 @@ int vcf_parse(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
             if ( v->max_unpack && !(v->max_unpack>>1) ) goto end; // BCF_UN_STR
         } else if (i == 6) { // FILTER
             if (strcmp(p, ".")) {
-                if (vcf_parse_filter(str, h, v, p, q)) goto err;
+                int res = vcf_parse_filter(str, h, v, p, q, add_hdr);
+                if (res) {
+                    if (res == VCF_PARSE_NEED_HDR) ret = res;
+                    goto err;
+                }
             } else bcf_enc_vint(str, 0, 0, -1);
             if ( v->max_unpack && !(v->max_unpack>>2) ) goto end; // BCF_UN_FLT
         } else if (i == 7) { // INFO
             if (strcmp(p, ".")) {
-                if (vcf_parse_info(str, h, v, p, q)) goto err;
+                int res = vcf_parse_info(str, h, v, p, q, add_hdr);
+                if (res) {
+                    if (res == VCF_PARSE_NEED_HDR) ret = res;
+                    goto err;
+                }
             }
             if ( v->max_unpack && !(v->max_unpack>>3) ) goto end;
         } else if (i == 8) {// FORMAT
-            return vcf_parse_format(s, h, v, p, q) == 0 ? 0 : -2;
+            ret = vcf_parse_format(s, h, v, p, q, mem, add_hdr);
+            return ret == 0 || ret == VCF_PARSE_NEED_HDR ? ret : -2;
         }
     }
 
@@ -2942,6 +3008,11 @@ int vcf_parse(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
     return ret;
 }
 
+int vcf_parse(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
+{
+    return vcf_parse_line(s, h, v, (kstring_t*)&h->mem, 1);
+}
+
 int vcf_open_mode(char *mode, const char *fn, const char *format)
 {
     if (format == NULL) {
@@ -2958,9 +3029,964 @@ int vcf_open_mode(char *mode, const char *fn, const char *format)
     return 0;
 }
 
+/*
+ * -----------------------------------------------------------------------------
+ * VCF threading
+ */
+// Size of VCF text block (reading)
+#define VCF_NM 240000
+// Number of bcf1_t records (writing)
+#define VCF_NB 1000
+
+struct VCF_state;
+
+// Input job - a block of VCF text
+typedef struct vp_lines {
+    struct vp_lines *next;
+
+    char *data;
+    int data_size;
+    int alloc;
+    int pos;            // start of the first line not yet parsed
+
+    kstring_t line;     // copy of the line being parsed
+    kstring_t mem;      // FORMAT scratch space, as bcf_hdr_t::mem
+
+    struct VCF_state *fd;
+    struct vp_recs *recs; // records kept for indexing when writing
+} vp_lines;
+
+// Output job - a block of parsed records
+typedef struct vp_recs {
+    struct vp_recs *next;
+
+    bcf1_t *recs;
+    int nrecs, arecs;   // used and alloc
+    int last_ret;       // vcf_parse return value for recs[nrecs-1]
+
+    // Lines the worker could not parse, to be finished off serially by
+    // vcf_read.  This happens when they need dummy header lines adding.
+    vp_lines *rest;
+
+    struct VCF_state *fd;
+} vp_recs;
+
+enum vcf_cmd {
+    VCF_NONE = 0,
+    VCF_CLOSE,
+    VCF_CLOSE_DONE,
+    VCF_PAUSE,
+    VCF_PAUSE_DONE,
+};
+
+typedef struct VCF_state {
+    const bcf_hdr_t *h;
+    int max_unpack;
+
+    hts_tpool *p;
+    int own_pool;
+    pthread_mutex_t lines_m;
+    hts_tpool_process *q;
+    int qsize;
+    pthread_t dispatcher;
+    int dispatching;
+
+    vp_lines *lines;    // free lists
+    vp_recs *recs;
+
+    vp_recs *curr_recs;
+    int curr_idx;
+    int eof;
+    int paused;         // dispatcher stopped by vcf_state_pause
+    int discard;        // file moved while paused, so drop the read-ahead
+    int64_t pause_off;  // file offset when paused
+    int read_eof;       // dispatcher has queued the EOF job
+
+    // Partial line left over from the last block read by the dispatcher
+    kstring_t frag;
+    int frag_len;
+
+    // Held for reading by the workers and for writing when vcf_read has
+    // to parse a line that adds to the header.
+    pthread_rwlock_t hdr_lock;
+
+    pthread_mutex_t command_m;
+    pthread_cond_t command_c;
+    enum vcf_cmd command;
+
+    // One of the E* errno codes
+    int errcode;
+
+    htsFile *fp;
+    struct VCF_state *next_active;
+} VCF_state;
+
+// Readers with running workers, so bcf_hdr_destroy() can stop any that are
+// still using the header.  Callers often destroy it before hts_close().
+static pthread_mutex_t vcf_active_m = PTHREAD_MUTEX_INITIALIZER;
+static VCF_state *vcf_active = NULL;
+
+static void vcf_state_err(VCF_state *fd, int errcode) {
+    pthread_mutex_lock(&fd->command_m);
+    if (!fd->errcode)
+        fd->errcode = errcode;
+    pthread_mutex_unlock(&fd->command_m);
+}
+
+static void vcf_free_vp_recs(vp_recs *r);
+
+static void vcf_free_vp_lines(vp_lines *l) {
+    if (!l)
+        return;
+    vcf_free_vp_recs(l->recs);
+    free(l->data);
+    free(l->line.s);
+    free(l->mem.s);
+    free(l);
+}
+
+static void vcf_free_vp_recs(vp_recs *r) {
+    if (!r)
+        return;
+    int i;
+    for (i = 0; i < r->arecs; i++)
+        bcf_empty(&r->recs[i]);
+    free(r->recs);
+    vcf_free_vp_lines(r->rest);
+    free(r);
+}
+
+// Cleanup function - job for vcf_parse_worker; result for vcf_format_worker
+static void cleanup_vp_lines(void *arg) {
+    vcf_free_vp_lines((vp_lines *)arg);
+}
+
+// Cleanup function - result for vcf_parse_worker; job for vcf_format_worker
+static void cleanup_vp_recs(void *arg) {
+    vcf_free_vp_recs((vp_recs *)arg);
+}
+
+// Run from one of the worker threads.
+// Parses a block of VCF lines into an array of bcf1_t records.  Lines are
+// parsed with the header held read-only; if one needs the header amending
+// the worker stops there and hands the remainder back to vcf_read.
+static void *vcf_parse_worker(void *arg) {
+    vp_lines *gl = (vp_lines *)arg;
+    VCF_state *fd = gl->fd;
+    vp_recs *gr = NULL;
+
+    // Use a block of records we had earlier if available.
+    pthread_mutex_lock(&fd->lines_m);
+    if (fd->recs) {
+        gr = fd->recs;
+        fd->recs = gr->next;
+    }
+    pthread_mutex_unlock(&fd->lines_m);
+
+    if (!gr) {
+        gr = calloc(1, sizeof(*gr));
+        if (!gr)
+            goto err;
+        gr->fd = fd;
+        gr->arecs = 100;
+        gr->recs = calloc(gr->arecs, sizeof(bcf1_t));
+        if (!gr->recs)
+            goto err;
+    }
+    gr->next = NULL;
+    gr->nrecs = 0;
+    gr->last_ret = 0;
+    gr->rest = NULL;
+
+    pthread_rwlock_rdlock(&fd->hdr_lock);
+    char *cp = gl->data, *cp_end = gl->data + gl->data_size;
+    while (cp < cp_end) {
+        if (gr->nrecs >= gr->arecs) {
+            bcf1_t *r = realloc(gr->recs, 2 * gr->arecs * sizeof(bcf1_t));
+            if (!r) {
+                pthread_rwlock_unlock(&fd->hdr_lock);
+                goto err;
+            }
+            memset(&r[gr->arecs], 0, gr->arecs * sizeof(bcf1_t));
+            gr->recs = r;
+            gr->arecs *= 2;
+        }
+
+        // vcf_parse modifies the line, so work on a copy in case it has
+        // to be parsed again by vcf_read.
+        char *nl = memchr(cp, '\n', cp_end - cp);
+        if (!nl) nl = cp_end;
+        size_t len = nl - cp;
+        if (len && cp[len-1] == '\r') len--;
+        gl->line.l = 0;
+        if (kputsn(cp, len, &gl->line) < 0) {
+            pthread_rwlock_unlock(&fd->hdr_lock);
+            goto err;
+        }
+
+        bcf1_t *v = &gr->recs[gr->nrecs];
+        v->max_unpack = fd->max_unpack;
+        int ret = vcf_parse_line(&gl->line, fd->h, v, &gl->mem, 0);
+        if (ret == VCF_PARSE_NEED_HDR) {
+            gl->pos = cp - gl->data;
+            gr->rest = gl;
+            break;
+        }
+        gr->nrecs++;
+        cp = nl < cp_end ? nl + 1 : cp_end;
+        if (ret < 0) {
+            // Return the failed record, then let vcf_read carry on
+            gr->last_ret = ret;
+            if (cp < cp_end) {
+                gl->pos = cp - gl->data;
+                gr->rest = gl;
+            }
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&fd->hdr_lock);
+
+    if (!gr->rest) {
+        pthread_mutex_lock(&fd->lines_m);
+        gl->next = fd->lines;
+        fd->lines = gl;
+        pthread_mutex_unlock(&fd->lines_m);
+    }
+    return gr;
+
+ err:
+    vcf_state_err(fd, ENOMEM);
+    vcf_free_vp_recs(gr);
+    vcf_free_vp_lines(gl);
+    return NULL;
+}
+
+static void *vcf_parse_eof(void *arg) {
+    return NULL;
+}
+
+// Runs in its own thread.
+// Reads a block of VCF text and sends a new job to the thread queue to
+// parse it.
+static void *vcf_dispatcher_read(void *vp) {
+    htsFile *fp = vp;
+    VCF_state *fd = fp->state;
+    vp_lines *l = NULL;
+
+    while (!fd->read_eof) {
+        // Check for command
+        pthread_mutex_lock(&fd->command_m);
+        if (fd->command == VCF_CLOSE) {
+            pthread_cond_signal(&fd->command_c);
+            pthread_mutex_unlock(&fd->command_m);
+            hts_tpool_process_shutdown(fd->q);
+            goto tidyup;
+        }
+        if (fd->command == VCF_PAUSE) {
+            // Leave the queue and fd->frag for vcf_state_start to resume
+            pthread_mutex_unlock(&fd->command_m);
+            goto tidyup;
+        }
+        pthread_mutex_unlock(&fd->command_m);
+
+        pthread_mutex_lock(&fd->lines_m);
+        if (fd->lines) {
+            l = fd->lines;
+            fd->lines = l->next;
+        }
+        pthread_mutex_unlock(&fd->lines_m);
+
+        if (!l) {
+            l = calloc(1, sizeof(*l));
+            if (!l)
+                goto err;
+            l->fd = fd;
+        }
+        l->next = NULL;
+        l->pos = 0;
+
+        int line_frag = fd->frag_len;
+        if (l->alloc < line_frag + VCF_NM) {
+            char *rp = realloc(l->data, line_frag + VCF_NM);
+            if (!rp)
+                goto err;
+            l->alloc = line_frag + VCF_NM;
+            l->data = rp;
+        }
+        if (line_frag)
+            memcpy(l->data, fd->frag.s, line_frag);
+        l->data_size = line_frag;
+        fd->frag_len = 0;
+
+        // Fill the block, then trim it back to the last newline.  The
+        // trailing fragment is carried over to the next block.
+        for (;;) {
+            ssize_t nbytes;
+            if (fp->is_bgzf)
+                nbytes = bgzf_read(fp->fp.bgzf, l->data + l->data_size,
+                                   l->alloc - l->data_size);
+            else
+                nbytes = hread(fp->fp.hfile, l->data + l->data_size,
+                               l->alloc - l->data_size);
+            if (nbytes < 0) {
+                vcf_state_err(fd, errno ? errno : EIO);
+                goto err;
+            }
+            l->data_size += nbytes;
+            if (l->data_size < l->alloc)
+                break; // EOF
+
+            char *cp = l->data + l->data_size;
+            while (cp > l->data && cp[-1] != '\n')
+                cp--;
+            if (cp > l->data) {
+                line_frag = l->data + l->data_size - cp;
+                if (ks_resize(&fd->frag, line_frag) < 0)
+                    goto err;
+                memcpy(fd->frag.s, cp, line_frag);
+                fd->frag_len = line_frag;
+                l->data_size -= line_frag;
+                break;
+            }
+
+            // Entire buffer is part of a single line
+            char *rp = realloc(l->data, l->alloc * 2);
+            if (!rp)
+                goto err;
+            l->alloc *= 2;
+            l->data = rp;
+        }
+
+        if (l->data_size == 0) {
+            if (hts_tpool_dispatch(fd->p, fd->q, vcf_parse_eof, NULL) < 0)
+                goto err;
+            fd->read_eof = 1;
+            break;
+        }
+
+        if (hts_tpool_dispatch3(fd->p, fd->q, vcf_parse_worker, l,
+                                cleanup_vp_lines, cleanup_vp_recs, 0) < 0)
+            goto err;
+        l = NULL;  // Now "owned" by vcf_parse_worker()
+    }
+
+    // At EOF, wait for close or pause request.
+    pthread_mutex_lock(&fd->command_m);
+    while (fd->command == VCF_NONE)
+        pthread_cond_wait(&fd->command_c, &fd->command_m);
+    if (fd->command == VCF_PAUSE) {
+        pthread_mutex_unlock(&fd->command_m);
+        goto tidyup;
+    }
+    pthread_cond_signal(&fd->command_c);
+    pthread_mutex_unlock(&fd->command_m);
+    hts_tpool_process_shutdown(fd->q);
+
+ tidyup:
+    pthread_mutex_lock(&fd->command_m);
+    fd->command = fd->command == VCF_PAUSE ? VCF_PAUSE_DONE : VCF_CLOSE_DONE;
+    pthread_cond_signal(&fd->command_c);
+    pthread_mutex_unlock(&fd->command_m);
+
+    if (l) {
+        pthread_mutex_lock(&fd->lines_m);
+        l->next = fd->lines;
+        fd->lines = l;
+        pthread_mutex_unlock(&fd->lines_m);
+    }
+
+    return NULL;
+
+ err:
+    vcf_state_err(fd, errno ? errno : ENOMEM);
+    hts_tpool_process_shutdown(fd->q);
+    goto tidyup;
+}
+
+// Run from one of the worker threads.
+// Formats a block of records (vp_recs) into a block of VCF text (vp_lines).
+static void *vcf_format_worker(void *arg) {
+    vp_recs *gr = (vp_recs *)arg;
+    VCF_state *fd = gr->fd;
+    vp_lines *gl = NULL;
+    int i;
+
+    // Use a block of VCF text we had earlier if available.
+    pthread_mutex_lock(&fd->lines_m);
+    if (fd->lines) {
+        gl = fd->lines;
+        fd->lines = gl->next;
+    }
+    pthread_mutex_unlock(&fd->lines_m);
+
+    if (!gl) {
+        gl = calloc(1, sizeof(*gl));
+        if (!gl) {
+            vcf_state_err(fd, ENOMEM);
+            vcf_free_vp_recs(gr);
+            return NULL;
+        }
+        gl->fd = fd;
+    }
+    gl->next = NULL;
+
+    kstring_t ks = {0, gl->alloc, gl->data};
+    for (i = 0; i < gr->nrecs; i++) {
+        if (vcf_format(fd->h, &gr->recs[i], &ks) < 0) {
+            gl->data = ks.s;
+            vcf_state_err(fd, errno ? errno : EIO);
+            vcf_free_vp_lines(gl);
+            vcf_free_vp_recs(gr);
+            return NULL;
+        }
+    }
+    gl->data = ks.s;
+    gl->data_size = ks.l;
+    gl->alloc = ks.m;
+
+    if (fd->fp->idx) {
+        // vcf_dispatcher_write needs the records to build the index
+        gl->recs = gr;
+    } else {
+        pthread_mutex_lock(&fd->lines_m);
+        gr->next = fd->recs;
+        fd->recs = gr;
+        pthread_mutex_unlock(&fd->lines_m);
+    }
+
+    return gl;
+}
+
+// Runs in its own thread.
+// Takes formatted blocks of VCF off the thread results queue and writes
+// them to our output stream, indexing as it goes.
+static void *vcf_dispatcher_write(void *vp) {
+    htsFile *fp = vp;
+    VCF_state *fd = fp->state;
+    hts_tpool_result *r;
+    vp_lines *gl = NULL;
+
+    // Iterates until result queue is shutdown, where it returns NULL.
+    while ((r = hts_tpool_next_result_wait(fd->q))) {
+        gl = (vp_lines *)hts_tpool_result_data(r);
+        hts_tpool_delete_result(r, 0);
+        if (!gl)
+            goto err;
+
+        if (fp->idx) {
+            vp_recs *gr = gl->recs;
+            int i = 0, count = 0;
+            while (i < gl->data_size && count < gr->nrecs) {
+                int j = i;
+                while (i < gl->data_size && gl->data[i] != '\n')
+                    i++;
+                if (i < gl->data_size)
+                    i++;
+
+                if (bgzf_write(fp->fp.bgzf, &gl->data[j], i-j) != i-j)
+                    goto err;
+
+                bcf1_t *v = &gr->recs[count++];
+                int tid = hts_idx_tbi_name(fp->idx, v->rid,
+                                           bcf_seqname_safe(fd->h, v));
+                if (tid < 0
+                    || bgzf_idx_push(fp->fp.bgzf, fp->idx, tid, v->pos,
+                                     v->pos + v->rlen,
+                                     bgzf_tell(fp->fp.bgzf), 1) < 0) {
+                    hts_log_error("Record at %s:%"PRIhts_pos" cannot be indexed",
+                                  bcf_seqname_safe(fd->h, v), v->pos+1);
+                    goto err;
+                }
+            }
+            if (i < gl->data_size || count != gr->nrecs) {
+                hts_log_error("Formatted VCF text does not match the %d "
+                              "records in the block", gr->nrecs);
+                errno = EINVAL;
+                goto err;
+            }
+
+            // Add record array to free-list
+            pthread_mutex_lock(&fd->lines_m);
+            gr->next = fd->recs;
+            fd->recs = gr;
+            gl->recs = NULL;
+            pthread_mutex_unlock(&fd->lines_m);
+        } else {
+            if (fp->is_bgzf) {
+                if (bgzf_write(fp->fp.bgzf, gl->data, gl->data_size) != gl->data_size)
+                    goto err;
+            } else {
+                if (hwrite(fp->fp.hfile, gl->data, gl->data_size) != gl->data_size)
+                    goto err;
+            }
+        }
+
+        pthread_mutex_lock(&fd->lines_m);
+        gl->next = fd->lines;
+        fd->lines = gl;
+        pthread_mutex_unlock(&fd->lines_m);
+        gl = NULL;
+    }
+
+    hts_tpool_process_shutdown(fd->q);
+    return NULL;
+
+ err:
+    vcf_state_err(fd, errno ? errno : EIO);
+    vcf_free_vp_lines(gl);
+    hts_tpool_process_shutdown(fd->q);
+    return (void *)-1;
+}
+
+// Dispatches any partially filled block of output records and waits until
+// everything queued so far has been written.
+static int vcf_state_flush(VCF_state *fd) {
+    vp_recs *gr = fd->curr_recs;
+    if (gr && gr->nrecs > 0) {
+        fd->curr_recs = NULL;
+        if (hts_tpool_dispatch3(fd->p, fd->q, vcf_format_worker, gr,
+                                cleanup_vp_recs, cleanup_vp_lines, 0) < 0) {
+            vcf_free_vp_recs(gr);
+            vcf_state_err(fd, EIO);
+        }
+    }
+
+    hts_tpool_process_flush(fd->q);
+    for (;;) {
+        pthread_mutex_lock(&fd->command_m);
+        int err = fd->errcode;
+        pthread_mutex_unlock(&fd->command_m);
+        if (err)
+            return -err;
+        if (hts_tpool_process_empty(fd->q))
+            return 0;
+        // not empty but shutdown implies error
+        if (hts_tpool_process_is_shutdown(fd->q))
+            return -EIO;
+        usleep(10000);
+    }
+}
+
+// Flushes any threaded writers formatting records with header h, so that
+// it can be modified without their workers reading it.
+static void vcf_flush_writers(const bcf_hdr_t *h) {
+    VCF_state *fd;
+    pthread_mutex_lock(&vcf_active_m);
+    for (fd = vcf_active; fd; fd = fd->next_active) {
+        if (fd->h == h && fd->fp->is_write)
+            vcf_state_flush(fd);
+    }
+    pthread_mutex_unlock(&vcf_active_m);
+}
+
+// Stops the dispatcher and waits for any running workers to finish.
+// Output is flushed first.  Must be called with vcf_active_m held.
+static int vcf_state_stop(VCF_state *fd) {
+    if (!fd->dispatching)
+        return 0;
+
+    VCF_state **pp;
+    for (pp = &vcf_active; *pp; pp = &(*pp)->next_active) {
+        if (*pp == fd) {
+            *pp = fd->next_active;
+            break;
+        }
+    }
+
+    if (fd->fp->is_write) {
+        vcf_state_flush(fd);
+        hts_tpool_process_shutdown(fd->q);
+        pthread_join(fd->dispatcher, NULL);
+    } else if (!fd->paused) {
+        pthread_mutex_lock(&fd->command_m);
+        if (fd->command != VCF_CLOSE_DONE)
+            fd->command = VCF_CLOSE;
+        pthread_cond_signal(&fd->command_c);
+        for (;;) {
+            // Avoid deadlocks with dispatcher
+            if (fd->command == VCF_CLOSE_DONE)
+                break;
+            hts_tpool_wake_dispatch(fd->q);
+            pthread_mutex_unlock(&fd->command_m);
+            usleep(10000);
+            pthread_mutex_lock(&fd->command_m);
+        }
+        pthread_mutex_unlock(&fd->command_m);
+        pthread_join(fd->dispatcher, NULL);
+    }
+
+    hts_tpool_process_destroy(fd->q);
+    fd->q = NULL;
+    fd->dispatching = 0;
+
+    return -fd->errcode;
+}
+
+// Called from bcf_hdr_destroy()
+static void vcf_state_release_hdr(const bcf_hdr_t *h) {
+    pthread_mutex_lock(&vcf_active_m);
+    VCF_state *fd = vcf_active;
+    while (fd) {
+        VCF_state *next = fd->next_active;
+        if (fd->h == h)
+            vcf_state_stop(fd);
+        fd = next;
+    }
+    pthread_mutex_unlock(&vcf_active_m);
+}
+
+// Destroys the state produced by vcf_set_thread_pool.
+int vcf_state_destroy(htsFile *fp) {
+    VCF_state *fd = fp->state;
+    int ret = 0;
+
+    if (!fd)
+        return 0;
+
+    pthread_mutex_lock(&vcf_active_m);
+    vcf_state_stop(fd);
+    pthread_mutex_unlock(&vcf_active_m);
+    ret = -fd->errcode;
+
+    if (fd->q)
+        hts_tpool_process_destroy(fd->q);
+    if (fd->own_pool)
+        hts_tpool_destroy(fd->p);
+
+    pthread_mutex_destroy(&fd->lines_m);
+    pthread_mutex_destroy(&fd->command_m);
+    pthread_cond_destroy(&fd->command_c);
+    pthread_rwlock_destroy(&fd->hdr_lock);
+
+    while (fd->lines) {
+        vp_lines *n = fd->lines->next;
+        vcf_free_vp_lines(fd->lines);
+        fd->lines = n;
+    }
+    while (fd->recs) {
+        vp_recs *n = fd->recs->next;
+        vcf_free_vp_recs(fd->recs);
+        fd->recs = n;
+    }
+    vcf_free_vp_recs(fd->curr_recs);
+    free(fd->frag.s);
+
+    free(fd);
+    fp->state = NULL;
+    return ret;
+}
+
+static int vcf_state_create(htsFile *fp, htsThreadPool *p) {
+    VCF_state *fd = calloc(1, sizeof(*fd));
+    if (!fd)
+        return -1;
+    fp->state = fd;
+    fd->fp = fp;
+
+    pthread_mutex_init(&fd->lines_m, NULL);
+    pthread_mutex_init(&fd->command_m, NULL);
+    pthread_cond_init(&fd->command_c, NULL);
+    pthread_rwlock_init(&fd->hdr_lock, NULL);
+    fd->p = p->pool;
+    fd->qsize = p->qsize;
+    if (!fd->qsize)
+        fd->qsize = 2*hts_tpool_size(fd->p);
+    fd->q = hts_tpool_process_init(fd->p, fd->qsize, 0);
+    if (!fd->q) {
+        vcf_state_destroy(fp);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Takes ownership of the pool.  BGZF shares the pool and is closed after
+// us, so when it is attached there it must be the one to destroy it.
+static void vcf_state_own_pool(htsFile *fp) {
+    VCF_state *fd = (VCF_state *)fp->state;
+    if (!hts_bgzf_threaded(fp) || bgzf_thread_pool_adopt(fp->fp.bgzf) < 0)
+        fd->own_pool = 1;
+}
+
+// Outputs opened in text mode are given a SAM_state by hts_set_thread_pool
+// as their format is not known until a header is written.  Swap it for a
+// VCF_state using the same pool.
+static int vcf_state_from_sam(htsFile *fp) {
+    htsThreadPool p;
+    int own = sam_state_take_pool(fp, &p);
+    if (own < 0)
+        return -1;
+
+    if (vcf_state_create(fp, &p) < 0) {
+        if (own)
+            hts_tpool_destroy(p.pool);
+        return -1;
+    }
+    if (own)
+        vcf_state_own_pool(fp);
+
+    return 0;
+}
+
+int vcf_set_thread_pool(htsFile *fp, htsThreadPool *p) {
+    if (fp->state)
+        return 0;
+
+    if (vcf_state_create(fp, p) < 0)
+        return -1;
+
+    if (hts_bgzf_threaded(fp))
+        return bgzf_thread_pool(fp->fp.bgzf, p->pool, p->qsize);
+
+    return 0;
+}
+
+int vcf_set_threads(htsFile *fp, int nthreads) {
+    if (nthreads <= 0)
+        return 0;
+
+    htsThreadPool p;
+    p.pool = hts_tpool_init(nthreads);
+    if (!p.pool)
+        return -1;
+    p.qsize = nthreads*2;
+
+    int ret = vcf_set_thread_pool(fp, &p);
+    if (ret < 0) {
+        if (fp->state)
+            ((VCF_state *)fp->state)->own_pool = 1;
+        else
+            hts_tpool_destroy(p.pool);
+        return ret;
+    }
+
+    vcf_state_own_pool(fp);
+    return 0;
+}
+
+// Parses the next line left over by vcf_parse_worker.  The header may be
+// modified, so the workers and any writers using it are held off while
+// this runs.
+static int vcf_parse_rest(VCF_state *fd, vp_lines *gl, bcf1_t *v) {
+    char *cp = gl->data + gl->pos, *cp_end = gl->data + gl->data_size;
+    char *nl = memchr(cp, '\n', cp_end - cp);
+    if (!nl) nl = cp_end;
+    gl->pos = nl < cp_end ? nl + 1 - gl->data : gl->data_size;
+
+    gl->line.l = 0;
+    if (kputsn(cp, nl - cp > 0 && nl[-1] == '\r' ? nl - cp - 1 : nl - cp,
+               &gl->line) < 0)
+        return -2;
+
+    vcf_flush_writers(fd->h);
+    pthread_rwlock_wrlock(&fd->hdr_lock);
+    int ret = vcf_parse_line(&gl->line, fd->h, v, (kstring_t *)&fd->h->mem, 1);
+    pthread_rwlock_unlock(&fd->hdr_lock);
+    return ret;
+}
+
+// Starts the reading dispatcher from the current file position, or from
+// where it left off if it was paused.
+static int vcf_state_start(VCF_state *fd) {
+    htsFile *fp = fd->fp;
+
+    pthread_mutex_lock(&vcf_active_m);
+    if (!fd->q) {
+        fd->q = hts_tpool_process_init(fd->p, fd->qsize, 0);
+        if (!fd->q) {
+            pthread_mutex_unlock(&vcf_active_m);
+            return -1;
+        }
+    }
+    fd->command = VCF_NONE;
+    if (pthread_create(&fd->dispatcher, NULL, vcf_dispatcher_read, fp) != 0) {
+        pthread_mutex_unlock(&vcf_active_m);
+        return -1;
+    }
+    fd->paused = 0;
+    if (!fd->dispatching) {
+        fd->dispatching = 1;
+        fd->next_active = vcf_active;
+        vcf_active = fd;
+    }
+    pthread_mutex_unlock(&vcf_active_m);
+    return 0;
+}
+
+static int64_t vcf_state_tell(htsFile *fp) {
+    return fp->is_bgzf ? bgzf_tell(fp->fp.bgzf) : htell(fp->fp.hfile);
+}
+
+// Stops the dispatcher so that the file can be used directly, as by index
+// iterators, hts_check_EOF() and hts_useek().  Records already read ahead
+// are kept, so if the file is left where the dispatcher stopped the next
+// vcf_read() carries on from them.  Set discard if the caller is going to
+// move the file.
+void vcf_state_pause(htsFile *fp, int discard) {
+    VCF_state *fd = (VCF_state *)fp->state;
+    if (fp->is_write || !fd->dispatching)
+        return;
+    if (discard)
+        fd->discard = 1;
+    if (fd->paused)
+        return;
+
+    pthread_mutex_lock(&fd->command_m);
+    if (fd->command == VCF_NONE)
+        fd->command = VCF_PAUSE;
+    pthread_cond_signal(&fd->command_c);
+    while (fd->command != VCF_PAUSE_DONE && fd->command != VCF_CLOSE_DONE) {
+        // Wake the dispatcher if it is waiting for space in the queue
+        hts_tpool_wake_dispatch(fd->q);
+        pthread_mutex_unlock(&fd->command_m);
+        usleep(10000);
+        pthread_mutex_lock(&fd->command_m);
+    }
+    pthread_mutex_unlock(&fd->command_m);
+    pthread_join(fd->dispatcher, NULL);
+
+    fd->paused = 1;
+    fd->pause_off = vcf_state_tell(fp);
+}
+
+// Discards everything read ahead and restarts the reader, from the last
+// seek if there was one.
+static int vcf_state_restart(VCF_state *fd) {
+    htsFile *fp = fd->fp;
+    int ret;
+
+    pthread_mutex_lock(&vcf_active_m);
+    ret = vcf_state_stop(fd);
+    pthread_mutex_unlock(&vcf_active_m);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    // Stopping destroyed the queue along with any results still in it
+    if (fd->curr_recs) {
+        vp_recs *gr = fd->curr_recs;
+        vcf_free_vp_lines(gr->rest);
+        gr->rest = NULL;
+        pthread_mutex_lock(&fd->lines_m);
+        gr->next = fd->recs;
+        fd->recs = gr;
+        pthread_mutex_unlock(&fd->lines_m);
+        fd->curr_recs = NULL;
+    }
+    fd->curr_idx = 0;
+    fd->eof = 0;
+    fd->paused = 0;
+    fd->discard = 0;
+    fd->read_eof = 0;
+    fd->frag_len = 0;
+
+    if (fp->is_bgzf && fp->fp.bgzf->seeked) {
+        if (bgzf_seek(fp->fp.bgzf, fp->fp.bgzf->seeked, SEEK_SET) < 0)
+            return -1;
+        fp->fp.bgzf->seeked = 0;
+    }
+
+    return vcf_state_start(fd);
+}
+
+static int vcf_read_mt(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
+{
+    VCF_state *fd = (VCF_state *)fp->state;
+
+    if (!fd->h) {
+        fd->h = h;
+        fd->max_unpack = v->max_unpack;
+
+        // We can only do this once we've got a header
+        if (fp->is_bgzf)
+            fp->fp.bgzf->seeked = 0;
+        if (vcf_state_start(fd) < 0)
+            return -2;
+    } else if (fp->is_bgzf && fp->fp.bgzf->seeked) {
+        // The file has been repositioned underneath the dispatcher
+        if (vcf_state_restart(fd) < 0)
+            return -2;
+    } else if (fd->paused) {
+        if (fd->errcode) {
+            errno = fd->errcode;
+            return -2;
+        }
+        if (fd->discard || vcf_state_tell(fp) != fd->pause_off) {
+            // The file has moved, so the records read ahead are stale
+            if (vcf_state_restart(fd) < 0)
+                return -2;
+        } else {
+            // Carry on from where the dispatcher stopped
+            if (vcf_state_start(fd) < 0)
+                return -2;
+        }
+    }
+
+    if (fd->h != h) {
+        hts_log_error("VCF multi-threaded decoding does not support changing header");
+        return -2;
+    }
+
+    for (;;) {
+        vp_recs *gr = fd->curr_recs;
+        if (!gr) {
+            if (fd->eof)
+                return -1;
+            if (fd->errcode || !fd->q) {
+                // Incase reader failed, or the header has been destroyed
+                errno = fd->errcode ? fd->errcode : EPIPE;
+                return -2;
+            }
+            hts_tpool_result *r = hts_tpool_next_result_wait(fd->q);
+            if (!r)
+                return -2;
+            fd->curr_recs = gr = (vp_recs *)hts_tpool_result_data(r);
+            hts_tpool_delete_result(r, 0);
+            if (!gr) {
+                if (fd->errcode)
+                    return -2;
+                fd->eof = 1;
+                return -1;
+            }
+        }
+
+        if (fd->curr_idx < gr->nrecs) {
+            // Swap rather than copy, recycling the caller's buffers
+            bcf1_t tmp = *v;
+            *v = gr->recs[fd->curr_idx];
+            gr->recs[fd->curr_idx] = tmp;
+            v->max_unpack = tmp.max_unpack;
+            fd->curr_idx++;
+            return fd->curr_idx == gr->nrecs ? gr->last_ret : 0;
+        }
+
+        if (gr->rest) {
+            vp_lines *gl = gr->rest;
+            if (gl->pos < gl->data_size)
+                return vcf_parse_rest(fd, gl, v);
+
+            gr->rest = NULL;
+            pthread_mutex_lock(&fd->lines_m);
+            gl->next = fd->lines;
+            fd->lines = gl;
+            pthread_mutex_unlock(&fd->lines_m);
+        }
+
+        pthread_mutex_lock(&fd->lines_m);
+        gr->next = fd->recs;
+        fd->recs = gr;
+        pthread_mutex_unlock(&fd->lines_m);
+        fd->curr_recs = NULL;
+        fd->curr_idx = 0;
+    }
+}
+
 int vcf_read(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
 {
     int ret;
+    if (fp->state)
+        return vcf_read_mt(fp, h, v);
     ret = hts_getline(fp, KS_SEP_LINE, &fp->line);
     if (ret < 0) return ret;
     return vcf_parse1(&fp->line, h, v);
@@ -3201,9 +4227,104 @@ int vcf_format(const bcf_hdr_t *h, const bcf1_t *v, kstring_t *s)
     return 0;
 }
 
+// Threaded output.  Records are copied into blocks of VCF_NB and formatted
+// by vcf_format_worker, then written in order by vcf_dispatcher_write.
+static int vcf_write_mt(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
+{
+    VCF_state *fd = (VCF_state *)fp->state;
+
+    if (!fd->h) {
+        if (!fd->q)
+            return -1;
+        fd->h = h;
+
+        pthread_mutex_lock(&vcf_active_m);
+        if (pthread_create(&fd->dispatcher, NULL, vcf_dispatcher_write, fp) != 0) {
+            pthread_mutex_unlock(&vcf_active_m);
+            return -1;
+        }
+        fd->dispatching = 1;
+        fd->next_active = vcf_active;
+        vcf_active = fd;
+        pthread_mutex_unlock(&vcf_active_m);
+    }
+
+    if (fd->h != h) {
+        hts_log_error("VCF multi-threaded encoding does not support changing header");
+        return -1;
+    }
+    if (!fd->dispatching) {
+        // Stopped by bcf_hdr_destroy()
+        errno = EPIPE;
+        return -1;
+    }
+
+    // Find a suitable record array to copy to
+    vp_recs *gr = fd->curr_recs;
+    if (!gr) {
+        pthread_mutex_lock(&fd->lines_m);
+        if (fd->recs) {
+            gr = fd->recs;
+            fd->recs = gr->next;
+        }
+        pthread_mutex_unlock(&fd->lines_m);
+        if (!gr) {
+            if (!(gr = calloc(1, sizeof(*gr))))
+                return -1;
+            if (!(gr->recs = calloc(VCF_NB, sizeof(bcf1_t)))) {
+                free(gr);
+                return -1;
+            }
+            gr->arecs = VCF_NB;
+            gr->fd = fd;
+        }
+        gr->next = NULL;
+        gr->nrecs = 0;
+        fd->curr_recs = gr;
+    }
+
+    bcf1_t *dst = &gr->recs[gr->nrecs];
+    if (!bcf_copy(dst, v))
+        return -1;
+    gr->nrecs++;
+
+    // Dispatch if full
+    if (gr->nrecs == VCF_NB) {
+        pthread_mutex_lock(&fd->command_m);
+        int err = fd->errcode;
+        pthread_mutex_unlock(&fd->command_m);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        if (hts_tpool_dispatch3(fd->p, fd->q, vcf_format_worker, gr,
+                                cleanup_vp_recs, cleanup_vp_lines, 0) < 0)
+            return -1;
+        fd->curr_recs = NULL;
+    }
+
+    return 0;
+}
+
+// Writes out everything given to vcf_write_mt so far, so the caller can
+// write to the file directly.
+static int vcf_write_flush(htsFile *fp)
+{
+    VCF_state *fd = (VCF_state *)fp->state;
+    if (!fd->dispatching)
+        return 0;
+
+    int ret = vcf_state_flush(fd);
+    if (ret < 0)
+        errno = -ret;
+    return ret;
+}
+
 int vcf_write_line(htsFile *fp, kstring_t *line)
 {
     int ret;
+    if ( fp->state && fp->format.format == vcf && vcf_write_flush(fp) < 0 )
+        return -1;
     if ( line->s[line->l-1]!='\n' ) kputc('\n',line);
     if ( fp->format.compression!=no_compression )
         ret = bgzf_write(fp->fp.bgzf, line->s, line->l);
@@ -3215,6 +4336,8 @@ int vcf_write_line(htsFile *fp, kstring_t *line)
 int vcf_write(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
 {
     int ret;
+    if (fp->state && fp->format.format == vcf)
+        return vcf_write_mt(fp, h, v);
     fp->line.l = 0;
     if (vcf_format1(h, v, &fp->line) != 0)
         return -1;
@@ -4670,9 +5793,9 @@ int bcf_get_format_string(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, c
     return n;
 }
 
-int bcf_get_format_values(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, void **dst, int *ndst, int type)
+// Checks that FORMAT tag_id may be fetched as the given type
+static int bcf_fmt_check_type(const bcf_hdr_t *hdr, const char *tag, int tag_id, int type)
 {
-    int i,j, tag_id = bcf_hdr_id2int(hdr, BCF_DT_ID, tag);
     if ( !bcf_hdr_idinfo_exists(hdr,BCF_HL_FMT,tag_id) ) return -1;    // no such FORMAT field in the header
     if ( tag[0]=='G' && tag[1]=='T' && tag[2]==0 )
     {
@@ -4680,13 +5803,13 @@ int bcf_get_format_values(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, v
         if ( bcf_hdr_id2type(hdr,BCF_HL_FMT,tag_id)!=BCF_HT_STR ) return -2;
     }
     else if ( bcf_hdr_id2type(hdr,BCF_HL_FMT,tag_id)!=type ) return -2;     // expected different type
+    return 0;
+}
 
-    if ( !(line->unpacked & BCF_UN_FMT) ) bcf_unpack(line, BCF_UN_FMT);
-
-    for (i=0; i<line->n_fmt; i++)
-        if ( line->d.fmt[i].id==tag_id ) break;
-    if ( i==line->n_fmt ) return -3;                               // the tag is not present in this record
-    bcf_fmt_t *fmt = &line->d.fmt[i];
+// Copies the values of an unpacked FORMAT field to *dst
+static int bcf_fmt_get_values(const bcf_hdr_t *hdr, bcf1_t *line, bcf_fmt_t *fmt, void **dst, int *ndst, int type)
+{
+    int i,j;
     if ( !fmt->p ) return -3;                                      // the tag was marked for removal
 
     if ( type==BCF_HT_STR )
@@ -4712,30 +5835,121 @@ int bcf_get_format_values(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, v
         if ( !*dst ) return -4;     // could not alloc
     }
 
-    #define BRANCH(type_t, convert, is_missing, is_vector_end, set_missing, set_vector_end, set_regular, out_type_t) { \
-        out_type_t *tmp = (out_type_t *) *dst; \
-        uint8_t *fmt_p = fmt->p; \
-        for (i=0; i<nsmpl; i++) \
-        { \
-            for (j=0; j<fmt->n; j++) \
-            { \
-                type_t p = convert(fmt_p + j * sizeof(type_t)); \
-                if ( is_missing ) set_missing; \
-                else if ( is_vector_end ) { set_vector_end; break; } \
-                else set_regular; \
-                tmp++; \
-            } \
-            for (; j<fmt->n; j++) { set_vector_end; tmp++; } \
-            fmt_p += fmt->size; \
-        } \
-    }
+    // The samples' values are contiguous, so convert them all in one go,
+    // translating the missing and vector end markers to their 32-bit forms
+    size_t n = (size_t) fmt->n*nsmpl;
+    uint32_t vector_end = bcf_int32_vector_end;
+    int has_vector_end;
     switch (fmt->type) {
-        case BCF_BT_INT8:  BRANCH(int8_t,  le_to_i8, p==bcf_int8_missing,  p==bcf_int8_vector_end,  *tmp=bcf_int32_missing, *tmp=bcf_int32_vector_end, *tmp=p, int32_t); break;
-        case BCF_BT_INT16: BRANCH(int16_t, le_to_i16, p==bcf_int16_missing, p==bcf_int16_vector_end, *tmp=bcf_int32_missing, *tmp=bcf_int32_vector_end, *tmp=p, int32_t); break;
-        case BCF_BT_INT32: BRANCH(int32_t, le_to_i32, p==bcf_int32_missing, p==bcf_int32_vector_end, *tmp=bcf_int32_missing, *tmp=bcf_int32_vector_end, *tmp=p, int32_t); break;
-        case BCF_BT_FLOAT: BRANCH(uint32_t, le_to_u32, p==bcf_float_missing, p==bcf_float_vector_end, bcf_float_set_missing(*tmp), bcf_float_set_vector_end(*tmp), bcf_float_set(tmp, p), float); break;
+        case BCF_BT_INT8:  has_vector_end = bcf_fmt_widen_int8(*dst, fmt->p, n); break;
+        case BCF_BT_INT16: has_vector_end = bcf_fmt_widen_int16(*dst, fmt->p, n); break;
+        case BCF_BT_INT32: has_vector_end = bcf_fmt_copy32(*dst, fmt->p, n, vector_end); break;
+        case BCF_BT_FLOAT:
+            vector_end = bcf_float_vector_end;
+            has_vector_end = bcf_fmt_copy32(*dst, fmt->p, n, vector_end);
+            break;
         default: hts_log_error("Unexpected type %d at %s:%"PRIhts_pos, fmt->type, bcf_seqname_safe(hdr,line), line->pos+1); exit(1);
     }
-    #undef BRANCH
+
+    // Everything after a vector end marker in a sample is also vector end.
+    // Propagating it forwards avoids a hard to predict branch per sample.
+    if ( has_vector_end && fmt->n > 1 )
+    {
+        uint32_t *tmp = (uint32_t *) *dst;
+        for (i=0; i<nsmpl; i++, tmp += fmt->n)
+            for (j=1; j<fmt->n; j++)
+                tmp[j] = tmp[j-1]==vector_end ? vector_end : tmp[j];
+    }
     return nsmpl*fmt->n;
 }
+
+int bcf_get_format_values(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, void **dst, int *ndst, int type)
+{
+    int i, ret, tag_id = bcf_hdr_id2int(hdr, BCF_DT_ID, tag);
+    if ( (ret = bcf_fmt_check_type(hdr, tag, tag_id, type)) < 0 ) return ret;
+
+    if ( !(line->unpacked & BCF_UN_FMT) ) bcf_unpack(line, BCF_UN_FMT);
+
+    for (i=0; i<line->n_fmt; i++)
+        if ( line->d.fmt[i].id==tag_id ) break;
+    if ( i==line->n_fmt ) return -3;                               // the tag is not present in this record
+    return bcf_fmt_get_values(hdr, line, &line->d.fmt[i], dst, ndst, type);
+}
+
+int bcf_get_format_view(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, bcf_view_t *view)
+{
+    int tag_id = bcf_hdr_id2int(hdr, BCF_DT_ID, tag);
+    if ( !bcf_hdr_idinfo_exists(hdr,BCF_HL_FMT,tag_id) ) return -1;    // no such FORMAT field in the header
+    bcf_fmt_t *fmt = bcf_get_fmt_id(line, tag_id);
+    if ( !fmt || !fmt->p ) return -3;                              // not present, or marked for removal
+
+    view->p = fmt->p;
+    view->type = fmt->type;
+    view->n = fmt->n;
+    view->size = fmt->size;
+    view->nsmpl = bcf_hdr_nsamples(hdr);
+    view->fmt = fmt;
+    view->info = NULL;
+    return view->n * view->nsmpl;
+}
+
+int bcf_get_info_view(const bcf_hdr_t *hdr, bcf1_t *line, const char *tag, bcf_view_t *view)
+{
+    int tag_id = bcf_hdr_id2int(hdr, BCF_DT_ID, tag);
+    if ( !bcf_hdr_idinfo_exists(hdr,BCF_HL_INFO,tag_id) ) return -1;   // no such INFO field in the header
+    bcf_info_t *info = bcf_get_info_id(line, tag_id);
+    if ( !info || !info->vptr ) return -3;                         // not present, or marked for removal
+
+    view->p = info->vptr;
+    view->type = info->type;
+    view->n = info->len;
+    view->size = info->vptr_len;
+    view->nsmpl = 1;
+    view->fmt = NULL;
+    view->info = info;
+    return view->n;
+}
+
+int bcf_get_format_values_many(const bcf_hdr_t *hdr, bcf1_t *line, int n,
+                               const char *const *tags, const int *types,
+                               void **dst, int *ndst, int *ret)
+{
+    int i, j, nfound = 0;
+    int tag_ids_stack[16], *tag_ids = tag_ids_stack;
+    bcf_fmt_t *fmt_stack[16], **fmts = fmt_stack;
+
+    if ( n < 0 ) return -1;
+    if ( n > 16 )
+    {
+        tag_ids = malloc(n * sizeof(*tag_ids));
+        fmts = malloc(n * sizeof(*fmts));
+        if ( !tag_ids || !fmts ) { nfound = -1; goto out; }
+    }
+
+    for (i=0; i<n; i++)
+    {
+        tag_ids[i] = bcf_hdr_id2int(hdr, BCF_DT_ID, tags[i]);
+        ret[i] = bcf_fmt_check_type(hdr, tags[i], tag_ids[i], types[i]);
+        fmts[i] = NULL;
+    }
+
+    if ( !(line->unpacked & BCF_UN_FMT) ) bcf_unpack(line, BCF_UN_FMT);
+
+    // One pass over the record's FORMAT fields finds all the tags
+    for (j=0; j<line->n_fmt; j++)
+        for (i=0; i<n; i++)
+            if ( ret[i]==0 && !fmts[i] && line->d.fmt[j].id==tag_ids[i] ) fmts[i] = &line->d.fmt[j];
+
+    for (i=0; i<n; i++)
+    {
+        if ( ret[i] < 0 ) continue;
+        if ( !fmts[i] ) { ret[i] = -3; continue; }                // the tag is not present in this record
+        ret[i] = bcf_fmt_get_values(hdr, line, fmts[i], &dst[i], &ndst[i], types[i]);
+        if ( ret[i] >= 0 ) nfound++;
+    }
+
+ out:
+    if ( tag_ids != tag_ids_stack ) free(tag_ids);
+    if ( fmts != fmt_stack ) free(fmts);
+    return nfound;
+}